@@ -0,0 +1,216 @@
+/**
+ * \file  bench.c
+ * \brief Microbenchmark workload for measuring the cost of Loom probes.
+ *
+ * Each kernel calls a (non-inlined) function with a different number and
+ * type of arguments in a tight loop. `run-bench` instruments calls to these
+ * functions with a variety of strategies, loggers and serializers and
+ * compares the results against an uninstrumented build of this same file,
+ * so every call to a kernel's function is exactly one event.
+ *
+ * Usage: bench <iterations> <results file>
+ *
+ * Results are written as one line per kernel:
+ *
+ *   <kernel> <iterations> <nanoseconds> <instructions>
+ *
+ * where <instructions> is -1 if hardware counters aren't available.
+ * Logged events themselves go to stdout, which should be redirected
+ * (e.g., to /dev/null).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define	NOINLINE	__attribute__((noinline))
+
+/* Somewhere to put results so that the compiler can't discard calls. */
+static volatile intptr_t sink;
+
+
+NOINLINE void	int0(void)		{ sink++; }
+NOINLINE void	int1(int a)		{ sink += a; }
+NOINLINE void	int4(int a, int b, int c, int d)	{ sink += a + b + c + d; }
+
+NOINLINE void
+int8(int a, int b, int c, int d, int e, int f, int g, int h)
+{
+	sink += a + b + c + d + e + f + g + h;
+}
+
+NOINLINE void	long2(long a, long b)	{ sink += a ^ b; }
+NOINLINE void	dbl2(double x, double y)	{ sink += (intptr_t) (x * y); }
+
+NOINLINE void
+ptr2(const char *s, void *p)
+{
+	sink += (intptr_t) s ^ (intptr_t) p;
+}
+
+NOINLINE void
+mixed4(int i, double d, const char *s, long l)
+{
+	sink += i + (intptr_t) d + (intptr_t) s + l;
+}
+
+
+static void run_int0(long n)	{ for (long i = 0; i < n; i++) int0(); }
+static void run_int1(long n)	{ for (long i = 0; i < n; i++) int1(i); }
+
+static void
+run_int4(long n)
+{
+	for (long i = 0; i < n; i++)
+		int4(i, i + 1, i + 2, i + 3);
+}
+
+static void
+run_int8(long n)
+{
+	for (long i = 0; i < n; i++)
+		int8(i, i + 1, i + 2, i + 3, i + 4, i + 5, i + 6, i + 7);
+}
+
+static void run_long2(long n)	{ for (long i = 0; i < n; i++) long2(i, -i); }
+static void run_dbl2(long n)	{ for (long i = 0; i < n; i++) dbl2(i, 0.5); }
+
+static void
+run_ptr2(long n)
+{
+	static char buffer[16];
+
+	for (long i = 0; i < n; i++)
+		ptr2("hello", buffer + (i & 0xf));
+}
+
+static void
+run_mixed4(long n)
+{
+	for (long i = 0; i < n; i++)
+		mixed4(i, 1.5, "world", -i);
+}
+
+
+static const struct kernel {
+	const char	*name;
+	void		(*run)(long);
+} kernels[] = {
+	{ "int0",	run_int0 },
+	{ "int1",	run_int1 },
+	{ "int4",	run_int4 },
+	{ "int8",	run_int8 },
+	{ "long2",	run_long2 },
+	{ "dbl2",	run_dbl2 },
+	{ "ptr2",	run_ptr2 },
+	{ "mixed4",	run_mixed4 },
+};
+
+
+/*
+ * Open a counter of user-space instructions retired by this thread,
+ * returning -1 if hardware counters aren't available (or permitted).
+ */
+static int
+open_insn_counter(void)
+{
+#if defined(__linux__)
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void
+start_insn_counter(int fd)
+{
+#if defined(__linux__)
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+static long long
+stop_insn_counter(int fd)
+{
+	long long count = -1;
+
+#if defined(__linux__)
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			count = -1;
+	}
+#endif
+
+	return count;
+}
+
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <iterations> <results file>\n", argv[0]);
+		return 1;
+	}
+
+	long iterations = strtol(argv[1], NULL, 0);
+	FILE *results = fopen(argv[2], "w");
+	if (iterations <= 0 || results == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	int counter = open_insn_counter();
+
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		const struct kernel *k = kernels + i;
+
+		/* Warm up caches, branch predictors, lazy binding, etc. */
+		k->run(iterations / 100 + 1);
+
+		start_insn_counter(counter);
+		long long start = now();
+		k->run(iterations);
+		long long ns = now() - start;
+		long long insns = stop_insn_counter(counter);
+
+		fprintf(results, "%s %ld %lld %lld\n", k->name, iterations, ns,
+		    insns);
+	}
+
+	fclose(results);
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * \file  stubs.c
+ * \brief Stand-ins for tracing system calls that aren't available everywhere.
+ *
+ * Benchmarks should measure what Loom adds to a program (serialization,
+ * argument conversion, calls), not the cost of a particular kernel's tracing
+ * facility. These stubs consume their arguments just enough that the work
+ * done to produce them can't be optimized away.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+static volatile uintptr_t consumed;
+
+/* FreeBSD's utrace(2): used by the ktrace logger in userspace mode. */
+int
+utrace(const void *addr, size_t len)
+{
+	const unsigned char *bytes = addr;
+
+	consumed += len + (len > 0 ? bytes[0] + bytes[len - 1] : 0);
+
+	return 0;
+}
+
+/*
+ * DTrace USDT-style probe: the DTrace logger passes a probe ID followed by
+ * up to five (integer-converted) arguments.
+ */
+int
+dt_probe(uintptr_t id, uintptr_t a0, uintptr_t a1, uintptr_t a2,
+    uintptr_t a3, uintptr_t a4)
+{
+	consumed += id;
+
+	return 0;
+}
@@ -0,0 +1,267 @@
+/**
+ * \file  compact-decode.c
+ * \brief Decode records written by Loom's compact serializer.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-compact.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct reader {
+	const uint8_t	*p;
+	const uint8_t	*end;
+};
+
+static int
+varint(struct reader *r, uint64_t *value)
+{
+	uint64_t x = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (r->p == r->end)
+			return -1;
+
+		uint8_t byte = *r->p++;
+		x |= (uint64_t) (byte & 0x7f) << shift;
+
+		if (!(byte & 0x80)) {
+			*value = x;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int
+zigzag(struct reader *r, int64_t *value)
+{
+	uint64_t x;
+
+	if (varint(r, &x) != 0)
+		return -1;
+
+	*value = (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+	return 0;
+}
+
+static int
+fixed(struct reader *r, unsigned bytes, uint64_t *value)
+{
+	uint64_t x = 0;
+
+	if ((size_t) (r->end - r->p) < bytes)
+		return -1;
+
+	for (unsigned i = 0; i < bytes; i++)
+		x |= (uint64_t) r->p[i] << (8 * i);
+
+	r->p += bytes;
+	*value = x;
+	return 0;
+}
+
+static size_t
+thread_hash(uint64_t process, uint64_t thread)
+{
+	uint64_t h = (process * 0x9e3779b97f4a7c15ull) ^ thread;
+
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 29;
+
+	return h;
+}
+
+/* Find the (open-addressed) entry for a thread, or the empty one for it. */
+static struct loom_compact_thread *
+thread_slot(struct loom_compact_thread *threads, size_t capacity,
+    uint64_t process, uint64_t thread)
+{
+	for (size_t i = thread_hash(process, thread);; i++) {
+		struct loom_compact_thread *t = threads + (i & (capacity - 1));
+
+		if (t->thread == 0
+		    || (t->thread == thread && t->process == process))
+			return t;
+	}
+}
+
+static struct loom_compact_thread *
+thread_state(struct loom_compact_decoder *d, uint64_t process,
+    uint64_t thread)
+{
+	struct loom_compact_thread *t;
+
+	if (thread == 0)
+		return NULL;
+
+	/* Keep the table at most half full. */
+	if (2 * (d->nthreads + 1) > d->capacity) {
+		size_t n = d->capacity ? 2 * d->capacity : 16;
+		struct loom_compact_thread *threads = calloc(n, sizeof(*threads));
+		if (threads == NULL)
+			return NULL;
+
+		for (size_t i = 0; i < d->capacity; i++) {
+			struct loom_compact_thread *old = d->threads + i;
+			if (old->thread != 0)
+				*thread_slot(threads, n, old->process,
+				    old->thread) = *old;
+		}
+
+		free(d->threads);
+		d->threads = threads;
+		d->capacity = n;
+	}
+
+	t = thread_slot(d->threads, d->capacity, process, thread);
+	if (t->thread == 0) {
+		t->process = process;
+		t->thread = thread;
+		d->nthreads++;
+	}
+
+	return t;
+}
+
+void
+loom_compact_init(struct loom_compact_decoder *d)
+{
+	d->threads = NULL;
+	d->nthreads = 0;
+	d->capacity = 0;
+}
+
+void
+loom_compact_free(struct loom_compact_decoder *d)
+{
+	free(d->threads);
+	loom_compact_init(d);
+}
+
+int
+loom_compact_decode(struct loom_compact_decoder *d, const void *buffer,
+    size_t len, struct loom_compact_record *rec)
+{
+	struct reader r = { buffer, (const uint8_t *) buffer + len };
+	struct loom_compact_thread *t;
+	const uint8_t *types, *bools;
+	uint64_t x, count;
+	int64_t delta;
+	unsigned nbools = 0;
+
+	if (fixed(&r, 4, &x) != 0)
+		return -1;
+	rec->site = x;
+
+	if (varint(&r, &rec->process) != 0 || varint(&r, &rec->thread) != 0
+	    || zigzag(&r, &delta) != 0
+	    || (t = thread_state(d, rec->process, rec->thread)) == NULL)
+		return -1;
+
+	t->timestamp += delta;
+	rec->timestamp = t->timestamp;
+
+	if (varint(&r, &count) != 0 || count > LOOM_COMPACT_MAX_VALUES
+	    || (size_t) (r.end - r.p) < (count + 1) / 2)
+		return -1;
+	rec->count = count;
+
+	types = r.p;
+	r.p += (count + 1) / 2;
+
+	for (unsigned i = 0; i < count; i++) {
+		rec->values[i].type = (types[i / 2] >> (4 * (i % 2))) & 0xf;
+		if (rec->values[i].type == LOOM_COMPACT_BOOL)
+			nbools++;
+	}
+
+	if ((size_t) (r.end - r.p) < (nbools + 7) / 8)
+		return -1;
+	bools = r.p;
+	r.p += (nbools + 7) / 8;
+
+	nbools = 0;
+	for (unsigned i = 0; i < count; i++) {
+		struct loom_compact_value *v = rec->values + i;
+
+		switch (v->type) {
+		case LOOM_COMPACT_INT:
+			if (zigzag(&r, &v->i) != 0)
+				return -1;
+			break;
+
+		case LOOM_COMPACT_BOOL:
+			v->i = (bools[nbools / 8] >> (nbools % 8)) & 1;
+			nbools++;
+			break;
+
+		case LOOM_COMPACT_POINTER:
+			if (zigzag(&r, &delta) != 0)
+				return -1;
+			t->pointer += delta;
+			v->p = t->pointer;
+			break;
+
+		case LOOM_COMPACT_FLOAT: {
+			uint32_t bits;
+			if (fixed(&r, 4, &x) != 0)
+				return -1;
+			bits = x;
+			memcpy(&v->f, &bits, sizeof(bits));
+			break;
+		}
+
+		case LOOM_COMPACT_DOUBLE:
+			if (fixed(&r, 8, &x) != 0)
+				return -1;
+			memcpy(&v->d, &x, sizeof(x));
+			break;
+
+		case LOOM_COMPACT_BYTES:
+			if (varint(&r, &x) != 0
+			    || (size_t) (r.end - r.p) < (x >> 1))
+				return -1;
+			v->bytes.data = r.p;
+			v->bytes.len = x >> 1;
+			v->bytes.truncated = x & 1;
+			r.p += v->bytes.len;
+			break;
+
+		case LOOM_COMPACT_UNSUPPORTED:
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	return (r.p == r.end) ? 0 : -1;
+}
@@ -0,0 +1,333 @@
+/**
+ * \file  loom-collector.c
+ * \brief Consume records from a shared-memory trace ring.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Usage: loom-collector [-f] [-u] [-c count] [-o output] [-z level] [name]
+ *
+ * Records are written to the output (default: stdout) in the same format
+ * as the runtime's trace writer: each record's payload preceded by its
+ * 32-bit length. Records are written straight from the shared ring with
+ * writev(2), without being copied into the collector's own memory.
+ *
+ * The consumer's position is only advanced after records have been
+ * written out, so a collector that is stopped (or killed) and restarted
+ * continues where it left off.
+ *
+ *   -f        follow: keep running after all producers have exited
+ *   -u        unlink the shared memory object when finished
+ *   -c count  stop after consuming `count` records
+ *   -o file   append records to a file rather than writing to stdout
+ *   -z level  compress records into LZ4 blocks (see loom-trace.h), which
+ *             requires copying them out of the ring first
+ */
+
+#include "loom-shm.h"
+#include "loom-trace.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define	BATCH		256		/* records per writev(2) */
+#define	BLOCK_SIZE	(256 * 1024)	/* records per compressed block */
+#define	IDLE_LIMIT	1000		/* ms without progress before giving up */
+
+static volatile sig_atomic_t stop;
+
+static void
+handle_signal(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static void
+sleep_ms(long ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "Usage: %s [-f] [-u] [-c count] [-o output] [-z level] [name]\n",
+	    argv0);
+	exit(1);
+}
+
+/* Map a ring, waiting for a producer to create it if necessary. */
+static struct loom_shm_header *
+map_ring(const char *name)
+{
+	struct loom_shm_header *hdr;
+	struct stat sb;
+	int fd;
+
+	while ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		if (errno != ENOENT) {
+			perror(name);
+			return NULL;
+		}
+
+		if (stop)
+			return NULL;
+
+		sleep_ms(100);
+	}
+
+	while (fstat(fd, &sb) == 0 && (size_t) sb.st_size < sizeof(*hdr)) {
+		if (stop)
+			return NULL;
+		sleep_ms(10);
+	}
+
+	hdr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LOOM_SHM_MAGIC) {
+		if (stop)
+			return NULL;
+		sleep_ms(10);
+	}
+
+	if (hdr->version != LOOM_SHM_VERSION
+	    || hdr->size + sizeof(*hdr) > (uint64_t) sb.st_size) {
+		fprintf(stderr, "%s: not a compatible Loom trace ring\n", name);
+		return NULL;
+	}
+
+	return hdr;
+}
+
+/* Write out a full set of iovecs, coping with short writes. */
+static int
+write_all(int fd, struct iovec *iov, int count)
+{
+	while (count > 0) {
+		ssize_t n = writev(fd, iov, count);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+
+		while (count > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = LOOM_SHM_DEFAULT_NAME;
+	const char *output = NULL;
+	unsigned long long limit = 0, consumed = 0;
+	int follow = 0, unlink_when_done = 0, level = 0;
+	int ch, out = STDOUT_FILENO;
+
+	while ((ch = getopt(argc, argv, "c:fo:uz:")) != -1) {
+		switch (ch) {
+		case 'c':
+			limit = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			follow = 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'u':
+			unlink_when_done = 1;
+			break;
+		case 'z':
+			level = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc)
+		name = argv[optind++];
+	if (optind != argc)
+		usage(argv[0]);
+
+	if (output != NULL) {
+		out = open(output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (out < 0) {
+			perror(output);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	struct loom_shm_header *hdr = map_ring(name);
+	if (hdr == NULL)
+		return 1;
+
+	const uint64_t size = hdr->size;
+	char *data = LOOM_SHM_DATA(hdr);
+	struct iovec iov[2 * BATCH];
+	long idle = 0;
+
+	/* Records are staged in blocks of about BLOCK_SIZE for compression. */
+	struct loom_lz4_state *lz4 = NULL;
+	size_t stage_size = (size > BLOCK_SIZE) ? size : BLOCK_SIZE;
+	char *stage = NULL, *block = NULL;
+
+	if (level > 0) {
+		lz4 = malloc(sizeof(*lz4));
+		stage = malloc(stage_size);
+		block = malloc(LOOM_TRACE_BLOCK_BOUND(stage_size));
+		if (lz4 == NULL || stage == NULL || block == NULL) {
+			perror("malloc");
+			return 1;
+		}
+	}
+
+	while (!stop && (limit == 0 || consumed < limit)) {
+		uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+		uint64_t pos = head;
+		int count = 0, records = 0;
+		size_t staged = 0;
+
+		/*
+		 * Gather a batch of committed records, in place (or, when
+		 * compressing, a block's worth copied into the stage).
+		 */
+		while ((level > 0 || records < BATCH)
+		    && (limit == 0 || consumed + records < limit)) {
+			struct loom_shm_record *rec =
+			    (struct loom_shm_record *) (data + (pos & (size - 1)));
+
+			if (__atomic_load_n(&rec->pos, __ATOMIC_ACQUIRE) != pos)
+				break;
+
+			if (rec->flags & LOOM_SHM_PADDING) {
+				/* Nothing to write. */
+			} else if (level > 0) {
+				size_t need = sizeof(rec->len) + rec->len;
+				if (staged > 0 && staged + need > BLOCK_SIZE)
+					break;
+
+				memcpy(stage + staged, &rec->len,
+				    sizeof(rec->len));
+				memcpy(stage + staged + sizeof(rec->len), rec + 1,
+				    rec->len);
+				staged += need;
+				records++;
+			} else {
+				iov[count].iov_base = &rec->len;
+				iov[count++].iov_len = sizeof(rec->len);
+				iov[count].iov_base = rec + 1;
+				iov[count++].iov_len = rec->len;
+				records++;
+			}
+
+			pos += LOOM_SHM_RECORD_SIZE(rec->len);
+		}
+
+		if (staged > 0) {
+			iov[0].iov_base = block;
+			iov[0].iov_len = loom_trace_pack(lz4, stage, staged, block,
+			    level);
+			count = 1;
+		}
+
+		if (pos != head) {
+			if (write_all(out, iov, count) != 0) {
+				perror("write");
+				return 1;
+			}
+
+			/* Only now can producers reuse the space. */
+			__atomic_store_n(&hdr->head, pos, __ATOMIC_RELEASE);
+			consumed += records;
+			idle = 0;
+			continue;
+		}
+
+		/* Nothing to consume: are we done? */
+		if (!follow && __atomic_load_n(&hdr->producers, __ATOMIC_ACQUIRE) == 0) {
+			uint64_t reserved =
+			    __atomic_load_n(&hdr->reserve, __ATOMIC_ACQUIRE);
+
+			if (reserved == head)
+				break;
+
+			if (idle >= IDLE_LIMIT) {
+				fprintf(stderr, "%s: %llu bytes reserved but never"
+				    " committed\n", name,
+				    (unsigned long long) (reserved - head));
+				break;
+			}
+		}
+
+		sleep_ms(1);
+		idle++;
+	}
+
+	fprintf(stderr, "loom-collector: consumed %llu records (%llu dropped"
+	    " by producers)\n", consumed,
+	    (unsigned long long) __atomic_load_n(&hdr->dropped,
+	    __ATOMIC_RELAXED));
+
+	if (unlink_when_done)
+		shm_unlink(name);
+
+	return 0;
+}
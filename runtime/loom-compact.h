@@ -0,0 +1,131 @@
+/**
+ * \file  loom-compact.h
+ * \brief Decoder for records written by Loom's compact serializer.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_COMPACT_H
+#define LOOM_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * `serialization: compact` records are encoded as:
+ *
+ *   site ID      4 B, little-endian (FNV-1a hash of the event name)
+ *   process      varint: the ID of the process that wrote the record
+ *   thread       varint (threads are numbered from 1 in each process)
+ *   timestamp    zig-zag varint: delta from the thread's previous record
+ *   count        varint: number of values
+ *   types        4-bit type codes, two per byte (low nibble first)
+ *   booleans     one bit per LOOM_COMPACT_BOOL value, eight per byte
+ *   values       everything but booleans, in order:
+ *                  LOOM_COMPACT_INT      zig-zag varint
+ *                  LOOM_COMPACT_POINTER  zig-zag varint delta from the
+ *                                        thread's previous pointer
+ *                  LOOM_COMPACT_FLOAT    4 B, little-endian
+ *                  LOOM_COMPACT_DOUBLE   8 B, little-endian
+ *                  LOOM_COMPACT_BYTES    varint (length << 1 | truncated),
+ *                                        then the captured bytes
+ *
+ * Since timestamps and pointers are delta-encoded per thread, a decoder
+ * must see every record (from a given thread) in order. Records that are
+ * dropped (e.g., by a full ring) aren't used as delta bases.
+ */
+
+enum loom_compact_type {
+	LOOM_COMPACT_INT	= 1,
+	LOOM_COMPACT_BOOL	= 2,
+	LOOM_COMPACT_POINTER	= 3,
+	LOOM_COMPACT_FLOAT	= 4,
+	LOOM_COMPACT_DOUBLE	= 5,
+	LOOM_COMPACT_UNSUPPORTED = 6,
+	LOOM_COMPACT_BYTES	= 7,
+};
+
+#define	LOOM_COMPACT_MAX_VALUES	64
+
+struct loom_compact_value {
+	enum loom_compact_type	type;
+	union {
+		int64_t		i;	/* INT and BOOL */
+		uint64_t	p;	/* POINTER */
+		float		f;	/* FLOAT */
+		double		d;	/* DOUBLE */
+		struct {		/* BYTES (pointing into the record) */
+			const uint8_t	*data;
+			uint64_t	 len;
+			int		 truncated;
+		}		bytes;
+	};
+};
+
+struct loom_compact_record {
+	uint32_t			site;
+	uint64_t			process;
+	uint64_t			thread;
+	uint64_t			timestamp;	/* absolute */
+	unsigned			count;
+	struct loom_compact_value	values[LOOM_COMPACT_MAX_VALUES];
+};
+
+/**
+ * Per-thread decoding state (previous timestamp and pointer), in a hash
+ * table keyed by process and thread.
+ */
+struct loom_compact_decoder {
+	struct loom_compact_thread {
+		uint64_t	process;
+		uint64_t	thread;		/* 0 for unused entries */
+		uint64_t	timestamp;
+		uint64_t	pointer;
+	}			*threads;
+	size_t			 nthreads;	/* entries in use */
+	size_t			 capacity;	/* a power of 2 */
+};
+
+void	loom_compact_init(struct loom_compact_decoder *);
+void	loom_compact_free(struct loom_compact_decoder *);
+
+/**
+ * Decode one record, updating the decoder's per-thread state.
+ *
+ * @returns 0 on success or -1 if the record is malformed or truncated
+ */
+int	loom_compact_decode(struct loom_compact_decoder *,
+	    const void *buffer, size_t len, struct loom_compact_record *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_COMPACT_H */
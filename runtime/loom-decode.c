@@ -0,0 +1,248 @@
+/**
+ * \file  loom-decode.c
+ * \brief Print compact-serialized trace records.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Usage: loom-decode [-s schema] [trace]
+ *
+ * Reads length-prefixed records (as written by the runtime's trace writer
+ * or loom-collector) from a file or stdin, decodes them as `compact`
+ * records and prints one line per record:
+ *
+ *   <process> <thread> <timestamp> <event name or site ID>: <values...>
+ *
+ * The schema file (from opt's `-loom-compact-schema`) maps site IDs to
+ * event names.
+ */
+
+#include "loom-compact.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct event {
+	uint32_t	 site;
+	char		*name;
+};
+
+static struct event *events;
+static size_t nevents;
+
+static int
+compare_events(const void *a, const void *b)
+{
+	uint32_t x = ((const struct event *) a)->site;
+	uint32_t y = ((const struct event *) b)->site;
+
+	return (x > y) - (x < y);
+}
+
+static int
+read_schema(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	char line[4096];
+	size_t capacity = 0;
+
+	if (f == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *name = strchr(line, '\t');
+		if (name == NULL)
+			continue;
+
+		*name++ = '\0';
+		name[strcspn(name, "\t\n")] = '\0';
+
+		if (nevents == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			events = realloc(events, capacity * sizeof(*events));
+			if (events == NULL) {
+				perror("realloc");
+				return -1;
+			}
+		}
+
+		events[nevents].site = strtoul(line, NULL, 16);
+		events[nevents].name = strdup(name);
+		nevents++;
+	}
+
+	fclose(f);
+	qsort(events, nevents, sizeof(*events), compare_events);
+
+	return 0;
+}
+
+static const char *
+event_name(uint32_t site)
+{
+	struct event key = { site, NULL };
+	struct event *e = bsearch(&key, events, nevents, sizeof(*events),
+	    compare_events);
+
+	return e ? e->name : NULL;
+}
+
+/* Print captured bytes as a C-style string literal. */
+static void
+print_bytes(const uint8_t *data, uint64_t len)
+{
+	printf(" \"");
+
+	for (uint64_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (isprint(c))
+			putchar(c);
+		else
+			printf("\\x%02x", c);
+	}
+
+	printf("\"");
+}
+
+static void
+print_record(const struct loom_compact_record *rec)
+{
+	const char *name = event_name(rec->site);
+
+	printf("%" PRIu64 " %" PRIu64 " %" PRIu64 " ", rec->process, rec->thread,
+	    rec->timestamp);
+	if (name != NULL)
+		printf("%s:", name);
+	else
+		printf("0x%08" PRIx32 ":", rec->site);
+
+	for (unsigned i = 0; i < rec->count; i++) {
+		const struct loom_compact_value *v = rec->values + i;
+
+		switch (v->type) {
+		case LOOM_COMPACT_INT:
+			printf(" %" PRId64, v->i);
+			break;
+		case LOOM_COMPACT_BOOL:
+			printf(" %s", v->i ? "true" : "false");
+			break;
+		case LOOM_COMPACT_POINTER:
+			printf(" 0x%" PRIx64, v->p);
+			break;
+		case LOOM_COMPACT_FLOAT:
+			printf(" %g", v->f);
+			break;
+		case LOOM_COMPACT_DOUBLE:
+			printf(" %g", v->d);
+			break;
+		case LOOM_COMPACT_BYTES:
+			print_bytes(v->bytes.data, v->bytes.len);
+			if (v->bytes.truncated)
+				printf("...");
+			break;
+		default:
+			printf(" ?");
+		}
+	}
+
+	printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct loom_compact_decoder decoder;
+	struct loom_compact_record rec;
+	unsigned long long records = 0, bad = 0;
+	size_t capacity = 0;
+	uint8_t *buffer = NULL;
+	uint32_t len;
+	FILE *in = stdin;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "s:")) != -1) {
+		switch (ch) {
+		case 's':
+			if (read_schema(optarg) != 0)
+				return 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s schema] [trace]\n",
+			    argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc && (in = fopen(argv[optind], "r")) == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	loom_compact_init(&decoder);
+
+	while (fread(&len, sizeof(len), 1, in) == 1) {
+		if (len > capacity) {
+			capacity = len;
+			buffer = realloc(buffer, capacity);
+			if (buffer == NULL) {
+				perror("realloc");
+				return 1;
+			}
+		}
+
+		if (fread(buffer, 1, len, in) != len) {
+			fprintf(stderr, "truncated record\n");
+			bad++;
+			break;
+		}
+
+		if (loom_compact_decode(&decoder, buffer, len, &rec) != 0) {
+			fprintf(stderr, "malformed record (%u B)\n", len);
+			bad++;
+			continue;
+		}
+
+		print_record(&rec);
+		records++;
+	}
+
+	loom_compact_free(&decoder);
+	free(buffer);
+
+	fprintf(stderr, "%llu records decoded, %llu malformed\n", records, bad);
+
+	return bad ? 1 : 0;
+}
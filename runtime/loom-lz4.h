@@ -0,0 +1,88 @@
+/**
+ * \file  loom-lz4.h
+ * \brief LZ4 block compression for trace files.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_LZ4_H
+#define LOOM_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small, dependency-free implementation of the LZ4 block format
+ * (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so that
+ * blocks can also be decompressed by any other LZ4 implementation.
+ *
+ * Compression levels trade speed for ratio: level 1 probes a single hash
+ * table entry per position (like LZ4's default mode), while higher levels
+ * follow hash chains up to 2^(level - 1) entries deep.
+ */
+
+#define	LOOM_LZ4_MAX_LEVEL	9
+#define	LOOM_LZ4_MAX_INPUT	0x7e000000
+
+/** The most bytes that compressing `len` bytes can produce. */
+#define	LOOM_LZ4_BOUND(len)	((len) + (len) / 255 + 16)
+
+#define	LOOM_LZ4_HASH_LOG	16
+#define	LOOM_LZ4_WINDOW		65536
+
+/** Compressor state, reusable between calls (about 512 KiB). */
+struct loom_lz4_state {
+	int32_t		head[1 << LOOM_LZ4_HASH_LOG];
+	int32_t		chain[LOOM_LZ4_WINDOW];
+};
+
+/**
+ * Compress a block.
+ *
+ * @param   dst     buffer of at least LOOM_LZ4_BOUND(len) bytes
+ * @returns the compressed length, or 0 if `len` > LOOM_LZ4_MAX_INPUT
+ */
+size_t	loom_lz4_compress(struct loom_lz4_state *, const void *src,
+	    size_t len, void *dst, int level);
+
+/**
+ * Decompress a block into a buffer of `capacity` bytes.
+ *
+ * @returns the decompressed length or -1 if the block is malformed or
+ *          wouldn't fit
+ */
+long	loom_lz4_decompress(const void *src, size_t len, void *dst,
+	    size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_LZ4_H */
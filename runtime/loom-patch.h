@@ -0,0 +1,100 @@
+/**
+ * \file  loom-patch.h
+ * \brief Enabling and disabling patchable (nop-sled) probes at run time.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_PATCH_H
+#define LOOM_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * With `strategy: patchable`, every probe site is a short sled that jumps
+ * over its own body:
+ *
+ *   unpatched:  jmp .+15; <13 bytes of padding>
+ *   patched:    movabs $hook, %r10; call __loom_patch_trampoline
+ *
+ * The hook's arguments are already in their (System V) argument registers
+ * when the sled executes, so a disabled probe costs a single jump. Patching
+ * a sled in makes it call the trampoline, which saves every caller-saved
+ * register before calling the hook.
+ *
+ * Each site is described by a `struct loom_sled` in the `loom_sleds` section,
+ * so this only knows about the sites in the executable or shared object that
+ * it is linked into. Patching is only supported on x86-64.
+ *
+ * Sites that can't be sleds (e.g., on other architectures, or with too many
+ * arguments for the argument registers) call their hooks behind a
+ * `<hook>_enabled` flag instead. The flag starts out clear and, on ELF, is
+ * described by a `struct loom_patch_flag` in the `loom_patch_flags` section,
+ * so loom_patch() sets and clears it along with the hook's sleds.
+ */
+
+/** The size of a sled, in bytes. */
+#define	LOOM_SLED_SIZE		15
+
+/** A patchable probe site, as recorded by the instrumentation. */
+struct loom_sled {
+	void		*address;	/* the sled itself */
+	void		(*hook)(void);	/* instrumentation to call */
+	const char	*name;		/* the hook's name */
+};
+
+/** A probe site's enable flag, used where a sled couldn't be. */
+struct loom_patch_flag {
+	uint8_t		*enabled;	/* the `<hook>_enabled` flag */
+	const char	*name;		/* the hook's name */
+};
+
+/** Get all of the sleds in this executable (or shared object). */
+const struct loom_sled	*loom_patch_sleds(size_t *count);
+
+/**
+ * Enable (patch in calls to hooks) or disable (patch out) probe sites.
+ *
+ * @param   name     only patch sites whose hook has this name
+ *                   (or all sites if NULL)
+ * @param   enable   patch calls in (non-zero) or out (zero)
+ *
+ * @returns the number of sites (or flags) patched, or -1 on failure (with
+ *          errno set); sites that are already patched as requested are
+ *          counted too
+ */
+int	loom_patch(const char *name, int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_PATCH_H */
@@ -0,0 +1,148 @@
+/**
+ * \file  loom-shm.h
+ * \brief Shared-memory trace ring for out-of-process collection.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_SHM_H
+#define LOOM_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Instrumented code (i.e., Loom's KTraceLogger with `ktrace: shm`) writes
+ * records into a ring buffer in a POSIX shared memory object. A separate
+ * `loom-collector` process maps the same object and consumes records in
+ * place, so formatting, compression and disk I/O all happen outside of the
+ * traced process.
+ *
+ * The ring (including the consumer's position) lives in the shared memory
+ * object, not in either process, so the collector can be stopped and
+ * restarted without losing records: records written while no collector is
+ * running simply wait in the ring. If the ring fills up, producers drop
+ * records (counting them in the ring header) rather than blocking.
+ *
+ * Any number of threads (or processes) can produce records concurrently;
+ * there is a single consumer.
+ *
+ * Tunable environment variables:
+ *
+ *   LOOM_SHM_NAME    shared memory object (if loom_shm_open() isn't called)
+ *   LOOM_SHM_SIZE    size of the ring in bytes (default 16 MiB; rounded up
+ *                    to a power of two)
+ */
+
+/** Identifies a Loom trace ring ("LOOMRING"). */
+#define	LOOM_SHM_MAGIC		0x474e49524d4f4f4cULL
+#define	LOOM_SHM_VERSION	1
+
+#define	LOOM_SHM_DEFAULT_NAME	"/loom-trace"
+
+/** Record flags. */
+#define	LOOM_SHM_PADDING	0x1	/* skip to the end of the ring */
+
+/**
+ * Every record in the ring starts with this header, aligned to
+ * LOOM_SHM_ALIGN bytes. A record is only complete once its `pos` field
+ * (written last, with release semantics) matches the record's position
+ * in the ring. Positions start at the ring's size, so no record can be at
+ * position 0: a new ring's zero-filled data never looks committed.
+ */
+struct loom_shm_record {
+	uint32_t	len;		/* payload length (bytes) */
+	uint32_t	flags;
+	uint64_t	pos;		/* ring position: commit marker */
+	/* payload follows */
+};
+
+#define	LOOM_SHM_ALIGN		sizeof(struct loom_shm_record)
+#define	LOOM_SHM_RECORD_SIZE(len) \
+	((sizeof(struct loom_shm_record) + (len) + LOOM_SHM_ALIGN - 1) \
+	    & ~(uint64_t) (LOOM_SHM_ALIGN - 1))
+
+/** The start of the shared memory object; ring data follows. */
+struct loom_shm_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	producers;	/* processes with the ring open */
+	uint64_t	size;		/* bytes of ring data (power of two) */
+	uint64_t	dropped;	/* records that didn't fit */
+
+	/* Producers claim space by advancing `reserve`. */
+	uint64_t	reserve __attribute__((aligned(64)));
+
+	/* The consumer's position: everything before it can be reused. */
+	uint64_t	head __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+#define	LOOM_SHM_DATA(hdr)	((char *) (hdr) + sizeof(struct loom_shm_header))
+
+
+/**
+ * Open (creating if necessary) a shared memory trace ring.
+ *
+ * This is optional: the first record written will open $LOOM_SHM_NAME
+ * (or LOOM_SHM_DEFAULT_NAME) if no ring is open yet. If the object already
+ * holds a ring (e.g., from a previous run that the collector hasn't finished
+ * consuming), it is reused as-is.
+ *
+ * @returns 0 on success or -1 on failure (with errno set)
+ */
+int	loom_shm_open(const char *name);
+
+/**
+ * Copy a (serialized) record into the ring.
+ *
+ * @returns 0 on success, -1 if the record was dropped
+ */
+int	loom_shm_write(const void *record, size_t len);
+
+/**
+ * Reserve space for a raw record of @b len bytes, to be filled in place and
+ * then committed with loom_shm_commit(). Records that are reserved but never
+ * committed stall the collector, so every reservation must be committed.
+ *
+ * @returns where to write the payload, or NULL if the record was dropped
+ */
+void	*loom_shm_reserve(size_t len);
+
+/** Make a record returned by loom_shm_reserve() visible to the collector. */
+void	loom_shm_commit(void *payload);
+
+/** Detach from the ring (called automatically at exit). */
+void	loom_shm_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_SHM_H */
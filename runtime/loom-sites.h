@@ -0,0 +1,74 @@
+/**
+ * \file  loom-sites.h
+ * \brief Mapping shared-hook site IDs back to source locations.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_SITES_H
+#define LOOM_SITES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * When every instruction is instrumented (`everything: true`) with hook
+ * functions, instructions with the same opcode and operand types share a
+ * hook and pass it a site ID as their first argument. The high 32 bits of a
+ * site ID are a hash of the instrumented module's identifier and the low 32
+ * bits number the site within that module.
+ *
+ * On ELF, every site is also described by a `struct loom_site` in the
+ * `loom_sites` section. As with patchable sleds, the section is collected
+ * per executable or shared object, so these functions only know about sites
+ * in the object that they are linked into.
+ */
+
+/** An instrumented instruction, as recorded by the instrumentation. */
+struct loom_site {
+	uint64_t	id;		/* passed to the shared hook */
+	const char	*function;	/* the instruction's function */
+	const char	*file;		/* source file ("" without debug info) */
+	uint32_t	line;		/* source line (0 without debug info) */
+	uint32_t	column;		/* source column */
+	const char	*description;	/* e.g., instrumentation:instruction:add */
+};
+
+/** Get all of the sites in this executable (or shared object). */
+const struct loom_site	*loom_site_table(size_t *count);
+
+/** Find a site by ID, or return NULL if it isn't in this object. */
+const struct loom_site	*loom_site_lookup(uint64_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_SITES_H */
@@ -0,0 +1,169 @@
+/**
+ * \file  loom-trace.h
+ * \brief Asynchronous trace writer for serialized Loom records.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_TRACE_H
+#define LOOM_TRACE_H
+
+#include "loom-lz4.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Instrumented code (i.e., Loom's KTraceLogger with `ktrace: file`) passes
+ * serialized records to loom_trace_write(), which copies them into a
+ * per-thread buffer. Full buffers are handed off to a writer thread, so the
+ * instrumented thread never blocks in write(2).
+ *
+ * On Linux, the writer thread submits batches of buffers as io_uring writes
+ * from registered (pre-mapped) buffers, recycling each buffer as soon as its
+ * write completes. Where io_uring is unavailable (older kernels, seccomp
+ * policies, other operating systems), it falls back to pwritev(2).
+ *
+ * Each record in the trace file is preceded by its length as a 32-bit,
+ * native-endian integer. Records from a single thread appear in the order
+ * they were written; records from different threads are interleaved at
+ * buffer granularity.
+ *
+ * If no buffers are free when a thread needs one (i.e., the disk can't keep
+ * up), records are dropped rather than blocking the instrumented thread.
+ * The number of dropped records is reported on stderr when the trace is
+ * closed.
+ *
+ * Tunable environment variables:
+ *
+ *   LOOM_TRACE_FILE          trace file (if loom_trace_open() isn't called)
+ *   LOOM_TRACE_BUFFERS       number of buffers in the pool (default 64)
+ *   LOOM_TRACE_BUFFER_SIZE   size of each buffer in bytes (default 256 KiB)
+ *   LOOM_TRACE_NO_URING      if set, always use pwritev(2)
+ *   LOOM_TRACE_COMPRESS      LZ4 compression level (1-9, default 0: off)
+ *
+ * When compression is enabled, the writer thread (never an instrumented
+ * thread) compresses each buffer into an independently-decodable block
+ * before writing it. Since records never span buffers, blocks can be
+ * decompressed in any order (e.g., in parallel by `loom-unpack`).
+ */
+
+/** Header of each block in a compressed trace. */
+struct loom_trace_block {
+	uint32_t	magic;		/* LOOM_TRACE_BLOCK_MAGIC */
+	uint32_t	codec;		/* LOOM_TRACE_BLOCK_{STORED,LZ4} */
+	uint32_t	raw_size;	/* length-prefixed records */
+	uint32_t	packed_size;	/* bytes following this header */
+};
+
+/*
+ * "LBLK": as the length prefix of an uncompressed trace's first record, this
+ * would be an implausible 1.2 GB, so compressed traces are easily detected.
+ */
+#define	LOOM_TRACE_BLOCK_MAGIC	0x4b4c424c
+
+enum {
+	LOOM_TRACE_BLOCK_STORED	= 0,	/* compression didn't help */
+	LOOM_TRACE_BLOCK_LZ4	= 1,
+};
+
+/**
+ * Open a trace file, starting the writer thread.
+ *
+ * This is optional: the first call to loom_trace_write() will open
+ * $LOOM_TRACE_FILE (or `loom.trace`) if no trace is open yet. The trace is
+ * flushed and closed at exit.
+ *
+ * @returns 0 on success or -1 on failure (with errno set)
+ */
+int	loom_trace_open(const char *filename);
+
+/**
+ * Append a record to the calling thread's trace buffer.
+ *
+ * @returns 0 if the record was buffered, -1 if it was dropped
+ */
+int	loom_trace_write(const void *record, size_t len);
+
+/**
+ * Hand the calling thread's partially-filled buffer to the writer thread.
+ *
+ * Buffers are otherwise only written when full, when their thread exits or
+ * when the trace is closed.
+ */
+void	loom_trace_flush(void);
+
+/**
+ * Flush all threads' buffers, wait for all writes to complete and
+ * close the trace file. Called automatically at exit.
+ */
+void	loom_trace_close(void);
+
+/** Statistics about a trace, e.g., for tests or benchmarks. */
+struct loom_trace_stats {
+	uint64_t	records;	/* records buffered */
+	uint64_t	dropped;	/* records dropped (no free buffer) */
+	uint64_t	writes;		/* buffers written */
+	uint64_t	bytes;		/* bytes written */
+	uint64_t	raw_bytes;	/* bytes written before compression */
+	int		io_uring;	/* non-zero if io_uring is in use */
+};
+
+void	loom_trace_stats(struct loom_trace_stats *);
+
+/**
+ * Compress `len` bytes of length-prefixed records into a block
+ * (header included).
+ *
+ * @param   block   buffer of at least LOOM_TRACE_BLOCK_BOUND(len) bytes
+ * @returns the size of the block
+ */
+size_t	loom_trace_pack(struct loom_lz4_state *, const void *records,
+	    size_t len, void *block, int level);
+
+#define	LOOM_TRACE_BLOCK_BOUND(len) \
+	(sizeof(struct loom_trace_block) + LOOM_LZ4_BOUND(len))
+
+/**
+ * Decompress a trace, writing its length-prefixed records to `out`.
+ *
+ * Blocks are decompressed by up to `threads` threads in parallel (0 means
+ * one per CPU). Uncompressed traces are copied unchanged. The input must
+ * be a regular file.
+ *
+ * @returns 0 on success or -1 on failure (reported on stderr)
+ */
+int	loom_trace_unpack(int in, int out, unsigned threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !LOOM_TRACE_H */
@@ -0,0 +1,90 @@
+/**
+ * \file  loom-unpack.c
+ * \brief Decompress a compressed trace file.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Usage: loom-unpack [-j threads] trace [output]
+ *
+ * Decompresses a trace written with LOOM_TRACE_COMPRESS (or by
+ * `loom-collector -z`), writing its length-prefixed records to the output
+ * (default: stdout), e.g., for `loom-decode`. Blocks are decompressed in
+ * parallel by up to `threads` threads (default: one per CPU). Uncompressed
+ * traces are copied unchanged.
+ */
+
+#include "loom-trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-j threads] trace [output]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned threads = 0;
+	int ch, in, out = STDOUT_FILENO;
+
+	while ((ch = getopt(argc, argv, "j:")) != -1) {
+		switch (ch) {
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind == argc || argc - optind > 2)
+		usage(argv[0]);
+
+	if ((in = open(argv[optind], O_RDONLY)) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (argc - optind == 2) {
+		const char *output = argv[optind + 1];
+
+		out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0) {
+			perror(output);
+			return 1;
+		}
+	}
+
+	return (loom_trace_unpack(in, out, threads) == 0) ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+/**
+ * \file  lz4.c
+ * \brief LZ4 block format compression and decompression.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-lz4.h"
+
+#include <string.h>
+
+#define	MIN_MATCH	4
+#define	LAST_LITERALS	5	/* the last 5 bytes are always literals */
+#define	MF_LIMIT	12	/* the last match starts >= 12 bytes from the end */
+#define	MAX_OFFSET	65535
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+hash4(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LOOM_LZ4_HASH_LOG);
+}
+
+/* Count the bytes that match at `a` and `b`, stopping at `limit` (for b). */
+static size_t
+match_length(const uint8_t *a, const uint8_t *b, const uint8_t *limit)
+{
+	const uint8_t *start = b;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (b + sizeof(uint64_t) <= limit) {
+		uint64_t x, y;
+
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		if (x != y)
+			return (b - start) + (__builtin_ctzll(x ^ y) >> 3);
+
+		a += sizeof(x);
+		b += sizeof(y);
+	}
+#endif
+
+	while (b < limit && *a == *b) {
+		a++;
+		b++;
+	}
+
+	return b - start;
+}
+
+/* Write the rest of a length that didn't fit in a token nibble. */
+static uint8_t *
+put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+/*
+ * Write a sequence: literals followed by a match (or, for the final
+ * sequence of a block, just literals: `matchlen` = 0).
+ */
+static uint8_t *
+put_sequence(uint8_t *op, const uint8_t *literals, size_t nliterals,
+    size_t offset, size_t matchlen)
+{
+	uint8_t *token = op++;
+
+	*token = (nliterals >= 15 ? 15 : nliterals) << 4;
+	if (nliterals >= 15)
+		op = put_length(op, nliterals - 15);
+
+	memcpy(op, literals, nliterals);
+	op += nliterals;
+
+	if (matchlen == 0)
+		return op;
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+
+	matchlen -= MIN_MATCH;
+	*token |= (matchlen >= 15 ? 15 : matchlen);
+	if (matchlen >= 15)
+		op = put_length(op, matchlen - 15);
+
+	return op;
+}
+
+static inline void
+insert(struct loom_lz4_state *s, const uint8_t *in, size_t i)
+{
+	uint32_t h = hash4(read32(in + i));
+
+	s->chain[i & (LOOM_LZ4_WINDOW - 1)] = s->head[h];
+	s->head[h] = i;
+}
+
+size_t
+loom_lz4_compress(struct loom_lz4_state *s, const void *src, size_t len,
+    void *dst, int level)
+{
+	const uint8_t *in = src;
+	uint8_t *op = dst;
+	size_t anchor = 0, i = 0;
+
+	if (len > LOOM_LZ4_MAX_INPUT)
+		return 0;
+
+	if (level > LOOM_LZ4_MAX_LEVEL)
+		level = LOOM_LZ4_MAX_LEVEL;
+	const unsigned depth = (level <= 1) ? 1 : 1u << (level - 1);
+
+	if (len > MF_LIMIT) {
+		const size_t limit = len - MF_LIMIT;
+		const uint8_t *match_limit = in + len - LAST_LITERALS;
+
+		memset(s->head, 0xff, sizeof(s->head));
+
+		while (i <= limit) {
+			const uint32_t seq = read32(in + i);
+			int32_t candidate = s->head[hash4(seq)];
+			size_t best = 0, best_pos = 0;
+
+			for (unsigned d = depth; d > 0 && candidate >= 0
+			    && i - candidate <= MAX_OFFSET; d--) {
+				if (read32(in + candidate) == seq) {
+					size_t n = MIN_MATCH + match_length(
+					    in + candidate + MIN_MATCH,
+					    in + i + MIN_MATCH, match_limit);
+
+					if (n > best) {
+						best = n;
+						best_pos = candidate;
+					}
+				}
+
+				candidate = s->chain[candidate & (LOOM_LZ4_WINDOW - 1)];
+			}
+
+			insert(s, in, i);
+
+			if (best < MIN_MATCH) {
+				/* Speed through incompressible data at level 1. */
+				i += (depth > 1) ? 1 : 1 + ((i - anchor) >> 6);
+				continue;
+			}
+
+			op = put_sequence(op, in + anchor, i - anchor,
+			    i - best_pos, best);
+
+			const size_t end = i + best;
+			if (depth > 1) {
+				while (++i < end && i <= limit)
+					insert(s, in, i);
+			} else if (end - 2 <= limit) {
+				insert(s, in, end - 2);
+			}
+
+			i = anchor = end;
+		}
+	}
+
+	op = put_sequence(op, in + anchor, len - anchor, 0, 0);
+
+	return op - (uint8_t *) dst;
+}
+
+/* Read the rest of a length that didn't fit in a token nibble. */
+static int
+get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip == end)
+			return -1;
+
+		byte = *(*ip)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return 0;
+}
+
+long
+loom_lz4_decompress(const void *src, size_t len, void *dst, size_t capacity)
+{
+	const uint8_t *ip = src, *const iend = ip + len;
+	uint8_t *op = dst, *const ostart = op, *const oend = op + capacity;
+
+	for (;;) {
+		size_t n, offset;
+
+		if (ip == iend)
+			return -1;
+
+		const unsigned token = *ip++;
+
+		n = token >> 4;
+		if (n == 15 && get_length(&ip, iend, &n) != 0)
+			return -1;
+
+		if ((size_t) (iend - ip) < n || (size_t) (oend - op) < n)
+			return -1;
+
+		memcpy(op, ip, n);
+		op += n;
+		ip += n;
+
+		/* The last sequence has no match. */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - ostart))
+			return -1;
+
+		n = token & 15;
+		if (n == 15 && get_length(&ip, iend, &n) != 0)
+			return -1;
+		n += MIN_MATCH;
+
+		if ((size_t) (oend - op) < n)
+			return -1;
+
+		/* Matches may overlap their own output (e.g., runs). */
+		const uint8_t *match = op - offset;
+		if (offset >= n) {
+			memcpy(op, match, n);
+			op += n;
+		} else {
+			while (n-- > 0)
+				*op++ = *match++;
+		}
+	}
+
+	return op - ostart;
+}
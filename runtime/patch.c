@@ -0,0 +1,318 @@
+/**
+ * \file  patch.c
+ * \brief Patching nop sleds into (and out of) calls to instrumentation.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-patch.h"
+
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The linker collects every module's sled descriptions into one array,
+ * which doesn't exist at all if nothing was instrumented.
+ */
+extern const struct loom_sled __start_loom_sleds[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct loom_sled __stop_loom_sleds[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct loom_patch_flag __start_loom_patch_flags[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct loom_patch_flag __stop_loom_patch_flags[]
+    __attribute__((weak, visibility("hidden")));
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+#if defined(__x86_64__)
+
+void	__loom_patch_trampoline(void) __attribute__((visibility("hidden")));
+
+/*
+ * The size of the XSAVE area for the extended (AVX, AVX-512, ...) state
+ * that the OS has enabled, or zero if XSAVE isn't available.
+ */
+uint32_t __loom_patch_xsave_size __attribute__((visibility("hidden")));
+
+/*
+ * Called from a patched sled with the hook's address in %r10 and its
+ * arguments in their argument registers. The instrumented code doesn't
+ * expect a call here, so we save every other caller-saved register
+ * (the sled itself clobbers %r10) and align the stack before calling
+ * the hook.
+ *
+ * Vector registers are saved with XSAVE rather than as %xmm registers:
+ * hooks can call library routines that use AVX and then `vzeroupper`,
+ * which would otherwise destroy live %ymm and %zmm values. XSAVE's
+ * header must be zeroed before use and its mask is passed in %edx:%eax,
+ * so those argument registers are reloaded before the call. Without
+ * XSAVE, FXSAVE saves the %xmm registers (and the x87 state).
+ */
+__asm__(
+"	.text\n"
+"	.globl	__loom_patch_trampoline\n"
+"	.hidden	__loom_patch_trampoline\n"
+"	.type	__loom_patch_trampoline, @function\n"
+"	.p2align 4\n"
+"__loom_patch_trampoline:\n"
+"	pushq	%rbp\n"
+"	movq	%rsp, %rbp\n"
+"	pushq	%rax\n"
+"	pushq	%rcx\n"
+"	pushq	%rdx\n"
+"	pushq	%rsi\n"
+"	pushq	%rdi\n"
+"	pushq	%r8\n"
+"	pushq	%r9\n"
+"	pushq	%r11\n"
+"	movl	__loom_patch_xsave_size(%rip), %r11d\n"
+"	testl	%r11d, %r11d\n"
+"	jz	1f\n"
+"	subq	%r11, %rsp\n"
+"	andq	$-64, %rsp\n"
+"	xorl	%eax, %eax\n"
+"	movq	%rax, 512(%rsp)\n"
+"	movq	%rax, 520(%rsp)\n"
+"	movq	%rax, 528(%rsp)\n"
+"	movq	%rax, 536(%rsp)\n"
+"	movq	%rax, 544(%rsp)\n"
+"	movq	%rax, 552(%rsp)\n"
+"	movq	%rax, 560(%rsp)\n"
+"	movq	%rax, 568(%rsp)\n"
+"	movl	$-1, %eax\n"
+"	movl	$-1, %edx\n"
+"	xsave64	(%rsp)\n"
+"	movq	-8(%rbp), %rax\n"
+"	movq	-24(%rbp), %rdx\n"
+"	callq	*%r10\n"
+"	movl	$-1, %eax\n"
+"	movl	$-1, %edx\n"
+"	xrstor64	(%rsp)\n"
+"	jmp	2f\n"
+"1:\n"
+"	subq	$512, %rsp\n"
+"	andq	$-16, %rsp\n"
+"	fxsave64	(%rsp)\n"
+"	callq	*%r10\n"
+"	fxrstor64	(%rsp)\n"
+"2:\n"
+"	leaq	-64(%rbp), %rsp\n"
+"	popq	%r11\n"
+"	popq	%r9\n"
+"	popq	%r8\n"
+"	popq	%rdi\n"
+"	popq	%rsi\n"
+"	popq	%rdx\n"
+"	popq	%rcx\n"
+"	popq	%rax\n"
+"	popq	%rbp\n"
+"	retq\n"
+"	.size	__loom_patch_trampoline, .-__loom_patch_trampoline\n"
+);
+
+/*
+ * Find the size of the XSAVE area for the state components that the OS
+ * has enabled in XCR0 (zero if the OS doesn't support XSAVE).
+ */
+static uint32_t
+xsave_size(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+		return 0;
+
+	if (!__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	return ebx;
+}
+
+/*
+ * Rewrite one sled: called with the lock held.
+ *
+ * The body of an unpatched sled is never executed, so it can be written
+ * at leisure; the sled is then switched (atomically) by replacing its
+ * first two bytes, which are either a short jump over the body or the
+ * start of a `movabs` into %r10.
+ */
+static int
+patch_sled(const struct loom_sled *s, int enable, uintptr_t pagesize)
+{
+	uint8_t *sled = s->address;
+	uint8_t code[LOOM_SLED_SIZE];
+	size_t len = 2;
+
+	if (enable) {
+		uintptr_t hook = (uintptr_t) s->hook;
+		intptr_t rel = (intptr_t) __loom_patch_trampoline
+		    - (intptr_t) (sled + LOOM_SLED_SIZE);
+		int32_t rel32 = (int32_t) rel;
+
+		if (rel != rel32) {
+			errno = ERANGE;
+			return -1;
+		}
+
+		code[0] = 0x49;				/* movabs $hook, %r10 */
+		code[1] = 0xba;
+		memcpy(code + 2, &hook, sizeof(hook));
+		code[10] = 0xe8;			/* call rel32 */
+		memcpy(code + 11, &rel32, sizeof(rel32));
+		len = LOOM_SLED_SIZE;
+	} else {
+		code[0] = 0xeb;				/* jmp .+LOOM_SLED_SIZE */
+		code[1] = LOOM_SLED_SIZE - 2;
+	}
+
+	if (memcmp(sled, code, len) == 0)
+		return 0;
+
+	uintptr_t start = (uintptr_t) sled & ~(pagesize - 1);
+	uintptr_t end = (uintptr_t) sled + LOOM_SLED_SIZE;
+
+	if (mprotect((void *) start, end - start,
+	    PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+		return -1;
+
+	uint16_t head;
+	memcpy(sled + 2, code + 2, len - 2);
+	memcpy(&head, code, sizeof(head));
+	__atomic_store_n((uint16_t *) sled, head, __ATOMIC_RELEASE);
+
+	return mprotect((void *) start, end - start, PROT_READ | PROT_EXEC);
+}
+
+#endif /* __x86_64__ */
+
+
+const struct loom_sled *
+loom_patch_sleds(size_t *count)
+{
+	if (__start_loom_sleds == NULL || __stop_loom_sleds == NULL) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = __stop_loom_sleds - __start_loom_sleds;
+	return __start_loom_sleds;
+}
+
+int
+loom_patch(const char *name, int enable)
+{
+	const struct loom_patch_flag *flags = __start_loom_patch_flags;
+	size_t nflags = 0;
+	int patched = 0;
+
+	if (__start_loom_patch_flags != NULL && __stop_loom_patch_flags != NULL)
+		nflags = __stop_loom_patch_flags - __start_loom_patch_flags;
+
+	pthread_mutex_lock(&lock);
+
+	/* Sites that couldn't be sleds are guarded by flags instead. */
+	for (size_t i = 0; i < nflags; i++) {
+		const struct loom_patch_flag *f = flags + i;
+
+		if (name != NULL && strcmp(name, f->name) != 0)
+			continue;
+
+		__atomic_store_n(f->enabled, enable != 0, __ATOMIC_RELAXED);
+		patched++;
+	}
+
+#if defined(__x86_64__)
+	static int checked_xsave;
+	const uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+	const struct loom_sled *sleds;
+	size_t count;
+
+	sleds = loom_patch_sleds(&count);
+
+	if (!checked_xsave) {
+		__loom_patch_xsave_size = xsave_size();
+		checked_xsave = 1;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const struct loom_sled *s = sleds + i;
+
+		if (name != NULL && strcmp(name, s->name) != 0)
+			continue;
+
+		if (patch_sled(s, enable, pagesize) != 0) {
+			patched = -1;
+			break;
+		}
+
+		patched++;
+	}
+#endif
+	pthread_mutex_unlock(&lock);
+
+	return patched;
+}
+
+/*
+ * Probes can be enabled from the start (without changing the program)
+ * by listing their hooks in $LOOM_PATCH, separated by commas, or `*`
+ * to enable every probe.
+ */
+__attribute__((constructor))
+static void
+patch_from_environment(void)
+{
+	const char *env = getenv("LOOM_PATCH");
+	char *names, *name, *next;
+
+	if (env == NULL || *env == '\0')
+		return;
+
+	if (strcmp(env, "*") == 0) {
+		loom_patch(NULL, 1);
+		return;
+	}
+
+	names = strdup(env);
+	if (names == NULL)
+		return;
+
+	for (name = strtok_r(names, ",", &next); name != NULL;
+	    name = strtok_r(NULL, ",", &next))
+		loom_patch(name, 1);
+
+	free(names);
+}
@@ -0,0 +1,268 @@
+/**
+ * \file  shm-ring.c
+ * \brief Producer side of the shared-memory trace ring.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-shm.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define	DEFAULT_SIZE	(16 * 1024 * 1024)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct loom_shm_header *ring;
+static int tried;
+
+
+static uint64_t
+ring_size(void)
+{
+	const char *s = getenv("LOOM_SHM_SIZE");
+	uint64_t want = s ? strtoull(s, NULL, 0) : 0;
+	uint64_t size = 4096;
+
+	if (want == 0)
+		want = DEFAULT_SIZE;
+
+	while (size < want)
+		size <<= 1;
+
+	return size;
+}
+
+/* Open the ring: called with the lock held. */
+static int
+open_locked(const char *name)
+{
+	struct loom_shm_header *hdr;
+	struct stat sb;
+	uint64_t size = ring_size();
+	int fd;
+
+	if (ring != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return -1;
+
+	/*
+	 * Reuse an existing ring (whatever its size) if there is one,
+	 * so that records not yet consumed aren't lost.
+	 */
+	if (fstat(fd, &sb) == 0 && (size_t) sb.st_size > sizeof(*hdr)) {
+		hdr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+		if (hdr != MAP_FAILED && hdr->magic == LOOM_SHM_MAGIC
+		    && hdr->version == LOOM_SHM_VERSION
+		    && hdr->size + sizeof(*hdr) <= (uint64_t) sb.st_size) {
+			close(fd);
+			__atomic_add_fetch(&hdr->producers, 1, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&ring, hdr, __ATOMIC_RELEASE);
+			return 0;
+		}
+
+		if (hdr != MAP_FAILED)
+			munmap(hdr, sb.st_size);
+	}
+
+	if (ftruncate(fd, sizeof(*hdr) + size) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	hdr = mmap(NULL, sizeof(*hdr) + size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return -1;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version = LOOM_SHM_VERSION;
+	hdr->size = size;
+	hdr->producers = 1;
+
+	/*
+	 * Positions start at `size` rather than 0: the new ring's data is
+	 * zero-filled, so a record at position 0 would already look committed
+	 * to a collector that attaches before anything is written.
+	 */
+	hdr->reserve = size;
+	hdr->head = size;
+
+	/* Publish the magic number last: the collector may be waiting for it. */
+	__atomic_store_n(&hdr->magic, LOOM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ring, hdr, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int
+loom_shm_open(const char *name)
+{
+	pthread_mutex_lock(&lock);
+	tried = 1;
+	int ret = open_locked(name);
+	pthread_mutex_unlock(&lock);
+
+	if (ret == 0)
+		atexit(loom_shm_close);
+
+	return ret;
+}
+
+static struct loom_shm_header *
+get_ring(void)
+{
+	struct loom_shm_header *r = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+	if (r != NULL || __atomic_load_n(&tried, __ATOMIC_RELAXED))
+		return r;
+
+	pthread_mutex_lock(&lock);
+	if (!tried) {
+		const char *name = getenv("LOOM_SHM_NAME");
+
+		tried = 1;
+		if (open_locked(name ? name : LOOM_SHM_DEFAULT_NAME) == 0)
+			atexit(loom_shm_close);
+		else
+			perror("loom: unable to open shared memory trace ring");
+	}
+	r = ring;
+	pthread_mutex_unlock(&lock);
+
+	return r;
+}
+
+void *
+loom_shm_reserve(size_t len)
+{
+	struct loom_shm_header *r = get_ring();
+	if (r == NULL)
+		return NULL;
+
+	const uint64_t size = r->size;
+	const uint64_t need = LOOM_SHM_RECORD_SIZE(len);
+	uint64_t pos, pad;
+
+	if (need > size / 2) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	/*
+	 * Claim space for the record, plus padding if it would otherwise
+	 * wrap around the end of the ring.
+	 */
+	pos = __atomic_load_n(&r->reserve, __ATOMIC_RELAXED);
+	do {
+		uint64_t offset = pos & (size - 1);
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+		pad = (offset + need > size) ? size - offset : 0;
+		if (pos + pad + need - head > size) {
+			__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n(&r->reserve, &pos,
+	    pos + pad + need, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	char *data = LOOM_SHM_DATA(r);
+
+	if (pad > 0) {
+		struct loom_shm_record *p =
+		    (struct loom_shm_record *) (data + (pos & (size - 1)));
+
+		p->len = pad - sizeof(*p);
+		p->flags = LOOM_SHM_PADDING;
+		__atomic_store_n(&p->pos, pos, __ATOMIC_RELEASE);
+		pos += pad;
+	}
+
+	struct loom_shm_record *rec =
+	    (struct loom_shm_record *) (data + (pos & (size - 1)));
+
+	rec->len = len;
+	rec->flags = 0;
+
+	/* Stash our position where loom_shm_commit() can find it. */
+	rec->pos = ~pos;
+
+	return rec + 1;
+}
+
+void
+loom_shm_commit(void *payload)
+{
+	struct loom_shm_record *rec = (struct loom_shm_record *) payload - 1;
+
+	__atomic_store_n(&rec->pos, ~rec->pos, __ATOMIC_RELEASE);
+}
+
+int
+loom_shm_write(const void *record, size_t len)
+{
+	void *payload = loom_shm_reserve(len);
+	if (payload == NULL)
+		return -1;
+
+	memcpy(payload, record, len);
+	loom_shm_commit(payload);
+
+	return 0;
+}
+
+void
+loom_shm_close(void)
+{
+	pthread_mutex_lock(&lock);
+	if (ring != NULL) {
+		__atomic_sub_fetch(&ring->producers, 1, __ATOMIC_SEQ_CST);
+
+		/*
+		 * Other threads may still be in the middle of writing records,
+		 * so leave the ring mapped: just stop accepting new records.
+		 */
+		__atomic_store_n(&ring, NULL, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lock);
+}
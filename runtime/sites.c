@@ -0,0 +1,68 @@
+/**
+ * \file  sites.c
+ * \brief Looking up shared-hook instrumentation sites.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-sites.h"
+
+/*
+ * The linker collects every module's site descriptions into one array,
+ * which doesn't exist at all if nothing was instrumented.
+ */
+extern const struct loom_site __start_loom_sites[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct loom_site __stop_loom_sites[]
+    __attribute__((weak, visibility("hidden")));
+
+
+const struct loom_site *
+loom_site_table(size_t *count)
+{
+	if (__start_loom_sites == NULL || __stop_loom_sites == NULL) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = __stop_loom_sites - __start_loom_sites;
+	return __start_loom_sites;
+}
+
+const struct loom_site *
+loom_site_lookup(uint64_t id)
+{
+	const struct loom_site *sites;
+	size_t count;
+
+	sites = loom_site_table(&count);
+	for (size_t i = 0; i < count; i++) {
+		if (sites[i].id == id)
+			return sites + i;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,269 @@
+/**
+ * \file  trace-block.c
+ * \brief Compressed trace blocks: packing and (parallel) unpacking.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-trace.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Blocks decompressed (by all threads) before each write(2). */
+#define	BLOCKS_PER_THREAD	8
+
+size_t
+loom_trace_pack(struct loom_lz4_state *lz4, const void *records, size_t len,
+    void *block, int level)
+{
+	struct loom_trace_block hdr = {
+		.magic = LOOM_TRACE_BLOCK_MAGIC,
+		.codec = LOOM_TRACE_BLOCK_LZ4,
+		.raw_size = len,
+	};
+	char *payload = (char *) block + sizeof(hdr);
+	size_t packed = loom_lz4_compress(lz4, records, len, payload, level);
+
+	if (packed == 0 || packed >= len) {
+		hdr.codec = LOOM_TRACE_BLOCK_STORED;
+		memcpy(payload, records, len);
+		packed = len;
+	}
+
+	hdr.packed_size = packed;
+	memcpy(block, &hdr, sizeof(hdr));
+
+	return sizeof(hdr) + packed;
+}
+
+
+struct block {
+	const char	*packed;
+	char		*raw;
+	struct loom_trace_block	hdr;
+};
+
+/* A window of blocks being decompressed in parallel. */
+struct window {
+	struct block	*blocks;
+	size_t		 count;
+	size_t		 next;		/* next block to claim */
+	int		 failed;
+};
+
+static void *
+unpack_blocks(void *arg)
+{
+	struct window *w = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED))
+	    < w->count) {
+		struct block *b = w->blocks + i;
+		long n;
+
+		if (b->hdr.codec == LOOM_TRACE_BLOCK_STORED) {
+			memcpy(b->raw, b->packed, b->hdr.raw_size);
+			continue;
+		}
+
+		n = loom_lz4_decompress(b->packed, b->hdr.packed_size, b->raw,
+		    b->hdr.raw_size);
+		if (n != (long) b->hdr.raw_size)
+			__atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("loom: error writing unpacked trace");
+			return -1;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Find the next block header, checking that the whole block is present. */
+static int
+next_block(const char *data, size_t size, size_t *offset, struct block *b)
+{
+	if (size - *offset < sizeof(b->hdr))
+		goto truncated;
+
+	memcpy(&b->hdr, data + *offset, sizeof(b->hdr));
+	if (b->hdr.magic != LOOM_TRACE_BLOCK_MAGIC
+	    || (b->hdr.codec != LOOM_TRACE_BLOCK_STORED
+		&& b->hdr.codec != LOOM_TRACE_BLOCK_LZ4)
+	    || (b->hdr.codec == LOOM_TRACE_BLOCK_STORED
+		&& b->hdr.packed_size != b->hdr.raw_size)) {
+		fprintf(stderr, "loom: bad trace block at offset %zu\n",
+		    *offset);
+		return -1;
+	}
+
+	*offset += sizeof(b->hdr);
+	if (size - *offset < b->hdr.packed_size)
+		goto truncated;
+
+	b->packed = data + *offset;
+	*offset += b->hdr.packed_size;
+
+	return 0;
+
+truncated:
+	fprintf(stderr, "loom: truncated trace block at offset %zu\n", *offset);
+	return -1;
+}
+
+int
+loom_trace_unpack(int in, int out, unsigned threads)
+{
+	struct stat sb;
+	uint32_t magic;
+	int ret = -1;
+
+	if (fstat(in, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+		fprintf(stderr, "loom: trace to unpack must be a regular file\n");
+		return -1;
+	}
+
+	const size_t size = sb.st_size;
+	if (size == 0)
+		return 0;
+
+	const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, 0);
+	if (data == MAP_FAILED) {
+		perror("loom: unable to map trace");
+		return -1;
+	}
+
+	if (size >= sizeof(magic))
+		memcpy(&magic, data, sizeof(magic));
+
+	if (size < sizeof(magic) || magic != LOOM_TRACE_BLOCK_MAGIC) {
+		ret = write_all(out, data, size);
+		munmap((void *) data, size);
+		return ret;
+	}
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+
+	const size_t capacity = threads * BLOCKS_PER_THREAD;
+	struct block *blocks = calloc(capacity, sizeof(*blocks));
+	pthread_t *workers = calloc(threads, sizeof(*workers));
+	char *raw = NULL;
+	size_t raw_capacity = 0;
+	size_t offset = 0;
+
+	if (blocks == NULL || workers == NULL) {
+		perror("loom: calloc");
+		goto done;
+	}
+
+	while (offset < size) {
+		struct window w = { blocks, 0, 0, 0 };
+		size_t raw_size = 0;
+
+		/* Index a window's worth of blocks (just their headers). */
+		while (w.count < capacity && offset < size) {
+			if (next_block(data, size, &offset, blocks + w.count) != 0)
+				goto done;
+
+			raw_size += blocks[w.count++].hdr.raw_size;
+		}
+
+		if (raw_size > raw_capacity) {
+			free(raw);
+			raw_capacity = raw_size;
+			if ((raw = malloc(raw_capacity)) == NULL) {
+				perror("loom: malloc");
+				goto done;
+			}
+		}
+
+		/* Blocks are decompressed in place within the output. */
+		raw_size = 0;
+		for (size_t i = 0; i < w.count; i++) {
+			blocks[i].raw = raw + raw_size;
+			raw_size += blocks[i].hdr.raw_size;
+		}
+
+		unsigned started = 0;
+		for (; started < threads && started < w.count; started++) {
+			if (pthread_create(workers + started, NULL,
+			    unpack_blocks, &w) != 0)
+				break;
+		}
+
+		/* If we couldn't start any threads, do the work ourselves. */
+		if (started == 0)
+			unpack_blocks(&w);
+
+		for (unsigned i = 0; i < started; i++)
+			pthread_join(workers[i], NULL);
+
+		if (w.failed) {
+			fprintf(stderr, "loom: corrupt block in trace\n");
+			goto done;
+		}
+
+		if (write_all(out, raw, raw_size) != 0)
+			goto done;
+	}
+
+	ret = 0;
+
+done:
+	free(raw);
+	free(workers);
+	free(blocks);
+	munmap((void *) data, size);
+
+	return ret;
+}
@@ -0,0 +1,863 @@
+/**
+ * \file  trace-writer.c
+ * \brief Per-thread trace buffers written asynchronously via io_uring.
+ */
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "loom-trace.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define	HAVE_IO_URING	1
+#endif
+#endif
+
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define	BATCH_MAX	IOV_MAX
+#else
+#define	BATCH_MAX	64		/* buffers per pwritev(2) */
+#endif
+
+#define	DEFAULT_BUFFERS		64
+#define	DEFAULT_BUFFER_SIZE	(256 * 1024)
+#define	DEFAULT_FILENAME	"loom.trace"
+
+/*
+ * A fixed-size buffer of length-prefixed records. Uncompressed buffers are
+ * written directly (`out` is `data`); otherwise, the writer thread packs
+ * `data` into a compressed block at `out`.
+ */
+struct buffer {
+	char		*data;
+	size_t		 used;
+	char		*out;
+	size_t		 outlen;
+	unsigned	 index;		/* within the pool (and registration) */
+	off_t		 offset;	/* file offset, assigned by the writer */
+	struct buffer	*next;
+};
+
+/*
+ * Per-thread state. `busy` is set while the owning thread touches `current`
+ * so that loom_trace_close() can safely take buffers from live threads.
+ * A thread never acquires the runtime lock while it is busy.
+ */
+struct thread_state {
+	struct buffer		*current;
+	int			 busy;
+	uint64_t		 records;
+	uint64_t		 dropped;
+	struct thread_state	*next;
+};
+
+enum { UNOPENED, OPEN, CLOSED };
+
+#ifdef HAVE_IO_URING
+/* Just enough of an io_uring to submit writes and reap their completions. */
+struct uring {
+	int			 fd;
+	unsigned		*sq_tail, *sq_mask, *sq_array;
+	unsigned		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring, *cq_ring;
+	size_t			 sq_ring_size, cq_ring_size, sqes_size;
+	unsigned		 inflight;
+};
+#endif
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 ready;		/* full buffers to write */
+	pthread_cond_t		 idle;		/* nothing pending */
+	int			 state;
+	int			 stopping;
+	int			 fd;
+
+	char			*region;
+	struct buffer		*buffers;
+	unsigned		 nbuffers;
+	size_t			 bufsize;
+
+	int			 level;		/* LZ4 level, 0 if uncompressed */
+	char			*packed;	/* a block per buffer */
+	size_t			 packsize;
+	struct loom_lz4_state	*lz4;		/* used by the writer thread */
+
+	struct buffer		*free;
+	struct buffer		*full, **full_tail;
+	unsigned		 pending;	/* handed off, not yet recycled */
+	off_t			 offset;
+
+	struct thread_state	*threads;
+	pthread_key_t		 key;
+	pthread_t		 writer;
+
+	uint64_t		 records, dropped, writes, bytes, raw_bytes;
+
+	int			 use_uring;
+#ifdef HAVE_IO_URING
+	struct uring		 ring;
+#endif
+} rt = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ready = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.state = UNOPENED,
+	.fd = -1,
+};
+
+static __thread struct thread_state *self;
+
+
+static size_t
+env_size(const char *name, size_t def)
+{
+	const char *s = getenv(name);
+	char *end;
+	unsigned long long v;
+
+	if (s == NULL)
+		return def;
+
+	v = strtoull(s, &end, 0);
+	return (end == s || v == 0) ? def : (size_t) v;
+}
+
+
+/*
+ * Buffer hand-off: all called with the runtime lock held.
+ */
+
+static void
+push_full_locked(struct buffer *b)
+{
+	b->next = NULL;
+	*rt.full_tail = b;
+	rt.full_tail = &b->next;
+	rt.pending++;
+	pthread_cond_signal(&rt.ready);
+}
+
+static void
+push_free_locked(struct buffer *b)
+{
+	b->used = 0;
+	b->next = rt.free;
+	rt.free = b;
+}
+
+static void
+recycle(struct buffer *b)
+{
+	pthread_mutex_lock(&rt.lock);
+	rt.writes++;
+	push_free_locked(b);
+	if (--rt.pending == 0)
+		pthread_cond_broadcast(&rt.idle);
+	pthread_mutex_unlock(&rt.lock);
+}
+
+
+/*
+ * Synchronous writes (from the writer thread only).
+ */
+
+static void
+pwrite_all(const char *data, size_t len, off_t offset)
+{
+	while (len > 0) {
+		ssize_t n = pwrite(rt.fd, data, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0) {
+			perror("loom: error writing trace");
+			return;
+		}
+
+		__atomic_add_fetch(&rt.bytes, n, __ATOMIC_RELAXED);
+		data += n;
+		len -= n;
+		offset += n;
+	}
+}
+
+/* Write a batch of buffers (with contiguous offsets) using pwritev(2). */
+static void
+pwritev_batch(struct buffer *batch)
+{
+	while (batch != NULL) {
+		struct iovec iov[BATCH_MAX];
+		struct buffer *first = batch;
+		off_t offset = batch->offset;
+		int count = 0;
+
+		for (; batch != NULL && count < BATCH_MAX;
+		    batch = batch->next, count++) {
+			iov[count].iov_base = batch->out;
+			iov[count].iov_len = batch->outlen;
+		}
+
+		ssize_t written;
+		do {
+			written = pwritev(rt.fd, iov, count, offset);
+		} while (written < 0 && errno == EINTR);
+
+		if (written < 0) {
+			perror("loom: error writing trace");
+			written = 0;
+		} else {
+			__atomic_add_fetch(&rt.bytes, written, __ATOMIC_RELAXED);
+		}
+
+		/* Finish any short write, then recycle every buffer. */
+		for (struct buffer *b = first; b != batch; ) {
+			struct buffer *next = b->next;
+			size_t done = (size_t) written > b->outlen ?
+			    b->outlen : (size_t) written;
+
+			if (done < b->outlen)
+				pwrite_all(b->out + done, b->outlen - done,
+				    b->offset + done);
+
+			written -= done;
+			recycle(b);
+			b = next;
+		}
+	}
+}
+
+
+#ifdef HAVE_IO_URING
+
+static int
+uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, min_complete, flags,
+	    NULL, 0);
+}
+
+static int
+uring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static void
+uring_destroy(struct uring *r)
+{
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring != NULL && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring != NULL)
+		munmap(r->sq_ring, r->sq_ring_size);
+	if (r->fd >= 0)
+		close(r->fd);
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/*
+ * Create a ring with one submission entry per buffer (so submissions can
+ * never outrun the queue) and register all of the buffers with the kernel.
+ */
+static int
+uring_init(struct uring *r)
+{
+	struct io_uring_params p;
+	char *base;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = uring_setup(rt.nbuffers, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED) {
+		r->sq_ring = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED) {
+			r->cq_ring = NULL;
+			goto fail;
+		}
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	base = r->sq_ring;
+	r->sq_tail = (unsigned *) (base + p.sq_off.tail);
+	r->sq_mask = (unsigned *) (base + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) (base + p.sq_off.array);
+
+	base = r->cq_ring;
+	r->cq_head = (unsigned *) (base + p.cq_off.head);
+	r->cq_tail = (unsigned *) (base + p.cq_off.tail);
+	r->cq_mask = (unsigned *) (base + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (base + p.cq_off.cqes);
+
+	/* Registered buffers are pinned once rather than on every write. */
+	struct iovec *iov = calloc(rt.nbuffers, sizeof(*iov));
+	if (iov == NULL)
+		goto fail;
+
+	for (unsigned i = 0; i < rt.nbuffers; i++) {
+		iov[i].iov_base = rt.buffers[i].out;
+		iov[i].iov_len = rt.level ? rt.packsize : rt.bufsize;
+	}
+
+	int err = uring_register(r->fd, IORING_REGISTER_BUFFERS, iov,
+	    rt.nbuffers);
+	free(iov);
+	if (err < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	uring_destroy(r);
+	return -1;
+}
+
+/* Queue a batch of buffers as fixed-buffer writes and submit them together. */
+static void
+uring_submit_batch(struct uring *r, struct buffer *batch)
+{
+	unsigned tail = *r->sq_tail;
+	unsigned count = 0;
+
+	for (struct buffer *b = batch; b != NULL; b = b->next) {
+		unsigned i = tail & *r->sq_mask;
+		struct io_uring_sqe *sqe = r->sqes + i;
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->fd = rt.fd;
+		sqe->addr = (uintptr_t) b->out;
+		sqe->len = b->outlen;
+		sqe->off = b->offset;
+		sqe->buf_index = b->index;
+		sqe->user_data = b->index;
+
+		r->sq_array[i] = i;
+		tail++;
+		count++;
+	}
+
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	r->inflight += count;
+
+	while (count > 0) {
+		int submitted = uring_enter(r->fd, count, 0, 0);
+		if (submitted < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+
+			/*
+			 * io_uring_enter() itself failed: the entries are still
+			 * queued, so wait for them the next time we reap.
+			 */
+			perror("loom: io_uring_enter");
+			break;
+		}
+
+		count -= submitted;
+	}
+}
+
+/*
+ * Reap write completions, recycling each buffer as soon as it has been
+ * written. Short or failed writes are finished with pwrite(2); if fixed
+ * writes aren't supported at all, stop using io_uring.
+ */
+static void
+uring_reap(struct uring *r, int wait)
+{
+	if (r->inflight == 0)
+		return;
+
+	if (wait) {
+		while (uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+		    && errno == EINTR)
+			;
+	}
+
+	unsigned head = *r->cq_head;
+	unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = r->cqes + (head & *r->cq_mask);
+		struct buffer *b = rt.buffers + cqe->user_data;
+		int res = cqe->res;
+
+		if (res < 0) {
+			if (res == -EINVAL || res == -EOPNOTSUPP)
+				rt.use_uring = 0;
+			res = 0;
+		} else {
+			__atomic_add_fetch(&rt.bytes, res, __ATOMIC_RELAXED);
+		}
+
+		if ((size_t) res < b->outlen)
+			pwrite_all(b->out + res, b->outlen - res, b->offset + res);
+
+		r->inflight--;
+		recycle(b);
+	}
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/* Prepare a buffer for writing, compressing it if required. */
+static void
+pack(struct buffer *b)
+{
+	if (rt.level == 0)
+		b->outlen = b->used;
+	else
+		b->outlen = loom_trace_pack(rt.lz4, b->data, b->used, b->out,
+		    rt.level);
+
+	__atomic_add_fetch(&rt.raw_bytes, b->used, __ATOMIC_RELAXED);
+}
+
+static void *
+writer_main(void *arg)
+{
+	(void) arg;
+
+	for (;;) {
+		struct buffer *batch;
+		unsigned inflight = 0;
+		int done;
+
+#ifdef HAVE_IO_URING
+		inflight = rt.ring.inflight;
+#endif
+
+		pthread_mutex_lock(&rt.lock);
+		while (rt.full == NULL && inflight == 0 && !rt.stopping)
+			pthread_cond_wait(&rt.ready, &rt.lock);
+
+		batch = rt.full;
+		rt.full = NULL;
+		rt.full_tail = &rt.full;
+
+		done = rt.stopping && batch == NULL && inflight == 0;
+		pthread_mutex_unlock(&rt.lock);
+
+		if (done)
+			break;
+
+		/*
+		 * Compress (outside the lock) and lay buffers out in the file
+		 * in the order they were handed off.
+		 */
+		for (struct buffer *b = batch; b != NULL; b = b->next) {
+			pack(b);
+			b->offset = rt.offset;
+			rt.offset += b->outlen;
+		}
+
+#ifdef HAVE_IO_URING
+		if (rt.use_uring) {
+			if (batch != NULL)
+				uring_submit_batch(&rt.ring, batch);
+
+			/* Only block on completions if there's nothing else to do. */
+			uring_reap(&rt.ring, batch == NULL);
+			continue;
+		}
+
+		/* We may have fallen back after reaping a failed write. */
+		uring_reap(&rt.ring, 1);
+#endif
+
+		if (batch != NULL)
+			pwritev_batch(batch);
+	}
+
+	return NULL;
+}
+
+
+static void thread_exit(void *);
+
+/* Open the trace: called with the runtime lock held. */
+static int
+open_locked(const char *filename)
+{
+	if (rt.state != UNOPENED) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	rt.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (rt.fd < 0)
+		return -1;
+
+	rt.nbuffers = env_size("LOOM_TRACE_BUFFERS", DEFAULT_BUFFERS);
+	rt.bufsize = env_size("LOOM_TRACE_BUFFER_SIZE", DEFAULT_BUFFER_SIZE);
+
+	size_t level = env_size("LOOM_TRACE_COMPRESS", 0);
+	rt.level = (level > LOOM_LZ4_MAX_LEVEL) ? LOOM_LZ4_MAX_LEVEL : level;
+	if (rt.bufsize > LOOM_LZ4_MAX_INPUT)
+		rt.level = 0;
+
+	rt.region = mmap(NULL, rt.nbuffers * rt.bufsize, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	rt.buffers = calloc(rt.nbuffers, sizeof(struct buffer));
+
+	if (rt.level > 0) {
+		rt.packsize = LOOM_TRACE_BLOCK_BOUND(rt.bufsize);
+		rt.packed = mmap(NULL, rt.nbuffers * rt.packsize,
+		    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		rt.lz4 = malloc(sizeof(*rt.lz4));
+	}
+
+	if (rt.region == MAP_FAILED || rt.buffers == NULL
+	    || (rt.level > 0 && (rt.packed == MAP_FAILED || rt.lz4 == NULL))) {
+		int error = errno;
+		close(rt.fd);
+		rt.fd = -1;
+		errno = error;
+		return -1;
+	}
+
+	rt.full_tail = &rt.full;
+	for (unsigned i = rt.nbuffers; i > 0; i--) {
+		struct buffer *b = rt.buffers + i - 1;
+
+		b->data = rt.region + (i - 1) * rt.bufsize;
+		b->out = rt.level ? rt.packed + (i - 1) * rt.packsize : b->data;
+		b->index = i - 1;
+		push_free_locked(b);
+	}
+
+	rt.use_uring = 0;
+#ifdef HAVE_IO_URING
+	if (getenv("LOOM_TRACE_NO_URING") == NULL)
+		rt.use_uring = (uring_init(&rt.ring) == 0);
+	else
+		rt.ring.fd = -1;
+#endif
+
+	pthread_key_create(&rt.key, thread_exit);
+	pthread_create(&rt.writer, NULL, writer_main, NULL);
+
+	__atomic_store_n(&rt.state, OPEN, __ATOMIC_SEQ_CST);
+	atexit(loom_trace_close);
+
+	return 0;
+}
+
+int
+loom_trace_open(const char *filename)
+{
+	pthread_mutex_lock(&rt.lock);
+	int ret = open_locked(filename);
+	pthread_mutex_unlock(&rt.lock);
+
+	return ret;
+}
+
+static struct thread_state *
+thread_init(void)
+{
+	struct thread_state *t;
+
+	pthread_mutex_lock(&rt.lock);
+	if (rt.state == UNOPENED) {
+		const char *filename = getenv("LOOM_TRACE_FILE");
+		if (open_locked(filename ? filename : DEFAULT_FILENAME) != 0)
+			perror("loom: unable to open trace file");
+	}
+
+	if (rt.state != OPEN) {
+		pthread_mutex_unlock(&rt.lock);
+		return NULL;
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (t != NULL) {
+		t->next = rt.threads;
+		rt.threads = t;
+		pthread_setspecific(rt.key, t);
+	}
+	pthread_mutex_unlock(&rt.lock);
+
+	return self = t;
+}
+
+/* Hand off a thread's current buffer, leaving it without one. */
+static void
+release_current(struct thread_state *t)
+{
+	__atomic_store_n(&t->busy, 1, __ATOMIC_SEQ_CST);
+	struct buffer *b = t->current;
+	t->current = NULL;
+	__atomic_store_n(&t->busy, 0, __ATOMIC_SEQ_CST);
+
+	if (b == NULL)
+		return;
+
+	pthread_mutex_lock(&rt.lock);
+	if (b->used > 0)
+		push_full_locked(b);
+	else
+		push_free_locked(b);
+	pthread_mutex_unlock(&rt.lock);
+}
+
+static void
+thread_exit(void *arg)
+{
+	struct thread_state *t = arg;
+
+	release_current(t);
+
+	pthread_mutex_lock(&rt.lock);
+	for (struct thread_state **p = &rt.threads; *p != NULL;
+	    p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+
+	rt.records += t->records;
+	__atomic_add_fetch(&rt.dropped, t->dropped, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rt.lock);
+
+	self = NULL;
+	free(t);
+}
+
+static int
+drop(struct thread_state *t)
+{
+	if (t != NULL)
+		t->dropped++;
+	else
+		__atomic_add_fetch(&rt.dropped, 1, __ATOMIC_RELAXED);
+
+	return -1;
+}
+
+int
+loom_trace_write(const void *record, size_t len)
+{
+	struct thread_state *t = self;
+	uint32_t header = len;
+	size_t need = sizeof(header) + len;
+
+	if (t == NULL && (t = thread_init()) == NULL)
+		return drop(NULL);
+
+	__atomic_store_n(&t->busy, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&rt.state, __ATOMIC_SEQ_CST) != OPEN) {
+		__atomic_store_n(&t->busy, 0, __ATOMIC_RELEASE);
+		return drop(t);
+	}
+
+	struct buffer *b = t->current;
+	if (b == NULL || b->used + need > rt.bufsize) {
+		/*
+		 * Slow path: swap buffers. We must not hold the runtime lock
+		 * while busy, so give up the current buffer first.
+		 */
+		__atomic_store_n(&t->busy, 0, __ATOMIC_RELEASE);
+		if (need > rt.bufsize)
+			return drop(t);
+
+		release_current(t);
+
+		pthread_mutex_lock(&rt.lock);
+		b = rt.free;
+		if (b != NULL)
+			rt.free = b->next;
+		pthread_mutex_unlock(&rt.lock);
+
+		if (b == NULL)
+			return drop(t);
+
+		__atomic_store_n(&t->busy, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&rt.state, __ATOMIC_SEQ_CST) != OPEN) {
+			__atomic_store_n(&t->busy, 0, __ATOMIC_RELEASE);
+
+			pthread_mutex_lock(&rt.lock);
+			push_free_locked(b);
+			pthread_mutex_unlock(&rt.lock);
+
+			return drop(t);
+		}
+
+		t->current = b;
+	}
+
+	memcpy(b->data + b->used, &header, sizeof(header));
+	memcpy(b->data + b->used + sizeof(header), record, len);
+	b->used += need;
+	t->records++;
+
+	__atomic_store_n(&t->busy, 0, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void
+loom_trace_flush(void)
+{
+	if (self != NULL)
+		release_current(self);
+}
+
+void
+loom_trace_close(void)
+{
+	pthread_mutex_lock(&rt.lock);
+	if (rt.state != OPEN) {
+		pthread_mutex_unlock(&rt.lock);
+		return;
+	}
+
+	/*
+	 * Stop accepting records, then take every thread's buffer once it
+	 * isn't in the middle of writing to it.
+	 */
+	__atomic_store_n(&rt.state, CLOSED, __ATOMIC_SEQ_CST);
+
+	for (struct thread_state *t = rt.threads; t != NULL; t = t->next) {
+		while (__atomic_load_n(&t->busy, __ATOMIC_SEQ_CST))
+			sched_yield();
+
+		struct buffer *b = t->current;
+		t->current = NULL;
+
+		if (b != NULL && b->used > 0)
+			push_full_locked(b);
+		else if (b != NULL)
+			push_free_locked(b);
+	}
+
+	while (rt.pending > 0)
+		pthread_cond_wait(&rt.idle, &rt.lock);
+
+	rt.stopping = 1;
+	pthread_cond_signal(&rt.ready);
+	pthread_mutex_unlock(&rt.lock);
+
+	pthread_join(rt.writer, NULL);
+
+#ifdef HAVE_IO_URING
+	if (rt.ring.fd >= 0)
+		uring_destroy(&rt.ring);
+#endif
+
+	close(rt.fd);
+	rt.fd = -1;
+
+	struct loom_trace_stats stats;
+	loom_trace_stats(&stats);
+	if (stats.dropped > 0)
+		fprintf(stderr, "loom: dropped %llu of %llu trace records\n",
+		    (unsigned long long) stats.dropped,
+		    (unsigned long long) (stats.records + stats.dropped));
+}
+
+void
+loom_trace_stats(struct loom_trace_stats *stats)
+{
+	pthread_mutex_lock(&rt.lock);
+
+	stats->records = rt.records;
+	stats->dropped = __atomic_load_n(&rt.dropped, __ATOMIC_RELAXED);
+	for (struct thread_state *t = rt.threads; t != NULL; t = t->next) {
+		stats->records += t->records;
+		stats->dropped += t->dropped;
+	}
+
+	stats->writes = rt.writes;
+	stats->bytes = __atomic_load_n(&rt.bytes, __ATOMIC_RELAXED);
+	stats->raw_bytes = __atomic_load_n(&rt.raw_bytes, __ATOMIC_RELAXED);
+	stats->io_uring = rt.use_uring;
+
+	pthread_mutex_unlock(&rt.lock);
+}
@@ -0,0 +1,134 @@
+//! @file Capture.cc  Definition of bounded captures of pointed-to bytes.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Capture.hh"
+
+#include <llvm/IR/Module.h>
+
+using namespace llvm;
+using namespace loom;
+
+namespace {
+
+const char *KindName(CaptureKind K) {
+  switch (K) {
+  case CaptureKind::String:
+    return "string";
+
+  case CaptureKind::Buffer:
+    return "buffer";
+  }
+}
+
+StructType *GetType(Module &Mod, CaptureKind K, uint64_t Max) {
+  const std::string Name =
+      std::string("loom.") + KindName(K) + "." + std::to_string(Max);
+
+  if (StructType *T = Mod.getTypeByName(Name))
+    return T;
+
+  LLVMContext &Ctx = Mod.getContext();
+  return StructType::create(Ctx,
+                            {Type::getInt8PtrTy(Ctx), Type::getInt64Ty(Ctx),
+                             Type::getInt1Ty(Ctx)},
+                            Name);
+}
+
+} // anonymous namespace
+
+Optional<CaptureType> loom::GetCaptureType(Type *T) {
+  auto *ST = dyn_cast<StructType>(T);
+  if (not ST or not ST->hasName())
+    return None;
+
+  StringRef Name = ST->getName();
+  if (not Name.consume_front("loom."))
+    return None;
+
+  StringRef Kind, Bound;
+  std::tie(Kind, Bound) = Name.split('.');
+
+  CaptureType Capture;
+  if (Kind == KindName(CaptureKind::String))
+    Capture.Kind = CaptureKind::String;
+  else if (Kind == KindName(CaptureKind::Buffer))
+    Capture.Kind = CaptureKind::Buffer;
+  else
+    return None;
+
+  if (Bound.getAsInteger(10, Capture.Max))
+    return None;
+
+  return Capture;
+}
+
+Value *loom::CreateCapture(CaptureKind Kind, uint64_t Max, Value *Ptr,
+                           Value *Length, IRBuilder<> &B) {
+  Module &Mod = *B.GetInsertBlock()->getModule();
+  IntegerType *Int64 = B.getInt64Ty();
+
+  Value *Bytes = B.CreatePointerCast(Ptr, B.getInt8PtrTy(), "bytes");
+  Value *Null = B.CreateIsNull(Bytes);
+
+  Value *Available;
+  if (Kind == CaptureKind::String) {
+    // Look no further than one byte past the bound: that's enough to tell
+    // whether the string is truncated. Null strings are empty.
+    IntegerType *SizeT = Mod.getDataLayout().getIntPtrType(Mod.getContext());
+    Value *Safe = B.CreateSelect(Null, B.CreateGlobalStringPtr(""), Bytes);
+    Constant *Strnlen = Mod.getOrInsertFunction(
+        "strnlen", SizeT, B.getInt8PtrTy(), SizeT);
+    Available = B.CreateZExt(
+        B.CreateCall(Strnlen, {Safe, ConstantInt::get(SizeT, Max + 1)}),
+        Int64);
+
+  } else {
+    assert(Length and "buffer captures require a length");
+    Available = B.CreateSelect(Null, B.getInt64(0),
+                               B.CreateZExtOrTrunc(Length, Int64));
+  }
+
+  Value *Truncated = B.CreateICmpUGT(Available, B.getInt64(Max));
+  Value *Len = B.CreateSelect(Truncated, B.getInt64(Max), Available);
+
+  Value *Capture = UndefValue::get(GetType(Mod, Kind, Max));
+  Capture = B.CreateInsertValue(Capture, Bytes, 0);
+  Capture = B.CreateInsertValue(Capture, Len, 1);
+  return B.CreateInsertValue(Capture, Truncated, 2, Ptr->getName());
+}
+
+Value *loom::CaptureData(Value *V, IRBuilder<> &B) {
+  return B.CreateExtractValue(V, 0);
+}
+
+Value *loom::CaptureLength(Value *V, IRBuilder<> &B) {
+  return B.CreateExtractValue(V, 1);
+}
+
+Value *loom::CaptureTruncated(Value *V, IRBuilder<> &B) {
+  return B.CreateExtractValue(V, 2);
+}
@@ -0,0 +1,82 @@
+//! @file Capture.hh  Declaration of bounded captures of pointed-to bytes.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_CAPTURE_H_
+#define LOOM_CAPTURE_H_
+
+#include <llvm/ADT/Optional.h>
+#include <llvm/IR/IRBuilder.h>
+
+namespace loom {
+
+/**
+ * How the bytes behind a captured pointer are bounded.
+ *
+ * Captured values are represented in instrumentation as `{ i8*, i64, i1 }`
+ * structures (the bytes, how many of them to record and whether that
+ * was fewer than were available) with named types like `loom.string.64`,
+ * so that loggers and serializers can recognize them and find their bounds
+ * without any other information.
+ */
+enum class CaptureKind {
+  String, //!< a NUL-terminated string
+  Buffer, //!< a buffer whose length is another value
+};
+
+//! The kind and maximum length of a capture type.
+struct CaptureType {
+  CaptureKind Kind;
+  uint64_t Max;
+};
+
+//! If a type represents a captured value, get its kind and bound.
+llvm::Optional<CaptureType> GetCaptureType(llvm::Type *);
+
+/**
+ * Generate code to capture (up to Max bytes of) a string or buffer.
+ *
+ * No bytes are copied here: loggers and serializers copy them directly
+ * into their output. A null pointer is captured as zero bytes.
+ *
+ * @param   Ptr       pointer to the string or buffer
+ * @param   Length    length of a buffer (ignored for strings)
+ */
+llvm::Value *CreateCapture(CaptureKind, uint64_t Max, llvm::Value *Ptr,
+                           llvm::Value *Length, llvm::IRBuilder<> &);
+
+//! The captured bytes (an `i8*`).
+llvm::Value *CaptureData(llvm::Value *, llvm::IRBuilder<> &);
+
+//! The number of captured bytes (an `i64` no greater than the bound).
+llvm::Value *CaptureLength(llvm::Value *, llvm::IRBuilder<> &);
+
+//! Whether more bytes were available than the bound allowed (an `i1`).
+llvm::Value *CaptureTruncated(llvm::Value *, llvm::IRBuilder<> &);
+
+} // namespace loom
+
+#endif // !LOOM_CAPTURE_H_
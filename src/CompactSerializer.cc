@@ -0,0 +1,414 @@
+//! @file CompactSerializer.cc  Definition of @ref loom::CompactSerializer.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "CompactSerializer.hh"
+#include "Capture.hh"
+#include "IRUtils.hh"
+
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+using namespace loom;
+using std::vector;
+
+namespace {
+
+/// Where to record the names and descriptions of compact-serialized events.
+cl::opt<std::string>
+    SchemaFile("loom-compact-schema",
+               cl::desc("append compact serialization schema to file"),
+               cl::value_desc("filename"), cl::init(""));
+
+/// The most bytes that a varint encoding of an N-bit value can occupy.
+unsigned VarintBytes(unsigned Bits) { return (Bits + 6) / 7; }
+
+/**
+ * Generates straight-line code that writes encoded values into a buffer,
+ * advancing a (static or dynamic) offset as it goes.
+ */
+class Encoder {
+public:
+  Encoder(IRBuilder<> &B, Value *Buffer)
+      : B(B), Buffer(Buffer), Int64(B.getInt64Ty()), Offset(B.getInt64(0)) {}
+
+  /// Write a single byte.
+  void Byte(Value *V) {
+    B.CreateStore(B.CreateTrunc(V, B.getInt8Ty()), At(0));
+    Advance(B.getInt64(1));
+  }
+
+  /// Write an integer as fixed-width, little-endian bytes.
+  void Fixed(Value *V) {
+    unsigned Bits = V->getType()->getIntegerBitWidth();
+    for (unsigned i = 0; i < Bits; i += 8) {
+      B.CreateStore(B.CreateTrunc(B.CreateLShr(V, i), B.getInt8Ty()),
+                    At(i / 8));
+    }
+    Advance(B.getInt64(Bits / 8));
+  }
+
+  /// Write an unsigned integer as a varint: 7 bits per byte, LSB first.
+  void Varint(Value *V) {
+    if (auto *C = dyn_cast<ConstantInt>(V)) {
+      uint64_t X = C->getZExtValue();
+      do {
+        uint8_t Next = X & 0x7f;
+        X >>= 7;
+        Byte(B.getInt8(Next | (X ? 0x80 : 0)));
+      } while (X);
+      return;
+    }
+
+    const unsigned Bits = V->getType()->getIntegerBitWidth();
+    const unsigned Groups = VarintBytes(Bits);
+    Value *X = B.CreateZExtOrTrunc(V, Int64);
+
+    // One byte for every (started) group of 7 significant bits, minimum one:
+    Module *M = B.GetInsertBlock()->getModule();
+    Function *Ctlz = Intrinsic::getDeclaration(M, Intrinsic::ctlz, {Int64});
+    Value *Zeros = B.CreateCall(Ctlz, {B.CreateOr(X, 1), B.getFalse()});
+    Value *Significant = B.CreateSub(B.getInt64(64), Zeros);
+    Value *Len = B.CreateUDiv(B.CreateAdd(Significant, B.getInt64(6)),
+                              B.getInt64(7));
+
+    // Write every group that could be needed: later values overwrite any
+    // bytes beyond Len, so no branches are required.
+    for (unsigned i = 0; i < Groups; i++) {
+      Value *Group = B.CreateAnd(B.CreateLShr(X, 7 * i), 0x7f);
+      if (i + 1 < Groups) {
+        Value *More = B.CreateICmpUGT(Len, B.getInt64(i + 1));
+        Group = B.CreateOr(Group, B.CreateSelect(More, B.getInt64(0x80),
+                                                 B.getInt64(0)));
+      }
+
+      B.CreateStore(B.CreateTrunc(Group, B.getInt8Ty()), At(i));
+    }
+
+    Advance(Len);
+  }
+
+  /// Copy a dynamic number of bytes.
+  void Copy(Value *Src, Value *Len) {
+    B.CreateMemCpy(At(0), 1, Src, 1, Len);
+    Advance(Len);
+  }
+
+  /// Write a signed integer as a zig-zag varint (small magnitudes are short).
+  void ZigZag(Value *V) {
+    unsigned Bits = V->getType()->getIntegerBitWidth();
+    Varint(B.CreateXor(B.CreateShl(V, 1), B.CreateAShr(V, Bits - 1)));
+  }
+
+  /// The total number of bytes written.
+  Value *Length() const { return Offset; }
+
+private:
+  Value *At(unsigned i) {
+    return B.CreateInBoundsGEP(Buffer, B.CreateAdd(Offset, B.getInt64(i)));
+  }
+
+  void Advance(Value *N) { Offset = B.CreateAdd(Offset, N); }
+
+  IRBuilder<> &B;
+  Value *Buffer;
+  IntegerType *Int64;
+  Value *Offset;
+};
+
+} // anonymous namespace
+
+CompactSerializer::CompactSerializer(Module &M)
+    : Serializer(M.getContext()), Mod(M), Int64(IntegerType::get(Ctx, 64)) {}
+
+uint32_t CompactSerializer::SiteID(StringRef Name) {
+  // 32-b FNV-1a:
+  uint32_t Hash = 2166136261u;
+  for (char c : Name) {
+    Hash ^= static_cast<uint8_t>(c);
+    Hash *= 16777619u;
+  }
+
+  return Hash;
+}
+
+Serializer::BufferInfo CompactSerializer::Serialize(StringRef Name,
+                                                    StringRef Descrip,
+                                                    ArrayRef<Value *> Values,
+                                                    IRBuilder<> &B) {
+  // Classify values and work out the largest possible record.
+  vector<TypeCode> Types;
+  vector<Value *> Bools;
+  size_t MaxSize = 4 + VarintBytes(32) + 10 + 10 + VarintBytes(32) +
+                   (Values.size() + 1) / 2;
+
+  for (Value *V : Values) {
+    Type *T = V->getType();
+
+    if (T->isIntegerTy(1)) {
+      Types.push_back(Bool);
+      Bools.push_back(V);
+
+    } else if (T->isIntegerTy() and T->getIntegerBitWidth() <= 64) {
+      Types.push_back(Int);
+      MaxSize += VarintBytes(T->getIntegerBitWidth());
+
+    } else if (T->isPointerTy()) {
+      Types.push_back(Pointer);
+      MaxSize += VarintBytes(64);
+
+    } else if (T->isFloatTy()) {
+      Types.push_back(Float);
+      MaxSize += 4;
+
+    } else if (T->isDoubleTy()) {
+      Types.push_back(Double);
+      MaxSize += 8;
+
+    } else if (auto Capture = GetCaptureType(T)) {
+      Types.push_back(Bytes);
+      MaxSize += VarintBytes(64) + Capture->Max;
+
+    } else {
+      raw_ostream &err = llvm::errs();
+      err << "WARNING: CompactSerializer doesn't support ";
+      T->print(err, true);
+      err << " (yet)\n";
+
+      Types.push_back(Unsupported);
+    }
+  }
+  MaxSize += (Bools.size() + 7) / 8;
+
+  const uint32_t ID = SiteID(Name);
+  AddToSchema(ID, Name, Descrip, Types);
+
+  // The buffer lives in the entry block so that loops don't grow the stack.
+  Function *Fn = B.GetInsertBlock()->getParent();
+  IRBuilder<> Entry(&*Fn->getEntryBlock().getFirstInsertionPt());
+  ArrayType *BufferType = ArrayType::get(Byte, MaxSize);
+  Value *Buffer = B.CreateConstInBoundsGEP2_32(
+      BufferType, Entry.CreateAlloca(BufferType, nullptr, "compact"), 0, 0);
+
+  Encoder E(B, Buffer);
+
+  // Header: site, process, thread and timestamp delta.
+  E.Fixed(B.getInt32(ID));
+  Value *Thread = B.CreateCall(ThreadNumber());
+  E.Varint(B.CreateLoad(ThreadLocal("__loom_compact_process")));
+  E.Varint(Thread);
+
+  GlobalVariable *LastTime = ThreadLocal("__loom_compact_time");
+  Value *Now = B.CreateCall(
+      Intrinsic::getDeclaration(&Mod, Intrinsic::readcyclecounter));
+  PreviousTime = B.CreateLoad(LastTime);
+  E.ZigZag(B.CreateSub(Now, PreviousTime));
+  B.CreateStore(Now, LastTime);
+
+  // Value types, packed two to a byte:
+  E.Varint(B.getInt64(Types.size()));
+  for (size_t i = 0; i < Types.size(); i += 2) {
+    uint8_t Pair = Types[i] | ((i + 1 < Types.size()) ? Types[i + 1] << 4 : 0);
+    E.Byte(B.getInt8(Pair));
+  }
+
+  // Booleans, packed eight to a byte:
+  for (size_t i = 0; i < Bools.size(); i += 8) {
+    Value *Bits = B.getInt8(0);
+    for (size_t j = i; j < Bools.size() and j < i + 8; j++) {
+      Value *Bit = B.CreateShl(B.CreateZExt(Bools[j], B.getInt8Ty()), j - i);
+      Bits = B.CreateOr(Bits, Bit);
+    }
+    E.Byte(Bits);
+  }
+
+  GlobalVariable *LastPointer = nullptr;
+  PreviousPointer = nullptr;
+
+  for (size_t i = 0; i < Values.size(); i++) {
+    Value *V = Values[i];
+
+    switch (Types[i]) {
+    case Int:
+      E.ZigZag(V);
+      break;
+
+    case Pointer: {
+      if (not LastPointer)
+        LastPointer = ThreadLocal("__loom_compact_pointer");
+
+      Value *P = B.CreatePtrToInt(V, Int64);
+      Value *Prev = B.CreateLoad(LastPointer);
+      if (not PreviousPointer)
+        PreviousPointer = Prev;
+
+      E.ZigZag(B.CreateSub(P, Prev));
+      B.CreateStore(P, LastPointer);
+      break;
+    }
+
+    case Float:
+      E.Fixed(B.CreateBitCast(V, B.getInt32Ty()));
+      break;
+
+    case Double:
+      E.Fixed(B.CreateBitCast(V, Int64));
+      break;
+
+    case Bytes: {
+      Value *Len = CaptureLength(V, B);
+      Value *Truncated = B.CreateZExt(CaptureTruncated(V, B), Int64);
+      E.Varint(B.CreateOr(B.CreateShl(Len, 1), Truncated));
+      E.Copy(CaptureData(V, B), Len);
+      break;
+    }
+
+    case Bool:
+    case Unsupported:
+      break;
+    }
+  }
+
+  return {Buffer, E.Length()};
+}
+
+void CompactSerializer::Written(BufferInfo &, Value *Written,
+                                IRBuilder<> &B) {
+  // Timestamps and pointers are encoded as deltas from the last ones that
+  // the decoder saw: if this record was dropped, later records must be
+  // encoded against the thread's previous values, not this record's.
+  auto Restore = [&](StringRef Name, Value *Previous) {
+    GlobalVariable *GV = ThreadLocal(Name);
+    B.CreateStore(B.CreateSelect(Written, B.CreateLoad(GV), Previous), GV);
+  };
+
+  Restore("__loom_compact_time", PreviousTime);
+  if (PreviousPointer)
+    Restore("__loom_compact_pointer", PreviousPointer);
+}
+
+Value *CompactSerializer::Cleanup(BufferInfo &, IRBuilder<> &B) {
+  // The buffer is on the stack: nothing to clean up.
+  auto *False = ConstantInt::getFalse(Ctx);
+  return B.CreateXor(False, False);
+}
+
+GlobalVariable *CompactSerializer::ThreadLocal(StringRef Name) {
+  if (GlobalVariable *GV = Mod.getGlobalVariable(Name))
+    return GV;
+
+  // Shared between instrumented modules, so that deltas are computed
+  // against the thread's previous record, wherever it came from.
+  auto *GV = new GlobalVariable(Mod, Int64, false,
+                                GlobalValue::LinkOnceODRLinkage,
+                                ConstantInt::get(Int64, 0), Name, nullptr,
+                                GlobalValue::GeneralDynamicTLSModel);
+  GV->setVisibility(GlobalValue::HiddenVisibility);
+
+  return GV;
+}
+
+Function *CompactSerializer::ThreadNumber() {
+  const char *Name = "__loom_compact_thread";
+  if (Function *F = Mod.getFunction(Name))
+    return F;
+
+  auto *F = Function::Create(FunctionType::get(Int64, false),
+                             GlobalValue::LinkOnceODRLinkage, Name, &Mod);
+  F->setVisibility(GlobalValue::HiddenVisibility);
+
+  GlobalVariable *Number = ThreadLocal("__loom_compact_thread_number");
+  GlobalVariable *Process = ThreadLocal("__loom_compact_process");
+  GlobalVariable *Count = Mod.getGlobalVariable("__loom_compact_threads");
+  if (not Count) {
+    Count = new GlobalVariable(Mod, Int64, false,
+                               GlobalValue::LinkOnceODRLinkage,
+                               ConstantInt::get(Int64, 0),
+                               "__loom_compact_threads");
+    Count->setVisibility(GlobalValue::HiddenVisibility);
+  }
+
+  // Threads are numbered the first time that they log anything (or the
+  // first time after a fork, since their numbers are per-process).
+  auto *Entry = BasicBlock::Create(Ctx, "entry", F);
+  auto *Assign = BasicBlock::Create(Ctx, "assign", F);
+  auto *Done = BasicBlock::Create(Ctx, "done", F);
+
+  IRBuilder<> B(Entry);
+  Value *N = B.CreateLoad(Number);
+  B.CreateCondBr(B.CreateICmpEQ(N, ConstantInt::get(Int64, 0)), Assign, Done);
+
+  B.SetInsertPoint(Done);
+  B.CreateRet(N);
+
+  B.SetInsertPoint(Assign);
+  Value *Prev = B.CreateAtomicRMW(AtomicRMWInst::Add, Count,
+                                  ConstantInt::get(Int64, 1),
+                                  AtomicOrdering::Monotonic);
+  Value *Next = B.CreateAdd(Prev, ConstantInt::get(Int64, 1));
+  B.CreateStore(Next, Number);
+
+  // Several processes can write to the same trace (e.g., a shared memory
+  // ring), so threads are identified by process as well as number.
+  Constant *GetPID = Mod.getOrInsertFunction(
+      "getpid", FunctionType::get(B.getInt32Ty(), false));
+  B.CreateStore(B.CreateZExt(B.CreateCall(GetPID), Int64), Process);
+  B.CreateRet(Next);
+
+  // A forked child is a new process: its thread must be numbered again and
+  // its timestamps and pointers mustn't be deltas from its parent's.
+  for (StringRef Name : {"__loom_compact_thread_number", "__loom_compact_time",
+                         "__loom_compact_pointer"}) {
+    ClearAfterFork(Mod, ThreadLocal(Name));
+  }
+
+  return F;
+}
+
+void CompactSerializer::AddToSchema(uint32_t ID, StringRef Name,
+                                    StringRef Descrip,
+                                    ArrayRef<TypeCode> Types) {
+  if (SchemaFile.empty() or not Schema.insert(ID).second)
+    return;
+
+  std::error_code EC;
+  raw_fd_ostream Out(SchemaFile, EC, sys::fs::F_Append | sys::fs::F_Text);
+  if (EC) {
+    errs() << "Error opening '" << SchemaFile << "': " << EC.message() << "\n";
+    return;
+  }
+
+  // One event per line: ID, name, types and description (tab-separated).
+  Out << format("%08x", ID) << "\t" << Name << "\t";
+  for (TypeCode T : Types)
+    Out << static_cast<unsigned>(T);
+  Out << "\t" << Descrip << "\n";
+}
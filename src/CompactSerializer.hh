@@ -0,0 +1,121 @@
+//! @file CompactSerializer.hh  Declaration of @ref loom::CompactSerializer.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_COMPACT_SERIALIZER_H_
+#define LOOM_COMPACT_SERIALIZER_H_
+
+#include "Serializer.hh"
+
+#include <llvm/ADT/DenseSet.h>
+
+namespace llvm {
+class Function;
+class GlobalVariable;
+class Module;
+} // namespace llvm
+
+namespace loom {
+
+/**
+ * A Serializer that packs values into a compact, varint-based encoding.
+ *
+ * Each record is encoded by straight-line code at its instrumentation point
+ * into a stack buffer:
+ *
+ *  - site ID       4 B, little-endian: FNV-1a hash of the event's name
+ *  - process       varint: ID of the process that logged the event
+ *  - thread        varint: small per-thread number (from 1, per process)
+ *  - timestamp     zig-zag varint: cycle counter delta from the thread's
+ *                  previous (written) record
+ *  - count         varint: number of values
+ *  - types         one 4-bit type code per value (low nibble first)
+ *  - booleans      one bit per boolean value (LSB first)
+ *  - values        in order (booleans excepted):
+ *                   - integers: zig-zag varint
+ *                   - pointers: zig-zag varint delta from the thread's
+ *                     previous pointer value
+ *                   - float/double: 4/8 B, little-endian
+ *                   - captured strings/buffers: varint (length << 1 |
+ *                     truncated), then the (bounded) bytes, copied straight
+ *                     from their source
+ *
+ * The matching decoder is in the runtime library (`loom-compact.h`) and the
+ * `loom-decode` tool. Event names and descriptions aren't in the records:
+ * they can be written to a schema file with `-loom-compact-schema`.
+ */
+class CompactSerializer : public Serializer {
+public:
+  //! Type codes for serialized values (see `loom-compact.h`).
+  enum TypeCode {
+    Int = 1,
+    Bool = 2,
+    Pointer = 3,
+    Float = 4,
+    Double = 5,
+    Unsupported = 6,
+    Bytes = 7,
+  };
+
+  CompactSerializer(llvm::Module &);
+
+  virtual llvm::StringRef SchemeName() const override { return "compact"; }
+
+  virtual BufferInfo Serialize(llvm::StringRef Name, llvm::StringRef Descrip,
+                               llvm::ArrayRef<llvm::Value *>,
+                               llvm::IRBuilder<> &) override;
+
+  virtual void Written(BufferInfo &, llvm::Value *Written,
+                       llvm::IRBuilder<> &) override;
+
+  virtual llvm::Value *Cleanup(BufferInfo &, llvm::IRBuilder<> &) override;
+
+  //! The ID of an event (as used in records and the schema).
+  static uint32_t SiteID(llvm::StringRef Name);
+
+private:
+  //! Get (or create) a zero-initialized, thread-local i64 shared by modules.
+  llvm::GlobalVariable *ThreadLocal(llvm::StringRef Name);
+
+  //! Get (or create) the function that returns the current thread's number.
+  llvm::Function *ThreadNumber();
+
+  //! Record an event in the schema file (if any).
+  void AddToSchema(uint32_t ID, llvm::StringRef Name, llvm::StringRef Descrip,
+                   llvm::ArrayRef<TypeCode>);
+
+  llvm::Module &Mod;
+  llvm::IntegerType *Int64;
+  llvm::DenseSet<uint32_t> Schema;
+
+  //! The thread's timestamp and pointer before the last Serialize() call.
+  llvm::Value *PreviousTime = nullptr;
+  llvm::Value *PreviousPointer = nullptr;
+};
+
+} // namespace loom
+
+#endif // !LOOM_COMPACT_SERIALIZER_H_
@@ -31,6 +31,7 @@
  */
 
 #include "DTraceLogger.hh"
+#include "Capture.hh"
 
 #include <algorithm>
 
@@ -49,7 +50,10 @@ DTraceLogger::DTraceLogger(llvm::Module& Mod)
 Value* DTraceLogger::ConvertValueToPtr(IRBuilder<>& B, LLVMContext& Ctx, Value* V, Type* param_t)
 {
 	Type *T = V->getType();
-	if (T->isPointerTy()) {
+	if (GetCaptureType(T)) {
+		// DTrace copies in strings and buffers itself (copyinstr, etc.).
+		return B.CreatePtrToInt(CaptureData(V, B), param_t);
+	} else if (T->isPointerTy()) {
 		return  B.CreatePtrToInt(V, param_t);
 	} else if (T->isIntegerTy()) {
 		return B.CreateSExt(V, param_t);
@@ -94,21 +98,8 @@ Value* DTraceLogger::Log(Instruction *I, ArrayRef<Value*> Values,
   args[0] = B.CreateSExt(ConstantInt::get(id_t, Metadata.Id), param_t);;
   for (int i = 0; i < n_args; i++)
   {
-    Value *ptr;
-
-	Transform Tf;
-	for (auto t: Transforms) {
-		if (t.Arg == i)
-			Tf = t;
-			break;
-	}
-
-	if (Tf.isValid()) {
-		ptr = ConvertValueToPtr(B, Ctx, Tf.CreateTransform(I, Mod, Values[i]), param_t);
-	} else {
-		ptr = ConvertValueToPtr(B, Ctx, Values[i], param_t);
-	}
-	
+    // Transforms (e.g., GetUUID) have already been applied to Values.
+    Value *ptr = ConvertValueToPtr(B, Ctx, Values[i], param_t);
     args[i + 1] = ptr;
   }
 
@@ -40,6 +40,7 @@
 
 #include "DebugInfo.hh"
 
+#include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Module.h>
@@ -67,14 +68,25 @@ DebugInfo::DebugInfo(llvm::Module &M)
     for (auto &Use : DbgValue->uses()) {
       auto *Dbg = dyn_cast<DbgValueInst>(Use.getUser());
       assert(Dbg && "call to llvm.dbg.value must be a DbgValueInst");
+      if (Value *V = Dbg->getValue()) {
+        DbgValues[V].push_back(Dbg->getVariable());
+      }
+    }
+  }
+
+  DebugInfoFinder Finder;
+  Finder.processModule(Mod);
+
+  for (DIType *T : Finder.types()) {
+    auto *CT = dyn_cast<DICompositeType>(T);
+    if (CT and CT->getTag() == dwarf::DW_TAG_structure_type and
+        not CT->isForwardDecl() and not CT->getName().empty()) {
+      StructTypes.insert({CT->getName(), CT});
     }
   }
 }
 
 bool DebugInfo::ModuleHasFullDebugInfo() const {
-  if (not DbgDeclare)
-    return false;
-
   auto *ModuleMetadata = Mod.getNamedMetadata("llvm.dbg.cu");
   if (not ModuleMetadata)
     return false;
@@ -82,13 +94,118 @@ bool DebugInfo::ModuleHasFullDebugInfo() const {
   if (auto *DI = Get<DICompileUnit>(ModuleMetadata)) {
     constexpr auto FullDebug = DICompileUnit::DebugEmissionKind::FullDebug;
 
-    return DI->getEmissionKind() == FullDebug and not DI->isOptimized();
+    return DI->getEmissionKind() == FullDebug;
+  }
+
+  return false;
+}
+
+bool loom::IsUnsigned(const DIType *T) {
+  while (auto *DT = dyn_cast_or_null<DIDerivedType>(T)) {
+    switch (DT->getTag()) {
+    case dwarf::DW_TAG_typedef:
+    case dwarf::DW_TAG_const_type:
+    case dwarf::DW_TAG_volatile_type:
+    case dwarf::DW_TAG_atomic_type:
+      T = dyn_cast_or_null<DIType>(DT->getBaseType());
+      continue;
+    }
+    return false;
+  }
+
+  auto *BT = dyn_cast_or_null<DIBasicType>(T);
+  if (not BT) {
+    return false;
+  }
+
+  switch (BT->getEncoding()) {
+  case dwarf::DW_ATE_boolean:
+  case dwarf::DW_ATE_unsigned:
+  case dwarf::DW_ATE_unsigned_char:
+    return true;
   }
 
   return false;
 }
 
+const DIDerivedType *DebugInfo::Member(StructType *ST, unsigned Index) {
+  if (not ST->hasName() or ST->isOpaque())
+    return nullptr;
+
+  // LLVM names structures `struct.foo`, or `struct.foo.123` to disambiguate
+  // identically-named types from different translation units.
+  StringRef Name = ST->getName();
+  Name.consume_front("struct.");
+
+  auto i = StructTypes.find(Name);
+  if (i == StructTypes.end()) {
+    StringRef Prefix, Suffix;
+    std::tie(Prefix, Suffix) = Name.rsplit('.');
+
+    unsigned N;
+    if (not Suffix.empty() and not Suffix.getAsInteger(10, N)) {
+      i = StructTypes.find(Prefix);
+    }
+  }
+
+  if (i == StructTypes.end())
+    return nullptr;
+
+  const DataLayout &DL = Mod.getDataLayout();
+  const uint64_t Offset =
+      DL.getStructLayout(ST)->getElementOffsetInBits(Index);
+
+  for (auto *Element : i->second->getElements()) {
+    auto *Member = dyn_cast<DIDerivedType>(Element);
+    if (Member and Member->getTag() == dwarf::DW_TAG_member and
+        not Member->isBitField() and Member->getOffsetInBits() == Offset) {
+      return Member;
+    }
+  }
+
+  return nullptr;
+}
+
+std::string DebugInfo::FieldName(StructType *ST, unsigned Index) {
+  const DIDerivedType *M = Member(ST, Index);
+  return M ? M->getName().str() : "";
+}
+
+const DIType *DebugInfo::ElementType(GetElementPtrInst *GEP) {
+  auto *ST = dyn_cast<StructType>(GEP->getSourceElementType());
+  if (ST and GEP->getNumIndices() == 2) {
+    if (auto *Index = dyn_cast<ConstantInt>(GEP->idx_begin()[1])) {
+      const DIDerivedType *M = Member(ST, Index->getZExtValue());
+      return M ? dyn_cast_or_null<DIType>(M->getBaseType()) : nullptr;
+    }
+  }
+
+  // An element of a global array (or the global itself).
+  auto *G = dyn_cast<GlobalVariable>(GEP->getPointerOperand());
+  const DIVariable *Var = G ? GetGlobalDIVariable(G) : nullptr;
+  if (not Var)
+    return nullptr;
+
+  const DIType *T = dyn_cast_or_null<DIType>(Var->getType());
+  while (auto *CT = dyn_cast_or_null<DICompositeType>(T)) {
+    if (CT->getTag() != dwarf::DW_TAG_array_type)
+      break;
+    T = dyn_cast_or_null<DIType>(CT->getBaseType());
+  }
+
+  return T;
+}
+
 std::string DebugInfo::FieldName(GetElementPtrInst *GEP) {
+  auto *ST = dyn_cast<StructType>(GEP->getSourceElementType());
+  if (ST and GEP->getNumIndices() == 2) {
+    if (auto *Index = dyn_cast<ConstantInt>(GEP->idx_begin()[1])) {
+      std::string Name = FieldName(ST, Index->getZExtValue());
+      if (not Name.empty())
+        return Name;
+    }
+  }
+
   // Trace back to a variable with debug metadata.
   SmallVector<size_t, 4> GEPOffsets;
   const DIVariable *Var = Trace(GEP, GEPOffsets);
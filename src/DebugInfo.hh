@@ -41,6 +41,7 @@
 #ifndef LOOM_DEBUG_INFO_H
 #define LOOM_DEBUG_INFO_H
 
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Instruction.h>
@@ -50,6 +51,7 @@
 
 namespace llvm {
 class GetElementPtrInst;
+class StructType;
 }
 
 namespace loom {
@@ -66,11 +68,44 @@ public:
 
   DebugInfo(llvm::Module &);
 
+  /**
+   * Does the module have full debug information (optimized or not)?
+   *
+   * Optimized modules describe most local variables with `llvm.dbg.value`
+   * rather than `llvm.dbg.declare`, but field names can still be found
+   * from structure types (see FieldName).
+   */
   bool ModuleHasFullDebugInfo() const;
 
-  /// Find the name of a field being looked up by a GetElementPtrInst.
+  /**
+   * Find the name of a field being looked up by a GetElementPtrInst.
+   *
+   * The field is first looked up by its structure type and byte offset;
+   * failing that, the GEP is traced back to a variable with debug metadata.
+   */
   std::string FieldName(llvm::GetElementPtrInst *);
 
+  /**
+   * Find the name of a structure field from the structure's debug type,
+   * matching the field's offset (according to the module's data layout)
+   * against DWARF member offsets. This doesn't depend on how the structure
+   * was reached, so it works in optimized code.
+   *
+   * @returns the field name, or an empty string if it can't be found
+   *          (e.g., the structure has no debug type or the field is a
+   *          bitfield)
+   */
+  std::string FieldName(llvm::StructType *, unsigned Index);
+
+  /**
+   * Find the source-level type of the element a GetElementPtrInst points
+   * at: a structure field (looked up as in FieldName) or an element of a
+   * global array.
+   *
+   * @returns the element's debug type, or nullptr if it can't be found
+   */
+  const llvm::DIType *ElementType(llvm::GetElementPtrInst *);
+
   template <class DebugType = llvm::Metadata>
   const DebugType *Get(llvm::NamedMDNode *Node) const {
     for (auto *MD : Node->operands()) {
@@ -104,14 +139,14 @@ public:
       }
     }
 
-    /* auto j = DbgValues.find(V);
+    auto j = DbgValues.find(V);
     if (j != DbgValues.end()) {
       for (auto *MD : j->second) {
         if (auto *DebugInfo = llvm::dyn_cast<DebugType>(MD)) {
           return DebugInfo;
         }
       }
-    } // */
+    }
 
     return nullptr;
   }
@@ -141,6 +176,9 @@ public:
   }
 
 private:
+  /// Find the DWARF member at a structure field's offset (see FieldName).
+  const llvm::DIDerivedType *Member(llvm::StructType *, unsigned Index);
+
   /**
    * Trace from a GetElementPtrInst representing a structure field lookup
    * back to a variable that has a DIVariable debug metadata node.
@@ -171,8 +209,18 @@ private:
   /// Declarations of metadata, i.e., metadata from `@llvm.db.value()` calls.
   llvm::ValueMap<llvm::Value *, llvm::SmallVector<llvm::Metadata *, 4>>
       DbgValues;
+
+  /// Structure types with debug information, by (source-level) name.
+  llvm::StringMap<const llvm::DICompositeType *> StructTypes;
 };
 
+/**
+ * Is a source-level type an unsigned integer (or boolean)?
+ *
+ * Typedefs and const/volatile/atomic qualifiers are looked through.
+ */
+bool IsUnsigned(const llvm::DIType *);
+
 } // namespace loom
 
 #endif // LOOM_DEBUG_INFO_H
@@ -0,0 +1,507 @@
+//! @file Filter.cc  Definition of @ref loom::Filter.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Filter.hh"
+#include "DebugInfo.hh"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+using namespace loom;
+using std::string;
+using std::unique_ptr;
+
+//! A node in a filter's expression tree.
+struct Filter::Node {
+  enum class Kind {
+    Int,   //!< integer literal
+    Float, //!< floating-point literal
+    Null,  //!< null pointer
+    Name,  //!< named value (argument, return value, etc.)
+    Not,   //!< logical negation
+    Binary //!< binary operator
+  };
+
+  Node(Kind K) : K(K) {}
+
+  Kind K;
+  int64_t Int = 0;
+  double Float = 0;
+  string Text; //!< name or operator
+  unique_ptr<Node> LHS, RHS;
+};
+
+namespace {
+
+//! A recursive-descent parser for filter expressions.
+class Parser {
+public:
+  Parser(StringRef Expr) : Rest(Expr) {}
+
+  unique_ptr<Filter::Node> Parse() {
+    unique_ptr<Filter::Node> N = Or();
+    if (N and not Skip().empty()) {
+      Fail("unexpected '" + Rest.str() + "'");
+      N.reset();
+    }
+    return N;
+  }
+
+  string Error;
+
+private:
+  using Node = Filter::Node;
+  using NodePtr = unique_ptr<Node>;
+
+  StringRef Skip() { return Rest = Rest.ltrim(); }
+
+  bool Accept(StringRef Token) {
+    if (not Skip().startswith(Token)) {
+      return false;
+    }
+
+    // Don't mistake '&&' for '&' or '<=' for '<', etc.
+    StringRef After = Rest.drop_front(Token.size());
+    if (Token == "&" and After.startswith("&")) {
+      return false;
+    }
+    if ((Token == "<" or Token == ">" or Token == "!") and
+        After.startswith("=")) {
+      return false;
+    }
+
+    Rest = After;
+    return true;
+  }
+
+  NodePtr Fail(const Twine &Message) {
+    if (Error.empty()) {
+      Error = Message.str();
+    }
+    return nullptr;
+  }
+
+  NodePtr Binary(StringRef Op, NodePtr LHS, NodePtr RHS) {
+    if (not LHS or not RHS) {
+      return nullptr;
+    }
+
+    auto N = NodePtr(new Node(Node::Kind::Binary));
+    N->Text = Op;
+    N->LHS = std::move(LHS);
+    N->RHS = std::move(RHS);
+    return N;
+  }
+
+  // or := and ('||' and)*
+  NodePtr Or() {
+    NodePtr N = And();
+    while (N and Accept("||")) {
+      N = Binary("||", std::move(N), And());
+    }
+    return N;
+  }
+
+  // and := comparison ('&&' comparison)*
+  NodePtr And() {
+    NodePtr N = Comparison();
+    while (N and Accept("&&")) {
+      N = Binary("&&", std::move(N), Comparison());
+    }
+    return N;
+  }
+
+  // comparison := bits (('==' | '!=' | '<=' | '>=' | '<' | '>') bits)?
+  NodePtr Comparison() {
+    NodePtr N = Bits();
+    if (not N) {
+      return N;
+    }
+
+    for (StringRef Op : {"==", "!=", "<=", ">=", "<", ">"}) {
+      if (Accept(Op)) {
+        return Binary(Op, std::move(N), Bits());
+      }
+    }
+
+    return N;
+  }
+
+  // bits := unary ('&' unary)*
+  NodePtr Bits() {
+    NodePtr N = Unary();
+    while (N and Accept("&")) {
+      N = Binary("&", std::move(N), Unary());
+    }
+    return N;
+  }
+
+  // unary := '!' unary | '(' or ')' | name | number
+  NodePtr Unary() {
+    if (Accept("!")) {
+      NodePtr Operand = Unary();
+      if (not Operand) {
+        return nullptr;
+      }
+
+      auto N = NodePtr(new Node(Node::Kind::Not));
+      N->LHS = std::move(Operand);
+      return N;
+    }
+
+    if (Accept("(")) {
+      NodePtr N = Or();
+      if (N and not Accept(")")) {
+        return Fail("expected ')'");
+      }
+      return N;
+    }
+
+    if (Skip().empty()) {
+      return Fail("unexpected end of expression");
+    }
+
+    if (isDigit(Rest[0]) or Rest[0] == '-') {
+      return Number();
+    }
+
+    if (isAlpha(Rest[0]) or Rest[0] == '_') {
+      size_t Len = Rest.find_if_not(
+          [](char C) { return isAlnum(C) or C == '_'; });
+      StringRef Name = Rest.take_front(Len);
+      Rest = Rest.drop_front(Name.size());
+
+      if (Name == "null") {
+        return NodePtr(new Node(Node::Kind::Null));
+      }
+
+      auto N = NodePtr(new Node(Node::Kind::Int));
+      if (Name == "true" or Name == "false") {
+        N->Int = (Name == "true");
+      } else {
+        N->K = Node::Kind::Name;
+        N->Text = Name;
+      }
+      return N;
+    }
+
+    return Fail("unexpected '" + Rest.str() + "'");
+  }
+
+  // number := '-'? (decimal | hex | float) ('K' | 'M' | 'G')? 'B'?
+  NodePtr Number() {
+    const bool Negative = Rest.startswith("-");
+    size_t Len = Rest.find_if_not([](char C) { return isAlnum(C) or C == '.'; },
+                                  Negative ? 1 : 0);
+    StringRef Literal = Rest.take_front(Len);
+    Rest = Rest.drop_front(Literal.size());
+
+    StringRef Digits = Literal.drop_front(Negative ? 1 : 0);
+    int64_t Scale = 1;
+    if (not (Digits.startswith("0x") or Digits.startswith("0X"))) {
+      Digits.consume_back("B");
+      if (Digits.consume_back("K")) {
+        Scale = 1LL << 10;
+      } else if (Digits.consume_back("M")) {
+        Scale = 1LL << 20;
+      } else if (Digits.consume_back("G")) {
+        Scale = 1LL << 30;
+      }
+    }
+
+    auto N = NodePtr(new Node(Node::Kind::Int));
+    uint64_t Int;
+    if (not Digits.getAsInteger(0, Int)) {
+      N->Int = static_cast<int64_t>(Int) * Scale * (Negative ? -1 : 1);
+      return N;
+    }
+
+    if (Digits.find('.') != StringRef::npos and Scale == 1 and
+        not Digits.getAsDouble(N->Float)) {
+      N->K = Node::Kind::Float;
+      N->Float *= (Negative ? -1 : 1);
+      return N;
+    }
+
+    return Fail("invalid number '" + Literal + "'");
+  }
+
+  StringRef Rest;
+};
+
+/// Convert a value to a form that can be compared: i64 or double.
+Value *Widen(IRBuilder<> &B, Value *V, bool Unsigned) {
+  Type *T = V->getType();
+
+  if (T->isFloatingPointTy()) {
+    return T->isDoubleTy() ? V : B.CreateFPCast(V, B.getDoubleTy());
+  }
+
+  if (T->isPointerTy()) {
+    return B.CreatePtrToInt(V, B.getInt64Ty());
+  }
+
+  if (T->isIntegerTy(1) or (T->isIntegerTy() and Unsigned)) {
+    return B.CreateZExtOrTrunc(V, B.getInt64Ty());
+  }
+
+  if (T->isIntegerTy()) {
+    return B.CreateSExtOrTrunc(V, B.getInt64Ty());
+  }
+
+  return nullptr;
+}
+
+/// Convert a widened value to a truth value (i1).
+Value *Truth(IRBuilder<> &B, Value *V) {
+  if (V->getType()->isIntegerTy(1)) {
+    return V;
+  }
+
+  if (V->getType()->isDoubleTy()) {
+    return B.CreateFCmpUNE(V, ConstantFP::get(V->getType(), 0));
+  }
+
+  return B.CreateICmpNE(V, ConstantInt::get(V->getType(), 0));
+}
+
+/// A compiled operand: an i1, i64 or double and whether it's unsigned.
+struct Operand {
+  Operand(Value *V = nullptr, bool Unsigned = false)
+      : V(V), Unsigned(Unsigned) {}
+
+  Value *V;
+  bool Unsigned;
+};
+
+class Compiler {
+public:
+  Compiler(IRBuilder<> &B, ArrayRef<Parameter> Params,
+           ArrayRef<Value *> Values, const DISubroutineType *Signature)
+      : B(B), Params(Params), Values(Values), Signature(Signature) {}
+
+  /// Compile a node into an i1, i64 or double (null on error).
+  Operand Compile(const Filter::Node &N) {
+    using Kind = Filter::Node::Kind;
+
+    switch (N.K) {
+    case Kind::Int:
+      return B.getInt64(N.Int);
+
+    case Kind::Float:
+      return ConstantFP::get(B.getDoubleTy(), N.Float);
+
+    case Kind::Null:
+      return {B.getInt64(0), true};
+
+    case Kind::Name:
+      return Lookup(N.Text);
+
+    case Kind::Not:
+      if (Value *V = Compile(*N.LHS).V) {
+        return {B.CreateNot(Truth(B, V)), true};
+      }
+      return {};
+
+    case Kind::Binary:
+      break;
+    }
+
+    Operand L = Compile(*N.LHS);
+    Operand R = Compile(*N.RHS);
+    if (not L.V or not R.V) {
+      return {};
+    }
+
+    if (N.Text == "&&") {
+      return {B.CreateAnd(Truth(B, L.V), Truth(B, R.V)), true};
+    }
+
+    if (N.Text == "||") {
+      return {B.CreateOr(Truth(B, L.V), Truth(B, R.V)), true};
+    }
+
+    if (L.V->getType()->isIntegerTy(1)) {
+      L.V = B.CreateZExt(L.V, B.getInt64Ty());
+    }
+    if (R.V->getType()->isIntegerTy(1)) {
+      R.V = B.CreateZExt(R.V, B.getInt64Ty());
+    }
+
+    // As in C, if either side is unsigned, so is the operation.
+    const bool Unsigned = L.Unsigned or R.Unsigned;
+
+    if (N.Text == "&") {
+      if (not L.V->getType()->isIntegerTy() or
+          not R.V->getType()->isIntegerTy()) {
+        errs() << "Warning: filter applies '&' to a floating-point value\n";
+        return {};
+      }
+      return {B.CreateAnd(L.V, R.V), Unsigned};
+    }
+
+    // Compare as doubles if either side is floating-point.
+    if (L.V->getType()->isDoubleTy() or R.V->getType()->isDoubleTy()) {
+      for (Operand *O : {&L, &R}) {
+        if (O->V->getType()->isIntegerTy()) {
+          O->V = O->Unsigned ? B.CreateUIToFP(O->V, B.getDoubleTy())
+                             : B.CreateSIToFP(O->V, B.getDoubleTy());
+        }
+      }
+
+      auto Pred = StringSwitch<CmpInst::Predicate>(N.Text)
+                      .Case("==", CmpInst::FCMP_OEQ)
+                      .Case("!=", CmpInst::FCMP_UNE)
+                      .Case("<", CmpInst::FCMP_OLT)
+                      .Case("<=", CmpInst::FCMP_OLE)
+                      .Case(">", CmpInst::FCMP_OGT)
+                      .Default(CmpInst::FCMP_OGE);
+
+      return {B.CreateFCmp(Pred, L.V, R.V), true};
+    }
+
+    auto Pred = StringSwitch<CmpInst::Predicate>(N.Text)
+                    .Case("==", CmpInst::ICMP_EQ)
+                    .Case("!=", CmpInst::ICMP_NE)
+                    .Case("<", Unsigned ? CmpInst::ICMP_ULT : CmpInst::ICMP_SLT)
+                    .Case("<=", Unsigned ? CmpInst::ICMP_ULE : CmpInst::ICMP_SLE)
+                    .Case(">", Unsigned ? CmpInst::ICMP_UGT : CmpInst::ICMP_SGT)
+                    .Default(Unsigned ? CmpInst::ICMP_UGE : CmpInst::ICMP_SGE);
+
+    return {B.CreateICmp(Pred, L.V, R.V), true};
+  }
+
+private:
+  /// Find a named value: a parameter name or argN.
+  Operand Lookup(StringRef Name) {
+    for (size_t i = 0; i < Params.size(); i++) {
+      if (Params[i].first == Name) {
+        return Get(i, Name);
+      }
+    }
+
+    // Arguments can also be referred to by position.
+    unsigned Index;
+    if (Name.startswith("arg") and not Name.substr(3).getAsInteger(10, Index)) {
+      if (FirstArgument() + Index < Params.size()) {
+        return Get(FirstArgument() + Index, Name);
+      }
+    }
+
+    errs() << "Warning: filter refers to unknown value '" << Name << "'\n";
+    return {};
+  }
+
+  /// The index of the first argument, skipping any leading return value
+  /// or call target.
+  size_t FirstArgument() const {
+    size_t First = 0;
+    while (First < Params.size() and
+           (Params[First].first == "retval" or
+            Params[First].first == "target")) {
+      First++;
+    }
+    return First;
+  }
+
+  /// Is the i'th value an unsigned integer in the source language?
+  ///
+  /// Pointers and booleans always are; other integers are only known to
+  /// be unsigned if the probed function's debug info says so.
+  bool Unsigned(size_t i) const {
+    Type *T = Values[i]->getType();
+    if (T->isPointerTy() or T->isIntegerTy(1)) {
+      return true;
+    }
+
+    if (not Signature) {
+      return false;
+    }
+
+    // The signature's types are the return type followed by the arguments.
+    auto Types = Signature->getTypeArray();
+    size_t Index;
+    if (Params[i].first == "retval") {
+      Index = 0;
+    } else if (i >= FirstArgument()) {
+      Index = i - FirstArgument() + 1;
+    } else {
+      return false;
+    }
+
+    return Index < Types.size() and
+           IsUnsigned(dyn_cast_or_null<DIType>(Types[Index]));
+  }
+
+  Operand Get(size_t i, StringRef Name) {
+    if (i >= Values.size() or not Values[i]) {
+      return {};
+    }
+
+    const bool U = Unsigned(i);
+    Value *V = Widen(B, Values[i], U);
+    if (not V) {
+      errs() << "Warning: filter value '" << Name
+             << "' is not a number or pointer\n";
+    }
+    return {V, U};
+  }
+
+  IRBuilder<> &B;
+  ArrayRef<Parameter> Params;
+  ArrayRef<Value *> Values;
+  const DISubroutineType *Signature;
+};
+
+} // anonymous namespace
+
+Filter::Filter(StringRef Expr, unique_ptr<Node> Root)
+    : Expr(Expr), Root(std::move(Root)) {}
+
+Filter::~Filter() {}
+
+unique_ptr<Filter> Filter::Parse(StringRef Expr, string &Error) {
+  Parser P(Expr);
+  unique_ptr<Node> Root = P.Parse();
+  if (not Root) {
+    Error = P.Error;
+    return nullptr;
+  }
+
+  return unique_ptr<Filter>(new Filter(Expr, std::move(Root)));
+}
+
+Value *Filter::Compile(IRBuilder<> &B, ArrayRef<Parameter> Params,
+                       ArrayRef<Value *> Values,
+                       const DISubroutineType *Signature) const {
+  Value *V = Compiler(B, Params, Values, Signature).Compile(*Root).V;
+  return V ? Truth(B, V) : nullptr;
+}
@@ -0,0 +1,106 @@
+//! @file Filter.hh  Declaration of @ref loom::Filter.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_FILTER_H_
+#define LOOM_FILTER_H_
+
+#include "IRUtils.hh"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/IRBuilder.h>
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+class DISubroutineType;
+}
+
+namespace loom {
+
+/**
+ * A predicate over an event's values that decides whether it is logged.
+ *
+ * Filters are written in a small expression language (e.g.,
+ * `size > 1MB && fd != 3`) whose operands are:
+ *
+ *  - values named after the instrumentation's parameters (function argument
+ *    names, `retval`, a field's `value`, etc.)
+ *  - function arguments by position (`arg0`, `arg1`, ...)
+ *  - integer literals (decimal or hex, optionally scaled by K, M or G,
+ *    e.g., `4K` or `1MB`), floating-point literals, `true`, `false` and
+ *    `null`
+ *
+ * with the operators `== != < <= > >=`, bitwise `&`, logical `&& || !` and
+ * parentheses. Integers are compared as 64-bit values, pointers as addresses
+ * and floating-point values as doubles. As in C, a comparison is unsigned if
+ * either side is: pointers, booleans and (when the probed function has debug
+ * info) values of unsigned source types such as `size_t`.
+ */
+class Filter {
+public:
+  ~Filter();
+
+  /**
+   * Parse a filter expression.
+   *
+   * @param   Error     set to a description of any syntax error
+   * @returns the parsed filter, or null on error
+   */
+  static std::unique_ptr<Filter> Parse(llvm::StringRef Expr,
+                                       std::string &Error);
+
+  //! The filter's source expression.
+  const std::string &Source() const { return Expr; }
+
+  /**
+   * Generate code to evaluate the filter.
+   *
+   * @param   Params    names and types of the instrumentation's parameters
+   * @param   Values    the corresponding values
+   * @param   Signature the probed function's source-level type (if known),
+   *                    which says which values are unsigned
+   * @returns an `i1` that is true if the event should be logged, or null
+   *          if the filter refers to values that this event doesn't have
+   */
+  llvm::Value *Compile(llvm::IRBuilder<> &, llvm::ArrayRef<Parameter> Params,
+                       llvm::ArrayRef<llvm::Value *> Values,
+                       const llvm::DISubroutineType *Signature = nullptr) const;
+
+  struct Node;
+
+private:
+  Filter(llvm::StringRef Expr, std::unique_ptr<Node> Root);
+
+  const std::string Expr;
+  const std::unique_ptr<Node> Root;
+};
+
+} // namespace loom
+
+#endif // !LOOM_FILTER_H_
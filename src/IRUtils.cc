@@ -33,7 +33,10 @@
 #include "IRUtils.hh"
 
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include <sstream>
 
@@ -56,3 +59,132 @@ ParamVec loom::GetParameters(Function *Fn) {
   }
   return Parameters;
 }
+
+StringRef loom::SourceName(const Value &V) {
+  StringRef Name = V.getName();
+  if (not isa<GlobalValue>(V))
+    return Name;
+
+  size_t Promoted = Name.rfind(".llvm.");
+  if (Promoted == StringRef::npos)
+    return Name;
+
+  unsigned long long Hash;
+  if (Name.substr(Promoted + 6).getAsInteger(10, Hash))
+    return Name;
+
+  return Name.substr(0, Promoted);
+}
+
+bool loom::SplitStructGEPs(Function &Fn,
+                           std::function<bool(StructType &)> Matters) {
+  vector<std::pair<GetElementPtrInst *, StructType *>> Split;
+
+  for (auto &I : instructions(Fn)) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(&I);
+    if (not GEP or GEP->getNumIndices() <= 2 or GEP->getType()->isVectorTy())
+      continue;
+
+    // Which type does the last index select a member of?
+    SmallVector<Value *, 4> Indices(GEP->idx_begin(), GEP->idx_end() - 1);
+    Type *Inner = GetElementPtrInst::getIndexedType(
+        GEP->getSourceElementType(), Indices);
+
+    auto *ST = dyn_cast_or_null<StructType>(Inner);
+    if (ST and Matters(*ST))
+      Split.emplace_back(GEP, ST);
+  }
+
+  for (auto &i : Split) {
+    GetElementPtrInst *GEP = i.first;
+    StructType *ST = i.second;
+
+    SmallVector<Value *, 4> Indices(GEP->idx_begin(), GEP->idx_end() - 1);
+    Value *Field = *(GEP->idx_end() - 1);
+    Value *Zero = ConstantInt::get(Indices.front()->getType(), 0);
+
+    auto *Outer = GetElementPtrInst::Create(GEP->getSourceElementType(),
+                                            GEP->getPointerOperand(), Indices,
+                                            GEP->getName() + ".outer", GEP);
+    auto *Inner = GetElementPtrInst::Create(ST, Outer, {Zero, Field}, "", GEP);
+
+    Outer->setIsInBounds(GEP->isInBounds());
+    Inner->setIsInBounds(GEP->isInBounds());
+    Inner->setDebugLoc(GEP->getDebugLoc());
+    Inner->takeName(GEP);
+
+    GEP->replaceAllUsesWith(Inner);
+    GEP->eraseFromParent();
+  }
+
+  return not Split.empty();
+}
+
+bool loom::MergeReturns(Function &Fn) {
+  vector<ReturnInst *> Returns;
+  for (auto &Block : Fn) {
+    auto *Ret = dyn_cast<ReturnInst>(Block.getTerminator());
+    if (Ret and not Block.getTerminatingMustTailCall()) {
+      Returns.push_back(Ret);
+    }
+  }
+
+  if (Returns.size() < 2) {
+    return false;
+  }
+
+  LLVMContext &Ctx = Fn.getContext();
+  BasicBlock *Exit = BasicBlock::Create(Ctx, "loom.exit", &Fn);
+  Type *RetTy = Fn.getReturnType();
+
+  PHINode *RetVal = nullptr;
+  if (not RetTy->isVoidTy()) {
+    RetVal = PHINode::Create(RetTy, Returns.size(), "retval", Exit);
+  }
+  ReturnInst::Create(Ctx, RetVal, Exit);
+
+  for (ReturnInst *Ret : Returns) {
+    if (RetVal) {
+      RetVal->addIncoming(Ret->getReturnValue(), Ret->getParent());
+    }
+
+    BranchInst::Create(Exit, Ret);
+    Ret->eraseFromParent();
+  }
+
+  return true;
+}
+
+void loom::ClearAfterFork(Module &Mod, GlobalVariable *Cache) {
+  const std::string Name = (Cache->getName() + "_forked").str();
+  if (Mod.getFunction(Name))
+    return;
+
+  LLVMContext &Ctx = Mod.getContext();
+  Type *Void = Type::getVoidTy(Ctx);
+  FunctionType *HandlerType = FunctionType::get(Void, false);
+  PointerType *HandlerPtr = HandlerType->getPointerTo();
+
+  auto *Child =
+      Function::Create(HandlerType, GlobalValue::LinkOnceODRLinkage, Name, &Mod);
+  Child->setVisibility(GlobalValue::HiddenVisibility);
+
+  IRBuilder<> B(BasicBlock::Create(Ctx, "entry", Child));
+  B.CreateStore(Constant::getNullValue(Cache->getValueType()), Cache);
+  B.CreateRetVoid();
+
+  // Register the handler when the program starts.
+  auto *Init = Function::Create(HandlerType, GlobalValue::InternalLinkage,
+                                Cache->getName() + "_atfork", &Mod);
+  Constant *AtFork = Mod.getOrInsertFunction(
+      "pthread_atfork",
+      FunctionType::get(B.getInt32Ty(), {HandlerPtr, HandlerPtr, HandlerPtr},
+                        false));
+
+  B.SetInsertPoint(BasicBlock::Create(Ctx, "entry", Init));
+  Constant *None = ConstantPointerNull::get(HandlerPtr);
+  B.CreateCall(AtFork, {None, None, Child});
+  B.CreateRetVoid();
+
+  appendToGlobalCtors(Mod, Init, 0);
+}
@@ -36,6 +36,7 @@
 #include <llvm/ADT/StringRef.h>
 #include <llvm/IR/IRBuilder.h>
 
+#include <functional>
 #include <vector>
 
 namespace loom {
@@ -52,6 +53,46 @@ llvm::BasicBlock *FindBlock(llvm::StringRef Name, llvm::Function &);
 /// Retrieve a function's parameter names and types.
 ParamVec GetParameters(llvm::Function *);
 
+/**
+ * The name of a value as it appeared in the source module.
+ *
+ * ThinLTO promotes internal symbols that are referenced from other modules,
+ * renaming them with a `.llvm.<hash>` suffix. Policy matching and hook/event
+ * names use the unpromoted name, so that they are the same whether a module
+ * is instrumented alone, within a ThinLTO backend or after `llvm-link`.
+ */
+llvm::StringRef SourceName(const llvm::Value &);
+
+/**
+ * Split GEPs that index into nested structures (e.g., `&p->a.b`) so that the
+ * innermost field is looked up by a two-index GEP on its own structure type.
+ *
+ * Optimizations like InstCombine fold chains of GEPs together, hiding the
+ * fields of nested structures from field instrumentation.
+ *
+ * @param   Matters    which (innermost) structure types to split GEPs for
+ * @returns whether any GEPs were split
+ */
+bool SplitStructGEPs(llvm::Function &,
+                     std::function<bool(llvm::StructType &)> Matters);
+
+/**
+ * Merge a function's return sites into a single exit block, with a PHI for
+ * the return value, so that the exit can be instrumented once.
+ *
+ * Returns that follow `musttail` calls can't be merged and are left alone.
+ *
+ * @returns whether any returns were merged
+ */
+bool MergeReturns(llvm::Function &);
+
+/**
+ * Zero a thread-local variable in forked children (via a `pthread_atfork`
+ * handler registered at startup): a child's only thread is a new thread,
+ * which mustn't use the forking thread's cached values (e.g., its ID).
+ */
+void ClearAfterFork(llvm::Module &, llvm::GlobalVariable *);
+
 } // namespace loom
 
 #endif // LOOM_IRUTILS_H
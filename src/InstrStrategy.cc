@@ -39,48 +39,220 @@
  * SUCH DAMAGE.
  */
 
+#include <llvm/ADT/StringSet.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 #include "InstrStrategy.hh"
+#include "IRUtils.hh"
 #include "Instrumentation.hh"
 
 using namespace llvm;
 using namespace loom;
+using std::string;
 using std::unique_ptr;
 
 namespace {
 
 class CalloutStrategy : public InstrStrategy {
 public:
-  CalloutStrategy(bool UseBlocks) : InstrStrategy(UseBlocks) {}
+  CalloutStrategy(Structure S) : InstrStrategy(S) {}
 
   Instrumentation Instrument(Instruction *I, StringRef Name, StringRef Descrip,
                              ArrayRef<Parameter> Params,
                              ArrayRef<Value *> Values, loom::Metadata Md,
                              std::vector<loom::Transform> Transforms, bool VarArgs,
 							 bool AfterInst, bool) override;
+
+  bool CreatesHooks() const override { return true; }
+
+protected:
+  //! Call an instrumentation function from (before) an instrumented site.
+  virtual void CallHook(Function *Hook, ArrayRef<Value *> Values,
+                        Instruction *Where);
+};
+
+/**
+ * Call out to instrumentation functions from patchable nop sleds.
+ *
+ * Each site is a short jump over a sled that can be patched at run time
+ * (see runtime/loom-patch.h) into a call to the instrumentation function,
+ * via a trampoline that saves registers (including the full vector state,
+ * which the hook may clobber). The hook's arguments are passed
+ * in its argument registers, so disabled probes cost a single jump.
+ *
+ * Sites that can't be sleds (on targets other than x86-64 ELF, or with
+ * too many arguments to pass in registers) fall back to calls guarded by
+ * the probe's enable flag.
+ */
+class PatchableStrategy : public CalloutStrategy {
+public:
+  PatchableStrategy(Structure S) : CalloutStrategy(S) {}
+
+protected:
+  void CallHook(Function *Hook, ArrayRef<Value *> Values,
+                Instruction *Where) override;
+
+private:
+  /// Guard a call that can't be put in a sled with a flag (initially clear)
+  /// that the runtime sets and clears along with the sleds.
+  void CallGuarded(Function *Hook, ArrayRef<Value *> Values,
+                   Instruction *Where, StringRef Why);
+
+  /// The size of a sled (see LOOM_SLED_SIZE in runtime/loom-patch.h).
+  static const unsigned SledSize = 15;
+
+  /// Hooks that have already been warned about falling back to a flag.
+  StringSet<> Guarded;
 };
 
 class InlineStrategy : public InstrStrategy {
 public:
-  InlineStrategy(bool UseBlocks) : InstrStrategy(UseBlocks) {}
+  InlineStrategy(Structure S) : InstrStrategy(S) {}
 
   Instrumentation Instrument(Instruction *I, StringRef Name, StringRef Descrip,
                              ArrayRef<Parameter> Params,
                              ArrayRef<Value *> Values, loom::Metadata Md,
                              std::vector<loom::Transform> Transforms, bool VarArgs,
 							 bool AfterInst, bool SuppressInstrumentation) override;
+
+  bool CreatesHooks() const override { return false; }
 };
 
+/// The gettid(2) system call number on Linux, or 0 if we don't know it.
+uint64_t LinuxGettid(const Triple &T) {
+  switch (T.getArch()) {
+  case Triple::x86_64:
+    return 186;
+  case Triple::x86:
+  case Triple::arm:
+    return 224;
+  case Triple::aarch64:
+  case Triple::riscv64:
+    return 178;
+  case Triple::ppc64:
+  case Triple::ppc64le:
+    return 207;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Get (or create) a function that returns the current thread's ID.
+ *
+ * The ID is looked up once per thread and cached in a thread-local variable
+ * shared by all instrumented modules, so events don't cost a system call.
+ * The cache is cleared in forked children, whose thread has a new ID.
+ * On platforms where we don't know how to get a kernel thread ID, threads
+ * are numbered (from 1) in the order that they first log an event.
+ */
+Function *ThreadIDFn(Module &Mod) {
+  const char *Name = "__loom_thread_id";
+  if (Function *F = Mod.getFunction(Name))
+    return F;
+
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *Int32 = Type::getInt32Ty(Ctx);
+  IntegerType *Int64 = Type::getInt64Ty(Ctx);
+
+  auto *F = Function::Create(FunctionType::get(Int32, false),
+                             GlobalValue::LinkOnceODRLinkage, Name, &Mod);
+  F->setVisibility(GlobalValue::HiddenVisibility);
+
+  auto *Cache = dyn_cast<GlobalVariable>(
+      Mod.getOrInsertGlobal("__loom_thread_id_cache", Int32));
+  if (not Cache->hasInitializer()) {
+    Cache->setLinkage(GlobalValue::LinkOnceODRLinkage);
+    Cache->setVisibility(GlobalValue::HiddenVisibility);
+    Cache->setInitializer(ConstantInt::get(Int32, 0));
+    Cache->setThreadLocalMode(GlobalValue::GeneralDynamicTLSModel);
+  }
+  ClearAfterFork(Mod, Cache);
+
+  auto *Entry = BasicBlock::Create(Ctx, "entry", F);
+  auto *Lookup = BasicBlock::Create(Ctx, "lookup", F);
+  auto *Done = BasicBlock::Create(Ctx, "done", F);
+
+  IRBuilder<> B(Entry);
+  Value *ID = B.CreateLoad(Cache);
+  B.CreateCondBr(B.CreateICmpEQ(ID, ConstantInt::get(Int32, 0)), Lookup, Done);
+
+  B.SetInsertPoint(Done);
+  B.CreateRet(ID);
+
+  B.SetInsertPoint(Lookup);
+  Triple T(Mod.getTargetTriple());
+  Value *NewID;
+
+  if (T.isOSLinux() and LinuxGettid(T) != 0) {
+    Constant *Syscall = Mod.getOrInsertFunction(
+        "syscall", FunctionType::get(Int64, {Int64}, true));
+    NewID = B.CreateTrunc(
+        B.CreateCall(Syscall, {ConstantInt::get(Int64, LinuxGettid(T))}),
+        Int32);
+
+  } else if (T.isOSFreeBSD()) {
+    Constant *GetTID = Mod.getOrInsertFunction(
+        "pthread_getthreadid_np", FunctionType::get(Int32, false));
+    NewID = B.CreateCall(GetTID);
+
+  } else {
+    auto *Count = dyn_cast<GlobalVariable>(
+        Mod.getOrInsertGlobal("__loom_thread_count", Int32));
+    if (not Count->hasInitializer()) {
+      Count->setLinkage(GlobalValue::LinkOnceODRLinkage);
+      Count->setVisibility(GlobalValue::HiddenVisibility);
+      Count->setInitializer(ConstantInt::get(Int32, 0));
+    }
+
+    Value *Prev = B.CreateAtomicRMW(AtomicRMWInst::Add, Count,
+                                    ConstantInt::get(Int32, 1),
+                                    AtomicOrdering::Monotonic);
+    NewID = B.CreateAdd(Prev, ConstantInt::get(Int32, 1));
+  }
+
+  B.CreateStore(NewID, Cache);
+  B.CreateRet(NewID);
+
+  return F;
+}
+
+/**
+ * Find the current CPU.
+ *
+ * On Linux, sched_getcpu() is served by the vDSO (or, with glibc >= 2.35,
+ * read from the thread's registered rseq area) rather than a system call.
+ * Where it isn't available, the CPU is logged as -1.
+ */
+Value *CurrentCPU(Module &Mod, IRBuilder<> &B) {
+  Triple T(Mod.getTargetTriple());
+  IntegerType *Int32 = B.getInt32Ty();
+
+  if (not T.isOSLinux() and not T.isOSFreeBSD())
+    return ConstantInt::get(Int32, -1, true);
+
+  Constant *GetCPU = Mod.getOrInsertFunction(
+      "sched_getcpu", FunctionType::get(Int32, false));
+
+  return B.CreateCall(GetCPU, {}, "cpu");
+}
+
 } // anonymous namespace
 
-unique_ptr<InstrStrategy> InstrStrategy::Create(Kind K, bool UseBlocks) {
+unique_ptr<InstrStrategy> InstrStrategy::Create(Kind K, Structure S) {
   switch (K) {
   case InstrStrategy::Kind::Callout:
-    return unique_ptr<InstrStrategy>(new CalloutStrategy(UseBlocks));
+    return unique_ptr<InstrStrategy>(new CalloutStrategy(S));
 
   case InstrStrategy::Kind::Inline:
-    return unique_ptr<InstrStrategy>(new InlineStrategy(UseBlocks));
+    return unique_ptr<InstrStrategy>(new InlineStrategy(S));
+
+  case InstrStrategy::Kind::Patchable:
+    return unique_ptr<InstrStrategy>(new PatchableStrategy(S));
   }
 }
 
@@ -91,12 +263,96 @@ void InstrStrategy::AddLogger(unique_ptr<Logger> L) {
   Loggers.emplace_back(std::move(L));
 }
 
+void InstrStrategy::AddTag(Tag T) { Tags.push_back(T); }
+
+Instruction *InstrStrategy::Guard(Instruction *I, StringRef Name,
+                                  bool Enable) {
+  BasicBlock *BB = I->getParent();
+  Function *F = BB->getParent();
+  Module &Mod = *F->getParent();
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *Int8 = Type::getInt8Ty(Ctx);
+
+  // The instrumented program may refer to the flag (e.g., to disable the
+  // probe), in which case we'll find its declaration here.
+  auto *Enabled = dyn_cast<GlobalVariable>(
+      Mod.getOrInsertGlobal((Name + "_enabled").str(), Int8));
+  if (not Enabled->hasInitializer()) {
+    Enabled->setLinkage(GlobalValue::WeakAnyLinkage);
+    Enabled->setInitializer(ConstantInt::get(Int8, Enable ? 1 : 0));
+  }
+
+  // PHIs (and allocas in the entry block) must stay where they are.
+  if (isa<PHINode>(I)) {
+    I = &*BB->getFirstInsertionPt();
+  }
+  if (BB == &F->getEntryBlock()) {
+    while (isa<AllocaInst>(I)) {
+      I = I->getNextNode();
+    }
+  }
+
+  // The hot path is a load and a (well-predicted) branch around a cold block
+  // at the end of the function that contains all of the instrumentation.
+  BasicBlock *Tail = BB->splitBasicBlock(I, BB->getName() + ".cont");
+  BasicBlock *Cold = BasicBlock::Create(Ctx, Name + ":cold", F);
+  Instruction *End = IRBuilder<>(Cold).CreateBr(Tail);
+
+  BB->getTerminator()->eraseFromParent();
+  IRBuilder<> B(BB);
+  Value *On = B.CreateICmpNE(B.CreateLoad(Enabled), B.getInt8(0));
+  B.CreateCondBr(On, Cold, Tail, MDBuilder(Ctx).createBranchWeights(1, 1000));
+
+  return End;
+}
+
 Value *InstrStrategy::AddLogging(Instruction *I, ArrayRef<Value *> Values,
                                  StringRef Name, StringRef Description,
                                  loom::Metadata Md, std::vector<loom::Transform> Transforms,
 								 bool SuppressUniqueness) {
   Value *End = nullptr;
 
+  // Transforms (e.g., captures of pointers' contents) replace values for
+  // every logger.
+  std::vector<Value *> Transformed;
+  for (auto &T : Transforms) {
+    if (Transformed.empty()) {
+      Transformed.assign(Values.begin(), Values.end());
+    }
+
+    IRBuilder<> B(I);
+    if (Value *V = T.Apply(B, Values)) {
+      Transformed[T.Arg] = V;
+    }
+  }
+
+  if (not Transformed.empty()) {
+    Values = Transformed;
+    Transforms.clear();
+  }
+
+  // Tags are logged ahead of the event's own values, by every logger.
+  std::vector<Value *> Tagged;
+  if (not Tags.empty()) {
+    Module &Mod = *I->getModule();
+    IRBuilder<> B(I);
+
+    for (Tag T : Tags) {
+      switch (T) {
+      case Tag::Thread:
+        Tagged.push_back(B.CreateCall(ThreadIDFn(Mod), {}, "thread"));
+        break;
+
+      case Tag::CPU:
+        Tagged.push_back(CurrentCPU(Mod, B));
+        break;
+      }
+    }
+
+    Tagged.insert(Tagged.end(), Values.begin(), Values.end());
+    Values = Tagged;
+  }
+
   for (auto &L : Loggers) {
     assert(L);
     End = L->Log(I, Values, Name, Description, Md, Transforms, SuppressUniqueness);
@@ -175,13 +431,7 @@ Instrumentation CalloutStrategy::Instrument(Instruction *I, StringRef Name,
   }
 
   // Call the instrumentation function:
-  CallInst *Call = CallInst::Create(InstrFn, Values);
-
-  if (AfterInst) {
-    Call->insertAfter(I);
-  } else {
-    Call->insertBefore(I);
-  }
+  CallHook(InstrFn, Values, AfterInst ? I->getNextNode() : I);
 
   if (UseBlockStructure) {
     return Instrumentation(InstrValues, Preamble, EndBlock, PreambleEnd, End);
@@ -190,6 +440,164 @@ Instrumentation CalloutStrategy::Instrument(Instruction *I, StringRef Name,
   }
 }
 
+void CalloutStrategy::CallHook(Function *Hook, ArrayRef<Value *> Values,
+                               Instruction *Where) {
+  if (GuardProbes) {
+    Where = Guard(Where, Hook->getName());
+  }
+
+  CallInst::Create(Hook, Values, "", Where);
+}
+
+void PatchableStrategy::CallHook(Function *Hook, ArrayRef<Value *> Values,
+                                 Instruction *Where) {
+  Module &Mod = *Hook->getParent();
+  Triple T(Mod.getTargetTriple());
+
+  // Arguments are passed to the hook (via the trampoline) in the System V
+  // argument registers: integers and pointers in the first six general
+  // purpose registers and floating-point values in the first eight SSE ones.
+  static const char *IntRegs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+  const unsigned MaxInts = sizeof(IntRegs) / sizeof(IntRegs[0]);
+  const unsigned MaxFPs = 8;
+
+  if (T.getArch() != Triple::x86_64 or not T.isOSBinFormatELF()) {
+    CallGuarded(Hook, Values, Where, "sleds need x86-64 ELF");
+    return;
+  }
+
+  if (Hook->isVarArg()) {
+    CallGuarded(Hook, Values, Where, "it's variadic");
+    return;
+  }
+
+  unsigned Ints = 0, FPs = 0;
+  for (Value *V : Values) {
+    Type *Ty = V->getType();
+    if (Ty->isFloatTy() or Ty->isDoubleTy()) {
+      FPs++;
+    } else if (Ty->isPointerTy() or
+               (Ty->isIntegerTy() and Ty->getIntegerBitWidth() <= 64)) {
+      Ints++;
+    } else {
+      Ints = MaxInts + 1;
+    }
+  }
+
+  if (Ints > MaxInts or FPs > MaxFPs) {
+    CallGuarded(Hook, Values, Where, "its arguments don't fit in registers");
+    return;
+  }
+
+  IRBuilder<> B(Where);
+  std::vector<Value *> Args;
+  std::vector<Type *> ArgTypes;
+  string Constraints;
+  Ints = FPs = 0;
+
+  for (Value *V : Values) {
+    Type *Ty = V->getType();
+    if (Ty->isFloatTy() or Ty->isDoubleTy()) {
+      Constraints += "{xmm" + std::to_string(FPs++) + "},";
+    } else {
+      // Hooks only look at the low bits of narrow integer arguments.
+      if (Ty->isIntegerTy()) {
+        V = B.CreateZExt(V, B.getInt64Ty());
+      }
+      Constraints += string("{") + IntRegs[Ints++] + "},";
+    }
+
+    Args.push_back(V);
+    ArgTypes.push_back(V->getType());
+  }
+
+  // The patched sled clobbers %r10 (the hook's address) and the flags,
+  // and the hook may read (or write) memory.
+  Constraints += "~{r10},~{memory},~{dirflag},~{fpsr},~{flags}";
+
+  // An unpatched sled jumps over its own body. The sled and its hook are
+  // described in the loom_sleds section, along with the hook's name.
+  const string Name = Hook->getName().str();
+  const string Asm = ".p2align 1\n"
+                     "0:\n"
+                     ".byte 0xeb, " + std::to_string(SledSize - 2) + "\n"
+                     ".skip " + std::to_string(SledSize - 2) + ", 0x90\n"
+                     ".pushsection .rodata\n"
+                     "1:\n"
+                     ".asciz \"" + Name + "\"\n"
+                     ".popsection\n"
+                     ".pushsection loom_sleds,\"aw\",@progbits\n"
+                     ".p2align 3\n"
+                     ".quad 0b, \"" + Name + "\", 1b\n"
+                     ".popsection";
+
+  auto *SledType = FunctionType::get(B.getVoidTy(), ArgTypes, false);
+  B.CreateCall(InlineAsm::get(SledType, Asm, Constraints, true), Args);
+
+  // A patched sled calls the hook from the middle of its caller, so the
+  // caller can't keep anything below the stack pointer.
+  Where->getFunction()->addFnAttr(Attribute::NoRedZone);
+
+  // The hook is only referred to by the sled's description, which also
+  // needs the runtime's trampoline (and patching code) to be linked in.
+  GlobalVariable *Runtime = Mod.getNamedGlobal("__loom_patch_runtime");
+  if (not Runtime) {
+    auto *Trampoline = dyn_cast<Function>(Mod.getOrInsertFunction(
+        "__loom_patch_trampoline", FunctionType::get(B.getVoidTy(), false)));
+    Trampoline->setVisibility(GlobalValue::HiddenVisibility);
+
+    Runtime = new GlobalVariable(Mod, Trampoline->getType(), true,
+                                 GlobalValue::InternalLinkage, Trampoline,
+                                 "__loom_patch_runtime");
+  }
+
+  appendToCompilerUsed(Mod, {Hook, Runtime});
+}
+
+void PatchableStrategy::CallGuarded(Function *Hook, ArrayRef<Value *> Values,
+                                    Instruction *Where, StringRef Why) {
+  Module &Mod = *Hook->getParent();
+  LLVMContext &Ctx = Mod.getContext();
+  const string Name = Hook->getName().str();
+
+  // Unlike callout probes, these start out disabled like their sleds.
+  CallInst::Create(Hook, Values, "", Guard(Where, Name, false));
+
+  if (not Guarded.insert(Name).second) {
+    return;
+  }
+
+  errs() << "Warning: " << Name << " can't be called from a patchable sled ("
+         << Why << "): guarding it with " << Name << "_enabled instead\n";
+
+  // On ELF, loom_patch() finds the flag (along with the sleds) by its hook's
+  // name in the loom_patch_flags section. Elsewhere, the program has to set
+  // the flag itself.
+  if (not Triple(Mod.getTargetTriple()).isOSBinFormatELF()) {
+    return;
+  }
+
+  PointerType *BytePtr = Type::getInt8PtrTy(Ctx);
+  StructType *FlagType = StructType::get(BytePtr, BytePtr);
+  Constant *Enabled = Mod.getNamedGlobal(Name + "_enabled");
+  Constant *NameStr = ConstantDataArray::getString(Ctx, Name);
+  auto *HookName = new GlobalVariable(Mod, NameStr->getType(), true,
+                                      GlobalValue::PrivateLinkage, NameStr,
+                                      Name + "_name");
+  HookName->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  auto *Flag = new GlobalVariable(
+      Mod, FlagType, false, GlobalValue::InternalLinkage,
+      ConstantStruct::get(FlagType,
+                          {ConstantExpr::getPointerCast(Enabled, BytePtr),
+                           ConstantExpr::getPointerCast(HookName, BytePtr)}),
+      Name + "_patch_flag");
+  Flag->setSection("loom_patch_flags");
+  Flag->setAlignment(8);
+
+  appendToCompilerUsed(Mod, {Flag});
+}
+
 Instrumentation InlineStrategy::Instrument(Instruction *I, StringRef Name,
                                            StringRef Descrip,
                                            ArrayRef<Parameter> Params,
@@ -233,6 +641,13 @@ Instrumentation InlineStrategy::Instrument(Instruction *I, StringRef Name,
 
     IRBuilder<>(BB).CreateBr(Preamble);
 
+  } else if (GuardProbes) {
+    Preamble = nullptr;
+    EndBlock = nullptr;
+
+    PreambleEnd = Guard(I, Name);
+    End = PreambleEnd;
+
   } else {
     Preamble = nullptr;
     EndBlock = nullptr;
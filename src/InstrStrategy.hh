@@ -56,6 +56,20 @@ public:
   enum class Kind {
     Callout, //!< Call out to a user-defined instrumentation function.
     Inline,  //!< Add instrumentation inline with the instrumented code.
+    Patchable, //!< Call out from nop sleds that are patched at run time.
+  };
+
+  //! How instrumentation code is laid out around the instrumented code.
+  enum class Structure {
+    Flat,     //!< A stream of instructions inline with the instrumented code.
+    Guarded,  //!< One branch (on the probe being enabled) to a cold block.
+    Blocks,   //!< Explicit preamble and end blocks (the old TESLA behaviour).
+  };
+
+  //! Values that can be logged ahead of every event's own values.
+  enum class Tag {
+    Thread, //!< Kernel thread ID (cached in TLS after the first event).
+    CPU,    //!< The CPU the thread is running on (via `sched_getcpu`).
   };
 
   virtual ~InstrStrategy();
@@ -64,18 +78,22 @@ public:
    * Create a new instrumentation strategy (callout, inline, etc.).
    *
    * @param   K         Which instrumentation approach to take.
-   * @param   UseBlocks Use BasicBlock-based internal structure for
-   *                    instrumentation in order to expose the control flow
-   *                    among [potentially] different instrumentation actions
-   *                    very explicit. This is the old behaviour from TESLA.
-   *                    The alternative (if UseBlocks is false) is to generate
-   *                    a stream of instructions.
+   * @param   S         How to structure the instrumentation: use explicit
+   *                    BasicBlocks in order to make the control flow among
+   *                    [potentially] different instrumentation actions very
+   *                    explicit (the old behaviour from TESLA), generate a
+   *                    stream of instructions or put all of a site's
+   *                    instrumentation in a single cold block, behind a
+   *                    check of whether or not the probe is enabled.
    */
-  static std::unique_ptr<InstrStrategy> Create(Kind K, bool UseBlocks);
+  static std::unique_ptr<InstrStrategy> Create(Kind K, Structure S);
 
   //! Add another @ref Logger to the instrumentation we generate.
   void AddLogger(std::unique_ptr<Logger>);
 
+  //! Tag every logged event with another value (e.g., the thread ID).
+  void AddTag(Tag);
+
   /**
    * Instrument a particular instruction, returning an @ref Instrumentation
    * object that can be used to create actions.
@@ -129,10 +147,34 @@ public:
              Metadata Md, std::vector<Transform> Tf, bool VarArgs = false,
              bool AfterInst = false, bool SuppressUniqueness = false) = 0;
 
+  /**
+   * Does this strategy create a function for every distinct instrumentation
+   * name? If so, instrumentation of many similar sites should share names
+   * (and pass a site identifier) rather than naming every site uniquely.
+   */
+  virtual bool CreatesHooks() const = 0;
+
   bool Initialize(llvm::Function &main);
 
 protected:
-  InstrStrategy(bool UseBlocks) : UseBlockStructure(UseBlocks) {}
+  InstrStrategy(Structure S)
+      : UseBlockStructure(S == Structure::Blocks),
+        GuardProbes(S == Structure::Guarded) {}
+
+  /**
+   * Move the instrumentation of an instruction into a cold block that is
+   * only entered when the probe is enabled.
+   *
+   * Each instrumentation name has a (weak, so that it is shared by all
+   * modules) `<Name>_enabled` flag, which is set by default but can be
+   * cleared at run time to disable the probe everywhere.
+   *
+   * @param     Enable    whether the flag is initially set
+   * @returns   the cold block's terminator, before which instrumentation
+   *            should be inserted
+   */
+  llvm::Instruction *Guard(llvm::Instruction *I, llvm::StringRef Name,
+                           bool Enable = true);
 
   /**
    * Add code to instrumentation preamble that will log the instrumented values
@@ -150,8 +192,12 @@ protected:
    */
   const bool UseBlockStructure;
 
+  //! Guard each site's instrumentation with a single enable check.
+  const bool GuardProbes;
+
 private:
   std::vector<std::unique_ptr<Logger>> Loggers;
+  std::vector<Tag> Tags;
 };
 
 } // namespace loom
@@ -39,14 +39,23 @@
  */
 
 #include "Instrumenter.hh"
+#include "Filter.hh"
+#include "IRUtils.hh"
 #include "Logger.hh"
 
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/MD5.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 // TODO: separate this out
 #include "llvm/IR/DebugInfoMetadata.h"
 
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cctype>
 #include <sstream>
 #include <string>
 
@@ -54,6 +63,65 @@ using namespace llvm;
 using namespace loom;
 using namespace std;
 
+namespace {
+
+/// Transforms name function arguments, which may follow other logged values
+/// (e.g., a return value).
+vector<loom::Transform> ShiftTransforms(vector<loom::Transform> Transforms,
+                                        unsigned Offset) {
+  for (auto &T : Transforms) {
+    T = T.Shifted(Offset);
+  }
+
+  return Transforms;
+}
+
+/// Describe a type in a form that can be used within a hook name.
+string TypeSignature(Type *T) {
+  if (auto *Ptr = dyn_cast<PointerType>(T)) {
+    return "p" + TypeSignature(Ptr->getElementType());
+  }
+
+  if (auto *ST = dyn_cast<StructType>(T)) {
+    if (ST->hasName()) {
+      string Name = ST->getName();
+      std::replace_if(Name.begin(), Name.end(),
+                      [](char C) { return not isalnum(C); }, '_');
+      return "s_" + Name + "_";
+    }
+
+    string Sig = "sl_";
+    for (Type *Elem : ST->elements()) {
+      Sig += TypeSignature(Elem);
+    }
+    return Sig + "_";
+  }
+
+  if (auto *AT = dyn_cast<ArrayType>(T)) {
+    return "a" + std::to_string(AT->getNumElements()) +
+           TypeSignature(AT->getElementType());
+  }
+
+  if (auto *VT = dyn_cast<VectorType>(T)) {
+    return "v" + std::to_string(VT->getNumElements()) +
+           TypeSignature(VT->getElementType());
+  }
+
+  if (auto *FT = dyn_cast<FunctionType>(T)) {
+    string Sig = "f_" + TypeSignature(FT->getReturnType());
+    for (Type *Param : FT->params()) {
+      Sig += TypeSignature(Param);
+    }
+    return Sig + (FT->isVarArg() ? "va_" : "_");
+  }
+
+  string Name;
+  raw_string_ostream(Name) << *T;
+  return Name;
+}
+
+} // anonymous namespace
+
 unique_ptr<Instrumenter> Instrumenter::Create(Module &Mod, NameFn NF,
                                               unique_ptr<InstrStrategy> S) {
   return unique_ptr<Instrumenter>(new Instrumenter(Mod, NF, std::move(S)));
@@ -61,9 +129,10 @@ unique_ptr<Instrumenter> Instrumenter::Create(Module &Mod, NameFn NF,
 
 Instrumenter::Instrumenter(llvm::Module &Mod, NameFn NF,
                            unique_ptr<InstrStrategy> S)
-    : Mod(Mod), Strategy(std::move(S)), Name(NF) {}
+    : Mod(Mod), Strategy(std::move(S)), ExitReturn(nullptr), Name(NF) {}
 
-bool Instrumenter::Instrument(llvm::Instruction *I, loom::Metadata Md, std::vector<loom::Transform> Transforms) {
+bool Instrumenter::Instrument(llvm::Instruction *I, loom::Metadata Md, std::vector<loom::Transform> Transforms,
+                              ProbeOptions Opts) {
   // If this instruction terminates a block, we need to treat it a bit
   // differently, placing instrumentation before it rather than after.
   const bool Terminator = I->isTerminator();
@@ -124,18 +193,40 @@ bool Instrumenter::Instrument(llvm::Instruction *I, loom::Metadata Md, std::vect
   // capture the instruction's value (if non-void).
   const bool AfterInst = not Terminator;
 
-  // Every instrumentation point needs a unique name. Eventually we should do
-  // something clever with debug information, but for now we'll use a more...
-  // simplistic approach.
+  // When every name gets its own hook function, share hooks among
+  // instructions with the same opcode and operand types, passing a site ID
+  // to identify the instruction (see InstructionSite).
+  if (Strategy->CreatesHooks()) {
+    string Signature;
+    for (auto &P : ValueDescriptions) {
+      Signature += TypeSignature(P.second);
+    }
+
+    const string Description =
+        string("instrumentation:instruction:") + I->getOpcodeName();
+
+    ConstantInt *Site = InstructionSite(I, Description);
+    ValueDescriptions.emplace(ValueDescriptions.begin(), "site",
+                              Site->getType());
+    Values.emplace(Values.begin(), Site);
+
+    const string Name = this->Name({"instruction", I->getOpcodeName(),
+                                    Signature});
+
+    return Probe(Opts, I, Name, Description + ":", ValueDescriptions, Values,
+                 Md, Transforms, Varargs, AfterInst, true);
+  }
+
+  // Otherwise, every instrumentation point needs a unique name. Eventually
+  // we should do something clever with debug information, but for now
+  // we'll use a more... simplistic approach.
   std::ostringstream NameBuilder;
   NameBuilder << "instrumentation:instruction:";
   NameBuilder << static_cast<const void *>(I);
   const string Name = NameBuilder.str();
 
-  Strategy->Instrument(I, Name, Name, ValueDescriptions, Values, Md, Transforms,
-						Varargs, AfterInst, true);
-
-  return true;
+  return Probe(Opts, I, Name, Name, ValueDescriptions, Values, Md, Transforms,
+               Varargs, AfterInst, true);
 }
 
 // Currently, the second parameter is unused. It would give us the source name
@@ -143,7 +234,8 @@ bool Instrumenter::Instrument(llvm::Instruction *I, loom::Metadata Md, std::vect
 bool Instrumenter::InstrumentPtrInsts(llvm::Instruction *I,
                                       const llvm::DIVariable *Var,
 									  loom::Metadata Md, 
-									  std::vector<loom::Transform> Transforms) {
+									  std::vector<loom::Transform> Transforms,
+									  ProbeOptions Opts) {
 
   std::ostringstream LocationBuilder;
 
@@ -270,73 +362,102 @@ bool Instrumenter::InstrumentPtrInsts(llvm::Instruction *I,
   NameBuilder << static_cast<const void *>(I);
   const string InstrName = Name({"instruction", NameBuilder.str()});
 
-  Strategy->Instrument(I, InstrName, FormatStringPrefix, ValueDescriptions,
-                       Values, Md, Transforms, Varargs, AfterInst, true);
-
-  return true;
+  return Probe(Opts, I, InstrName, FormatStringPrefix, ValueDescriptions,
+               Values, Md, Transforms, Varargs, AfterInst, true);
 }
 
 bool Instrumenter::Instrument(CallInst *Call, const Policy::Directions &D,
-		loom::Metadata Md, std::vector<loom::Transform> Transforms) {
+		loom::Metadata Md, std::vector<loom::Transform> Transforms,
+		ProbeOptions Opts) {
   bool ModifiedIR = false;
 
   for (auto Dir : D) {
-    ModifiedIR |= Instrument(Call, Dir, Md, Transforms);
+    ModifiedIR |= Instrument(Call, Dir, Md, Transforms, Opts);
   }
 
   return ModifiedIR;
 }
 
 bool Instrumenter::Instrument(llvm::CallInst *Call, Policy::Direction Dir,
-		loom::Metadata Md, std::vector<loom::Transform> Transforms) {
+		loom::Metadata Md, std::vector<loom::Transform> Transforms,
+		ProbeOptions Opts) {
   Function *Target = Call->getCalledFunction();
-  assert(Target); // TODO: support indirect targets, too
+  FunctionType *TargetType = Call->getFunctionType();
 
   // Get some relevant details about the call and the target function.
-  const string TargetName = Target->getName();
-  const bool VarArgs = Target->isVarArg();
+  const bool VarArgs = TargetType->isVarArg();
   Type *CallType = Call->getType();
   const bool voidFunction = CallType->isVoidTy();
   const bool Return = (Dir == Policy::Direction::Out);
 
   const string Description = Return ? "return" : "call";
-  const string FormatStringPrefix = Description + " " + TargetName + ":";
-  const string InstrName = Name({Description, TargetName});
+  string FormatStringPrefix;
+  string InstrName;
 
-  // Start by copying static and dynamic value details from the target function.
-  ParamVec Parameters = GetParameters(Target);
+  ParamVec Parameters;
   vector<Value *> Arguments(Call->getNumArgOperands());
   std::copy(Call->arg_begin(), Call->arg_end(), Arguments.begin());
 
+  if (Target) {
+    // Start by copying static details from the target function.
+    const string TargetName = SourceName(*Target);
+    FormatStringPrefix = Description + " " + TargetName + ":";
+    InstrName = Name({Description, TargetName});
+    Parameters = GetParameters(Target);
+  } else {
+    // Indirect calls are named after the caller and the call site within it,
+    // and the (dynamic) target is logged ahead of the arguments.
+    const string Caller = SourceName(*Call->getFunction());
+    const string Site = std::to_string(IndirectCallSite(Call));
+    FormatStringPrefix = Description + " indirect " + Caller + "#" + Site + ":";
+    InstrName = Name({Description, "indirect", Caller, Site});
+
+    Type *TargetPtrTy = Type::getInt8PtrTy(Mod.getContext());
+    Parameters.emplace_back("target", TargetPtrTy);
+    for (unsigned i = 0; i < TargetType->getNumParams(); i++) {
+      Parameters.emplace_back("arg" + std::to_string(i),
+                              TargetType->getParamType(i));
+    }
+
+    Arguments.emplace(Arguments.begin(), IndirectTarget(Call));
+  }
+
   // The return value, if present, comes first in the instrumentation.
   if (Return and not voidFunction) {
     Parameters.emplace(Parameters.begin(), "retval", Call->getType());
     Arguments.emplace(Arguments.begin(), Call);
   }
 
-  bool InstrAfterCall = Return;
-  Strategy->Instrument(Call, InstrName, FormatStringPrefix, Parameters,
-                       Arguments, Md, Transforms, VarArgs, InstrAfterCall);
+  Transforms = ShiftTransforms(Transforms,
+                               Arguments.size() - Call->getNumArgOperands());
 
-  return true;
+  bool InstrAfterCall = Return;
+  return Probe(Opts, Call, InstrName, FormatStringPrefix, Parameters,
+               Arguments, Md, Transforms, VarArgs, InstrAfterCall);
 }
 
 bool Instrumenter::Instrument(Function &Fn, const Policy::Directions &D,
-                              loom::Metadata Md, std::vector<loom::Transform> Transforms) {
+                              loom::Metadata Md, std::vector<loom::Transform> Transforms,
+                              ProbeOptions Opts) {
   bool ModifiedIR = false;
 
   for (auto Dir : D) {
-    ModifiedIR |= Instrument(Fn, Dir, Md, Transforms);
+    ModifiedIR |= Instrument(Fn, Dir, Md, Transforms, Opts);
   }
 
   return ModifiedIR;
 }
 
 bool Instrumenter::Instrument(Function &Fn, Policy::Direction Dir,
-                              loom::Metadata Md, std::vector<loom::Transform> Transforms) {
+                              loom::Metadata Md, std::vector<loom::Transform> Transforms,
+                              ProbeOptions Opts) {
+  if (Opts.Kind == ProbeOptions::Action::Skip) {
+    return false;
+  }
+
   const bool Return = (Dir == Policy::Direction::Out);
   const string Description = Return ? "leave" : "enter";
-  StringRef FnName = Fn.getName();
+  StringRef FnName = SourceName(Fn);
   const bool VarArgs = Fn.isVarArg();
 
   if (VarArgs) {
@@ -363,9 +484,15 @@ bool Instrumenter::Instrument(Function &Fn, Policy::Direction Dir,
 
   const string InstrName = Name({Description, FnName});
   string FormatStringPrefix = (Description + " " + FnName + ":").str();
+  Transforms = ShiftTransforms(Transforms, Arguments.size() - Fn.arg_size());
 
   if (Return) {
-    // Instrument all returns from the function:
+    // Instrument all returns from the function, optionally after merging
+    // them so that a single copy of the instrumentation is needed:
+    if (Opts.SingleExit) {
+      MergeReturns(Fn);
+    }
+
     SmallVector<ReturnInst *, 4> Returns;
 
     for (auto &Block : Fn) {
@@ -385,8 +512,8 @@ bool Instrumenter::Instrument(Function &Fn, Policy::Direction Dir,
         FormatStringPrefix.append(" %%void%%");
       }
 
-      Strategy->Instrument(Ret, InstrName, FormatStringPrefix, InstrParameters,
-                           Arguments, Md, Transforms, VarArgs);
+      Probe(Opts, Ret, InstrName, FormatStringPrefix, InstrParameters,
+            Arguments, Md, Transforms, VarArgs);
     }
 
   } else {
@@ -394,8 +521,8 @@ bool Instrumenter::Instrument(Function &Fn, Policy::Direction Dir,
     assert(not Fn.getBasicBlockList().empty());
     BasicBlock &Entry = Fn.getBasicBlockList().front();
 
-    Strategy->Instrument(&Entry.front(), InstrName, FormatStringPrefix,
-                         InstrParameters, Arguments, Md, Transforms, VarArgs);
+    Probe(Opts, &Entry.front(), InstrName, FormatStringPrefix,
+          InstrParameters, Arguments, Md, Transforms, VarArgs);
   }
 
   return true;
@@ -403,7 +530,8 @@ bool Instrumenter::Instrument(Function &Fn, Policy::Direction Dir,
 
 bool Instrumenter::Instrument(GetElementPtrInst *GEP, LoadInst *Load,
                               StringRef FieldName, loom::Metadata Md, 
-							  std::vector<loom::Transform> Transforms) {
+							  std::vector<loom::Transform> Transforms,
+							  ProbeOptions Opts) {
   StructType *SourceType = dyn_cast<StructType>(GEP->getSourceElementType());
   assert(SourceType);
   assert(SourceType->getName().startswith("struct."));
@@ -425,15 +553,14 @@ bool Instrumenter::Instrument(GetElementPtrInst *GEP, LoadInst *Load,
   const string FormatStringPrefix =
       (StructName + "." + FieldName + " load:").str();
 
-  Strategy->Instrument(Load, InstrName, FormatStringPrefix, Parameters,
-                       Arguments, Md, Transforms, false, true);
-
-  return true;
+  return Probe(Opts, Load, InstrName, FormatStringPrefix, Parameters,
+               Arguments, Md, Transforms, false, true);
 }
 
 bool Instrumenter::Instrument(GetElementPtrInst *GEP, StoreInst *Store,
                               StringRef FieldName, loom::Metadata Md,
-							  std::vector<loom::Transform> Transforms) {
+							  std::vector<loom::Transform> Transforms,
+							  ProbeOptions Opts) {
   StructType *SourceType = dyn_cast<StructType>(GEP->getSourceElementType());
   assert(SourceType);
   assert(SourceType->getName().startswith("struct."));
@@ -455,12 +582,640 @@ bool Instrumenter::Instrument(GetElementPtrInst *GEP, StoreInst *Store,
   const string FormatStringPrefix =
       (StructName + "." + FieldName + " store:").str();
 
-  Strategy->Instrument(Store, InstrName, FormatStringPrefix, Parameters,
-                       Arguments, Md, Transforms);
+  return Probe(Opts, Store, InstrName, FormatStringPrefix, Parameters,
+               Arguments, Md, Transforms);
+}
+
+bool Instrumenter::Summarize(GetElementPtrInst *GEP, StoreInst *Store,
+                             StringRef FieldName, BasicBlock *Preheader,
+                             ArrayRef<BasicBlock *> Exits, bool Unsigned,
+                             loom::Metadata Md,
+                             std::vector<loom::Transform> Transforms) {
+  Value *V = Store->getValueOperand();
+  Type *T = V->getType();
+  const bool FloatingPoint = T->isFloatingPointTy();
+
+  if (not T->isIntegerTy() and not FloatingPoint) {
+    return false;
+  }
+
+  // Structure fields are named struct.field; globals are just named.
+  std::vector<std::string> Components{"summary"};
+  string Target;
+  auto *SourceType = dyn_cast<StructType>(GEP->getSourceElementType());
+  if (SourceType and SourceType->getName().startswith("struct.")) {
+    const string StructName = SourceType->getName().substr(7);
+    Components.insert(Components.end(),
+                      {"struct", StructName, "field", FieldName});
+    Target = (StructName + "." + FieldName).str();
+  } else {
+    Components.insert(Components.end(), {"global", FieldName});
+    Target = FieldName.str();
+  }
+
+  const string InstrName = Name(Components);
+  const string FormatStringPrefix = Target + " summary:";
+
+  Function *Fn = Store->getFunction();
+  IntegerType *CountTy = IntegerType::get(Mod.getContext(), 64);
+  Constant *Zero = ConstantInt::get(CountTy, 0);
+
+  // The summary is accumulated in the instrumented function's stack frame.
+  IRBuilder<> Entry(&*Fn->getEntryBlock().getFirstInsertionPt());
+  Value *Count = Entry.CreateAlloca(CountTy, nullptr, "loom.count");
+  Value *First = Entry.CreateAlloca(T, nullptr, "loom.first");
+  Value *Last = Entry.CreateAlloca(T, nullptr, "loom.last");
+  Value *Min = Entry.CreateAlloca(T, nullptr, "loom.min");
+  Value *Max = Entry.CreateAlloca(T, nullptr, "loom.max");
+
+  // Start counting afresh every time we enter the loop.
+  IRBuilder<>(Preheader->getTerminator()).CreateStore(Zero, Count);
+
+  // Accumulate the summary at every write within the loop.
+  IRBuilder<> B(Store);
+  Value *N = B.CreateLoad(Count);
+  Value *IsFirst = B.CreateICmpEQ(N, Zero);
+
+  Value *OldMin = B.CreateLoad(Min);
+  Value *OldMax = B.CreateLoad(Max);
+  Value *Less, *Greater;
+  if (FloatingPoint) {
+    Less = B.CreateFCmpOLT(V, OldMin);
+    Greater = B.CreateFCmpOGT(V, OldMax);
+  } else if (Unsigned) {
+    Less = B.CreateICmpULT(V, OldMin);
+    Greater = B.CreateICmpUGT(V, OldMax);
+  } else {
+    Less = B.CreateICmpSLT(V, OldMin);
+    Greater = B.CreateICmpSGT(V, OldMax);
+  }
+
+  B.CreateStore(B.CreateSelect(IsFirst, V, B.CreateLoad(First)), First);
+  B.CreateStore(V, Last);
+  B.CreateStore(B.CreateSelect(B.CreateOr(IsFirst, Less), V, OldMin), Min);
+  B.CreateStore(B.CreateSelect(B.CreateOr(IsFirst, Greater), V, OldMax), Max);
+  B.CreateStore(B.CreateAdd(N, ConstantInt::get(CountTy, 1)), Count);
+
+  ParamVec Parameters{
+      {"source", GEP->getPointerOperandType()},
+      {"iterations", CountTy},
+      {"first", T},
+      {"last", T},
+      {"min", T},
+      {"max", T},
+  };
+
+  // Log the summary on every way out of the loop, as long as the loop
+  // actually wrote something.
+  for (BasicBlock *Exit : Exits) {
+    Instruction *SplitPoint = &*Exit->getFirstInsertionPt();
+    IRBuilder<> ExitBuilder(SplitPoint);
+    Value *Written = ExitBuilder.CreateICmpNE(ExitBuilder.CreateLoad(Count),
+                                              Zero);
+
+    Instruction *Then = SplitBlockAndInsertIfThen(Written, SplitPoint, false);
+    IRBuilder<> Summary(Then);
+
+    vector<Value *> Arguments{
+        GEP->getPointerOperand(), Summary.CreateLoad(Count),
+        Summary.CreateLoad(First), Summary.CreateLoad(Last),
+        Summary.CreateLoad(Min),   Summary.CreateLoad(Max),
+    };
+
+    Strategy->Instrument(Then, InstrName, FormatStringPrefix, Parameters,
+                         Arguments, Md, Transforms);
+  }
 
   return true;
 }
 
+bool Instrumenter::Probe(const ProbeOptions &Opts, Instruction *I,
+                         StringRef InstrName, StringRef Description,
+                         ArrayRef<Parameter> Params, ArrayRef<Value *> Values,
+                         loom::Metadata Md, vector<loom::Transform> Transforms,
+                         bool VarArgs, bool AfterInst, bool SuppressUniqueness) {
+  if (Opts.Kind == ProbeOptions::Action::Skip) {
+    return false;
+  }
+
+  // Events that don't pass the probe's filter skip everything else
+  // (logging, sampling or counting), costing only the filter's comparisons.
+  if (Opts.When) {
+    Instruction *Where = GuardPoint(I, AfterInst);
+    IRBuilder<> B(Where);
+
+    if (Value *Pass = Opts.When->Compile(B, Params, Values, Opts.Signature)) {
+      I = SplitBlockAndInsertIfThen(Pass, Where, false);
+      AfterInst = false;
+    } else {
+      errs() << "Warning: ignoring filter '" << Opts.When->Source()
+             << "' for " << InstrName << "\n";
+    }
+  }
+
+  // Rate-limited probes also log the number of events dropped (since the
+  // last event that was logged) after the event's own values.
+  auto Log = [&](Instruction *At, bool After) {
+    if (Opts.MaxRate == 0) {
+      Strategy->Instrument(At, InstrName, Description, Params, Values, Md,
+                           Transforms, VarArgs, After, SuppressUniqueness);
+      return;
+    }
+
+    Value *Dropped;
+    At = RateLimit(GuardPoint(At, After), InstrName, Opts.MaxRate, Dropped);
+
+    ParamVec LimitedParams(Params.begin(), Params.end());
+    LimitedParams.emplace_back("dropped", Dropped->getType());
+    vector<Value *> LimitedValues(Values.begin(), Values.end());
+    LimitedValues.push_back(Dropped);
+
+    Strategy->Instrument(At, InstrName, Description, LimitedParams,
+                         LimitedValues, Md, Transforms, VarArgs, false,
+                         SuppressUniqueness);
+  };
+
+  if (Opts.Kind == ProbeOptions::Action::Log) {
+    Log(I, AfterInst);
+    return true;
+  }
+
+  Instruction *Where = GuardPoint(I, AfterInst);
+  IRBuilder<> B(Where);
+  MDBuilder MDB(Mod.getContext());
+
+  if (Opts.Kind == ProbeOptions::Action::Sample) {
+    // Log one event in every SampleRate, counting down to the next sample.
+    // Sites that share instrumentation may be sampled at different rates,
+    // so each site has its own counter.
+    const unsigned Rate = std::max(Opts.SampleRate, 1u);
+    const unsigned Site = SampledSites[InstrName]++;
+    GlobalVariable *Count =
+        Counter((InstrName + "_sample_" + Twine(Site)).str());
+
+    Value *N = B.CreateAdd(B.CreateLoad(Count), B.getInt64(1));
+    Value *Fire = B.CreateICmpUGE(N, B.getInt64(Rate));
+    B.CreateStore(B.CreateSelect(Fire, B.getInt64(0), N), Count);
+
+    Instruction *Then = SplitBlockAndInsertIfThen(
+        Fire, Where, false, MDB.createBranchWeights(1, Rate - 1));
+
+    Log(Then, false);
+    return true;
+  }
+
+  // Aggregate: just count events here, logging the count at exit.
+  const string CountName = (InstrName + "_count").str();
+  const bool FirstSite = not Mod.getNamedGlobal(CountName);
+  GlobalVariable *Count = Counter(CountName);
+  B.CreateStore(B.CreateAdd(B.CreateLoad(Count), B.getInt64(1)), Count);
+
+  // Every site with the same instrumentation shares a counter and exit event.
+  if (FirstSite) {
+    ReturnInst *Ret = AtExit();
+    IRBuilder<> Exit(Ret);
+    Value *Total = Exit.CreateLoad(Count);
+    Instruction *Then = SplitBlockAndInsertIfThen(
+        Exit.CreateICmpNE(Total, Exit.getInt64(0)), Ret, false);
+
+    ParamVec CountParams{{"count", Total->getType()}};
+    vector<Value *> CountValues{Total};
+    Strategy->Instrument(Then, (InstrName + "_aggregate").str(),
+                         (Description.rtrim(':') + " aggregate:").str(),
+                         CountParams, CountValues, Md,
+                         vector<loom::Transform>());
+  }
+
+  return true;
+}
+
+Instruction *Instrumenter::GuardPoint(Instruction *I, bool AfterInst) {
+  // Don't split the entry block before its allocas: they must stay in the
+  // entry block.
+  Instruction *Where = AfterInst ? I->getNextNode() : I;
+  if (isa<PHINode>(Where)) {
+    Where = &*Where->getParent()->getFirstInsertionPt();
+  }
+  if (Where->getParent() == &Where->getFunction()->getEntryBlock()) {
+    while (isa<AllocaInst>(Where)) {
+      Where = Where->getNextNode();
+    }
+  }
+
+  return Where;
+}
+
+Instruction *Instrumenter::RateLimit(Instruction *Where, StringRef InstrName,
+                                     unsigned MaxRate, Value *&Dropped) {
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *Int64 = Type::getInt64Ty(Ctx);
+  MDBuilder MDB(Ctx);
+
+  // Tokens are counted in thousandths of an event, so that buckets can be
+  // refilled from a millisecond clock without any division. A full bucket
+  // holds one second's worth of events.
+  const uint64_t Cost = 1000;
+  const uint64_t Capacity = uint64_t(MaxRate) * Cost;
+
+  // Every module that probes the same event shares its bucket, so the limit
+  // applies to the event rather than to each translation unit.
+  auto Bucket = [&](StringRef Suffix) {
+    GlobalVariable *G = Counter((InstrName + Suffix).str(), true);
+    G->setLinkage(GlobalValue::LinkOnceODRLinkage);
+    G->setVisibility(GlobalValue::HiddenVisibility);
+    return G;
+  };
+
+  GlobalVariable *Tokens = Bucket("_tokens");
+  GlobalVariable *Refilled = Bucket("_refilled");
+  GlobalVariable *DropCount = Bucket("_dropped");
+
+  BasicBlock *Head = Where->getParent();
+  BasicBlock *Tail = Head->splitBasicBlock(Where, "ratelimit.done");
+  Function *Fn = Head->getParent();
+
+  auto *Refill = BasicBlock::Create(Ctx, "ratelimit.refill", Fn, Tail);
+  auto *Check = BasicBlock::Create(Ctx, "ratelimit.check", Fn, Tail);
+  auto *Drop = BasicBlock::Create(Ctx, "ratelimit.drop", Fn, Tail);
+  auto *Accept = BasicBlock::Create(Ctx, "ratelimit.accept", Fn, Tail);
+
+  // Only look at the clock when the bucket runs dry.
+  Head->getTerminator()->eraseFromParent();
+  IRBuilder<> B(Head);
+  Value *Available = B.CreateLoad(Tokens);
+  B.CreateCondBr(B.CreateICmpUGE(Available, B.getInt64(Cost)), Check, Refill,
+                 MDB.createBranchWeights(1000, 1));
+
+  B.SetInsertPoint(Refill);
+  Value *Now = B.CreateCall(CoarseClock(), {}, "now");
+  Value *Elapsed = B.CreateSub(Now, B.CreateLoad(Refilled));
+  B.CreateStore(Now, Refilled);
+  Elapsed = B.CreateSelect(B.CreateICmpULT(Elapsed, B.getInt64(1000)),
+                           Elapsed, B.getInt64(1000));
+  Value *Topped = B.CreateAdd(Available,
+                              B.CreateMul(Elapsed, B.getInt64(MaxRate)));
+  Topped = B.CreateSelect(B.CreateICmpULT(Topped, B.getInt64(Capacity)),
+                          Topped, B.getInt64(Capacity));
+  B.CreateBr(Check);
+
+  B.SetInsertPoint(Check);
+  PHINode *Current = B.CreatePHI(Int64, 2, "tokens");
+  Current->addIncoming(Available, Head);
+  Current->addIncoming(Topped, Refill);
+  B.CreateCondBr(B.CreateICmpUGE(Current, B.getInt64(Cost)), Accept, Drop);
+
+  B.SetInsertPoint(Drop);
+  B.CreateStore(B.CreateAdd(B.CreateLoad(DropCount), B.getInt64(1)),
+                DropCount);
+  B.CreateStore(Current, Tokens);
+  B.CreateBr(Tail);
+
+  B.SetInsertPoint(Accept);
+  B.CreateStore(B.CreateSub(Current, B.getInt64(Cost)), Tokens);
+  Dropped = B.CreateLoad(DropCount, "dropped");
+  B.CreateStore(B.getInt64(0), DropCount);
+
+  return B.CreateBr(Tail);
+}
+
+Function *Instrumenter::CoarseClock() {
+  const char *FnName = "__loom_coarse_clock_ms";
+  if (Function *F = Mod.getFunction(FnName)) {
+    return F;
+  }
+
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *Int32 = Type::getInt32Ty(Ctx);
+  IntegerType *Int64 = Type::getInt64Ty(Ctx);
+
+  auto *F = Function::Create(FunctionType::get(Int64, false),
+                             GlobalValue::LinkOnceODRLinkage, FnName, &Mod);
+  F->setVisibility(GlobalValue::HiddenVisibility);
+
+  IRBuilder<> B(BasicBlock::Create(Ctx, "entry", F));
+  Triple T(Mod.getTargetTriple());
+
+  // Linux and FreeBSD have clocks that are read from the vDSO (or shared
+  // page) without any hardware access, at the cost of some precision.
+  int ClockID = -1;
+  if (T.isOSLinux()) {
+    ClockID = 6; // CLOCK_MONOTONIC_COARSE
+  } else if (T.isOSFreeBSD()) {
+    ClockID = 12; // CLOCK_MONOTONIC_FAST
+  }
+
+  if (ClockID < 0) {
+    // Elsewhere, settle for time(3)'s one-second resolution.
+    PointerType *TimePtr = Int64->getPointerTo();
+    Constant *Time = Mod.getOrInsertFunction(
+        "time", FunctionType::get(Int64, {TimePtr}, false));
+    Value *Seconds = B.CreateCall(Time, {ConstantPointerNull::get(TimePtr)});
+    B.CreateRet(B.CreateMul(Seconds, B.getInt64(1000)));
+    return F;
+  }
+
+  // struct timespec is { time_t, long }: both are pointer-sized on the
+  // platforms that we know clock IDs for.
+  IntegerType *Long = Mod.getDataLayout().getIntPtrType(Ctx);
+  StructType *TimeSpec = StructType::get(Ctx, {Long, Long});
+  Constant *GetTime = Mod.getOrInsertFunction(
+      "clock_gettime",
+      FunctionType::get(Int32, {Int32, TimeSpec->getPointerTo()}, false));
+
+  Value *TS = B.CreateAlloca(TimeSpec);
+  B.CreateCall(GetTime, {B.getInt32(ClockID), TS});
+  Value *Sec = B.CreateSExt(B.CreateLoad(B.CreateStructGEP(TimeSpec, TS, 0)),
+                            Int64);
+  Value *NSec = B.CreateSExt(B.CreateLoad(B.CreateStructGEP(TimeSpec, TS, 1)),
+                             Int64);
+  B.CreateRet(B.CreateAdd(B.CreateMul(Sec, B.getInt64(1000)),
+                          B.CreateUDiv(NSec, B.getInt64(1000000))));
+
+  return F;
+}
+
+GlobalVariable *Instrumenter::Counter(StringRef CounterName,
+                                      bool ThreadLocal) {
+  if (GlobalVariable *G = Mod.getNamedGlobal(CounterName)) {
+    return G;
+  }
+
+  IntegerType *CountTy = IntegerType::get(Mod.getContext(), 64);
+  auto *G = new GlobalVariable(Mod, CountTy, false,
+                               GlobalValue::InternalLinkage,
+                               ConstantInt::get(CountTy, 0), CounterName);
+  if (ThreadLocal) {
+    G->setThreadLocalMode(GlobalValue::GeneralDynamicTLSModel);
+  }
+
+  return G;
+}
+
+bool Instrumenter::ProfileTargets(CallInst *Call, unsigned Targets) {
+  assert(not Call->getCalledFunction());
+  assert(Targets > 0);
+
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *CountTy = IntegerType::get(Ctx, 64);
+  IntegerType *IndexTy = IntegerType::get(Ctx, 32);
+  PointerType *TargetPtrTy = Type::getInt8PtrTy(Ctx);
+
+  const string Caller = SourceName(*Call->getFunction());
+  const string Site = std::to_string(IndirectCallSite(Call));
+
+  // Each call site gets a table of {target,count} entries, with one extra
+  // entry at the end for targets that don't fit in the table.
+  Function *Profiler = TargetProfiler();
+  auto *EntryTy = cast<StructType>(
+      cast<PointerType>(Profiler->getFunctionType()->getParamType(1))
+          ->getElementType());
+  auto *TableTy = ArrayType::get(EntryTy, Targets + 1);
+
+  auto *Table = new GlobalVariable(Mod, TableTy, false,
+                                   GlobalValue::InternalLinkage,
+                                   ConstantAggregateZero::get(TableTy),
+                                   Name({"targets", Caller, Site}));
+
+  Constant *Zero = ConstantInt::get(IndexTy, 0);
+  Constant *Slots = ConstantInt::get(IndexTy, Targets);
+
+  IRBuilder<> B(Call);
+  B.CreateCall(Profiler,
+               {IndirectTarget(Call), ConstantExpr::getInBoundsGetElementPtr(
+                            TableTy, Table, ArrayRef<Constant *>{Zero, Zero}),
+                Slots});
+
+  // On exit, log every entry in the table that was actually used.
+  ReturnInst *Ret = AtExit();
+  BasicBlock *Before = Ret->getParent();
+  BasicBlock *After = Before->splitBasicBlock(Ret, "targets.done");
+  Function *Fn = Before->getParent();
+
+  auto *Loop = BasicBlock::Create(Ctx, "targets.entry", Fn, After);
+  auto *Log = BasicBlock::Create(Ctx, "targets.log", Fn, After);
+  auto *Next = BasicBlock::Create(Ctx, "targets.next", Fn, After);
+
+  Before->getTerminator()->eraseFromParent();
+  IRBuilder<>(Before).CreateBr(Loop);
+
+  IRBuilder<> L(Loop);
+  PHINode *Index = L.CreatePHI(IndexTy, 2, "index");
+  Index->addIncoming(Zero, Before);
+
+  Value *Entry = L.CreateInBoundsGEP(TableTy, Table, {Zero, Index});
+  Value *EntryTarget = L.CreateLoad(L.CreateStructGEP(EntryTy, Entry, 0));
+  Value *Count = L.CreateLoad(L.CreateStructGEP(EntryTy, Entry, 1));
+  L.CreateCondBr(L.CreateICmpNE(Count, ConstantInt::get(CountTy, 0)), Log,
+                 Next);
+
+  Instruction *LogEnd = IRBuilder<>(Log).CreateBr(Next);
+  ParamVec Parameters{{"target", TargetPtrTy}, {"count", CountTy}};
+  vector<Value *> Arguments{EntryTarget, Count};
+  Strategy->Instrument(LogEnd, Name({"targets", "indirect", Caller, Site}),
+                       "targets indirect " + Caller + "#" + Site + ":",
+                       Parameters, Arguments, loom::Metadata(),
+                       vector<loom::Transform>());
+
+  IRBuilder<> N(Next);
+  Value *NextIndex = N.CreateAdd(Index, ConstantInt::get(IndexTy, 1));
+  Index->addIncoming(NextIndex, Next);
+  N.CreateCondBr(N.CreateICmpULE(NextIndex, Slots), Loop, After);
+
+  return true;
+}
+
+ConstantInt *Instrumenter::InstructionSite(Instruction *I,
+                                           StringRef Description) {
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *SiteTy = IntegerType::get(Ctx, 64);
+
+  const uint64_t ModuleBits = MD5Hash(Mod.getModuleIdentifier()) << 32;
+  ConstantInt *Site = ConstantInt::get(SiteTy, ModuleBits | InstructionSites++);
+
+  if (not Triple(Mod.getTargetTriple()).isOSBinFormatELF()) {
+    return Site;
+  }
+
+  StringRef File;
+  unsigned Line = 0, Column = 0;
+  if (const DILocation *Loc = I->getDebugLoc()) {
+    File = Loc->getFilename();
+    Line = Loc->getLine();
+    Column = Loc->getColumn();
+  }
+
+  PointerType *BytePtr = Type::getInt8PtrTy(Ctx);
+  IntegerType *LineTy = IntegerType::get(Ctx, 32);
+  StructType *EntryTy =
+      StructType::get(SiteTy, BytePtr, BytePtr, LineTy, LineTy, BytePtr);
+
+  auto *Entry = new GlobalVariable(
+      Mod, EntryTy, true, GlobalValue::InternalLinkage,
+      ConstantStruct::get(EntryTy,
+                          {Site, SiteString(I->getFunction()->getName()),
+                           SiteString(File), ConstantInt::get(LineTy, Line),
+                           ConstantInt::get(LineTy, Column),
+                           SiteString(Description)}),
+      "loom_site");
+  Entry->setSection("loom_sites");
+  Entry->setAlignment(8);
+
+  appendToCompilerUsed(Mod, {Entry});
+
+  return Site;
+}
+
+Constant *Instrumenter::SiteString(StringRef S) {
+  Constant *&Str = SiteStrings[S];
+  if (Str) {
+    return Str;
+  }
+
+  LLVMContext &Ctx = Mod.getContext();
+  Constant *Init = ConstantDataArray::getString(Ctx, S);
+  auto *G = new GlobalVariable(Mod, Init->getType(), true,
+                               GlobalValue::PrivateLinkage, Init,
+                               "loom_site_string");
+  G->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  Str = ConstantExpr::getPointerCast(G, Type::getInt8PtrTy(Ctx));
+  return Str;
+}
+
+unsigned Instrumenter::IndirectCallSite(CallInst *Call) {
+  auto i = IndirectCallSites.find(Call);
+  if (i != IndirectCallSites.end()) {
+    return i->second;
+  }
+
+  // Number all of the function's indirect calls in order, so that names
+  // don't depend on the order in which call sites are instrumented.
+  unsigned Site = 0;
+  for (auto &Inst : instructions(*Call->getFunction())) {
+    if (auto *C = dyn_cast<CallInst>(&Inst)) {
+      if (not C->getCalledFunction() and not C->isInlineAsm()) {
+        IndirectCallSites[C] = Site++;
+      }
+    }
+  }
+
+  assert(IndirectCallSites.count(Call));
+  return IndirectCallSites[Call];
+}
+
+Value *Instrumenter::IndirectTarget(CallInst *Call) {
+  Value *&Target = IndirectTargets[Call];
+  if (not Target) {
+    Target = IRBuilder<>(Call).CreatePointerCast(
+        Call->getCalledValue(), Type::getInt8PtrTy(Mod.getContext()));
+  }
+
+  return Target;
+}
+
+Function *Instrumenter::TargetProfiler() {
+  const string ProfilerName = Name({"profile", "target"});
+  if (Function *F = Mod.getFunction(ProfilerName)) {
+    return F;
+  }
+
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *CountTy = IntegerType::get(Ctx, 64);
+  IntegerType *IndexTy = IntegerType::get(Ctx, 32);
+  PointerType *TargetPtrTy = Type::getInt8PtrTy(Ctx);
+  StructType *EntryTy = StructType::get(Ctx, {TargetPtrTy, CountTy});
+
+  // void profile_target(i8 *target, {i8*,i64} *table, i32 slots)
+  auto *FT = FunctionType::get(Type::getVoidTy(Ctx),
+                               {TargetPtrTy, EntryTy->getPointerTo(), IndexTy},
+                               false);
+  Function *F = Function::Create(FT, GlobalValue::InternalLinkage,
+                                 ProfilerName, &Mod);
+
+  auto Args = F->arg_begin();
+  Value *Target = &*Args++;
+  Value *Table = &*Args++;
+  Value *Slots = &*Args++;
+  Target->setName("target");
+  Table->setName("table");
+  Slots->setName("slots");
+
+  auto *Entry = BasicBlock::Create(Ctx, "entry", F);
+  auto *Loop = BasicBlock::Create(Ctx, "search", F);
+  auto *Empty = BasicBlock::Create(Ctx, "check_empty", F);
+  auto *Claim = BasicBlock::Create(Ctx, "claim", F);
+  auto *Next = BasicBlock::Create(Ctx, "next", F);
+  auto *Hit = BasicBlock::Create(Ctx, "hit", F);
+  auto *Other = BasicBlock::Create(Ctx, "other", F);
+
+  Constant *Zero = ConstantInt::get(IndexTy, 0);
+  Constant *One = ConstantInt::get(CountTy, 1);
+  Constant *Null = ConstantPointerNull::get(TargetPtrTy);
+  const auto Order = AtomicOrdering::Monotonic;
+  const DataLayout &DL = Mod.getDataLayout();
+
+  IRBuilder<> B(Entry);
+  B.CreateBr(Loop);
+
+  // Look for the target (or an empty slot) in the table.
+  B.SetInsertPoint(Loop);
+  PHINode *Index = B.CreatePHI(IndexTy, 2, "index");
+  Index->addIncoming(Zero, Entry);
+  Value *Slot = B.CreateInBoundsGEP(EntryTy, Table, Index);
+  Value *SlotTarget = B.CreateStructGEP(EntryTy, Slot, 0);
+  LoadInst *Existing = B.CreateLoad(SlotTarget);
+  Existing->setAtomic(Order);
+  Existing->setAlignment(DL.getABITypeAlignment(TargetPtrTy));
+  B.CreateCondBr(B.CreateICmpEQ(Existing, Target), Hit, Empty);
+
+  // Only contend for slots that look empty.
+  B.SetInsertPoint(Empty);
+  B.CreateCondBr(B.CreateICmpEQ(Existing, Null), Claim, Next);
+
+  // Another thread may claim the slot first (possibly for the same target).
+  B.SetInsertPoint(Claim);
+  Value *Prev = B.CreateExtractValue(
+      B.CreateAtomicCmpXchg(SlotTarget, Null, Target, Order, Order), 0);
+  B.CreateCondBr(B.CreateOr(B.CreateICmpEQ(Prev, Null),
+                            B.CreateICmpEQ(Prev, Target)),
+                 Hit, Next);
+
+  B.SetInsertPoint(Next);
+  Value *NextIndex = B.CreateAdd(Index, ConstantInt::get(IndexTy, 1));
+  Index->addIncoming(NextIndex, Next);
+  B.CreateCondBr(B.CreateICmpULT(NextIndex, Slots), Loop, Other);
+
+  B.SetInsertPoint(Hit);
+  B.CreateAtomicRMW(AtomicRMWInst::Add, B.CreateStructGEP(EntryTy, Slot, 1),
+                    One, Order);
+  B.CreateRetVoid();
+
+  // The table is full: count this call in the final "other" entry.
+  B.SetInsertPoint(Other);
+  Value *Overflow = B.CreateInBoundsGEP(EntryTy, Table, Slots);
+  B.CreateAtomicRMW(AtomicRMWInst::Add,
+                    B.CreateStructGEP(EntryTy, Overflow, 1), One, Order);
+  B.CreateRetVoid();
+
+  return F;
+}
+
+ReturnInst *Instrumenter::AtExit() {
+  if (not ExitReturn) {
+    LLVMContext &Ctx = Mod.getContext();
+    auto *FT = FunctionType::get(Type::getVoidTy(Ctx), false);
+
+    Function *F = Function::Create(FT, GlobalValue::InternalLinkage,
+                                   Name({"at", "exit"}), &Mod);
+    ExitReturn =
+        IRBuilder<>(BasicBlock::Create(Ctx, "entry", F)).CreateRetVoid();
+
+    appendToGlobalDtors(Mod, F, 65535);
+  }
+
+  return ExitReturn;
+}
+
 bool Instrumenter::InitializeLoggers(llvm::Function &Main) {
 
   assert(Main.getName().startswith("main"));
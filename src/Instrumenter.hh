@@ -44,6 +44,9 @@
 
 #include "Instrumentation.hh"
 #include "Policy.hh"
+#include "ProbeOptions.hh"
+
+#include <llvm/ADT/DenseMap.h>
 
 #include <functional>
 
@@ -71,36 +74,83 @@ public:
                                               std::unique_ptr<InstrStrategy>);
 
   /// Instrument an instruction generically: instruction name and values.
-  bool Instrument(llvm::Instruction *, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+  bool Instrument(llvm::Instruction *, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+                  ProbeOptions = ProbeOptions());
 
   /// Instrument an instruction generically with better info: instruction type
   /// and values.
   bool InstrumentPtrInsts(llvm::Instruction *, const llvm::DIVariable *,
-		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+		  ProbeOptions = ProbeOptions());
 
   /// Instrument a function call in the call and/or return direction.
   bool Instrument(llvm::CallInst *, const Policy::Directions &,
-		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+		  ProbeOptions = ProbeOptions());
 
   /// Instrument a function call (caller-side), either calling or returning.
   bool Instrument(llvm::CallInst *Call, Policy::Direction,
-		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+		  Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+		  ProbeOptions = ProbeOptions());
 
   /// Instrument a function entry and/or exit.
   bool Instrument(llvm::Function &, const Policy::Directions &,
-    Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+    Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+    ProbeOptions = ProbeOptions());
 
   /// Instrument a function entry or exit.
   bool Instrument(llvm::Function &, Policy::Direction, 
-    Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+    Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+    ProbeOptions = ProbeOptions());
 
   /// Instrument a read from a structure field.
   bool Instrument(llvm::GetElementPtrInst *, llvm::LoadInst *,
-                  llvm::StringRef FieldName, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+                  llvm::StringRef FieldName, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+                  ProbeOptions = ProbeOptions());
 
   /// Instrument a write to a structure field.
   bool Instrument(llvm::GetElementPtrInst *, llvm::StoreInst *,
-                  llvm::StringRef FieldName, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>());
+                  llvm::StringRef FieldName, Metadata = Metadata(), std::vector<Transform> = std::vector<Transform>(),
+                  ProbeOptions = ProbeOptions());
+
+  /**
+   * Summarize a loop-invariant write within a loop.
+   *
+   * Rather than logging every iteration, accumulate the number of writes,
+   * the first and last values written and their minimum and maximum, then
+   * log that summary once on each exit from the loop (if anything was written).
+   *
+   * @param   GEP         the field (or global) lookup being written to
+   * @param   Store       the write, which must be an integer or floating-point
+   * @param   FieldName   the name of the field or global being written to
+   * @param   Preheader   block that executes once before the loop is entered
+   * @param   Exits       the loop's exit blocks, which must be dedicated
+   *                      (i.e., only reachable from within the loop)
+   * @param   Unsigned    compare integer values as unsigned when finding
+   *                      the minimum and maximum
+   */
+  bool Summarize(llvm::GetElementPtrInst *GEP, llvm::StoreInst *Store,
+                 llvm::StringRef FieldName, llvm::BasicBlock *Preheader,
+                 llvm::ArrayRef<llvm::BasicBlock *> Exits, bool Unsigned,
+                 Metadata = Metadata(),
+                 std::vector<Transform> = std::vector<Transform>());
+
+  /**
+   * Profile the targets of an indirect call site.
+   *
+   * Every call through the site records its target in a small per-site table
+   * with room for @b Targets distinct targets; calls to any other targets are
+   * counted together in a final, null-target entry. The table is logged
+   * (one event per target that was called) when the program exits.
+   */
+  bool ProfileTargets(llvm::CallInst *, unsigned Targets);
+
+  /**
+   * Find the return instruction of a function that will run when the program
+   * exits, creating the function (and registering it as a destructor) if
+   * necessary. Code added before this instruction runs at exit.
+   */
+  llvm::ReturnInst *AtExit();
 
   /// Add initialization required by Loggers
   bool InitializeLoggers(llvm::Function &);
@@ -141,10 +191,79 @@ private:
 
   uint32_t FieldNumber(llvm::GetElementPtrInst *);
 
+  /**
+   * Instrument a probe site according to its @ref ProbeOptions: log every
+   * event, skip the site, or guard the instrumentation so that it samples
+   * or counts (aggregates) events. Events can also be filtered before any
+   * of these actions and logged events can be rate-limited.
+   * Otherwise like InstrStrategy::Instrument.
+   */
+  bool Probe(const ProbeOptions &, llvm::Instruction *, llvm::StringRef Name,
+             llvm::StringRef Description, llvm::ArrayRef<Parameter> Params,
+             llvm::ArrayRef<llvm::Value *> Values, Metadata,
+             std::vector<Transform>, bool VarArgs = false,
+             bool AfterInst = false, bool SuppressUniqueness = false);
+
+  /// Find where a guard for instrumenting instruction I can be inserted.
+  llvm::Instruction *GuardPoint(llvm::Instruction *I, bool AfterInst);
+
+  /**
+   * Guard instrumentation with a per-thread token bucket shared by every
+   * site of the same instrumentation, allowing at most MaxRate events per
+   * second. Events over the limit are dropped and counted.
+   *
+   * @param   Where     where the rate limiter should be inserted
+   * @param   Dropped   set to the number of events dropped before this one
+   * @returns where instrumentation for accepted events should be inserted
+   */
+  llvm::Instruction *RateLimit(llvm::Instruction *Where, llvm::StringRef Name,
+                               unsigned MaxRate, llvm::Value *&Dropped);
+
+  /// Get (or create) a function that reads a coarse millisecond clock.
+  llvm::Function *CoarseClock();
+
+  /// Get (or create) an internal, zero-initialized 64-b counter.
+  llvm::GlobalVariable *Counter(llvm::StringRef Name,
+                                bool ThreadLocal = false);
+
+  /**
+   * Number an instruction that calls a shared (signature-keyed) hook.
+   *
+   * Site IDs carry a hash of the module's identifier in their high 32 bits,
+   * so they don't collide across modules. On ELF, each site is described by
+   * a `struct loom_site` (see loom-sites.h) in the `loom_sites` section.
+   */
+  llvm::ConstantInt *InstructionSite(llvm::Instruction *,
+                                     llvm::StringRef Description);
+
+  /// Get (or create) a private, NUL-terminated copy of a string.
+  llvm::Constant *SiteString(llvm::StringRef);
+
+  /// Find the per-function number of an indirect call site.
+  unsigned IndirectCallSite(llvm::CallInst *);
+
+  /// Get (or create) an i8* version of an indirect call's target.
+  llvm::Value *IndirectTarget(llvm::CallInst *);
+
+  /// Get (or create) the function that records an indirect call's target.
+  llvm::Function *TargetProfiler();
+
   llvm::Module &Mod;
   std::unique_ptr<InstrStrategy> Strategy;
   llvm::StringMap<std::unique_ptr<Instrumentation>> Instr;
+  llvm::DenseMap<llvm::CallInst *, unsigned> IndirectCallSites;
+  llvm::DenseMap<llvm::CallInst *, llvm::Value *> IndirectTargets;
+  llvm::ReturnInst *ExitReturn;
   NameFn Name;
+
+  //! Instructions instrumented via shared (signature-keyed) hooks so far.
+  unsigned InstructionSites = 0;
+
+  //! Sampled sites so far, by instrumentation name (see Probe).
+  llvm::StringMap<unsigned> SampledSites;
+
+  //! Strings (function and file names, descriptions) in the site table.
+  llvm::StringMap<llvm::Constant *> SiteStrings;
 };
 
 } // namespace loom
@@ -40,8 +40,9 @@ using namespace loom;
 using namespace llvm;
 using std::vector;
 
-KTraceLogger::KTraceLogger(Module &Mod, std::unique_ptr<Serializer> S, bool K)
-    : Logger(Mod), Serial(std::move(S)), KernelMode(K) {
+KTraceLogger::KTraceLogger(Module &Mod, std::unique_ptr<Serializer> S,
+                           Transport T, std::string TraceFile)
+    : Logger(Mod), Serial(std::move(S)), Target(T), TraceFile(TraceFile) {
   assert(Serial && "no Serializer passed into KTraceLogger");
 }
 
@@ -56,21 +57,71 @@ Value *KTraceLogger::Log(Instruction *I, ArrayRef<Value *> Values,
 
   LLVMContext &Ctx = Mod.getContext();
 
-  if (!KernelMode) {
+  // Whether the record was written (if the transport can drop records).
+  Value *Written = nullptr;
+
+  switch (Target) {
+  case Transport::Utrace: {
     // Send record to `utrace`:
     auto *FT = TypeBuilder<int(const void *, size_t), false>::get(Ctx);
     Constant *F = Mod.getOrInsertFunction("utrace", FT);
 
-    B.CreateCall(F, {Buffer.first, Buffer.second});
+    Written = B.CreateICmpEQ(B.CreateCall(F, {Buffer.first, Buffer.second}),
+                             B.getInt32(0));
+    break;
+  }
 
-  } else {
+  case Transport::Kernel: {
     // Send record to `ktrstruct`:
     auto *FT = TypeBuilder<void(const char *, void *, size_t), false>::get(Ctx);
     Constant *F = Mod.getOrInsertFunction("ktrstruct", FT);
     Value *Name = B.CreateGlobalStringPtr(Serial->SchemeName(), "scheme");
 
     B.CreateCall(F, {Name, Buffer.first, Buffer.second});
+    break;
+  }
+
+  case Transport::Runtime: {
+    // Copy record into the runtime's per-thread trace buffer:
+    auto *FT = TypeBuilder<int(const void *, size_t), false>::get(Ctx);
+    Constant *F = Mod.getOrInsertFunction("loom_trace_write", FT);
+
+    Written = B.CreateICmpEQ(B.CreateCall(F, {Buffer.first, Buffer.second}),
+                             B.getInt32(0));
+    break;
+  }
+
+  case Transport::SharedMemory: {
+    // Copy record into the shared-memory ring:
+    auto *FT = TypeBuilder<int(const void *, size_t), false>::get(Ctx);
+    Constant *F = Mod.getOrInsertFunction("loom_shm_write", FT);
+
+    Written = B.CreateICmpEQ(B.CreateCall(F, {Buffer.first, Buffer.second}),
+                             B.getInt32(0));
+    break;
+  }
+  }
+
+  if (Written) {
+    Serial->Written(Buffer, Written, B);
   }
 
   return Serial->Cleanup(Buffer, B);
 }
+
+bool KTraceLogger::HasInitialization() {
+  return (Target == Transport::Runtime or Target == Transport::SharedMemory)
+         and not TraceFile.empty();
+}
+
+Value *KTraceLogger::Initialize(Function &Main) {
+  LLVMContext &Ctx = Mod.getContext();
+  IRBuilder<> B(&*Main.getEntryBlock().getFirstInsertionPt());
+
+  auto *FT = TypeBuilder<int(const char *), false>::get(Ctx);
+  Constant *F = Mod.getOrInsertFunction(
+      (Target == Transport::SharedMemory) ? "loom_shm_open" : "loom_trace_open",
+      FT);
+
+  return B.CreateCall(F, B.CreateGlobalStringPtr(TraceFile, "trace_file"));
+}
@@ -35,6 +35,8 @@
 
 #include "Logger.hh"
 
+#include <string>
+
 namespace loom {
 
 class Serializer;
@@ -44,19 +46,41 @@ class Serializer;
  * to the BSD `ktrace` framework. If we're instrumenting kernel code, we
  * submit the record directly to `ktrace` ourselves. If we're instrumenting
  * userspace code, we submit it via the `utrace` system call.
+ *
+ * Serialized records can also be written to a file by Loom's runtime
+ * library (`loom_trace_write`), which buffers them per-thread and writes
+ * them asynchronously (via io_uring where available), or put into a
+ * shared-memory ring (`loom_shm_write`) to be consumed by `loom-collector`.
  */
 class KTraceLogger : public loom::Logger {
 public:
-  KTraceLogger(llvm::Module &Mod, std::unique_ptr<Serializer>, bool KernelMode);
+  //! How serialized records are delivered.
+  enum class Transport { Kernel, Utrace, Runtime, SharedMemory };
+
+  /**
+   * @param   TraceFile   for the Runtime (or SharedMemory) transport, the
+   *                      trace file (or shared memory object) to open at the
+   *                      start of `main` (if empty, the runtime opens
+   *                      `$LOOM_TRACE_FILE` or `$LOOM_SHM_NAME` when the first
+   *                      record is written)
+   */
+  KTraceLogger(llvm::Module &Mod, std::unique_ptr<Serializer>, Transport,
+               std::string TraceFile = "");
 
   virtual llvm::Value *Log(llvm::Instruction *, llvm::ArrayRef<llvm::Value *>,
                            llvm::StringRef Name, llvm::StringRef Descrip,
                            loom::Metadata Md, std::vector<loom::Transform> Transforms,
                            bool SuppressUniqueness) override;
 
+  bool HasInitialization() override;
+
+  //! Open the trace file or ring (Runtime and SharedMemory transports).
+  llvm::Value *Initialize(llvm::Function &Main) override;
+
 private:
   const std::unique_ptr<Serializer> Serial;
-  const bool KernelMode;
+  const Transport Target;
+  const std::string TraceFile;
 };
 
 } // namespace loom
@@ -31,6 +31,7 @@
  */
 
 #include "Logger.hh"
+#include "Capture.hh"
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/TypeBuilder.h>
@@ -104,10 +105,12 @@ CallInst *SimpleLogger::Call(IRBuilder<> &Builder, StringRef Prefix,
                              loom::Metadata Md, std::vector<loom::Transform> Transforms,
 							 bool SuppressUniqueness) {
 
-  vector<Value *> Args = Adapt(Values, Builder);
-
-  Value *FormatString = CreateFormatString(Builder, Prefix, Args, Suffix,
+  // Format strings describe the original values: adaptation may expand
+  // some values (e.g., captures) into several arguments.
+  Value *FormatString = CreateFormatString(Builder, Prefix, Values, Suffix,
                                            Md, SuppressUniqueness);
+
+  vector<Value *> Args = Adapt(Values, Builder);
   Args.emplace(Args.begin(), FormatString);
 
   return Builder.CreateCall(GetFunction(), Args);
@@ -135,6 +138,27 @@ vector<Value *> SimpleLogger::Adapt(ArrayRef<Value *> Values, IRBuilder<> &B) {
       V = B.CreateFPExt(V, B.getDoubleTy());
     }
 
+    // Captured strings are passed as (precision, bytes) for `%.*s` and
+    // buffers as (address, length), each followed by a truncation marker.
+    if (auto Capture = GetCaptureType(V->getType())) {
+      Value *Data = CaptureData(V, B);
+      Value *Length = CaptureLength(V, B);
+      Value *Marker =
+          B.CreateSelect(CaptureTruncated(V, B), B.CreateGlobalStringPtr("..."),
+                         B.CreateGlobalStringPtr(""));
+
+      if (Capture->Kind == CaptureKind::String) {
+        Adapted.push_back(B.CreateTrunc(Length, B.getInt32Ty()));
+        Adapted.push_back(Data);
+      } else {
+        Adapted.push_back(Data);
+        Adapted.push_back(Length);
+      }
+
+      Adapted.push_back(Marker);
+      continue;
+    }
+
     Adapted.push_back(V);
   }
 
@@ -154,6 +178,17 @@ Value *LibxoLogger::CreateFormatString(IRBuilder<> &Builder, StringRef Prefix,
     const string Name = V->getName();
     Type *T = V->getType();
 
+    if (auto Capture = GetCaptureType(T)) {
+      FormatString << "{P: }";
+      if (Capture->Kind == CaptureKind::String) {
+        FormatString << "{:" << Name << "/%.*s}";
+      } else {
+        FormatString << "{:" << Name << "/%p}{:" << Name << "_length/%ld}";
+      }
+      FormatString << "{d:" << Name << "_truncated/%s}";
+      continue;
+    }
+
     // xo can humanize values (e.g., 41025981 -> 41M), but we don't want to
     // do this with pointer values (e.g., 0x7fff01... -> 128T) or
     // floating-point numbers (13.415235 -> 13).
@@ -223,6 +258,12 @@ Value *PrintfLogger::CreateFormatString(IRBuilder<> &Builder, StringRef Prefix,
   for (Value *V : Values) {
     Type *T = V->getType();
 
+    if (auto Capture = GetCaptureType(T)) {
+      FormatString << ((Capture->Kind == CaptureKind::String) ? " \"%.*s\"%s"
+                                                               : " %p[%ld]%s");
+      continue;
+    }
+
     FormatString << " %";
 
     if (T->isIntegerTy(8)) {
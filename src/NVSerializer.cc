@@ -31,9 +31,11 @@
  */
 
 #include "NVSerializer.hh"
+#include "Capture.hh"
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/TypeBuilder.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Support/raw_ostream.h>
 
 using namespace llvm;
@@ -186,6 +188,24 @@ void LibNV::Add(Value *List, StringRef Name, Value *V, IRBuilder<> &B) {
       }
     }
 
+  } else if (GetCaptureType(T)) {
+    // libnv rejects empty binary values, so only add non-empty captures
+    // (along with whether they were truncated).
+    Value *Data = CaptureData(V, B);
+    Value *Length = B.CreateZExtOrTrunc(CaptureLength(V, B), SizeT);
+    Instruction *Next = &*B.GetInsertPoint();
+
+    IRBuilder<> Then(SplitBlockAndInsertIfThen(
+        B.CreateICmpNE(Length, ConstantInt::get(SizeT, 0)), Next, false));
+    Constant *Binary = Fn("nvlist_add_binary", Void,
+                          {NVListPtr, BytePtr, BytePtr, SizeT});
+    Then.CreateCall(Binary,
+                    {List, Then.CreateGlobalStringPtr(Name), Data, Length});
+
+    B.SetInsertPoint(Next);
+    Add(List, (Name + "_truncated").str(), CaptureTruncated(V, B), B);
+    return;
+
   } else if (T->isPointerTy()) {
     if (T == NVListPtr) {
       F = Fn("nvlist_add_nvlist", Void, {NVListPtr, BytePtr, NVListPtr});
@@ -45,14 +45,22 @@
 #include "Instrumenter.hh"
 #include "PolicyFile.hh"
 #include "Metadata.hh"
+#include "OverheadBudget.hh"
+#include "SampleProfile.hh"
 #include "Transform.hh"
 
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <unordered_set>
 
 using namespace llvm;
 using namespace loom;
@@ -67,16 +75,300 @@ cl::opt<string> PolicyFilename("loom-file",
                                cl::value_desc("filename"),
                                cl::init("loom.policy"));
 
+/// Where (if anywhere) to run Loom within clang's optimization pipeline.
+enum class ExtensionPoint { None, OptimizerLast, ScalarOptimizerLate };
+
+cl::opt<ExtensionPoint> EP(
+    "loom-ep",
+    cl::desc("run Loom within the standard optimization pipeline"),
+    cl::init(ExtensionPoint::None),
+    cl::values(clEnumValN(ExtensionPoint::None, "none",
+                          "only run as an explicit pass (opt -loom)"),
+               clEnumValN(ExtensionPoint::OptimizerLast, "optimizer-last",
+                          "after all optimizations (cleanup passes only)"),
+               clEnumValN(ExtensionPoint::ScalarOptimizerLate,
+                          "scalar-optimizer-late",
+                          "after function simplification, before "
+                          "vectorization and late cleanup")));
+
 struct OptPass : public ModulePass {
   static char ID;
   OptPass() : ModulePass(ID), PolFile(PolicyFile::Open(PolicyFilename)) {}
 
   bool runOnModule(Module &) override;
+  void getAnalysisUsage(AnalysisUsage &) const override;
 
   llvm::ErrorOr<unique_ptr<PolicyFile>> PolFile;
 };
+
+/// Everything we need to know in order to summarize a write within a loop.
+struct LoopSummary {
+  GetElementPtrInst *GEP;
+  std::string Name;
+  BasicBlock *Preheader;
+  SmallVector<BasicBlock *, 4> Exits;
+  bool Unsigned; //!< the source-level type is unsigned (or boolean)
+};
+
+/**
+ * Find the outermost loop that a write can be summarized over.
+ *
+ * The written location must be invariant within the loop and the loop must
+ * have a preheader and dedicated exits for us to put summary code in.
+ *
+ * @returns the loop to summarize over, or nullptr if there is none
+ */
+Loop *SummaryLoop(LoopInfo &LI, GetElementPtrInst *GEP, StoreInst *Store) {
+  Type *T = Store->getValueOperand()->getType();
+  if (Store->getPointerOperand() != GEP or
+      not(T->isIntegerTy() or T->isFloatingPointTy())) {
+    return nullptr;
+  }
+
+  Loop *Summary = nullptr;
+
+  for (Loop *L = LI.getLoopFor(Store->getParent()); L;
+       L = L->getParentLoop()) {
+    if (not L->hasLoopInvariantOperands(GEP) or not L->getLoopPreheader() or
+        not L->hasDedicatedExits()) {
+      break;
+    }
+
+    SmallVector<BasicBlock *, 4> Exits;
+    L->getExitBlocks(Exits);
+    if (std::any_of(Exits.begin(), Exits.end(),
+                    [](BasicBlock *BB) { return BB->isEHPad(); })) {
+      break;
+    }
+
+    Summary = L;
+  }
+
+  return Summary;
+}
+
+/// The probes within a single function.
+struct FunctionProbes {
+  Function *Fn = nullptr;
+
+  /// Instrumentation of the function itself (entry/exit).
+  Policy::Directions Directions;
+  loom::Metadata Md;
+  vector<loom::Transform> Transforms;
+
+  /// Is the function itself hot (according to profile data)?
+  bool Hot = false;
+
+  /// Instructions whose probes are hot (according to profile data).
+  std::unordered_set<Instruction *> HotSites;
+
+  typedef std::pair<GetElementPtrInst *, std::string> NamedGEP;
+
+  vector<Instruction *> AllInstructions;
+  vector<std::pair<Instruction *, const DIVariable *>> PointerInsts;
+  vector<std::pair<CallInst *, Policy::Directions>> Calls;
+  vector<CallInst *> IndirectCalls;
+  vector<std::pair<LoadInst *, NamedGEP>> FieldReads;
+  vector<std::pair<StoreInst *, NamedGEP>> FieldWrites;
+  vector<std::pair<LoadInst *, NamedGEP>> GlobalReads;
+  vector<std::pair<StoreInst *, NamedGEP>> GlobalWrites;
+  vector<std::pair<StoreInst *, LoopSummary>> SummarizedWrites;
+
+  bool IsHot(Instruction *I) const { return HotSites.count(I) > 0; }
+};
+
+/// Transforms (including captures) of a function's arguments, which apply
+/// to its call and function events in every logger.
+vector<loom::Transform> FnTransforms(Policy &P, const Function &Fn) {
+  vector<loom::Transform> Transforms = P.InstrTransforms(Fn);
+  vector<loom::Transform> Captures = P.Captures(Fn);
+  Transforms.insert(Transforms.end(), Captures.begin(), Captures.end());
+  return Transforms;
+}
+
+/// A function's source-level type (from its debug info), if it has one.
+const DISubroutineType *Signature(const Function &Fn) {
+  const DISubprogram *SP = Fn.getSubprogram();
+  return SP ? SP->getType() : nullptr;
+}
+
+/**
+ * Find the instructions within a function that should be instrumented.
+ *
+ * @param   LI    loop information, if writes should be summarized over loops
+ */
+void FindProbes(Function &Fn, Policy &P, DebugInfo &Debug, LoopInfo *LI,
+                bool HookIndirectCalls, FunctionProbes &Probes) {
+  // Should a write be summarized over a loop rather than logged directly?
+  auto Summarize = [&](StoreInst *Store, GetElementPtrInst *GEP,
+                       const std::string &Name) {
+    Loop *L = LI ? SummaryLoop(*LI, GEP, Store) : nullptr;
+    if (not L) {
+      return false;
+    }
+
+    LoopSummary S;
+    S.GEP = GEP;
+    S.Name = Name;
+    S.Preheader = L->getLoopPreheader();
+    L->getExitBlocks(S.Exits);
+    S.Unsigned = IsUnsigned(Debug.ElementType(GEP));
+    Probes.SummarizedWrites.emplace_back(Store, std::move(S));
+
+    return true;
+  };
+
+  for (auto &Inst : instructions(Fn)) {
+    if (P.InstrumentAll()) {
+      Probes.AllInstructions.push_back(&Inst);
+    }
+
+    if (P.InstrumentPointerInsts()) {
+      if (isa<StoreInst>(&Inst) || isa<LoadInst>(&Inst) ||
+          isa<GetElementPtrInst>(&Inst)) {
+
+        Value *Ptr = nullptr;
+        if (StoreInst *store = dyn_cast<StoreInst>(&Inst)) {
+          Ptr = store->getPointerOperand();
+        } else if (LoadInst *load = dyn_cast<LoadInst>(&Inst)) {
+          Ptr = load->getPointerOperand();
+        } else if (GetElementPtrInst *gep =
+                       dyn_cast<GetElementPtrInst>(&Inst)) {
+          Ptr = gep->getPointerOperand();
+        }
+
+        const DIVariable *Var = Debug.Get<DIVariable>(Ptr);
+        if (auto *G = llvm::dyn_cast<llvm::GlobalVariable>(Ptr)) {
+          Var = Debug.GetGlobalDIVariable(G);
+        }
+
+        Probes.PointerInsts.emplace_back(&Inst, Var);
+      }
+
+      if (BitCastInst *bc = dyn_cast<BitCastInst>(&Inst)) {
+        Type *tau = bc->getType();
+        // If dest type is a pointer, the source type must be, too
+        if (isa<PointerType>(tau)) {
+          Probes.PointerInsts.emplace_back(bc, nullptr);
+        }
+      }
+    }
+
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(&Inst)) {
+      if (auto *ST = dyn_cast<StructType>(GEP->getSourceElementType())) {
+        // A GEP used for structure field lookup should have indices
+        // 0 and i, where i is the field number (not byte index).
+        if (GEP->getNumIndices() != 2 or !GEP->hasAllConstantIndices())
+          continue;
+
+        if (not P.StructTypeMatters(*ST))
+          continue;
+
+        // Without a field name (e.g., no debug info for this structure
+        // type), there's nothing to match against the policy.
+        std::string FieldName = Debug.FieldName(GEP);
+        if (FieldName.empty())
+          continue;
+
+        const bool HookReads = P.FieldReadHook(*ST, FieldName);
+        const bool HookWrites = P.FieldWriteHook(*ST, FieldName);
+
+        // Filtered or rate-limited writes must be checked one at a time,
+        // not summarized.
+        const bool Filtered = (P.FieldFilter(*ST, FieldName) != nullptr or
+                               P.FieldMaxRate(*ST, FieldName) != 0);
+
+        if (not HookReads and not HookWrites) {
+          continue;
+        }
+
+        for (auto &Use : GEP->uses()) {
+          User *U = Use.getUser();
+
+          if (HookReads) {
+            if (auto *Load = dyn_cast<LoadInst>(U)) {
+              Probes.FieldReads.emplace_back(
+                  Load, FunctionProbes::NamedGEP(GEP, FieldName));
+            }
+          }
+
+          if (HookWrites) {
+            if (auto *Store = dyn_cast<StoreInst>(U)) {
+              if (Filtered or not Summarize(Store, GEP, FieldName)) {
+                Probes.FieldWrites.emplace_back(
+                    Store, FunctionProbes::NamedGEP(GEP, FieldName));
+              }
+            }
+          }
+        }
+      }
+      if (isa<GlobalVariable>(GEP->getPointerOperand())) {
+        Value *V = GEP->getPointerOperand();
+        if (not P.GlobalValueMatters(*V))
+          continue;
+
+        const bool HookReads = P.GlobalReadHook(*V);
+        const bool HookWrites = P.GlobalWriteHook(*V);
+
+        std::string GlobalName = V->getName().str();
+        assert(not GlobalName.empty());
+
+        if (not HookReads and not HookWrites)
+          continue;
+
+        for (auto &Use : GEP->uses()) {
+          User *U = Use.getUser();
+
+          if (HookReads) {
+            if (auto *Load = dyn_cast<LoadInst>(U)) {
+              Probes.GlobalReads.emplace_back(
+                  Load, FunctionProbes::NamedGEP(GEP, GlobalName));
+            }
+          }
+
+          if (HookWrites) {
+            if (auto *Store = dyn_cast<StoreInst>(U)) {
+              if (not Summarize(Store, GEP, GlobalName)) {
+                Probes.GlobalWrites.emplace_back(
+                    Store, FunctionProbes::NamedGEP(GEP, GlobalName));
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // Is this a call to instrument?
+    if (CallInst *Call = dyn_cast<CallInst>(&Inst)) {
+      Function *Target = Call->getCalledFunction();
+      if (not Target) {
+        if (HookIndirectCalls and not Call->isInlineAsm())
+          Probes.IndirectCalls.push_back(Call);
+        continue;
+      }
+
+      Policy::Directions Directions = P.CallHooks(*Target);
+      if (not Directions.empty())
+        Probes.Calls.emplace_back(Call, Directions);
+    }
+  }
+}
 } // namespace
 
+void OptPass::getAnalysisUsage(AnalysisUsage &AU) const {
+  // Only compute loop information if we actually need it.
+  if (PolFile and (*PolFile)->SummarizeLoops()) {
+    AU.addRequired<LoopInfoWrapperPass>();
+  }
+
+  // Likewise for block frequencies (which we use to find hot probes
+  // and to estimate costs for an overhead budget).
+  if (PolFile and
+      ((*PolFile)->MaxHotness() > 0 or (*PolFile)->BudgetPercent() > 0)) {
+    AU.addRequired<BlockFrequencyInfoWrapperPass>();
+  }
+}
+
 bool OptPass::runOnModule(Module &Mod) {
   if (std::error_code err = PolFile.getError()) {
     errs() << "Error opening LOOM policy file '" << PolicyFilename
@@ -97,36 +389,42 @@ bool OptPass::runOnModule(Module &Mod) {
     return P.InstrName(Components);
   };
 
-  auto S = InstrStrategy::Create(P.Strategy(), P.UseBlockStructure());
+  auto S = InstrStrategy::Create(P.Strategy(), P.BlockStructure());
 
   for (auto &L : P.Loggers(Mod)) {
     S->AddLogger(std::move(L));
   }
 
-  unique_ptr<Instrumenter> Instr(Instrumenter::Create(Mod, Name, std::move(S)));
+  for (InstrStrategy::Tag T : P.Tags()) {
+    S->AddTag(T);
+  }
 
-  //
-  // In order to keep from invalidating iterators or instrumenting our
-  // instrumentation, we need to decide on the instruction-oriented
-  // instrumentation points like calls before we actually instrument them.
-  //
-  std::vector<Instruction *> AllInstructions;
+  unique_ptr<Instrumenter> Instr(Instrumenter::Create(Mod, Name, std::move(S)));
 
-  std::unordered_map<Function *, Policy::Directions> Functions;
-  std::unordered_map<Function *, loom::Metadata> FnMetadata;
-  std::unordered_map<Function *, vector<loom::Transform>> FnTransforms;
-  std::unordered_map<CallInst *, Policy::Directions> Calls;
+  const Policy::Directions IndirectDirections = P.IndirectCallHooks();
+  const unsigned ProfiledTargets = P.IndirectCallTargets();
+  const bool HookIndirectCalls =
+      not IndirectDirections.empty() or ProfiledTargets > 0;
 
-  typedef std::pair<GetElementPtrInst *, std::string> NamedGEP;
-  std::unordered_map<LoadInst *, NamedGEP> FieldReads;
-  std::unordered_map<StoreInst *, NamedGEP> FieldWrites;
+  // Probes that profile data says are hot may be treated differently.
+  const uint64_t MaxHotness = P.MaxHotness();
+  const ProbeOptions HotProbe = P.HotProbes();
 
-  std::unordered_map<LoadInst *, NamedGEP> GlobalReads;
-  std::unordered_map<StoreInst *, NamedGEP> GlobalWrites;
+  // An overhead budget may sample or drop any probes that aren't hot.
+  unique_ptr<OverheadBudget> Budget;
+  if (P.BudgetPercent() > 0) {
+    Budget.reset(new OverheadBudget(P, P.BudgetPercent()));
+  }
 
-  std::unordered_map<Instruction *, const DIVariable *> PointerInsts;
+  const string ProfileOutput = P.ProfileOutput();
+  SampleProfile Profile(Name);
 
+  //
+  // Instrumentation adds functions (hooks, etc.) to the module: only the
+  // functions that were there to begin with should be instrumented.
+  //
   Function *Main = nullptr;
+  vector<Function *> Fns;
 
   for (auto &Fn : Mod) {
     // Store a reference to main for initialization code
@@ -134,193 +432,283 @@ bool OptPass::runOnModule(Module &Mod) {
       Main = &Fn;
     }
 
-    // Do we need to instrument this function?
-    Policy::Directions Directions = P.FnHooks(Fn);
-    if (not Directions.empty()) {
-      Functions.emplace(&Fn, Directions);
+    // When run in a ThinLTO backend, functions imported from other modules
+    // are only here to be inlined: they are instrumented in their own module.
+    if (Fn.hasAvailableExternallyLinkage()) {
+      continue;
+    }
 
-      auto Md = P.InstrMetadata(Fn);
-      if (not Md.Name.empty() && not Md.Id == 0) {
-        FnMetadata.emplace(&Fn, Md);
-      }
-      auto Transforms = P.InstrTransforms(Fn);
-      if (not Md.Name.empty() && not Md.Id == 0) {
-        FnTransforms.emplace(&Fn, Transforms);
-      }
+    if (not ProfileOutput.empty()) {
+      Profile.Add(Fn);
     }
 
-    for (auto &Inst : instructions(Fn)) {
-      if (P.InstrumentAll()) {
-        AllInstructions.push_back(&Inst);
+    Fns.push_back(&Fn);
+  }
+
+  //
+  // Optimization folds nested structure lookups into single GEPs. Split them
+  // before looking at any function, so that the overhead budget (below) and
+  // the instrumentation itself both see the same IR.
+  //
+  bool SplitGEPs = false;
+  for (Function *Fn : Fns) {
+    SplitGEPs |= SplitStructGEPs(
+        *Fn, [&P](StructType &ST) { return P.StructTypeMatters(ST); });
+  }
+
+  //
+  // Find a function's probes: in order to keep from invalidating iterators
+  // or instrumenting our instrumentation, we need to decide on the
+  // instruction-oriented instrumentation points like calls before we
+  // actually instrument them.
+  //
+  auto Discover = [&](Function &Fn, FunctionProbes &Probes) {
+    Probes.Fn = &Fn;
+
+    // Do we need to instrument this function?
+    Probes.Directions = P.FnHooks(Fn);
+    if (not Probes.Directions.empty()) {
+      auto Md = P.InstrMetadata(Fn);
+      if (not Md.Name.empty() && not Md.Id == 0) {
+        Probes.Md = Md;
       }
 
-      if (P.InstrumentPointerInsts()) {
-        if (isa<StoreInst>(&Inst) || isa<LoadInst>(&Inst) ||
-            isa<GetElementPtrInst>(&Inst)) {
-
-          Value *Ptr = nullptr;
-          if (StoreInst *store = dyn_cast<StoreInst>(&Inst)) {
-            Ptr = store->getPointerOperand();
-          } else if (LoadInst *load = dyn_cast<LoadInst>(&Inst)) {
-            Ptr = load->getPointerOperand();
-          } else if (GetElementPtrInst *gep =
-                         dyn_cast<GetElementPtrInst>(&Inst)) {
-            Ptr = gep->getPointerOperand();
-          }
+      Probes.Transforms = FnTransforms(P, Fn);
+    }
 
-          const DIVariable *Var = Debug.Get<DIVariable>(Ptr);
-          if (auto *G = llvm::dyn_cast<llvm::GlobalVariable>(Ptr)) {
-            Var = Debug.GetGlobalDIVariable(G);
-          }
+    BlockFrequencyInfo *BFI = nullptr;
+    if ((MaxHotness > 0 or Budget) and not Fn.isDeclaration()) {
+      BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>(Fn).getBFI();
+    }
 
-          PointerInsts[&Inst] = Var;
-        }
+    if (MaxHotness > 0 and BFI and Fn.getEntryCount().hasValue()) {
+      Probes.Hot = (Fn.getEntryCount().getCount() > MaxHotness);
 
-        if (BitCastInst *bc = dyn_cast<BitCastInst>(&Inst)) {
-          Type *tau = bc->getType();
-          // If dest type is a pointer, the source type must be, too
-          if (isa<PointerType>(tau)) {
-            PointerInsts[bc] = nullptr;
+      for (auto &BB : Fn) {
+        Optional<uint64_t> Count = BFI->getBlockProfileCount(&BB);
+        if (Count.hasValue() and *Count > MaxHotness) {
+          for (auto &I : BB) {
+            Probes.HotSites.insert(&I);
           }
         }
       }
+    }
 
-      if (auto *GEP = dyn_cast<GetElementPtrInst>(&Inst)) {
-        if (auto *ST = dyn_cast<StructType>(GEP->getSourceElementType())) {
-          // A GEP used for structure field lookup should have indices
-          // 0 and i, where i is the field number (not byte index).
-          if (GEP->getNumIndices() != 2 or !GEP->hasAllConstantIndices())
-            continue;
+    LoopInfo *LI = nullptr;
+    if (P.SummarizeLoops() and not Fn.isDeclaration()) {
+      LI = &getAnalysis<LoopInfoWrapperPass>(Fn).getLoopInfo();
+    }
 
-          if (not P.StructTypeMatters(*ST))
-            continue;
+    FindProbes(Fn, P, Debug, LI, HookIndirectCalls, Probes);
 
-          std::string FieldName = Debug.FieldName(GEP);
-          assert(not FieldName.empty());
+    return BFI;
+  };
 
-          const bool HookReads = P.FieldReadHook(*ST, FieldName);
-          const bool HookWrites = P.FieldWriteHook(*ST, FieldName);
+  auto Opts = [&](const FunctionProbes &Probes, Instruction *I) {
+    if (Probes.IsHot(I)) {
+      return HotProbe;
+    }
+    return Budget ? Budget->Options(I) : ProbeOptions();
+  };
 
-          if (not HookReads and not HookWrites) {
-            continue;
-          }
+  //
+  // Fit the (non-hot) probes in the module into the overhead budget, if any.
+  // This needs all of the module's probes at once, but only long enough to
+  // add them to the budget: they are found again when we instrument them.
+  //
+  if (Budget) {
+    for (Function *Fn : Fns) {
+      FunctionProbes Probes;
+      if (BlockFrequencyInfo *BFI = Discover(*Fn, Probes)) {
+        Budget->AddFunction(*Fn, *BFI);
+      }
 
-          for (auto &Use : GEP->uses()) {
-            User *U = Use.getUser();
+      auto AddProbe = [&](Instruction *I, const Twine &Description,
+                          unsigned Values, unsigned Events) {
+        if (not Probes.IsHot(I) and Events > 0) {
+          StringRef Caller = Fn->getName();
+          Budget->AddProbe(I, I->getParent(),
+                           (Description + " in " + Caller).str(), Values,
+                           Events);
+        }
+      };
 
-            if (HookReads) {
-              if (auto *Load = dyn_cast<LoadInst>(U)) {
-                FieldReads[Load] = {GEP, FieldName};
-              }
-            }
+      if (not Probes.Directions.empty() and not Probes.Hot) {
+        Budget->AddProbe(Fn, &Fn->getEntryBlock(),
+                         ("function " + Fn->getName()).str(),
+                         Fn->arg_size() + 1, Probes.Directions.size());
+      }
 
-            if (HookWrites) {
-              if (auto *Store = dyn_cast<StoreInst>(U)) {
-                FieldWrites[Store] = {GEP, FieldName};
-              }
-            }
-          }
-        }
-        if (isa<GlobalVariable>(GEP->getPointerOperand())) {
-          Value *V = GEP->getPointerOperand();
-          if (not P.GlobalValueMatters(*V))
-            continue;
+      for (auto &i : Probes.Calls) {
+        CallInst *Call = i.first;
+        AddProbe(Call, "call " + Call->getCalledFunction()->getName(),
+                 Call->getNumArgOperands() + 1, i.second.size());
+      }
 
-          const bool HookReads = P.GlobalReadHook(*V);
-          const bool HookWrites = P.GlobalWriteHook(*V);
+      for (CallInst *Call : Probes.IndirectCalls) {
+        AddProbe(Call, "indirect call", Call->getNumArgOperands() + 2,
+                 IndirectDirections.size());
+      }
 
-          std::string GlobalName = V->getName().str();
-          assert(not GlobalName.empty());
+      for (auto &i : Probes.FieldReads) {
+        AddProbe(i.first, "read of field " + i.second.second, 2, 1);
+      }
 
-          if (not HookReads and not HookWrites)
-            continue;
+      for (auto &i : Probes.FieldWrites) {
+        AddProbe(i.first, "write to field " + i.second.second, 2, 1);
+      }
 
-          for (auto &Use : GEP->uses()) {
-            User *U = Use.getUser();
+      for (auto &i : Probes.GlobalReads) {
+        AddProbe(i.first, "read of global " + i.second.second, 2, 1);
+      }
 
-            if (HookReads) {
-              if (auto *Load = dyn_cast<LoadInst>(U)) {
-                GlobalReads[Load] = {GEP, GlobalName};
-              }
-            }
+      for (auto &i : Probes.GlobalWrites) {
+        AddProbe(i.first, "write to global " + i.second.second, 2, 1);
+      }
 
-            if (HookWrites) {
-              if (auto *Store = dyn_cast<StoreInst>(U)) {
-                GlobalWrites[Store] = {GEP, GlobalName};
-              }
-            }
-          }
-        }
+      for (Instruction *I : Probes.AllInstructions) {
+        AddProbe(I, I->getOpcodeName() + Twine(" instruction"),
+                 I->getNumOperands() + 2, 1);
+      }
+
+      for (auto &i : Probes.PointerInsts) {
+        AddProbe(i.first, i.first->getOpcodeName() + Twine(" instruction"), 2,
+                 1);
       }
+    }
+
+    Budget->Solve();
 
-      // Is this a call to instrument?
-      if (CallInst *Call = dyn_cast<CallInst>(&Inst)) {
-        Function *Target = Call->getCalledFunction();
-        if (not Target)
-          continue; // TODO: support indirect targets
+    const string ReportFilename = P.BudgetReport();
+    if (not ReportFilename.empty()) {
+      std::error_code EC;
+      raw_fd_ostream Report(ReportFilename, EC, sys::fs::F_Text);
 
-        Policy::Directions Directions = P.CallHooks(*Target);
-        if (not Directions.empty())
-          Calls.emplace(Call, Directions);
+      if (EC) {
+        errs() << "Error opening LOOM budget report '" << ReportFilename
+               << "': " << EC.message() << "\n";
+      } else {
+        Budget->Report(Report);
       }
     }
   }
 
   //
-  // Now we actually perform the instrumentation:
+  // Now we actually perform the instrumentation, one function at a time,
+  // so that we only need to keep track of one function's probes at once.
+  // Hooks and other support code shared between functions are created
+  // when they are first needed.
   //
   bool ModifiedIR = false;
 
-  for (auto *I : AllInstructions) {
-    Instr->Instrument(I);
-  }
+  for (Function *Fn : Fns) {
+    FunctionProbes Probes;
+    Discover(*Fn, Probes);
 
-  for (auto &i : PointerInsts) {
-    Instruction *I = i.first;
-    const DIVariable *Var = i.second;
-    Instr->InstrumentPtrInsts(I, Var);
-  }
+    for (auto *I : Probes.AllInstructions) {
+      Instr->Instrument(I, loom::Metadata(), vector<loom::Transform>(),
+                        Opts(Probes, I));
+    }
 
-  for (auto &i : Functions) {
-	auto Md = FnMetadata[i.first];
-	auto Transforms = FnTransforms[i.first];
-    ModifiedIR |= Instr->Instrument(*i.first, i.second, Md, Transforms);
-  }
+    for (auto &i : Probes.PointerInsts) {
+      Instruction *I = i.first;
+      const DIVariable *Var = i.second;
+      Instr->InstrumentPtrInsts(I, Var, loom::Metadata(),
+                                vector<loom::Transform>(), Opts(Probes, I));
+    }
 
-  for (auto &i : Calls) {
-    ModifiedIR |= Instr->Instrument(i.first, i.second);
-  }
+    if (not Probes.Directions.empty()) {
+      auto FnOpts = Probes.Hot ? HotProbe
+                    : Budget   ? Budget->Options(Fn)
+                               : ProbeOptions();
+      FnOpts.When = P.FnFilter(*Fn);
+      FnOpts.Signature = Signature(*Fn);
+      FnOpts.MaxRate = P.FnMaxRate(*Fn);
+      FnOpts.SingleExit = P.SingleExit();
+      ModifiedIR |= Instr->Instrument(*Fn, Probes.Directions, Probes.Md,
+                                      Probes.Transforms, FnOpts);
+    }
 
-  for (auto &i : FieldReads) {
-    LoadInst *Load = i.first;
-    GetElementPtrInst *GEP = i.second.first;
-    StringRef FieldName = i.second.second;
+    for (auto &i : Probes.Calls) {
+      Function *Target = i.first->getCalledFunction();
+      ProbeOptions CallOpts = Opts(Probes, i.first);
+      CallOpts.When = P.FnFilter(*Target);
+      CallOpts.Signature = Signature(*Target);
+      CallOpts.MaxRate = P.FnMaxRate(*Target);
+      ModifiedIR |= Instr->Instrument(i.first, i.second, loom::Metadata(),
+                                      FnTransforms(P, *Target), CallOpts);
+    }
 
-    ModifiedIR |= Instr->Instrument(GEP, Load, FieldName);
-  }
+    for (CallInst *Call : Probes.IndirectCalls) {
+      ModifiedIR |=
+          Instr->Instrument(Call, IndirectDirections, loom::Metadata(),
+                            vector<loom::Transform>(), Opts(Probes, Call));
 
-  for (auto &i : FieldWrites) {
-    StoreInst *Store = i.first;
-    GetElementPtrInst *GEP = i.second.first;
-    StringRef FieldName = i.second.second;
+      if (ProfiledTargets > 0) {
+        ModifiedIR |= Instr->ProfileTargets(Call, ProfiledTargets);
+      }
+    }
 
-    ModifiedIR |= Instr->Instrument(GEP, Store, FieldName);
-  }
+    for (auto &i : Probes.FieldReads) {
+      LoadInst *Load = i.first;
+      GetElementPtrInst *GEP = i.second.first;
+      StringRef FieldName = i.second.second;
+      auto *ST = cast<StructType>(GEP->getSourceElementType());
+
+      ProbeOptions LoadOpts = Opts(Probes, Load);
+      LoadOpts.When = P.FieldFilter(*ST, FieldName);
+      LoadOpts.MaxRate = P.FieldMaxRate(*ST, FieldName);
+      ModifiedIR |= Instr->Instrument(GEP, Load, FieldName, loom::Metadata(),
+                                      vector<loom::Transform>(), LoadOpts);
+    }
+
+    for (auto &i : Probes.FieldWrites) {
+      StoreInst *Store = i.first;
+      GetElementPtrInst *GEP = i.second.first;
+      StringRef FieldName = i.second.second;
+      auto *ST = cast<StructType>(GEP->getSourceElementType());
+
+      ProbeOptions StoreOpts = Opts(Probes, Store);
+      StoreOpts.When = P.FieldFilter(*ST, FieldName);
+      StoreOpts.MaxRate = P.FieldMaxRate(*ST, FieldName);
+      ModifiedIR |= Instr->Instrument(GEP, Store, FieldName, loom::Metadata(),
+                                      vector<loom::Transform>(), StoreOpts);
+    }
+
+    for (auto &i : Probes.GlobalReads) {
+      LoadInst *Load = i.first;
+      GetElementPtrInst *GEP = i.second.first;
+      StringRef Name = i.second.second;
+
+      ModifiedIR |= Instr->Instrument(GEP, Load, Name, loom::Metadata(),
+                                      vector<loom::Transform>(),
+                                      Opts(Probes, Load));
+    }
+
+    for (auto &i : Probes.GlobalWrites) {
+      StoreInst *Store = i.first;
+      GetElementPtrInst *GEP = i.second.first;
+      StringRef Name = i.second.second;
+
+      ModifiedIR |= Instr->Instrument(GEP, Store, Name, loom::Metadata(),
+                                      vector<loom::Transform>(),
+                                      Opts(Probes, Store));
+    }
 
-  for (auto &i : GlobalReads) {
-    LoadInst *Load = i.first;
-    GetElementPtrInst *GEP = i.second.first;
-    StringRef Name = i.second.second;
+    for (auto &i : Probes.SummarizedWrites) {
+      StoreInst *Store = i.first;
+      LoopSummary &S = i.second;
 
-    ModifiedIR |= Instr->Instrument(GEP, Load, Name);
+      ModifiedIR |=
+          Instr->Summarize(S.GEP, Store, S.Name, S.Preheader, S.Exits,
+                           S.Unsigned);
+    }
   }
 
-  for (auto &i : GlobalWrites) {
-    StoreInst *Store = i.first;
-    GetElementPtrInst *GEP = i.second.first;
-    StringRef Name = i.second.second;
+  ModifiedIR |= SplitGEPs;
 
-    ModifiedIR |= Instr->Instrument(GEP, Store, Name);
+  if (not ProfileOutput.empty()) {
+    ModifiedIR |= Profile.Instrument(*Instr, ProfileOutput);
   }
 
   if (ModifiedIR) {
@@ -330,8 +718,53 @@ bool OptPass::runOnModule(Module &Mod) {
     }
 
   }
+
+  // If the policy caches descriptors' UUIDs, every module (whether or not it
+  // looks any up itself) must invalidate them when descriptors are closed.
+  if (P.UsesTransform("GetUUID")) {
+    ModifiedIR |= loom::InvalidateTransformCaches(Mod);
+  }
+
   return ModifiedIR;
 }
 
 char OptPass::ID = 0;
 static RegisterPass<OptPass> X("loom", "Loom instrumentation", false, false);
+
+//
+// When loaded into clang (-Xclang -load -Xclang LLVMLoom.so), Loom can add
+// itself to the standard pipeline so that probes are inserted after inlining,
+// SROA, etc. rather than preventing them. The optimizer's extension points
+// aren't used at -O0, so we also register for EP_EnabledOnOptLevel0.
+//
+static void AddOptPass(ExtensionPoint Where, const PassManagerBuilder &,
+                       legacy::PassManagerBase &PM) {
+  if (EP == Where) {
+    PM.add(new OptPass());
+  }
+}
+
+static void AddOptPassO0(const PassManagerBuilder &,
+                         legacy::PassManagerBase &PM) {
+  if (EP != ExtensionPoint::None) {
+    PM.add(new OptPass());
+  }
+}
+
+static RegisterStandardPasses
+    OptimizerLast(PassManagerBuilder::EP_OptimizerLast,
+                  [](const PassManagerBuilder &PMB,
+                     legacy::PassManagerBase &PM) {
+                    AddOptPass(ExtensionPoint::OptimizerLast, PMB, PM);
+                  });
+
+static RegisterStandardPasses
+    ScalarOptimizerLate(PassManagerBuilder::EP_ScalarOptimizerLate,
+                        [](const PassManagerBuilder &PMB,
+                           legacy::PassManagerBase &PM) {
+                          AddOptPass(ExtensionPoint::ScalarOptimizerLate, PMB,
+                                     PM);
+                        });
+
+static RegisterStandardPasses
+    OptLevel0(PassManagerBuilder::EP_EnabledOnOptLevel0, AddOptPassO0);
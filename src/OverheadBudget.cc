@@ -0,0 +1,284 @@
+//! @file OverheadBudget.cc  Definition of @ref loom::OverheadBudget.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "OverheadBudget.hh"
+
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <queue>
+
+using namespace llvm;
+using namespace loom;
+
+namespace {
+
+/// Sampling rates are powers of two, up to this limit (then probes are dropped).
+const unsigned MaxSampleRate = 1 << 16;
+
+/// Estimated cycles to execute a basic block (ignoring the cost of callees).
+double BlockCost(const BasicBlock &BB) {
+  double Cost = 0;
+
+  for (const Instruction &I : BB) {
+    if (isa<DbgInfoIntrinsic>(I)) {
+      continue;
+    }
+
+    Cost += isa<CallInst>(I) or isa<InvokeInst>(I) ? 20 : 1;
+  }
+
+  return Cost;
+}
+
+} // namespace
+
+OverheadBudget::OverheadBudget(const Policy &P, double Percent)
+    : Strategy(P.Strategy()), BlockStructure(P.BlockStructure()),
+      Logging(P.Logging()), Tags(P.Tags()), KTrace(P.KTrace()),
+      DTrace(P.DTrace()),
+      Serialization(P.SerializationScheme()), Percent(Percent),
+      BaseCycles(0), ProbeCycles(0) {}
+
+void OverheadBudget::AddFunction(Function &Fn, BlockFrequencyInfo &BFI) {
+  // Without profile data, assume that each function is called once and
+  // weight its blocks according to static frequency heuristics.
+  auto EntryCount = Fn.getEntryCount();
+  const double Entries = EntryCount.hasValue() ? EntryCount.getCount() : 1;
+  const double EntryFreq = BFI.getEntryFreq();
+
+  for (const BasicBlock &BB : Fn) {
+    double Frequency;
+
+    Optional<uint64_t> Count = BFI.getBlockProfileCount(&BB);
+    if (Count.hasValue()) {
+      Frequency = *Count;
+    } else {
+      Frequency = Entries * BFI.getBlockFreq(&BB).getFrequency() / EntryFreq;
+    }
+
+    BlockFrequency[&BB] = Frequency;
+    BaseCycles += Frequency * BlockCost(BB);
+  }
+}
+
+void OverheadBudget::AddProbe(const Value *Site, const BasicBlock *Block,
+                              StringRef Description, unsigned Values,
+                              unsigned Events) {
+  auto i = BlockFrequency.find(Block);
+  const double Frequency = (i == BlockFrequency.end()) ? 1 : i->second;
+
+  Probe &P = Probes[Site];
+  P.Description = Description;
+  P.Frequency = Frequency;
+  P.Cost = Events * EventCost(Values);
+  P.SampleRate = 1;
+  P.Dropped = false;
+}
+
+double OverheadBudget::EventCost(unsigned Values) const {
+  // These are rough estimates of cycles per event, only meant to rank
+  // probes against each other and against the cost of the program itself.
+  double Cost = 0;
+
+  switch (Strategy) {
+  case InstrStrategy::Kind::Callout:
+    Cost += 5;
+    break;
+  case InstrStrategy::Kind::Patchable:
+    // A call via the trampoline, which saves and restores every register
+    // (including the vector state, with XSAVE/XRSTOR).
+    Cost += 100;
+    break;
+  case InstrStrategy::Kind::Inline:
+    break;
+  }
+
+  // Tags are logged like any other value. A cached thread ID is a call and a
+  // TLS load; sched_getcpu() is a vDSO call (or an rseq load).
+  for (InstrStrategy::Tag T : Tags) {
+    Cost += (T == InstrStrategy::Tag::CPU) ? 20 : 3;
+    Values++;
+  }
+
+  switch (BlockStructure) {
+  case InstrStrategy::Structure::Blocks:
+    Cost += 2;
+    break;
+  case InstrStrategy::Structure::Guarded:
+    Cost += 1;
+    break;
+  case InstrStrategy::Structure::Flat:
+    break;
+  }
+
+  switch (Logging) {
+  case SimpleLogger::LogType::Printf:
+    Cost += 800 + 60 * Values;
+    break;
+
+  case SimpleLogger::LogType::Libxo:
+    Cost += 2000 + 150 * Values;
+    break;
+
+  case SimpleLogger::LogType::None:
+    break;
+  }
+
+  if (KTrace != Policy::KTraceTarget::None) {
+    // A system call (or in-kernel ktrace record, or a copy into a runtime
+    // buffer) plus serialization:
+    switch (KTrace) {
+    case Policy::KTraceTarget::Kernel:
+      Cost += 300;
+      break;
+    case Policy::KTraceTarget::Userspace:
+      Cost += 1000;
+      break;
+    case Policy::KTraceTarget::File:
+    case Policy::KTraceTarget::SharedMemory:
+      Cost += 60;
+      break;
+    case Policy::KTraceTarget::None:
+      break;
+    }
+
+    if (Serialization == "nvlist") {
+      Cost += 300 + 80 * Values;
+    } else if (Serialization == "compact") {
+      Cost += 20 + 8 * Values;
+    } else if (Serialization != "null") {
+      Cost += 50 + 10 * Values;
+    }
+  }
+
+  switch (DTrace) {
+  case Policy::DTraceTarget::Userspace:
+    Cost += 30 + 2 * Values;
+    break;
+  case Policy::DTraceTarget::USDT:
+    // A nop (and arguments in registers) unless a tracer is attached. The
+    // probe point is in the hook, though, so unless hooks are inlined every
+    // event still pays to pass its values to the hook (on top of the call).
+    Cost += 1;
+    if (Strategy != InstrStrategy::Kind::Inline) {
+      Cost += Values;
+    }
+    break;
+  case Policy::DTraceTarget::None:
+    break;
+  }
+
+  return std::max(Cost, 1.0);
+}
+
+void OverheadBudget::Solve() {
+  const double Budget = BaseCycles * Percent / 100;
+
+  // Repeatedly halve the sampling rate of the most expensive probe
+  // (dropping it once the rate gets too low) until we fit in the budget.
+  auto Cheaper = [this](const Value *A, const Value *B) {
+    return Probes.find(A)->second.Total() < Probes.find(B)->second.Total();
+  };
+  std::priority_queue<const Value *, std::vector<const Value *>,
+                      decltype(Cheaper)>
+      Queue(Cheaper);
+
+  ProbeCycles = 0;
+  for (auto &i : Probes) {
+    ProbeCycles += i.second.Total();
+    Queue.push(i.first);
+  }
+
+  while (ProbeCycles > Budget and not Queue.empty()) {
+    const Value *Site = Queue.top();
+    Queue.pop();
+
+    Probe &P = Probes.find(Site)->second;
+    const double Before = P.Total();
+
+    if (P.SampleRate < MaxSampleRate) {
+      P.SampleRate *= 2;
+      Queue.push(Site);
+    } else {
+      P.Dropped = true;
+    }
+
+    ProbeCycles -= Before - P.Total();
+  }
+}
+
+ProbeOptions OverheadBudget::Options(const Value *Site) const {
+  auto i = Probes.find(Site);
+  if (i == Probes.end()) {
+    return ProbeOptions();
+  }
+
+  const Probe &P = i->second;
+  if (P.Dropped) {
+    return ProbeOptions(ProbeOptions::Action::Skip);
+  }
+
+  if (P.SampleRate > 1) {
+    return ProbeOptions(ProbeOptions::Action::Sample, P.SampleRate);
+  }
+
+  return ProbeOptions();
+}
+
+void OverheadBudget::Report(raw_ostream &Out) const {
+  const double Budget = BaseCycles * Percent / 100;
+
+  Out << "# Loom overhead budget: " << format("%.2f", Percent) << "% of "
+      << format("%.0f", BaseCycles) << " estimated cycles = "
+      << format("%.0f", Budget) << " cycles\n"
+      << "# Estimated instrumentation cost: " << format("%.0f", ProbeCycles)
+      << " cycles (" << Probes.size() << " probes)\n"
+      << "#\n"
+      << "# frequency\tcycles/event\tcycles\tdecision\tprobe\n";
+
+  for (auto &i : Probes) {
+    const Probe &P = i.second;
+
+    Out << format("%.0f", P.Frequency) << "\t" << format("%.0f", P.Cost)
+        << "\t" << format("%.0f", P.Total()) << "\t";
+
+    if (P.Dropped) {
+      Out << "drop";
+    } else if (P.SampleRate > 1) {
+      Out << "sample 1/" << P.SampleRate;
+    } else {
+      Out << "log";
+    }
+
+    Out << "\t" << P.Description << "\n";
+  }
+}
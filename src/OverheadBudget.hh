@@ -0,0 +1,129 @@
+//! @file OverheadBudget.hh  Declaration of @ref loom::OverheadBudget.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_OVERHEAD_BUDGET_H
+#define LOOM_OVERHEAD_BUDGET_H
+
+#include "Policy.hh"
+#include "ProbeOptions.hh"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/MapVector.h>
+
+#include <string>
+
+namespace llvm {
+class BasicBlock;
+class BlockFrequencyInfo;
+class Function;
+class raw_ostream;
+class Value;
+} // namespace llvm
+
+namespace loom {
+
+/**
+ * A budget for the run-time overhead of instrumentation.
+ *
+ * The budget estimates the (uninstrumented) cost of a module's code and the
+ * cost of every probe site, using a crude per-event cost model for the
+ * policy's strategy, loggers and serializer along with execution frequencies
+ * from profile data (if present) or static block frequency heuristics.
+ * It then chooses sampling rates (or drops probes) so that the estimated
+ * instrumentation cost fits within a fraction of the estimated program cost.
+ */
+class OverheadBudget {
+public:
+  /**
+   * Create a budget for instrumenting a module according to a policy.
+   *
+   * @param   Percent     the acceptable overhead, as a percentage of the
+   *                      module's estimated (uninstrumented) cycles
+   */
+  OverheadBudget(const Policy &, double Percent);
+
+  /// Estimate the cost (and block frequencies) of a function's code.
+  void AddFunction(llvm::Function &, llvm::BlockFrequencyInfo &);
+
+  /**
+   * Describe a probe site.
+   *
+   * @param   Site        the instrumented value (e.g., instruction or function)
+   * @param   Block       where the probe will execute
+   * @param   Description human-readable description for the report
+   * @param   Values      the number of values logged by each event
+   * @param   Events      the number of events logged each time through Block
+   *                      (e.g., 2 for a call instrumented on entry and exit)
+   */
+  void AddProbe(const llvm::Value *Site, const llvm::BasicBlock *Block,
+                llvm::StringRef Description, unsigned Values,
+                unsigned Events = 1);
+
+  /// Choose sampling rates or drop probes to fit within the budget.
+  void Solve();
+
+  /// How a probe site should be instrumented (after solving the budget).
+  ProbeOptions Options(const llvm::Value *Site) const;
+
+  /// Explain the budget and every probe decision.
+  void Report(llvm::raw_ostream &) const;
+
+private:
+  /// The estimated cost (in cycles) of logging a single event.
+  double EventCost(unsigned Values) const;
+
+  /// Everything we know about a probe site.
+  struct Probe {
+    std::string Description;
+    double Frequency;
+    double Cost;
+    unsigned SampleRate;
+    bool Dropped;
+
+    //! Estimated cycles spent on this probe with its current sampling rate.
+    double Total() const { return Dropped ? 0 : Frequency * Cost / SampleRate; }
+  };
+
+  InstrStrategy::Kind Strategy;
+  InstrStrategy::Structure BlockStructure;
+  SimpleLogger::LogType Logging;
+  std::vector<InstrStrategy::Tag> Tags;
+  Policy::KTraceTarget KTrace;
+  Policy::DTraceTarget DTrace;
+  std::string Serialization;
+
+  const double Percent;
+  double BaseCycles;
+  double ProbeCycles;
+
+  llvm::DenseMap<const llvm::BasicBlock *, double> BlockFrequency;
+  llvm::MapVector<const llvm::Value *, Probe> Probes;
+};
+
+} // namespace loom
+
+#endif // LOOM_OVERHEAD_BUDGET_H
@@ -33,6 +33,7 @@
 #include "DTraceLogger.hh"
 #include "Policy.hh"
 #include "KTraceLogger.hh"
+#include "USDTLogger.hh"
 
 using namespace llvm;
 using namespace loom;
@@ -53,11 +54,25 @@ std::vector<unique_ptr<Logger>> Policy::Loggers(Module &Mod) const {
 
   switch (this->KTrace()) {
   case Policy::KTraceTarget::Kernel:
-    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial), true));
+    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial),
+                                          KTraceLogger::Transport::Kernel));
     break;
 
   case Policy::KTraceTarget::Userspace:
-    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial), false));
+    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial),
+                                          KTraceLogger::Transport::Utrace));
+    break;
+
+  case Policy::KTraceTarget::File:
+    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial),
+                                          KTraceLogger::Transport::Runtime,
+                                          this->TraceFile()));
+    break;
+
+  case Policy::KTraceTarget::SharedMemory:
+    Loggers.emplace_back(new KTraceLogger(Mod, std::move(Serial),
+                                          KTraceLogger::Transport::SharedMemory,
+                                          this->TraceFile()));
     break;
 
   case Policy::KTraceTarget::None:
@@ -69,6 +84,10 @@ std::vector<unique_ptr<Logger>> Policy::Loggers(Module &Mod) const {
     Loggers.emplace_back(new DTraceLogger(Mod));
     break;
 
+  case Policy::DTraceTarget::USDT:
+    Loggers.emplace_back(new USDTLogger(Mod, this->USDTSemaphores()));
+    break;
+
   case Policy::DTraceTarget::None:
     break;
   }
@@ -44,6 +44,7 @@
 #include "InstrStrategy.hh"
 #include "Serializer.hh"
 #include "Metadata.hh"
+#include "ProbeOptions.hh"
 #include "Transform.hh"
 
 #include <string>
@@ -80,27 +81,58 @@ public:
   //! Simple (non-serializing) logging.
   virtual SimpleLogger::LogType Logging() const = 0;
 
-  //! Ways that we can use KTrace (or not).
-  enum class KTraceTarget { Kernel, Userspace, None };
+  /**
+   * Values (e.g., thread and CPU IDs) to log with every event, ahead of its
+   * own values, by every logger.
+   */
+  virtual std::vector<InstrStrategy::Tag> Tags() const = 0;
+
+  /**
+   * Ways that we can use KTrace (or not).
+   *
+   * `File` and `SharedMemory` aren't actually ktrace: they send the same
+   * serialized records to Loom's runtime library, which either writes them
+   * to a trace file asynchronously or puts them in a shared-memory ring for
+   * an out-of-process collector.
+   */
+  enum class KTraceTarget { Kernel, Userspace, File, SharedMemory, None };
 
   //! Should we use ktrace logging?
   virtual KTraceTarget KTrace() const = 0;
+
+  /**
+   * The trace file (or, for KTraceTarget::SharedMemory, the shared memory
+   * object) to open at startup.
+   */
+  virtual std::string TraceFile() const = 0;
   
-  //! Ways that we can use DTrace (or not).
-  enum class DTraceTarget { Userspace, None };
+  /**
+   * Ways that we can use DTrace (or not): calls to libusdt's `dt_probe`
+   * (Userspace) or SystemTap-style USDT probe points (USDT), which can also
+   * be used by perf, bpftrace, etc.
+   */
+  enum class DTraceTarget { Userspace, USDT, None };
 
-  //! Should we use ktrace logging?
+  //! Should we use DTrace logging?
   virtual DTraceTarget DTrace() const = 0;
 
+  //! Should USDT probes be skipped when no tracer is attached?
+  virtual bool USDTSemaphores() const = 0;
+
 
   //! How should we serialize data?
   virtual std::unique_ptr<Serializer> Serialization(llvm::Module &) const = 0;
 
+  //! The name of the serialization scheme, without creating a Serializer.
+  virtual std::string SerializationScheme() const = 0;
+
   /**
-   * Create instrumentation within BasicBlocks, making the structure of the
-   * instrumentation clearer but more complex.
+   * How to structure instrumentation: inline with the instrumented code,
+   * within explicit BasicBlocks (making the structure of the instrumentation
+   * clearer but more complex) or in one cold block per site, behind a check
+   * of whether the probe is enabled.
    */
-  virtual bool UseBlockStructure() const = 0;
+  virtual InstrStrategy::Structure BlockStructure() const = 0;
 
   //! Special case: instrument every single function.
   virtual bool InstrumentAll() const = 0;
@@ -108,6 +140,56 @@ public:
   //! Special case: instrument all load, store, and GEP instructions.
   virtual bool InstrumentPointerInsts() const = 0;
 
+  /**
+   * Summarize writes within loops rather than logging every iteration.
+   *
+   * When a field or global write occurs within a loop and always writes to
+   * the same location (i.e., the probe site is loop-invariant), we can
+   * replace per-iteration events with a single summary event (iteration
+   * count, first/last values and min/max) emitted on the way out of the loop.
+   */
+  virtual bool SummarizeLoops() const = 0;
+
+  /**
+   * Merge each callee-instrumented function's returns into a single exit
+   * block, so that its exit is instrumented once rather than at every
+   * return site.
+   */
+  virtual bool SingleExit() const = 0;
+
+  /**
+   * Where should function entry and call site counts be written?
+   *
+   * When set, every function with debug information counts its entries and
+   * call sites and writes them on exit (to `<output>.<pid>`) as an LLVM
+   * sample profile. An empty string means that nothing is profiled.
+   */
+  virtual std::string ProfileOutput() const = 0;
+
+  /**
+   * How many times can a probe be expected to execute before it's "hot"?
+   *
+   * When a module carries profile data (e.g., from PGO), the expected number
+   * of executions of each probe can be derived from its block and function
+   * entry counts. Zero means that no probe is considered hot.
+   */
+  virtual uint64_t MaxHotness() const = 0;
+
+  //! How should hot probes be instrumented (skipped, sampled or aggregated)?
+  virtual ProbeOptions HotProbes() const = 0;
+
+  /**
+   * How much run-time overhead can instrumentation add, as a percentage of
+   * the estimated cycles spent in uninstrumented code?
+   *
+   * When set, probes are sampled (or dropped) to fit within the budget.
+   * Zero means that there is no budget.
+   */
+  virtual double BudgetPercent() const = 0;
+
+  //! Where to write a report explaining budget decisions (if anywhere).
+  virtual std::string BudgetReport() const = 0;
+
   //! A direction that we can instrument: on the way in or on the way out.
   enum class Direction { In, Out };
 
@@ -120,12 +202,49 @@ public:
   //! In which directions (preamble/return) should a function be instrumented?
   virtual Directions FnHooks(const llvm::Function &) const = 0;
 
+  //! In which directions should indirect calls (via pointers) be instrumented?
+  virtual Directions IndirectCallHooks() const = 0;
+
+  /**
+   * How many distinct targets should be profiled at each indirect call site?
+   *
+   * Each indirect call site can record the targets that it actually calls
+   * (and how often it calls them) in a small table that is logged when the
+   * program exits. Zero means that targets are not profiled.
+   */
+  virtual unsigned IndirectCallTargets() const = 0;
+
   //! Return any metadata defined for an instruction
   virtual Metadata InstrMetadata(const llvm::Function &Fn) const = 0;
   
   //! Return any transforms defined for an instruction
   virtual std::vector<Transform> InstrTransforms(const llvm::Function &Fn) const = 0;
 
+  //! Does any function's instrumentation use the named transform?
+  virtual bool UsesTransform(llvm::StringRef Name) const = 0;
+
+  /**
+   * Which of a function's (pointer) arguments should have the strings or
+   * buffers that they point to captured in its call and function events?
+   *
+   * These are returned as `CaptureString` or `CaptureBuffer` transforms,
+   * with argument indices counted from the function's first argument.
+   */
+  virtual std::vector<Transform> Captures(const llvm::Function &Fn) const = 0;
+
+  /**
+   * Which events involving a function (calls or its own entry and exit)
+   * should actually be logged? Null means all of them.
+   */
+  virtual std::shared_ptr<const Filter>
+  FnFilter(const llvm::Function &Fn) const = 0;
+
+  /**
+   * How many events involving a function should each thread log per second?
+   * Zero means that there is no limit.
+   */
+  virtual unsigned FnMaxRate(const llvm::Function &Fn) const = 0;
+
   /**
    * A structure type is relevant in some way to instrumentation.
    *
@@ -153,6 +272,17 @@ public:
   virtual bool FieldWriteHook(const llvm::StructType &T,
                               llvm::StringRef Field) const = 0;
 
+  /**
+   * Which reads from or writes to a structure field should actually be
+   * logged? Null means all of them.
+   */
+  virtual std::shared_ptr<const Filter>
+  FieldFilter(const llvm::StructType &T, llvm::StringRef Field) const = 0;
+
+  //! How many field events should each thread log per second (0: any)?
+  virtual unsigned FieldMaxRate(const llvm::StructType &T,
+                                llvm::StringRef Field) const = 0;
+
   /**
    * A global value is relevant in some way to instrumentation.
    *
@@ -38,6 +38,10 @@
  */
 
 #include "PolicyFile.hh"
+#include "Capture.hh"
+#include "CompactSerializer.hh"
+#include "Filter.hh"
+#include "IRUtils.hh"
 #include "NVSerializer.hh"
 #include "Strings.hh"
 
@@ -66,6 +70,21 @@ template <class T> bool vecContains(const std::vector<T> &V, const T &Val) {
 // Data that can be represented in an instrumentation description file:
 //
 
+/// An argument whose string or buffer contents should be captured.
+struct CaptureInstrumentation {
+  /// Which argument points to the string or buffer (counting from 0).
+  unsigned Arg = 0;
+
+  /// Is the argument a NUL-terminated string or a buffer?
+  CaptureKind Kind = CaptureKind::String;
+
+  /// For buffers, the argument that holds the buffer's length.
+  unsigned Length = 0;
+
+  /// The most bytes to capture (longer strings or buffers are truncated).
+  unsigned Max = 64;
+};
+
 /// A description of how to instrument a function.
 struct FnInstrumentation {
   /// Function name (as named by LLVM, possibly language-mangled).
@@ -86,6 +105,51 @@ struct FnInstrumentation {
 
   /// Additions transformations that should be applied when logging function call.
   vector<loom::Transform> Transforms;
+
+  /// String and buffer arguments whose contents should be logged.
+  vector<CaptureInstrumentation> Captures;
+
+  /// Only log events that satisfy this filter expression (if non-empty).
+  string When;
+
+  /// The parsed form of When.
+  std::shared_ptr<const Filter> WhenFilter;
+
+  /// Most events to log per second per thread (e.g., "100/s"; empty: any).
+  string MaxRate;
+
+  /// The parsed form of MaxRate (0 for no limit).
+  unsigned EventsPerSecond = 0;
+};
+
+/// A description of how to instrument indirect calls (via function pointers).
+struct IndirectCallInstrumentation {
+  /// Instrumentation that should be applied to indirect calls.
+  Policy::Directions Call;
+
+  /// How many distinct targets to profile at each call site (0 to disable).
+  unsigned ProfileTargets = 0;
+};
+
+/// What to do with probes that profile data says are hot.
+struct HotnessPolicy {
+  /// Probes expected to execute more often than this are hot (0: no limit).
+  uint64_t MaxCount = 0;
+
+  /// What to do with hot probes.
+  ProbeOptions::Action Action = ProbeOptions::Action::Skip;
+
+  /// When sampling hot probes, log one in this many events.
+  unsigned SampleRate = 100;
+};
+
+/// A budget for instrumentation overhead.
+struct BudgetPolicy {
+  /// Acceptable overhead (percent of estimated cycles; 0 for no budget).
+  double Overhead = 0;
+
+  /// Where to write a report explaining the budget's decisions.
+  string Report;
 };
 
 /// An operation that can be performed on a variable
@@ -102,10 +166,23 @@ struct FieldInstrumentation {
 
   /// Operations (read/write) that should be instrumented.
   vector<Operation> Operations;
+
+  /// Only log events that satisfy this filter expression (if non-empty).
+  string When;
+
+  /// The parsed form of When.
+  std::shared_ptr<const Filter> WhenFilter;
+
+  /// Most events to log per second per thread (e.g., "100/s"; empty: any).
+  string MaxRate;
+
+  /// The parsed form of MaxRate (0 for no limit).
+  unsigned EventsPerSecond = 0;
 };
 
-/// Serialization strategies we can use (libnv, MessagePack, null...).
+/// Serialization strategies we can use (libnv, compact, null...).
 enum class SerializationType {
+  Compact,
   LibNV,
   None,
 };
@@ -141,17 +218,27 @@ struct PolicyFile::PolicyFileData {
   /// Simple (non-serializing) logging strategy.
   SimpleLogger::LogType Logging;
 
+  /// Values to log with every event (thread and/or CPU).
+  vector<InstrStrategy::Tag> Tags;
+
   /// KTrace-based logging.
   Policy::KTraceTarget KTrace;
+
+  /// Where the runtime should write serialized records (`ktrace: file|shm`).
+  string TraceFile;
   
   /// DTrace-based logging.
   Policy::DTraceTarget DTrace;
 
+  /// Give USDT probes semaphores (only fire when a tracer is attached).
+  bool USDTSemaphores;
+
   /// Serialization.
   SerializationType Serial;
 
-  /// Whether or not to put instrumentation in an explicit block structure.
-  bool UseBlockStructure;
+  /// Whether to put instrumentation in an explicit block structure, a cold
+  /// block behind an enable check or neither.
+  InstrStrategy::Structure BlockStructure;
 
   /// Just instrument every instruction.
   bool InstrumentEverything;
@@ -159,9 +246,27 @@ struct PolicyFile::PolicyFileData {
   /// Instrument all stores, loads and GEPs.
   bool InstrumentPointerInsts;
 
+  /// Summarize loop-invariant writes within loops.
+  bool SummarizeLoops;
+
+  /// Instrument function exits at a single, merged return.
+  bool SingleExit;
+
+  /// Where to write sample profiles (if anywhere).
+  string ProfileOutput;
+
+  /// Profile-guided treatment of hot probes.
+  HotnessPolicy Hotness;
+
+  /// Overhead budget.
+  BudgetPolicy Budget;
+
   /// Function instrumentation.
   vector<FnInstrumentation> Functions;
 
+  /// Indirect call instrumentation.
+  IndirectCallInstrumentation IndirectCalls;
+
   /// Structure field instrumentation.
   vector<StructInstrumentation> Structures;
   
@@ -189,6 +294,24 @@ template <> struct yaml::ScalarEnumerationTraits<InstrStrategy::Kind> {
   static void enumeration(yaml::IO &io, InstrStrategy::Kind &K) {
     io.enumCase(K, "callout", InstrStrategy::Kind::Callout);
     io.enumCase(K, "inline", InstrStrategy::Kind::Inline);
+    io.enumCase(K, "patchable", InstrStrategy::Kind::Patchable);
+  }
+};
+
+/// Converts an InstrStrategy::Structure to/from YAML.
+template <> struct yaml::ScalarEnumerationTraits<InstrStrategy::Structure> {
+  static void enumeration(yaml::IO &io, InstrStrategy::Structure &S) {
+    io.enumCase(S, "false", InstrStrategy::Structure::Flat);
+    io.enumCase(S, "guarded", InstrStrategy::Structure::Guarded);
+    io.enumCase(S, "true", InstrStrategy::Structure::Blocks);
+  }
+};
+
+/// Converts an InstrStrategy::Tag to/from YAML.
+template <> struct yaml::ScalarEnumerationTraits<InstrStrategy::Tag> {
+  static void enumeration(yaml::IO &io, InstrStrategy::Tag &T) {
+    io.enumCase(T, "thread", InstrStrategy::Tag::Thread);
+    io.enumCase(T, "cpu", InstrStrategy::Tag::CPU);
   }
 };
 
@@ -197,6 +320,8 @@ template <> struct yaml::ScalarEnumerationTraits<Policy::KTraceTarget> {
   static void enumeration(yaml::IO &io, Policy::KTraceTarget &T) {
     io.enumCase(T, "kernel", Policy::KTraceTarget::Kernel);
     io.enumCase(T, "utrace", Policy::KTraceTarget::Userspace);
+    io.enumCase(T, "file", Policy::KTraceTarget::File);
+    io.enumCase(T, "shm", Policy::KTraceTarget::SharedMemory);
     io.enumCase(T, "none", Policy::KTraceTarget::None);
   }
 };
@@ -206,6 +331,7 @@ template <>
 struct yaml::ScalarEnumerationTraits<Policy::DTraceTarget> {
   static void enumeration(yaml::IO &io, Policy::DTraceTarget& T) {
     io.enumCase(T, "userspace", Policy::DTraceTarget::Userspace);
+    io.enumCase(T, "usdt", Policy::DTraceTarget::USDT);
     io.enumCase(T, "none", Policy::DTraceTarget::None);
   }
 };
@@ -232,11 +358,111 @@ template <> struct yaml::MappingTraits<loom::Transform> {
     io.mapOptional("arg", Transform.Arg);
     io.mapOptional("fn", Transform.Fn);
   }
+
+  static StringRef validate(yaml::IO &io, loom::Transform &Transform) {
+    return Transform.isKnown() ? StringRef() : "unknown transform";
+  }
+};
+
+/// Converts a CaptureKind to/from YAML.
+template <> struct yaml::ScalarEnumerationTraits<CaptureKind> {
+  static void enumeration(yaml::IO &io, CaptureKind &K) {
+    io.enumCase(K, "string", CaptureKind::String);
+    io.enumCase(K, "buffer", CaptureKind::Buffer);
+  }
+};
+
+/// Converts CaptureInstrumentation to/from YAML.
+template <> struct yaml::MappingTraits<CaptureInstrumentation> {
+  static void mapping(yaml::IO &io, CaptureInstrumentation &c) {
+    io.mapRequired("arg", c.Arg);
+    io.mapOptional("type", c.Kind, CaptureKind::String);
+    io.mapOptional("length", c.Length, 0u);
+    io.mapOptional("max", c.Max, 64u);
+  }
+
+  static StringRef validate(yaml::IO &io, CaptureInstrumentation &c) {
+    if (c.Kind == CaptureKind::Buffer and c.Length == c.Arg)
+      return "buffer captures need a (different) length argument";
+    if (c.Max == 0)
+      return "capture max must be at least 1 byte";
+    return StringRef();
+  }
+};
+
+/// Parse a `when:` filter expression, returning any error message.
+static StringRef ParseWhen(const string &When,
+                           std::shared_ptr<const Filter> &Result) {
+  static string Error;
+
+  if (When.empty()) {
+    Result.reset();
+    return StringRef();
+  }
+
+  string Message;
+  Result = Filter::Parse(When, Message);
+  if (not Result) {
+    Error = "invalid filter '" + When + "': " + Message;
+    return Error;
+  }
+
+  return StringRef();
+}
+
+/// Parse a `max_rate:` value (events per second), returning any error.
+static StringRef ParseRate(StringRef Rate, unsigned &Result) {
+  static string Error;
+
+  Result = 0;
+  if (Rate.empty()) {
+    return StringRef();
+  }
+
+  StringRef Count = Rate.trim();
+  if (Count.consume_back("/s")) {
+    Count = Count.rtrim();
+  }
+
+  if (Count.getAsInteger(10, Result) or Result == 0) {
+    Error = "invalid max_rate '" + Rate.str() + "' (expected, e.g., 100/s)";
+    return Error;
+  }
+
+  return StringRef();
+}
+
+/// Converts a ProbeOptions::Action to/from YAML.
+template <> struct yaml::ScalarEnumerationTraits<ProbeOptions::Action> {
+  static void enumeration(yaml::IO &io, ProbeOptions::Action &A) {
+    io.enumCase(A, "log", ProbeOptions::Action::Log);
+    io.enumCase(A, "skip", ProbeOptions::Action::Skip);
+    io.enumCase(A, "sample", ProbeOptions::Action::Sample);
+    io.enumCase(A, "aggregate", ProbeOptions::Action::Aggregate);
+  }
+};
+
+/// Converts HotnessPolicy to/from YAML.
+template <> struct yaml::MappingTraits<HotnessPolicy> {
+  static void mapping(yaml::IO &io, HotnessPolicy &h) {
+    io.mapRequired("max_count", h.MaxCount);
+    io.mapOptional("action", h.Action, ProbeOptions::Action::Skip);
+    io.mapOptional("sample_rate", h.SampleRate, 100u);
+  }
+};
+
+/// Converts BudgetPolicy to/from YAML.
+template <> struct yaml::MappingTraits<BudgetPolicy> {
+  static void mapping(yaml::IO &io, BudgetPolicy &b) {
+    io.mapRequired("overhead", b.Overhead);
+    io.mapOptional("report", b.Report, string());
+  }
 };
 
 /// Converts a SerializationType to/from YAML.
 template <> struct yaml::ScalarEnumerationTraits<SerializationType> {
   static void enumeration(yaml::IO &io, SerializationType &S) {
+    io.enumCase(S, "compact", SerializationType::Compact);
     io.enumCase(S, "nv", SerializationType::LibNV);
     io.enumCase(S, "none", SerializationType::None);
   }
@@ -260,6 +486,22 @@ template <> struct yaml::MappingTraits<FnInstrumentation> {
     io.mapOptional("callee", fn.Body);
     io.mapOptional("metadata", fn.Meta);
     io.mapOptional("transforms", fn.Transforms);
+    io.mapOptional("captures", fn.Captures);
+    io.mapOptional("when", fn.When, string());
+    io.mapOptional("max_rate", fn.MaxRate, string());
+  }
+
+  static StringRef validate(yaml::IO &io, FnInstrumentation &fn) {
+    StringRef Error = ParseWhen(fn.When, fn.WhenFilter);
+    return Error.empty() ? ParseRate(fn.MaxRate, fn.EventsPerSecond) : Error;
+  }
+};
+
+/// Converts IndirectCallInstrumentation to/from YAML.
+template <> struct yaml::MappingTraits<IndirectCallInstrumentation> {
+  static void mapping(yaml::IO &io, IndirectCallInstrumentation &ic) {
+    io.mapOptional("caller", ic.Call);
+    io.mapOptional("profile_targets", ic.ProfileTargets, 0u);
   }
 };
 
@@ -277,6 +519,13 @@ template <> struct yaml::MappingTraits<FieldInstrumentation> {
   static void mapping(yaml::IO &io, FieldInstrumentation &f) {
     io.mapRequired("name", f.Name);
     io.mapRequired("operations", f.Operations);
+    io.mapOptional("when", f.When, string());
+    io.mapOptional("max_rate", f.MaxRate, string());
+  }
+
+  static StringRef validate(yaml::IO &io, FieldInstrumentation &f) {
+    StringRef Error = ParseWhen(f.When, f.WhenFilter);
+    return Error.empty() ? ParseRate(f.MaxRate, f.EventsPerSecond) : Error;
   }
 };
 
@@ -302,14 +551,24 @@ template <> struct yaml::MappingTraits<PolicyFile::PolicyFileData> {
   static void mapping(yaml::IO &io, PolicyFile::PolicyFileData &policy) {
     io.mapOptional("strategy", policy.Strategy, InstrStrategy::Kind::Callout);
     io.mapOptional("logging", policy.Logging, SimpleLogger::LogType::None);
+    io.mapOptional("tags", policy.Tags);
     io.mapOptional("ktrace", policy.KTrace, Policy::KTraceTarget::None);
+    io.mapOptional("trace_file", policy.TraceFile, string());
     io.mapOptional("dtrace", policy.DTrace, Policy::DTraceTarget::None);
+    io.mapOptional("usdt_semaphores", policy.USDTSemaphores, false);
     io.mapOptional("serialization", policy.Serial, SerializationType::None);
-    io.mapOptional("block_structure", policy.UseBlockStructure, false);
+    io.mapOptional("block_structure", policy.BlockStructure,
+                   InstrStrategy::Structure::Flat);
     io.mapOptional("hook_prefix", policy.HookPrefix, string("__loom"));
     io.mapOptional("everything", policy.InstrumentEverything, false);
     io.mapOptional("pointerInsts", policy.InstrumentPointerInsts, false);
+    io.mapOptional("summarize_loops", policy.SummarizeLoops, false);
+    io.mapOptional("single_exit", policy.SingleExit, false);
+    io.mapOptional("profile_output", policy.ProfileOutput, string());
+    io.mapOptional("hotness", policy.Hotness);
+    io.mapOptional("budget", policy.Budget);
     io.mapOptional("functions", policy.Functions);
+    io.mapOptional("indirect_calls", policy.IndirectCalls);
     io.mapOptional("structures", policy.Structures);
 	io.mapOptional("globals", policy.Globals);
   }
@@ -346,13 +605,21 @@ InstrStrategy::Kind PolicyFile::Strategy() const { return Policy->Strategy; }
 
 SimpleLogger::LogType PolicyFile::Logging() const { return Policy->Logging; }
 
+vector<InstrStrategy::Tag> PolicyFile::Tags() const { return Policy->Tags; }
+
 Policy::KTraceTarget PolicyFile::KTrace() const { return Policy->KTrace; }
 
+string PolicyFile::TraceFile() const { return Policy->TraceFile; }
+
 Policy::DTraceTarget PolicyFile::DTrace() const { return Policy->DTrace; }
 
+bool PolicyFile::USDTSemaphores() const { return Policy->USDTSemaphores; }
+
 unique_ptr<Serializer> PolicyFile::Serialization(Module& Mod) const
 {
   switch (Policy->Serial) {
+  case SerializationType::Compact:
+    return unique_ptr<Serializer>(new CompactSerializer(Mod));
   case SerializationType::LibNV:
     return unique_ptr<Serializer>(new NVSerializer(Mod));
   case SerializationType::None:
@@ -360,7 +627,20 @@ unique_ptr<Serializer> PolicyFile::Serialization(Module& Mod) const
   }
 }
 
-bool PolicyFile::UseBlockStructure() const { return Policy->UseBlockStructure; }
+string PolicyFile::SerializationScheme() const {
+  switch (Policy->Serial) {
+  case SerializationType::Compact:
+    return "compact";
+  case SerializationType::LibNV:
+    return "nvlist";
+  case SerializationType::None:
+    return "null";
+  }
+}
+
+InstrStrategy::Structure PolicyFile::BlockStructure() const {
+  return Policy->BlockStructure;
+}
 
 bool PolicyFile::InstrumentAll() const { return Policy->InstrumentEverything; }
 
@@ -368,8 +648,24 @@ bool PolicyFile::InstrumentPointerInsts() const {
   return Policy->InstrumentPointerInsts;
 }
 
+bool PolicyFile::SummarizeLoops() const { return Policy->SummarizeLoops; }
+
+bool PolicyFile::SingleExit() const { return Policy->SingleExit; }
+
+string PolicyFile::ProfileOutput() const { return Policy->ProfileOutput; }
+
+uint64_t PolicyFile::MaxHotness() const { return Policy->Hotness.MaxCount; }
+
+ProbeOptions PolicyFile::HotProbes() const {
+  return ProbeOptions(Policy->Hotness.Action, Policy->Hotness.SampleRate);
+}
+
+double PolicyFile::BudgetPercent() const { return Policy->Budget.Overhead; }
+
+string PolicyFile::BudgetReport() const { return Policy->Budget.Report; }
+
 Policy::Directions PolicyFile::CallHooks(const llvm::Function &Fn) const {
-  StringRef Name = Fn.getName();
+  StringRef Name = SourceName(Fn);
 
   for (FnInstrumentation &F : Policy->Functions) {
     if (MatchName(F.Name, Name)) {
@@ -381,7 +677,7 @@ Policy::Directions PolicyFile::CallHooks(const llvm::Function &Fn) const {
 }
 
 Policy::Directions PolicyFile::FnHooks(const llvm::Function &Fn) const {
-  StringRef Name = Fn.getName();
+  StringRef Name = SourceName(Fn);
 
   std::string FileName = "";
   DISubprogram* Sp = Fn.getSubprogram();
@@ -405,8 +701,16 @@ Policy::Directions PolicyFile::FnHooks(const llvm::Function &Fn) const {
   return Policy::Directions();
 }
 
+Policy::Directions PolicyFile::IndirectCallHooks() const {
+  return Policy->IndirectCalls.Call;
+}
+
+unsigned PolicyFile::IndirectCallTargets() const {
+  return Policy->IndirectCalls.ProfileTargets;
+}
+
 loom::Metadata PolicyFile::InstrMetadata(const llvm::Function &Fn) const {
-  StringRef Name = Fn.getName();
+  StringRef Name = SourceName(Fn);
 
   for (FnInstrumentation &F : Policy->Functions) {
     if (MatchName(F.Name, Name)) {
@@ -416,13 +720,74 @@ loom::Metadata PolicyFile::InstrMetadata(const llvm::Function &Fn) const {
 }
 
 vector<loom::Transform> PolicyFile::InstrTransforms(const llvm::Function &Fn) const {
-  StringRef Name = Fn.getName();
+  StringRef Name = SourceName(Fn);
 
   for (FnInstrumentation &F : Policy->Functions) {
     if (MatchName(F.Name, Name)) {
       return F.Transforms;
     }
   }
+
+  return {};
+}
+
+bool PolicyFile::UsesTransform(StringRef Name) const {
+  for (FnInstrumentation &F : Policy->Functions) {
+    for (const loom::Transform &T : F.Transforms) {
+      if (T.Fn == Name) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+vector<loom::Transform> PolicyFile::Captures(const llvm::Function &Fn) const {
+  StringRef Name = SourceName(Fn);
+  vector<loom::Transform> Captures;
+
+  for (FnInstrumentation &F : Policy->Functions) {
+    if (not MatchName(F.Name, Name)) {
+      continue;
+    }
+
+    for (CaptureInstrumentation &C : F.Captures) {
+      const bool Buffer = (C.Kind == CaptureKind::Buffer);
+      loom::Transform T(Buffer ? "CaptureBuffer" : "CaptureString", C.Arg);
+      T.Length = C.Length;
+      T.Max = C.Max;
+      Captures.push_back(T);
+    }
+    break;
+  }
+
+  return Captures;
+}
+
+std::shared_ptr<const Filter>
+PolicyFile::FnFilter(const llvm::Function &Fn) const {
+  StringRef Name = SourceName(Fn);
+
+  for (FnInstrumentation &F : Policy->Functions) {
+    if (MatchName(F.Name, Name)) {
+      return F.WhenFilter;
+    }
+  }
+
+  return nullptr;
+}
+
+unsigned PolicyFile::FnMaxRate(const llvm::Function &Fn) const {
+  StringRef Name = SourceName(Fn);
+
+  for (FnInstrumentation &F : Policy->Functions) {
+    if (MatchName(F.Name, Name)) {
+      return F.EventsPerSecond;
+    }
+  }
+
+  return 0;
 }
 
 bool PolicyFile::StructTypeMatters(const llvm::StructType &T) const {
@@ -495,12 +860,58 @@ bool PolicyFile::FieldWriteHook(const llvm::StructType &T,
   return false;
 }
 
+std::shared_ptr<const Filter>
+PolicyFile::FieldFilter(const llvm::StructType &T, StringRef Field) const {
+  if (not T.getName().startswith("struct.")) {
+    return nullptr;
+  }
+
+  StringRef Name = T.getName().substr(7);
+
+  for (StructInstrumentation &S : Policy->Structures) {
+    if (!MatchName(S.Name, Name)) {
+      continue;
+    }
+
+    for (auto &F : S.Fields) {
+      if (MatchName(F.Name, Field)) {
+        return F.WhenFilter;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+unsigned PolicyFile::FieldMaxRate(const llvm::StructType &T,
+                                  StringRef Field) const {
+  if (not T.getName().startswith("struct.")) {
+    return 0;
+  }
+
+  StringRef Name = T.getName().substr(7);
+
+  for (StructInstrumentation &S : Policy->Structures) {
+    if (!MatchName(S.Name, Name)) {
+      continue;
+    }
+
+    for (auto &F : S.Fields) {
+      if (MatchName(F.Name, Field)) {
+        return F.EventsPerSecond;
+      }
+    }
+  }
+
+  return 0;
+}
+
 bool PolicyFile::GlobalValueMatters(const llvm::Value &V) const {
   if (not V.hasName()) {
     return false;
   }
 
-  StringRef Name = V.getName();
+  StringRef Name = SourceName(V);
 
   for (GlobalInstrumentation &G : Policy->Globals) {
     if (G.Name == Name) {
@@ -512,7 +923,7 @@ bool PolicyFile::GlobalValueMatters(const llvm::Value &V) const {
 }
 
 bool PolicyFile::GlobalReadHook(const llvm::Value &V) const {
-  StringRef Name = V.getName();
+  StringRef Name = SourceName(V);
 
   for (GlobalInstrumentation &G : Policy->Globals) {
     if (G.Name != Name) {
@@ -526,7 +937,7 @@ bool PolicyFile::GlobalReadHook(const llvm::Value &V) const {
 }
 
 bool PolicyFile::GlobalWriteHook(const llvm::Value &V) const {
-  StringRef Name = V.getName();
+  StringRef Name = SourceName(V);
 
   for (GlobalInstrumentation &G : Policy->Globals) {
     if (G.Name != Name) {
@@ -61,31 +61,71 @@ public:
   SimpleLogger::LogType Logging() const override;
 
   KTraceTarget KTrace() const override;
+
+  std::string TraceFile() const override;
   
   DTraceTarget DTrace() const override;
 
+  bool USDTSemaphores() const override;
+
   std::unique_ptr<Serializer> Serialization(llvm::Module &) const override;
 
-  bool UseBlockStructure() const override;
+  std::string SerializationScheme() const override;
+
+  InstrStrategy::Structure BlockStructure() const override;
 
   bool InstrumentAll() const override;
 
   bool InstrumentPointerInsts() const override;
 
+  bool SummarizeLoops() const override;
+
+  bool SingleExit() const override;
+
+  std::string ProfileOutput() const override;
+
+  std::vector<InstrStrategy::Tag> Tags() const override;
+
+  uint64_t MaxHotness() const override;
+
+  ProbeOptions HotProbes() const override;
+
+  double BudgetPercent() const override;
+
+  std::string BudgetReport() const override;
+
   Policy::Directions CallHooks(const llvm::Function &) const override;
 
   Policy::Directions FnHooks(const llvm::Function &) const override;
 
+  Policy::Directions IndirectCallHooks() const override;
+
+  unsigned IndirectCallTargets() const override;
+
   Metadata InstrMetadata(const llvm::Function &Fn) const override;
   
   std::vector<Transform> InstrTransforms(const llvm::Function &Fn) const override;
 
+  bool UsesTransform(llvm::StringRef Name) const override;
+
+  std::vector<Transform> Captures(const llvm::Function &Fn) const override;
+
+  std::shared_ptr<const Filter> FnFilter(const llvm::Function &) const override;
+
+  unsigned FnMaxRate(const llvm::Function &) const override;
+
   bool StructTypeMatters(const llvm::StructType &) const override;
 
   bool FieldReadHook(const llvm::StructType &, llvm::StringRef) const override;
 
   bool FieldWriteHook(const llvm::StructType &, llvm::StringRef) const override;
 
+  std::shared_ptr<const Filter> FieldFilter(const llvm::StructType &,
+                                            llvm::StringRef) const override;
+
+  unsigned FieldMaxRate(const llvm::StructType &,
+                        llvm::StringRef) const override;
+
   bool GlobalValueMatters(const llvm::Value &) const override;
 
   bool GlobalReadHook(const llvm::Value &) const override;
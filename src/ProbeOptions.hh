@@ -0,0 +1,72 @@
+//! @file ProbeOptions.hh  Declaration of @ref loom::ProbeOptions.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_PROBE_OPTIONS_H
+#define LOOM_PROBE_OPTIONS_H
+
+#include <memory>
+
+namespace llvm {
+class DISubroutineType;
+}
+
+namespace loom {
+
+class Filter;
+
+//! Options that change how a single probe (instrumentation point) behaves.
+struct ProbeOptions {
+  //! What a probe does when it is reached.
+  enum class Action {
+    Log,       //!< log every event (the default)
+    Skip,      //!< don't instrument the probe site at all
+    Sample,    //!< only log one in every SampleRate events
+    Aggregate, //!< count events, logging the total when the program exits
+  };
+
+  ProbeOptions(Action A = Action::Log, unsigned Rate = 1)
+      : Kind(A), SampleRate(Rate) {}
+
+  Action Kind;
+  unsigned SampleRate;
+
+  //! Only log events whose values satisfy this filter (if set).
+  std::shared_ptr<const Filter> When;
+
+  //! The probed function's source-level type, if known (see Filter).
+  const llvm::DISubroutineType *Signature = nullptr;
+
+  //! Log at most this many events per second per thread (0: no limit).
+  unsigned MaxRate = 0;
+
+  //! Probe a function's exit once, after merging its return sites.
+  bool SingleExit = false;
+};
+
+} // namespace loom
+
+#endif /* LOOM_PROBE_OPTIONS_H */
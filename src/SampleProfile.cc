@@ -0,0 +1,219 @@
+//! @file SampleProfile.cc  Definition of @ref loom::SampleProfile.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "SampleProfile.hh"
+
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/TypeBuilder.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+#include <sstream>
+
+using namespace llvm;
+using namespace loom;
+using std::string;
+using std::vector;
+
+namespace {
+
+/// Escape a name for use within a printf format string.
+string Escape(StringRef Name) {
+  string Escaped;
+  for (char C : Name) {
+    if (C == '%') {
+      Escaped += '%';
+    }
+    Escaped += C;
+  }
+  return Escaped;
+}
+
+/// Increment a counter (non-atomically: the odd lost count is fine here).
+void Increment(IRBuilder<> &B, GlobalVariable *Counters, unsigned Index) {
+  Value *Counter = B.CreateConstInBoundsGEP2_32(Counters->getValueType(),
+                                                Counters, 0, Index);
+  B.CreateStore(B.CreateAdd(B.CreateLoad(Counter), B.getInt64(1)), Counter);
+}
+
+} // namespace
+
+bool SampleProfile::Add(Function &Fn) {
+  DISubprogram *SP = Fn.getSubprogram();
+  if (Fn.isDeclaration() or not SP) {
+    return false;
+  }
+
+  vector<CallSite> &Calls = Functions[&Fn];
+
+  for (auto &Inst : instructions(Fn)) {
+    auto *Call = dyn_cast<CallInst>(&Inst);
+    if (not Call or isa<IntrinsicInst>(Call) or Call->isInlineAsm()) {
+      continue;
+    }
+
+    // Calls from inlined code would need nested (inlinee) profile records.
+    const DILocation *Loc = Call->getDebugLoc();
+    if (not Loc or Loc->getInlinedAt() or Loc->getLine() < SP->getLine()) {
+      continue;
+    }
+
+    Calls.push_back({Call, (Loc->getLine() - SP->getLine()) & 0xffff,
+                     Loc->getBaseDiscriminator()});
+  }
+
+  return true;
+}
+
+bool SampleProfile::Instrument(Instrumenter &Instr, StringRef Filename) {
+  if (Functions.empty()) {
+    return false;
+  }
+
+  Module &Mod = Instr.getModule();
+  LLVMContext &Ctx = Mod.getContext();
+  IntegerType *CountTy = Type::getInt64Ty(Ctx);
+  const unsigned PathMax = 1024;
+
+  auto *Snprintf = Mod.getOrInsertFunction(
+      "snprintf",
+      TypeBuilder<int(char *, size_t, const char *, ...), false>::get(Ctx));
+  auto *GetPid =
+      Mod.getOrInsertFunction("getpid", TypeBuilder<int(), false>::get(Ctx));
+  auto *Fopen = Mod.getOrInsertFunction(
+      "fopen",
+      TypeBuilder<void *(const char *, const char *), false>::get(Ctx));
+  auto *Fprintf = Mod.getOrInsertFunction(
+      "fprintf", TypeBuilder<int(void *, const char *, ...), false>::get(Ctx));
+  auto *Fclose = Mod.getOrInsertFunction(
+      "fclose", TypeBuilder<int(void *), false>::get(Ctx));
+
+  // On exit, open Filename.<pid> for appending: every module (and every run)
+  // adds its own functions' records, which llvm-profdata will merge.
+  ReturnInst *Ret = Instr.AtExit();
+  Function *ExitFn = Ret->getFunction();
+  IRBuilder<> Entry(&*ExitFn->getEntryBlock().getFirstInsertionPt());
+  auto *PathTy = ArrayType::get(Entry.getInt8Ty(), PathMax);
+  Value *PathBuffer = Entry.CreateAlloca(PathTy, nullptr, "profile.path");
+
+  IRBuilder<> B(Ret);
+  Value *Path = B.CreateConstInBoundsGEP2_32(PathTy, PathBuffer, 0, 0);
+  B.CreateCall(Snprintf, {Path, B.getInt64(PathMax),
+                          B.CreateGlobalStringPtr("%s.%d"),
+                          B.CreateGlobalStringPtr(Filename),
+                          B.CreateCall(GetPid)});
+  Value *File = B.CreateCall(Fopen, {Path, B.CreateGlobalStringPtr("a")});
+
+  Instruction *Write =
+      SplitBlockAndInsertIfThen(B.CreateIsNotNull(File), Ret, false);
+
+  for (auto &i : Functions) {
+    Function *Fn = i.first;
+    const vector<CallSite> &Calls = i.second;
+
+    // Counter 0 counts function entries; the rest count calls.
+    auto *CountersTy = ArrayType::get(CountTy, Calls.size() + 1);
+    auto *Counters = new GlobalVariable(Mod, CountersTy, false,
+                                        GlobalValue::InternalLinkage,
+                                        ConstantAggregateZero::get(CountersTy),
+                                        Name({"counts", Fn->getName()}));
+
+    IRBuilder<> FnEntry(&*Fn->getEntryBlock().getFirstInsertionPt());
+    Increment(FnEntry, Counters, 0);
+
+    for (unsigned j = 0; j < Calls.size(); j++) {
+      IRBuilder<> CallBuilder(Calls[j].Call);
+      Increment(CallBuilder, Counters, j + 1);
+    }
+
+    // On exit, write a record for every function that was actually called.
+    IRBuilder<> W(Write);
+    auto Count = [&](unsigned Index) {
+      return W.CreateLoad(
+          W.CreateConstInBoundsGEP2_32(CountersTy, Counters, 0, Index));
+    };
+
+    Value *Head = Count(0);
+    W.SetInsertPoint(SplitBlockAndInsertIfThen(
+        W.CreateICmpNE(Head, W.getInt64(0)), Write, false));
+
+    // Group calls by location: each line has a sample count and a
+    // count for each target called from it.
+    typedef std::pair<unsigned, unsigned> Location;
+    MapVector<Location, MapVector<Function *, Value *>> Lines;
+    for (unsigned j = 0; j < Calls.size(); j++) {
+      const CallSite &CS = Calls[j];
+      Value *&Targets =
+          Lines[{CS.LineOffset, CS.Discriminator}][CS.Call->getCalledFunction()];
+      Value *N = Count(j + 1);
+      Targets = Targets ? W.CreateAdd(Targets, N) : N;
+    }
+
+    std::ostringstream Format;
+    vector<Value *> Args{File, nullptr, nullptr, Head};
+    Value *Total = Head;
+
+    Format << Escape(Fn->getName()) << ":%llu:%llu\n";
+
+    for (auto &Line : Lines) {
+      const Location &Loc = Line.first;
+
+      Value *Samples = nullptr;
+      for (auto &Target : Line.second) {
+        Samples = Samples ? W.CreateAdd(Samples, Target.second) : Target.second;
+      }
+      Total = W.CreateAdd(Total, Samples);
+
+      Format << " " << Loc.first;
+      if (Loc.second != 0) {
+        Format << "." << Loc.second;
+      }
+      Format << ": %llu";
+      Args.push_back(Samples);
+
+      // Indirect calls only contribute to the line's sample count.
+      for (auto &Target : Line.second) {
+        if (Function *Callee = Target.first) {
+          Format << " " << Escape(Callee->getName()) << ":%llu";
+          Args.push_back(Target.second);
+        }
+      }
+
+      Format << "\n";
+    }
+
+    Args[1] = W.CreateGlobalStringPtr(Format.str());
+    Args[2] = Total;
+    W.CreateCall(Fprintf, Args);
+  }
+
+  IRBuilder<>(Write).CreateCall(Fclose, {File});
+
+  return true;
+}
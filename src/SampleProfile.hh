@@ -0,0 +1,89 @@
+//! @file SampleProfile.hh  Declaration of @ref loom::SampleProfile.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOOM_SAMPLE_PROFILE_H
+#define LOOM_SAMPLE_PROFILE_H
+
+#include "Instrumenter.hh"
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <vector>
+
+namespace llvm {
+class CallInst;
+class Function;
+} // namespace llvm
+
+namespace loom {
+
+/**
+ * Function entry and call site counters that are written out, when the
+ * program exits, in LLVM's text sample profile format.
+ *
+ * Sample profiles identify call sites by line offsets within functions
+ * rather than by CFG hashes, so counts collected from a Loom-instrumented
+ * binary can be merged (`llvm-profdata merge -sample`) and used to optimize
+ * an uninstrumented build (`clang -fprofile-sample-use`).
+ */
+class SampleProfile {
+public:
+  SampleProfile(Instrumenter::NameFn NF) : Name(NF) {}
+
+  /**
+   * Record a function's call sites for profiling.
+   *
+   * This should be done before the function is otherwise instrumented,
+   * since profiles should only count calls that are in the original code.
+   *
+   * @returns whether or not the function can be profiled
+   *          (only functions with debug information can be)
+   */
+  bool Add(llvm::Function &);
+
+  /**
+   * Count entries into (and calls from) all recorded functions and write
+   * the counts to `Filename.<pid>` when the program exits.
+   */
+  bool Instrument(Instrumenter &, llvm::StringRef Filename);
+
+private:
+  /// A call site, located relative to the start of its function.
+  struct CallSite {
+    llvm::CallInst *Call;
+    unsigned LineOffset;
+    unsigned Discriminator;
+  };
+
+  llvm::MapVector<llvm::Function *, std::vector<CallSite>> Functions;
+  Instrumenter::NameFn Name;
+};
+
+} // namespace loom
+
+#endif // LOOM_SAMPLE_PROFILE_H
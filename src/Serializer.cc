@@ -45,6 +45,8 @@ Serializer::Serializer(llvm::LLVMContext &Ctx)
 
 Serializer::~Serializer() {}
 
+void Serializer::Written(BufferInfo &, Value *, IRBuilder<> &) {}
+
 Serializer::BufferInfo NullSerializer::Serialize(StringRef /* Name */,
                                                  StringRef /* Description */,
                                                  ArrayRef<Value *> V,
@@ -65,6 +65,16 @@ public:
                                llvm::ArrayRef<llvm::Value *> Values,
                                llvm::IRBuilder<> &B) = 0;
 
+  /**
+   * Generate the code to run once a serialized record has been handed off,
+   * which may have dropped it (e.g., because a trace buffer was full).
+   * Serializers whose records depend on earlier ones can use this to keep
+   * from depending on records that were never written.
+   *
+   * @param  Written      an `i1` that is true if the record was written
+   */
+  virtual void Written(BufferInfo &, llvm::Value *Written, llvm::IRBuilder<> &);
+
   /**
    * Clean up a serialized data buffer using Serializer-specific cleanup code
    * (e.g., `free()` or `nvlist_destroy`).
@@ -30,78 +30,374 @@
  * SUCH DAMAGE.
  */
 
-#include "DTraceLogger.hh"
+#include "Capture.hh"
+#include "Transform.hh"
 
 #include <algorithm>
 
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/TypeBuilder.h>
 #include <llvm/Support/raw_ostream.h>
 
 using namespace loom;
 using namespace llvm;
+using std::pair;
 using std::vector;
 
 
-Value* Transform::CreateTransform(Instruction* I, Module& Mod, Value* V) {
+namespace {
 
-	Value* call = V;
+/**
+ * Create the value to log in place of `Values[T.Arg]`.
+ *
+ * Every transform that can be named in a policy file is implemented by one
+ * of these, listed in the `Registry` below.
+ */
+typedef Value *(*TransformFn)(const Transform &T, IRBuilder<> &B,
+                              ArrayRef<Value *> Values);
+
+Value *Capture(const Transform &T, IRBuilder<> &B, ArrayRef<Value *> Values) {
+	return T.CreateCapture(B, Values);
+}
+
+Value *GetUUID(const Transform &T, IRBuilder<> &B, ArrayRef<Value *> Values);
 
-	if (this->Fn == "GetUUID") {
-	  call = CreateUUIDTransform(I, Mod, V);
-	} else {
-	  errs() << "Warning: Dtrace Logger requires the use of Metadata to function properly.";
-	  call = nullptr;
+//! All of the transforms that Loom knows how to apply.
+const struct {
+	const char *Name;
+	TransformFn Create;
+} Registry[] = {
+	{ "CaptureString", Capture },
+	{ "CaptureBuffer", Capture },
+	{ "GetUUID", GetUUID },
+};
+
+TransformFn Lookup(StringRef Name) {
+	for (auto &R : Registry) {
+		if (Name == R.Name) {
+			return R.Create;
+		}
 	}
 
-	return call;
+	return nullptr;
 }
 
-/* Length of a node address (an IEEE 802 address). */
-/* #define _UUID_NODE_LEN      6 */
-/* struct uuid { */
-/* 	uint32_t    time_low; */
-/* 	uint16_t    time_mid; */
-/* 	uint16_t    time_hi_and_version; */
-/* 	uint8_t     clock_seq_hi_and_reserved; */
-/* 	uint8_t     clock_seq_low; */
-/* 	uint8_t     node[_UUID_NODE_LEN]; */
-/* } */
+//! File descriptors share cache slots (and generations) by their low bits.
+const unsigned FDCacheSlots = 64;
+
+//! A `struct uuid`, as returned by `fgetuuid(2)`, is 16 bytes long.
+const unsigned UUIDSize = 16;
+
+/**
+ * Get (or create) the generation of each file descriptor cache slot.
+ *
+ * Generations are shared by all threads and bumped whenever a descriptor
+ * that maps to the slot is closed or replaced, so cache entries that were
+ * filled in an earlier generation are stale. Descriptors belong to the
+ * process, so the generations have default visibility: the dynamic linker
+ * gives every shared object the same copy.
+ */
+GlobalVariable *FDGenerations(Module &Mod) {
+	ArrayType *T = ArrayType::get(Type::getInt64Ty(Mod.getContext()),
+	                              FDCacheSlots);
+
+	auto *G = dyn_cast<GlobalVariable>(
+		Mod.getOrInsertGlobal("__loom_fd_generation", T));
+	if (not G->hasInitializer()) {
+		G->setLinkage(GlobalValue::LinkOnceODRLinkage);
+		G->setInitializer(ConstantAggregateZero::get(T));
+	}
 
-/* int fgetuuid(int, struct uuid *); */
+	return G;
+}
 
-Value* Transform::CreateUUIDTransform(Instruction* I, Module& Mod, Value* V) {
+/**
+ * Get (or create) a function that bumps every cache slot's generation,
+ * for calls that close an unknown set of descriptors.
+ */
+Function *InvalidateAllFn(Module &Mod) {
+	const char *Name = "__loom_fd_invalidate_all";
+	if (Function *F = Mod.getFunction(Name))
+		return F;
 
-  IRBuilder<> B(I);
+	LLVMContext &Ctx = Mod.getContext();
+	auto *F = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+	                           GlobalValue::LinkOnceODRLinkage, Name, &Mod);
+	F->setVisibility(GlobalValue::HiddenVisibility);
 
-  LLVMContext &Ctx = Mod.getContext();
-  Type* fd_t = TypeBuilder<int, false>::get(Ctx);
-  Type* uuid_t = StructType::get( TypeBuilder<uint32_t, false>::get(Ctx),
-								  TypeBuilder<uint16_t, false>::get(Ctx),
-								  TypeBuilder<uint16_t, false>::get(Ctx),
-								  TypeBuilder<uint8_t, false>::get(Ctx),
-								  TypeBuilder<uint8_t, false>::get(Ctx),
-								  TypeBuilder<uint8_t[6], false>::get(Ctx));
+	IRBuilder<> B(BasicBlock::Create(Ctx, "entry", F));
+	GlobalVariable *Generations = FDGenerations(Mod);
+	for (unsigned i = 0; i < FDCacheSlots; i++) {
+		B.CreateAtomicRMW(AtomicRMWInst::Add,
+		                  B.CreateConstInBoundsGEP2_32(
+		                      Generations->getValueType(), Generations, 0, i),
+		                  B.getInt64(1), AtomicOrdering::Monotonic);
+	}
+	B.CreateRetVoid();
 
+	return F;
+}
 
-  Value* args[2];
-  args[0] = V;
-  args[1] = B.CreateAlloca(uuid_t); 
-  ArrayRef<Value*> argsRef(args, 2);
-  
-  std::vector<Type*> params;
-  params.push_back(fd_t);
-  params.push_back(args[1]->getType());
-  
-  auto *FT = FunctionType::get( TypeBuilder<int, false>::get(Ctx), params, false);
-  
-  Constant *F = Mod.getOrInsertFunction("fgetuuid", FT);
+/**
+ * Get (or create) a function that returns a pointer to a file descriptor's
+ * UUID.
+ *
+ * UUIDs are kept in a per-thread cache, keyed by descriptor and generation,
+ * so `fgetuuid(2)` is only called the first time that a thread logs a
+ * descriptor or after the descriptor has been closed or replaced.
+ */
+Function *FDUUIDFn(Module &Mod) {
+	const char *Name = "__loom_fd_uuid";
+	if (Function *F = Mod.getFunction(Name))
+		return F;
 
+	LLVMContext &Ctx = Mod.getContext();
+	IntegerType *Int32 = Type::getInt32Ty(Ctx);
+	IntegerType *Int64 = Type::getInt64Ty(Ctx);
+	PointerType *BytePtr = Type::getInt8PtrTy(Ctx);
+	ArrayType *UUIDType = ArrayType::get(Type::getInt8Ty(Ctx), UUIDSize);
+	StructType *EntryType = StructType::get(Int32, Int64, UUIDType);
+	ArrayType *CacheType = ArrayType::get(EntryType, FDCacheSlots);
 
-  B.CreateCall(F, argsRef);
+	auto *F = Function::Create(FunctionType::get(BytePtr, {Int32}, false),
+	                           GlobalValue::LinkOnceODRLinkage, Name, &Mod);
+	F->setVisibility(GlobalValue::HiddenVisibility);
 
-  return argsRef.data()[1];
+	// Each entry is (descriptor, generation, UUID); no entry starts out
+	// holding a valid descriptor.
+	auto *Cache = dyn_cast<GlobalVariable>(
+		Mod.getOrInsertGlobal("__loom_fd_uuid_cache", CacheType));
+	if (not Cache->hasInitializer()) {
+		Constant *Empty = ConstantStruct::get(EntryType, {
+			ConstantInt::get(Int32, -1, true),
+			ConstantInt::get(Int64, 0),
+			ConstantAggregateZero::get(UUIDType),
+		});
 
+		Cache->setLinkage(GlobalValue::LinkOnceODRLinkage);
+		Cache->setVisibility(GlobalValue::HiddenVisibility);
+		Cache->setInitializer(ConstantArray::get(
+			CacheType, vector<Constant *>(FDCacheSlots, Empty)));
+		Cache->setThreadLocalMode(GlobalValue::GeneralDynamicTLSModel);
+	}
+
+	Value *FD = &*F->arg_begin();
+	FD->setName("fd");
+
+	auto *Entry = BasicBlock::Create(Ctx, "entry", F);
+	auto *Fill = BasicBlock::Create(Ctx, "fill", F);
+	auto *Failed = BasicBlock::Create(Ctx, "failed", F);
+	auto *Done = BasicBlock::Create(Ctx, "done", F);
+
+	IRBuilder<> B(Entry);
+	Value *Zero = B.getInt32(0);
+	Value *Slot = B.CreateAnd(FD, FDCacheSlots - 1, "slot");
+
+	// Read the generation before (possibly) looking the UUID up: if the
+	// descriptor is closed in the meantime, the new entry is already stale.
+	LoadInst *Generation = B.CreateAlignedLoad(
+		B.CreateInBoundsGEP(FDGenerations(Mod), {Zero, Slot}), 8,
+		"generation");
+	Generation->setAtomic(AtomicOrdering::Monotonic);
+
+	Value *E = B.CreateInBoundsGEP(Cache, {Zero, Slot}, "entry");
+	Value *CachedFD = B.CreateStructGEP(EntryType, E, 0);
+	Value *CachedGeneration = B.CreateStructGEP(EntryType, E, 1);
+	Value *UUID = B.CreatePointerCast(B.CreateStructGEP(EntryType, E, 2),
+	                                  BytePtr, "uuid");
+
+	Value *Hit = B.CreateAnd(
+		B.CreateICmpEQ(B.CreateLoad(CachedFD), FD),
+		B.CreateICmpEQ(B.CreateLoad(CachedGeneration), Generation));
+	B.CreateCondBr(Hit, Done, Fill,
+	               MDBuilder(Ctx).createBranchWeights(1000, 1));
+
+	/* int fgetuuid(int, struct uuid *); */
+	B.SetInsertPoint(Fill);
+	Constant *FGetUUID =
+		Mod.getOrInsertFunction("fgetuuid", Int32, Int32, BytePtr);
+	Value *Error = B.CreateCall(FGetUUID, {FD, UUID});
+	B.CreateStore(FD, CachedFD);
+	B.CreateStore(Generation, CachedGeneration);
+	B.CreateCondBr(B.CreateICmpEQ(Error, Zero), Done, Failed);
+
+	// Descriptors without UUIDs get the nil UUID, which isn't cached.
+	B.SetInsertPoint(Failed);
+	B.CreateStore(ConstantInt::get(Int32, -1, true), CachedFD);
+	B.CreateMemSet(UUID, B.getInt8(0), UUIDSize, 1);
+	B.CreateBr(Done);
+
+	B.SetInsertPoint(Done);
+	B.CreateRet(UUID);
+
+	return F;
 }
 
+/**
+ * Replace a file descriptor with (a capture of) the UUID of the file that
+ * it refers to, so that every logger can record it.
+ */
+Value *GetUUID(const Transform &T, IRBuilder<> &B, ArrayRef<Value *> Values) {
+	Value *FD = Values[T.Arg];
+	if (not FD->getType()->isIntegerTy()) {
+		errs() << "Warning: " << T.Fn << " requires an integer file "
+		       << "descriptor (value " << T.Arg << ")\n";
+		return nullptr;
+	}
+
+	Module &Mod = *B.GetInsertBlock()->getModule();
+	Value *Cached = B.CreateCall(FDUUIDFn(Mod),
+	                             {B.CreateSExtOrTrunc(FD, B.getInt32Ty())});
+
+	// The cache entry can be overwritten by another descriptor that maps to
+	// the same slot (e.g., another GetUUID of the same event), so the UUID
+	// is copied out of it before being captured. The copy lives in the entry
+	// block so that loops don't grow the stack.
+	Function *Fn = B.GetInsertBlock()->getParent();
+	IRBuilder<> Entry(&*Fn->getEntryBlock().getFirstInsertionPt());
+	ArrayType *UUIDType = ArrayType::get(B.getInt8Ty(), UUIDSize);
+	Value *Copy = Entry.CreateAlloca(UUIDType, nullptr,
+	                                 FD->getName() + ".uuid");
+	Value *UUID = B.CreateConstInBoundsGEP2_32(UUIDType, Copy, 0, 0);
+	B.CreateMemCpy(UUID, 1, Cached, 1, UUIDSize);
+
+	return loom::CreateCapture(CaptureKind::Buffer, UUIDSize, UUID,
+	                           B.getInt64(UUIDSize), B);
+}
+
+} // anonymous namespace
+
+
+bool Transform::isCapture() const {
+	return Fn == "CaptureString" or Fn == "CaptureBuffer";
+}
+
+bool Transform::isKnown() const {
+	return Lookup(Fn) != nullptr;
+}
+
+Transform Transform::Shifted(unsigned int Offset) const {
+	Transform T = *this;
+	T.Arg += Offset;
+	T.Length += Offset;
+	return T;
+}
+
+Value* Transform::Apply(IRBuilder<>& B, ArrayRef<Value*> Values) const {
+	TransformFn Create = Lookup(Fn);
+	if (not Create) {
+		errs() << "Warning: unknown transform '" << Fn << "'\n";
+		return nullptr;
+	}
+
+	if (Arg >= Values.size()) {
+		errs() << "Warning: no value " << Arg << " to " << Fn << "\n";
+		return nullptr;
+	}
+
+	return Create(*this, B, Values);
+}
+
+Value* Transform::CreateCapture(IRBuilder<>& B, ArrayRef<Value*> Values) const {
+	assert(isCapture());
+
+	if (Arg >= Values.size() or not Values[Arg]->getType()->isPointerTy()) {
+		errs() << "Warning: can only capture pointer values (" << Fn
+		       << " of value " << Arg << ")\n";
+		return nullptr;
+	}
+
+	if (Fn == "CaptureString") {
+		return loom::CreateCapture(CaptureKind::String, Max, Values[Arg],
+		                           nullptr, B);
+	}
+
+	if (Length >= Values.size() or
+	    not Values[Length]->getType()->isIntegerTy()) {
+		errs() << "Warning: buffer length (value " << Length
+		       << ") must be an integer\n";
+		return nullptr;
+	}
+
+	return loom::CreateCapture(CaptureKind::Buffer, Max, Values[Arg],
+	                           Values[Length], B);
+}
+
+bool loom::InvalidateTransformCaches(Module& Mod) {
+	// How a function that closes or replaces descriptors names them:
+	enum class Closes {
+		FD,      //!< the descriptor itself
+		Stream,  //!< a `FILE *` (whose descriptor is its `fileno`)
+		Dir,     //!< a `DIR *` (whose descriptor is its `dirfd`)
+		All,     //!< an unknown set of descriptors (e.g., a range)
+	};
+
+	// Functions that close or replace descriptors (the argument given):
+	const struct {
+		const char *Name;
+		unsigned Arg;
+		Closes What;
+	} Closers[] = {
+		{ "close", 0, Closes::FD },
+		{ "dup2", 1, Closes::FD },
+		{ "dup3", 1, Closes::FD },
+		{ "fclose", 0, Closes::Stream },
+		{ "fdclose", 0, Closes::Stream },
+		{ "freopen", 2, Closes::Stream },
+		{ "pclose", 0, Closes::Stream },
+		{ "closedir", 0, Closes::Dir },
+		{ "closefrom", 0, Closes::All },
+		{ "close_range", 0, Closes::All },
+	};
+
+	bool Modified = false;
+	for (auto &C : Closers) {
+		Function *F = Mod.getFunction(C.Name);
+		if (not F) {
+			continue;
+		}
+
+		vector<CallInst*> Calls;
+		for (User *U : F->users()) {
+			auto *Call = dyn_cast<CallInst>(U);
+			if (Call and Call->getCalledFunction() == F
+			    and C.Arg < Call->getNumArgOperands()) {
+				Calls.push_back(Call);
+			}
+		}
+
+		for (CallInst *Call : Calls) {
+			Value *Arg = Call->getArgOperand(C.Arg);
+
+			// Streams and directories must be asked for their descriptors
+			// before they are closed.
+			Value *FD = Arg;
+			if (C.What == Closes::Stream or C.What == Closes::Dir) {
+				const char *Get = (C.What == Closes::Stream) ? "fileno"
+				                                             : "dirfd";
+				Constant *GetFD = Mod.getOrInsertFunction(
+					Get, Type::getInt32Ty(Mod.getContext()), Arg->getType());
+				FD = IRBuilder<>(Call).CreateCall(GetFD, {Arg});
+			}
+
+			// Bump generations after the call, so that any lookup that
+			// raced with it (and might have seen the old file) is stale.
+			IRBuilder<> B(Call->getNextNode());
+			if (C.What == Closes::All) {
+				B.CreateCall(InvalidateAllFn(Mod));
+			} else {
+				Value *Slot = B.CreateAnd(
+					B.CreateSExtOrTrunc(FD, B.getInt32Ty()), FDCacheSlots - 1);
+				B.CreateAtomicRMW(AtomicRMWInst::Add,
+				                  B.CreateInBoundsGEP(FDGenerations(Mod),
+				                                      {B.getInt32(0), Slot}),
+				                  B.getInt64(1), AtomicOrdering::Monotonic);
+			}
+
+			Modified = true;
+		}
+	}
+
+	return Modified;
+}
@@ -33,6 +33,9 @@
 #ifndef LOOM_TRANSFORM_H
 #define LOOM_TRANSFORM_H
 
+#include <llvm/IR/IRBuilder.h>
+
+#include <string>
 
 namespace loom {
 
@@ -55,14 +58,54 @@ namespace loom {
     unsigned int Arg;
 	std::string Fn;
 
-	llvm::Value* CreateTransform(llvm::Instruction*, llvm::Module&, llvm::Value*);
+	//! For buffer captures, the value that holds the buffer's length.
+	unsigned int Length = 0;
 
-  private:
-	llvm::Value* CreateUUIDTransform(llvm::Instruction*, llvm::Module&, llvm::Value*);
-  
-  };
+	//! For captures, the most bytes to record.
+	unsigned int Max = 0;
+
+	//! Is this a capture (`CaptureString` or `CaptureBuffer`)?
+	bool isCapture() const;
+
+	//! Refer to values Offset places later (e.g., after a return value).
+	Transform Shifted(unsigned int Offset) const;
 
+	//! Does Loom know how to apply this transform?
+	bool isKnown() const;
+
+	/**
+	 * Apply this transform to one of the values being logged.
+	 *
+	 * @param  Values   all of the values being logged
+	 * @returns  the value to log in place of `Values[Arg]`, or nullptr if
+	 *           the transform can't be applied to it
+	 */
+	llvm::Value* Apply(llvm::IRBuilder<>&, llvm::ArrayRef<llvm::Value*> Values) const;
+
+	/**
+	 * Replace a string or buffer argument with a bounded capture of its
+	 * contents (see Capture.hh).
+	 *
+	 * @param  Values   all of the values being logged
+	 */
+	llvm::Value* CreateCapture(llvm::IRBuilder<>&, llvm::ArrayRef<llvm::Value*> Values) const;
+  };
 
+  /**
+   * Keep transforms' per-thread caches (e.g., of file descriptors' UUIDs)
+   * coherent by invalidating entries after calls that close or replace file
+   * descriptors: `close`, `dup2`, `dup3`, `closefrom` and `close_range`, and
+   * `fclose`, `fdclose`, `freopen`, `pclose` and `closedir` (which release
+   * the descriptors behind streams and directories).
+   *
+   * This needs to be done in every module of a program that uses the caches,
+   * whether or not the module uses them itself. Descriptors closed any other
+   * way (by code that Loom doesn't instrument, by other libc functions, via
+   * `syscall(2)` or by `fcntl(F_DUP2FD)`) aren't noticed.
+   *
+   * @returns  whether the module was modified
+   */
+  bool InvalidateTransformCaches(llvm::Module&);
 
 } // namespace loom
 
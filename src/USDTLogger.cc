@@ -0,0 +1,208 @@
+//! @file USDTLogger.cc  Definition of @ref loom::USDTLogger.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "USDTLogger.hh"
+#include "Capture.hh"
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+using namespace loom;
+using namespace llvm;
+using std::string;
+using std::vector;
+
+namespace {
+
+/// The (USDT) provider of all Loom probes.
+const char *Provider = "loom";
+
+/**
+ * Convert a value into something that a tracer can read from a register
+ * (or an immediate), describing it as `[-]<size in bytes>`.
+ */
+Value *ProbeArgument(IRBuilder<> &B, Value *V, string &Size) {
+  Type *T = V->getType();
+
+  if (GetCaptureType(T)) {
+    // Tracers copy in strings and buffers themselves.
+    V = CaptureData(V, B);
+    T = V->getType();
+  }
+
+  if (T->isPointerTy()) {
+    Size = std::to_string(B.GetInsertBlock()->getModule()->getDataLayout()
+                              .getPointerSize());
+    return V;
+  }
+
+  if (T->isIntegerTy(1)) {
+    Size = "1";
+    return B.CreateZExt(V, B.getInt8Ty());
+  }
+
+  if (T->isIntegerTy(8) or T->isIntegerTy(16) or T->isIntegerTy(32) or
+      T->isIntegerTy(64)) {
+    Size = "-" + std::to_string(T->getIntegerBitWidth() / 8);
+    return V;
+  }
+
+  if (T->isIntegerTy()) {
+    Size = "-8";
+    return B.CreateSExtOrTrunc(V, B.getInt64Ty());
+  }
+
+  // Floating-point values are passed as their bit patterns, since tracers
+  // can only read general-purpose registers.
+  if (T->isFloatTy()) {
+    Size = "4";
+    return B.CreateBitCast(V, B.getInt32Ty());
+  }
+
+  if (T->isDoubleTy()) {
+    Size = "8";
+    return B.CreateBitCast(V, B.getInt64Ty());
+  }
+
+  Size = "8";
+  return B.getInt64(0);
+}
+
+} // anonymous namespace
+
+USDTLogger::USDTLogger(Module &Mod, bool Semaphores)
+    : Logger(Mod), Semaphores(Semaphores) {}
+
+GlobalVariable *USDTLogger::Semaphore(StringRef Name) {
+  const string SemName = (Twine(Provider) + "_" + Name + "_semaphore").str();
+  if (GlobalVariable *G = Mod.getNamedGlobal(SemName)) {
+    return G;
+  }
+
+  // Semaphores are shared by every module that has the same probe, and are
+  // found (and incremented) by tracers in the .probes section.
+  IntegerType *Int16 = Type::getInt16Ty(Mod.getContext());
+  auto *G = new GlobalVariable(Mod, Int16, false, GlobalValue::WeakAnyLinkage,
+                               ConstantInt::get(Int16, 0), SemName);
+  G->setVisibility(GlobalValue::HiddenVisibility);
+  G->setSection(".probes");
+  appendToCompilerUsed(Mod, {G});
+
+  return G;
+}
+
+Value *USDTLogger::Log(Instruction *I, ArrayRef<Value *> Values,
+                       StringRef Name, StringRef Descrip, loom::Metadata Md,
+                       std::vector<loom::Transform> Transforms,
+                       bool /* SuppressUniqueness */) {
+
+  Triple T(Mod.getTargetTriple());
+  if (not T.isOSBinFormatELF()) {
+    errs() << "Warning: USDT probes require ELF: not instrumenting " << Name
+           << "\n";
+    return nullptr;
+  }
+
+  if (Values.size() > MaxArgs) {
+    errs() << "Warning: USDT probe " << Name << " only has room for "
+           << MaxArgs << " of its " << Values.size() << " arguments\n";
+    Values = Values.slice(0, MaxArgs);
+  }
+
+  IRBuilder<> B(I);
+  LLVMContext &Ctx = Mod.getContext();
+  GlobalVariable *Sem = Semaphores ? Semaphore(Name) : nullptr;
+
+  if (Sem) {
+    LoadInst *Tracers = B.CreateLoad(Sem);
+    Tracers->setVolatile(true);
+
+    Instruction *Then = SplitBlockAndInsertIfThen(
+        B.CreateICmpNE(Tracers, B.getInt16(0)), I, false,
+        MDBuilder(Ctx).createBranchWeights(1, 1000));
+    B.SetInsertPoint(Then);
+  }
+
+  //
+  // Each argument is described by its size (negative if signed) and an
+  // operand of the probe's inline assembly (a register or an immediate),
+  // e.g., `-4@%edi 8@%rsi -4@$42`.
+  //
+  vector<Value *> Args;
+  vector<Type *> ArgTypes;
+  string ArgSpec, Constraints;
+
+  for (size_t i = 0; i < Values.size(); i++) {
+    string Size;
+    Value *V = ProbeArgument(B, Values[i], Size);
+
+    ArgSpec += (i == 0 ? "" : " ") + Size + "@${" + std::to_string(i) + "}";
+    Constraints += isa<ConstantInt>(V) ? "n," : "r,";
+    Args.push_back(V);
+    ArgTypes.push_back(V->getType());
+  }
+
+  Constraints += "~{memory}";
+
+  const string Addr =
+      Mod.getDataLayout().getPointerSize() == 8 ? ".8byte" : ".4byte";
+  const string SemName = Sem ? Sem->getName().str() : "0";
+
+  // This is the same note that <sys/sdt.h> creates: see
+  // https://sourceware.org/systemtap/wiki/UserSpaceProbeImplementation
+  const string Asm =
+      "990: nop\n"
+      ".pushsection .note.stapsdt,\"\",@note\n"
+      ".balign 4\n"
+      ".4byte 992f-991f, 994f-993f, 3\n"
+      "991: .asciz \"stapsdt\"\n"
+      "992: .balign 4\n"
+      "993: " + Addr + " 990b\n" +
+      Addr + " _.stapsdt.base\n" +
+      Addr + " " + SemName + "\n"
+      ".asciz \"" + Provider + "\"\n"
+      ".asciz \"" + Name.str() + "\"\n"
+      ".asciz \"" + ArgSpec + "\"\n"
+      "994: .balign 4\n"
+      ".popsection\n"
+      ".ifndef _.stapsdt.base\n"
+      ".pushsection .stapsdt.base,\"aG\",@progbits,.stapsdt.base,comdat\n"
+      ".weak _.stapsdt.base\n"
+      ".hidden _.stapsdt.base\n"
+      "_.stapsdt.base: .space 1\n"
+      ".size _.stapsdt.base, 1\n"
+      ".popsection\n"
+      ".endif";
+
+  auto *ProbeType = FunctionType::get(B.getVoidTy(), ArgTypes, false);
+  return B.CreateCall(InlineAsm::get(ProbeType, Asm, Constraints, true), Args);
+}
@@ -0,0 +1,78 @@
+//! @file USDTLogger.hh  Declaration of @ref loom::USDTLogger.
+/*
+ * Copyright (c) 2019 Loom contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef USDT_LOGGER_H_
+#define USDT_LOGGER_H_
+
+#include "Logger.hh"
+
+namespace llvm {
+class GlobalVariable;
+}
+
+namespace loom {
+
+/**
+ * A logging technique that emits SystemTap-style USDT probe points: a `nop`
+ * described by a `.note.stapsdt` ELF note that tells tracers (DTrace, perf,
+ * bpftrace, SystemTap...) where the probe is and where to find each of its
+ * arguments (registers or constants) when the `nop` is executed.
+ *
+ * Probes cost nothing beyond keeping their arguments available unless a
+ * tracer attaches to them. Probes can also have semaphores, counters that
+ * tracers increment while attached, so that the work of loading arguments
+ * is only done when someone is listening.
+ *
+ * Every probe has the provider `loom` and is named after the event's
+ * instrumentation (e.g., `__loom_call_foo`).
+ */
+class USDTLogger : public loom::Logger {
+public:
+  /**
+   * @param   Semaphores   skip probes (and the computation of their
+   *                       arguments) unless a tracer is attached
+   */
+  USDTLogger(llvm::Module &Mod, bool Semaphores);
+
+  virtual llvm::Value *Log(llvm::Instruction *, llvm::ArrayRef<llvm::Value *>,
+                           llvm::StringRef Name, llvm::StringRef Descrip,
+                           loom::Metadata Md, std::vector<loom::Transform> Transforms,
+                           bool SuppressUniqueness) override;
+
+  //! The maximum number of arguments that tracers can read from a probe.
+  static const size_t MaxArgs = 12;
+
+private:
+  //! Get (or create) the semaphore for a probe.
+  llvm::GlobalVariable *Semaphore(llvm::StringRef Name);
+
+  const bool Semaphores;
+};
+
+} // namespace loom
+
+#endif // !USDT_LOGGER_H_
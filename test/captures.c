@@ -0,0 +1,96 @@
+/**
+ * \file  captures.c
+ * \brief Tests bounded capture of string and buffer arguments.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp -DPOLICY_FILE -DCOMPACT '-DTRACE_FILE="%t.trace"' %s > %t.compact.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ *
+ * RUN: rm -f %t.schema %t.trace
+ * RUN: %loom -S %t.ll -loom-file %t.compact.yaml -loom-compact-schema %t.schema \
+ * RUN:   -o %t.compact.ll
+ * RUN: %clang %t.compact.ll %rtflags -o %t.compact
+ * RUN: %t.compact
+ * RUN: %decode -s %t.schema %t.trace | %filecheck %s -check-prefix DECODE
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+#if defined (COMPACT)
+ktrace: file
+serialization: compact
+trace_file: TRACE_FILE
+#else
+logging: printf
+#endif
+
+functions:
+  - name: greet
+    caller: [ entry ]
+    captures:
+      - arg: 0
+        type: string
+        max: 8
+
+  - name: send
+    callee: [ entry ]
+    captures:
+      - arg: 1
+        type: buffer
+        length: 2
+        max: 4
+
+#else
+
+#include <stddef.h>
+#include <stdio.h>
+
+// CHECK: call i64 @strnlen(i8* {{.*}}, i64 9)
+int	greet(const char *name)	{ return name ? 1 : 0; }
+
+// CHECK: define{{.*}} @send(
+// CHECK-NOT: malloc
+// CHECK: ret
+int
+send(int fd, const void *buf, size_t len)
+{
+	return (int) len;
+}
+
+int
+main(int argc, char *argv[])
+{
+	// CHECK-OUTPUT: call greet: "Alice"
+	// DECODE: {{.*}}call_greet: "Alice"
+	greet("Alice");
+
+	// CHECK-OUTPUT: call greet: "Bartholo"...
+	// DECODE: {{.*}}call_greet: "Bartholo"...
+	greet("Bartholomew");
+
+	// CHECK-OUTPUT: call greet: ""
+	// DECODE: {{.*}}call_greet: ""
+	greet(NULL);
+
+	// CHECK-OUTPUT: enter send: 1 0x{{[0-9a-f]+}}[3] 3
+	// DECODE: {{.*}}enter_send: 1 "ab\x00" 3
+	send(1, "ab", 3);
+
+	// CHECK-OUTPUT: enter send: 2 0x{{[0-9a-f]+}}[4]... 10
+	// DECODE: {{.*}}enter_send: 2 "0123"... 10
+	send(2, "0123456789", 10);
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,67 @@
+/**
+ * \file  compact-serializer.c
+ * \brief Tests compact (varint/delta-encoded) serialization.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE '-DTRACE_FILE="%t.trace"' %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: rm -f %t.schema %t.trace
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -loom-compact-schema %t.schema \
+ * RUN:   -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %filecheck -input-file %t.schema %s -check-prefix SCHEMA
+ * RUN: %clang %t.instr.ll %rtflags -o %t.bin
+ * RUN: %t.bin
+ * RUN: %decode -s %t.schema %t.trace | %filecheck %s -check-prefix DECODE
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __compact_test
+
+ktrace: file
+
+serialization: compact
+
+trace_file: TRACE_FILE
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+    - name: bar
+      caller: [ entry ]
+
+#else
+
+#include <stdbool.h>
+
+// SCHEMA: {{[0-9a-f]{8}}}	{{.*}}call_foo	1145	call
+// SCHEMA: {{[0-9a-f]{8}}}	{{.*}}call_bar	32	call
+
+// DECODE: {{[0-9]+}} 1 {{[0-9]+}} {{.*}}call_foo: 1 -2 1.5 2.25
+// DECODE: {{[0-9]+}} 1 {{[0-9]+}} {{.*}}call_foo: 300 -70000 -1.5 1e+100
+// DECODE: {{[0-9]+}} 1 {{[0-9]+}} {{.*}}call_bar: 0x{{[0-9a-f]+}} true
+// DECODE: {{[0-9]+}} 1 {{[0-9]+}} {{.*}}call_bar: 0x0 false
+
+// CHECK: define{{.*}} void @__compact_test_call_foo
+// CHECK:   alloca [{{[0-9]+}} x i8]
+// CHECK:   call i64 @__loom_compact_thread()
+// CHECK:   call i64 @llvm.readcyclecounter()
+// CHECK:   call i32 @loom_trace_write
+int	foo(int x, long y, float f, double d)	{ return x; }
+int	bar(const char *s, bool b)		{ return b; }
+
+int
+main(int argc, char *argv[])
+{
+	foo(1, -2, 1.5, 2.25);
+	foo(300, -70000, -1.5, 1e100);
+	bar("hello", true);
+	bar(0, false);
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
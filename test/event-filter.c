@@ -0,0 +1,121 @@
+/**
+ * \file  event-filter.c
+ * \brief Tests filtering of function and field events with `when:`.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+functions:
+  - name: transfer
+    caller: [ entry ]
+    when: "size > 1MB && fd == 3"
+
+  - name: lookup
+    callee: [ exit ]
+    when: "retval == null || arg0 & 0x10"
+
+  - name: scale
+    caller: [ entry ]
+    when: "!(factor < 0.5)"
+
+  - name: set_flags
+    caller: [ entry ]
+    when: "flags > 0x7fffffff"
+
+structures:
+  - name: foo
+    fields:
+      - name: f_int
+        operations: [ write ]
+        when: "value >= 4K"
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct foo {
+	int	f_int;
+};
+
+// CHECK-LABEL: define{{.*}} @lookup(
+// CHECK: icmp eq i64 {{.*}}, 0
+// CHECK: and i64 {{.*}}, 16
+// CHECK: br i1 {{%.+}}, label %[[LOG:.+]], label
+// CHECK: [[LOG]]:
+// CHECK: call void @__test_hook_leave_lookup(
+// CHECK: ret
+int *
+lookup(int key)
+{
+	static int value;
+
+	return (key % 2) ? &value : NULL;
+}
+
+void	scale(double factor)	{ }
+void	set_flags(uint32_t flags)	{ }
+int	transfer(int fd, long size)	{ return fd; }
+
+int
+main(int argc, char *argv[])
+{
+	struct foo f;
+
+	// CHECK: call void @__test_hook_call_transfer(
+	// CHECK-OUTPUT-NOT: call transfer: 1
+	// CHECK-OUTPUT-NOT: call transfer: 3 1024
+	// CHECK-OUTPUT: call transfer: 3 4194304
+	transfer(1, 4 * 1024 * 1024);
+	transfer(3, 1024);
+	transfer(3, 4 * 1024 * 1024);
+
+	// CHECK-OUTPUT-NOT: leave lookup: 0x{{.*}} 1
+	// CHECK-OUTPUT: leave lookup: {{.*}} 2
+	// CHECK-OUTPUT: leave lookup: 0x{{[0-9a-f]+}} 17
+	lookup(1);
+	lookup(2);
+	lookup(17);
+
+	// CHECK-OUTPUT-NOT: call scale: 0.25
+	// CHECK-OUTPUT: call scale: 0.75
+	scale(0.25);
+	scale(0.75);
+
+	// Unsigned values are zero-extended and compared as unsigned:
+	// CHECK: zext i32 {{.*}} to i64
+	// CHECK: icmp ugt i64 {{.*}}, 2147483647
+	// CHECK: call void @__test_hook_call_set_flags(
+	// CHECK-OUTPUT-NOT: call set_flags: 1{{$}}
+	// CHECK-OUTPUT: call set_flags: {{2147483649|-2147483647}}
+	uint32_t flags = 1;
+	set_flags(flags);
+	flags |= 0x80000000;
+	set_flags(flags);
+
+	// CHECK: call void @__test_hook_store_struct_foo_field_f_int(
+	// CHECK-OUTPUT-NOT: foo.f_int store: {{.*}} 1{{$}}
+	// CHECK-OUTPUT: foo.f_int store: {{.*}} 8192
+	f.f_int = 1;
+	f.f_int = 8192;
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
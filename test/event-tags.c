@@ -0,0 +1,86 @@
+/**
+ * \file  event-tags.c
+ * \brief Tests tagging events with thread and CPU IDs.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+tags: [ thread, cpu ]
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+#else
+
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#define	gettid()	((int) syscall(SYS_gettid))
+#elif defined(__FreeBSD__)
+#include <pthread_np.h>
+#define	gettid()	pthread_getthreadid_np()
+#endif
+
+// The cached thread ID is cleared in forked children:
+// CHECK: @llvm.global_ctors = {{.*}} @__loom_thread_id_cache_atfork
+
+// The thread ID is looked up once per thread and cached:
+// CHECK: define{{.*}} void @__test_hook_call_foo(i32 %x)
+// CHECK:   [[TID:%.*]] = call i32 @__loom_thread_id()
+// CHECK:   [[CPU:%.*]] = call i32 @sched_getcpu()
+// CHECK:   call {{.*}} @printf({{.*}}, i32 [[TID]], i32 [[CPU]], i32 %x)
+//
+// CHECK: define linkonce_odr hidden i32 @__loom_thread_id()
+// CHECK:   load i32, i32* @__loom_thread_id_cache
+int	foo(int x)	{ return x; }
+
+int
+main(int argc, char *argv[])
+{
+	// CHECK-OUTPUT: thread: [[TID:[0-9]+]]
+	printf("thread: %d\n", gettid());
+	fflush(stdout);
+
+	// CHECK-OUTPUT: call foo: [[TID]] {{[0-9]+}} 1
+	// CHECK-OUTPUT: call foo: [[TID]] {{[0-9]+}} 2
+	foo(1);
+	foo(2);
+	fflush(stdout);
+
+	// A forked child's thread has its own ID:
+	// CHECK-OUTPUT: child thread: [[CHILD_TID:[0-9]+]]
+	// CHECK-OUTPUT: call foo: [[CHILD_TID]] {{[0-9]+}} 3
+	pid_t child = fork();
+	if (child == 0) {
+		printf("child thread: %d\n", gettid());
+		foo(3);
+		exit(0);
+	}
+	waitpid(child, NULL, 0);
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
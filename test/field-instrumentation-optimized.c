@@ -0,0 +1,86 @@
+/**
+ * \file  field-instrumentation-optimized.c
+ * \brief Tests structure field instrumentation in optimized code.
+ *
+ * At -O2, fields are reached through pointers described by `llvm.dbg.value`
+ * (rather than allocas with `llvm.dbg.declare`) and nested field lookups are
+ * folded into single GEPs.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -O2 -S -emit-llvm %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll 2> %t.err
+ * RUN: %filecheck -input-file %t.err %s -check-prefix CHECK-ERR
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+structures:
+  - name: foo
+    fields:
+      - name: f_count
+        operations: [ read, write ]
+
+  - name: bar
+    fields:
+      - name: b_limit
+        operations: [ read ]
+
+#else
+
+// CHECK-ERR-NOT: module missing metadata
+
+struct foo {
+	int		f_ignored;
+	int		f_count;
+};
+
+struct bar {
+	double		b_double;
+	struct foo	b_foo;
+	long		b_limit;
+};
+
+
+/* Not static, so that IPO can't replace `b` with a constant expression. */
+__attribute__((noinline))
+long
+bump(struct bar *b)
+{
+	// CHECK: [[FOO:%.+]] = getelementptr inbounds %struct.bar, %struct.bar* %{{.*}}, i64 0, i32 1
+	// CHECK: [[COUNT_PTR:%.+]] = getelementptr inbounds %struct.foo, %struct.foo* [[FOO]], i64 0, i32 1
+	// CHECK: [[COUNT:%.+]] = load i32, i32* [[COUNT_PTR]]
+	// CHECK: call void @__test_hook_load_struct_foo_field_f_count(%struct.foo* [[FOO]], i32 [[COUNT]])
+	// CHECK: call void @__test_hook_store_struct_foo_field_f_count(%struct.foo* [[FOO]], i32
+	//
+	// CHECK-OUTPUT: foo.f_count load: [[FOO:0x.*]] 41
+	// CHECK-OUTPUT: foo.f_count store: [[FOO]] 42
+	b->b_foo.f_count++;
+
+	// CHECK: call void @__test_hook_load_struct_bar_field_b_limit(
+	// CHECK-OUTPUT: bar.b_limit load: {{.*}} 100
+	return b->b_limit;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bar b = {
+		.b_foo = { .f_count = 41 },
+		.b_limit = 100,
+	};
+
+	return (bump(&b) == 100) ? 0 : 1;
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,77 @@
+/**
+ * \file  guarded-probes.c
+ * \brief Tests instrumentation in one cold block per site, behind an
+ *        enable check that can be cleared at run time.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+strategy: inline
+
+block_structure: guarded
+
+logging: printf
+
+hook_prefix: __test_hook
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+    - name: bar
+      caller: [ entry ]
+
+#else
+
+#include <stdio.h>
+
+// Every probe has a flag, set by default, that enables it.
+// CHECK-DAG: @__test_hook_call_foo_enabled = weak global i8 1
+// CHECK-DAG: @__test_hook_call_bar_enabled = weak global i8 1
+extern char __test_hook_call_bar_enabled;
+
+int	foo(int x)	{ return x; }
+int	bar(int x)	{ return x; }
+
+// CHECK: define{{.*}} i32 @main
+int
+main(int argc, char *argv[])
+{
+	// The hot path is a single branch on the probe's flag:
+	// CHECK: [[FOO_ON:%.*]] = load i8, i8* @__test_hook_call_foo_enabled
+	// CHECK: [[FOO_CHECK:%.*]] = icmp ne i8 [[FOO_ON]], 0
+	// CHECK: br i1 [[FOO_CHECK]], label %"__test_hook_call_foo:cold", label [[FOO_CONT:%.*]], !prof
+	// CHECK: [[FOO_CONT]]:
+	// CHECK-NEXT: call i32 @foo(i32 1)
+	foo(1);
+	// CHECK-OUTPUT: call foo: 1
+
+	bar(2);
+	// CHECK-OUTPUT: call bar: 2
+
+	__test_hook_call_bar_enabled = 0;
+	foo(3);
+	bar(4);
+	// CHECK-OUTPUT: call foo: 3
+	// CHECK-OUTPUT-NOT: call bar: 4
+
+	return 0;
+
+	// All of a site's logging is in a cold block at the end of the function:
+	// CHECK: "__test_hook_call_foo:cold":
+	// CHECK: call {{.*}} @printf
+	// CHECK: br label [[FOO_CONT]]
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,59 @@
+; \file  hot-probes.ll
+; \brief Tests profile-guided sampling of hot probes
+;
+; Commands for llvm-lit:
+; RUN: %loom -S %s -loom-file %s.policy -o %t.instr.ll
+; RUN: %filecheck -input-file %t.instr.ll %s
+; RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-freebsd12.0"
+
+; Hot probes share a per-hook sampling counter:
+; CHECK-DAG: @[[PREFIX:__loom]]_enter_hot_sample = internal global i64 0
+; CHECK-DAG: @[[PREFIX]]_call_hot_sample = internal global i64 0
+
+; CHECK-LABEL: define i32 @cold
+define i32 @cold(i32 %x) !prof !0 {
+entry:
+  ret i32 %x
+}
+
+; The entry to @hot happens far too often to log every time:
+; CHECK-LABEL: define i32 @hot
+define i32 @hot(i32 %x) !prof !1 {
+entry:
+  ; CHECK: load i64, i64* @[[PREFIX]]_enter_hot_sample
+  ; CHECK: br i1 {{.*}}, !prof
+  ; CHECK: call void @[[PREFIX]]_enter_hot(i32 %x)
+  ret i32 %x
+}
+
+; CHECK-LABEL: define i32 @main
+define i32 @main(i32 %argc, i8** %argv) !prof !0 {
+entry:
+  ; The call to @cold is logged every time:
+  ; CHECK: call void @[[PREFIX]]_call_cold(i32 %argc)
+  ; CHECK-NEXT: %c = call i32 @cold(i32 %argc)
+  %c = call i32 @cold(i32 %argc)
+  br label %loop
+
+loop:
+  ; ... but calls to @hot within the loop are sampled:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  ; CHECK: load i64, i64* @[[PREFIX]]_call_hot_sample
+  ; CHECK: br i1 {{.*}}, !prof
+  ; CHECK: call void @[[PREFIX]]_call_hot(i32 %i)
+  ; CHECK: %h = call i32 @hot(i32 %i)
+  %h = call i32 @hot(i32 %i)
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 1000000
+  br i1 %done, label %exit, label %loop, !prof !2
+
+exit:
+  ret i32 0
+}
+
+!0 = !{!"function_entry_count", i64 1}
+!1 = !{!"function_entry_count", i64 1000000}
+!2 = !{!"branch_weights", i32 1, i32 999999}
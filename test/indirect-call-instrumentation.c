@@ -0,0 +1,64 @@
+/**
+ * \file  indirect-call-instrumentation.c
+ * \brief Tests instrumentation and target profiling of indirect calls.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+indirect_calls:
+  caller: [ entry, exit ]
+  profile_targets: 2
+
+#else
+
+#include <stdio.h>
+
+int	double_it(int x) { return 2 * x; }
+int	square(int x) { return x * x; }
+int	negate(int x) { return -x; }
+
+int
+main(int argc, char *argv[])
+{
+	int (*fns[])(int) = { double_it, square, negate };
+
+	for (int i = 0; i < 6; i++) {
+		// CHECK: [[TARGET:%.*]] = bitcast i32 (i32)* [[FN:%.*]] to i8*
+		// CHECK: call void @[[PREFIX:__test_hook]]_call_indirect_main_0(i8* [[TARGET]], i32 [[ARG:%.*]])
+		// CHECK: call void @[[PREFIX]]_profile_target(i8* {{.*}}, {{.*}}@[[PREFIX]]_targets_main_0{{.*}}, i32 2)
+		// CHECK: [[RET:%.*]] = call i32 [[FN]](i32 [[ARG]])
+		// CHECK: call void @[[PREFIX]]_return_indirect_main_0(i32 [[RET]], i8* [[TARGET]], i32 [[ARG]])
+		fns[i % 3](i);
+	}
+
+	// CHECK-OUTPUT: call indirect main#0: 0x{{[0-9a-f]+}} 0
+	// CHECK-OUTPUT: return indirect main#0: 0 0x{{[0-9a-f]+}} 0
+	// CHECK-OUTPUT: call indirect main#0: 0x{{[0-9a-f]+}} 1
+	// CHECK-OUTPUT: return indirect main#0: 1 0x{{[0-9a-f]+}} 1
+	// CHECK-OUTPUT: call indirect main#0: 0x{{[0-9a-f]+}} 2
+	// CHECK-OUTPUT: return indirect main#0: -2 0x{{[0-9a-f]+}} 2
+
+	// Only two targets fit in the table; the third is counted as "other".
+	// CHECK-OUTPUT: targets indirect main#0: 0x{{[0-9a-f]+}} 2
+	// CHECK-OUTPUT: targets indirect main#0: 0x{{[0-9a-f]+}} 2
+	// CHECK-OUTPUT: targets indirect main#0: {{.*}} 2
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,50 @@
+; \file  instrument-everything-callout.ll
+; \brief Tests that callout hooks for all instructions are shared by signature
+;
+; Commands for llvm-lit:
+; RUN: %loom -S %s -loom-file %s.policy -o %t.instr.ll
+; RUN: %filecheck -input-file %t.instr.ll %s
+; RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-freebsd12.0"
+
+; Every site is described (by function, source location and description)
+; in the loom_sites section, under an ID whose high bits hash the module:
+; CHECK: @loom_site_string{{.*}} = private unnamed_addr constant [5 x i8] c"main\00"
+; CHECK: @loom_site_string{{.*}} = private unnamed_addr constant [35 x i8] c"instrumentation:instruction:alloca\00"
+; CHECK: @loom_site = internal constant { i64, i8*, i8*, i32, i32, i8* } { i64 [[A:-?[0-9]+]], {{.*}} @loom_site_string{{.*}}, i32 0, i32 0, {{.*}} section "loom_sites", align 8
+; CHECK: @loom_site.1 = internal constant {{.*}} { i64 [[B:-?[0-9]+]], {{.*}} section "loom_sites"
+; CHECK: @loom_site.2 = internal constant {{.*}} { i64 [[C:-?[0-9]+]], {{.*}} section "loom_sites"
+; CHECK: @loom_site.3 = internal constant {{.*}} { i64 [[D:-?[0-9]+]], {{.*}} section "loom_sites"
+; CHECK: @llvm.compiler.used = {{.*}} @loom_site
+
+; Instructions with the same opcode and operand types share a hook,
+; which is passed a site ID (and the opcode) ahead of the values:
+; CHECK-LABEL: define i32 @main
+define i32 @main(i32 %argc) {
+entry:
+  ; CHECK: %a = alloca i32
+  ; CHECK-NEXT: call void @[[ALLOCA:__loom_instruction_alloca_i32pi32i32]](i64 [[A]], i32 {{[0-9]+}}, i32* %a, i32 1)
+  %a = alloca i32
+  ; CHECK: %b = alloca i32
+  ; CHECK-NEXT: call void @[[ALLOCA]](i64 [[B]], i32 {{[0-9]+}}, i32* %b, i32 1)
+  %b = alloca i32
+
+  ; CHECK: store i32 %argc, i32* %a
+  ; CHECK-NEXT: call void @[[STORE:__loom_instruction_store_i32i32pi32]](i64 [[C]], i32 {{[0-9]+}}, i32 %argc, i32* %a)
+  store i32 %argc, i32* %a
+  ; CHECK: store i32 0, i32* %b
+  ; CHECK-NEXT: call void @[[STORE]](i64 [[D]], i32 {{[0-9]+}}, i32 0, i32* %b)
+  store i32 0, i32* %b
+
+  ; CHECK: %v = load i32, i32* %a
+  ; CHECK-NEXT: call void @__loom_instruction_load_i32i32pi32(i64 {{-?[0-9]+}},
+  %v = load i32, i32* %a
+  ret i32 %v
+}
+
+; CHECK: define internal void @[[ALLOCA]](i64 %site,
+; CHECK-NOT: define internal void @[[ALLOCA]](
+; CHECK: define internal void @[[STORE]](i64 %site,
+; CHECK-NOT: define internal void @[[STORE]](
@@ -0,0 +1,106 @@
+/**
+ * \file  instrument-everything-sites.c
+ * \brief Tests that shared-hook site IDs are unique across modules and can
+ *        be mapped back to their source locations.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %cpp %cflags -DOTHER_MODULE %s > %t.other.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.other.c -o %t.other.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %loom -S %t.other.ll -loom-file %t.yaml -o %t.other.instr.ll
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %llc -filetype=obj %t.other.instr.ll -o %t.other.instr.o
+ * RUN: %clang %cflags -DCHECKER -c %s -o %t.checker.o
+ * RUN: %clang %t.instr.o %t.other.instr.o %t.checker.o %rtflags -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s
+ */
+
+#if defined (POLICY_FILE)
+
+strategy: callout
+
+logging: printf
+
+everything: true
+
+#elif defined (OTHER_MODULE)
+
+int
+add_other(int x)
+{
+	return x + 2;
+}
+
+#elif defined (CHECKER)
+
+/*
+ * This module isn't instrumented: it looks up the sites that the other two
+ * modules passed to their (identically-named) add hooks.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+struct loom_site {
+	uint64_t	id;
+	const char	*function;
+	const char	*file;
+	uint32_t	line;
+	uint32_t	column;
+	const char	*description;
+};
+
+const struct loom_site	*loom_site_table(size_t *count);
+const struct loom_site	*loom_site_lookup(uint64_t id);
+
+int	add(int x);
+int	add_other(int x);
+
+int
+main(int argc, char *argv[])
+{
+	const struct loom_site *sites;
+	size_t count, duplicates = 0;
+
+	// CHECK: instrumentation:instruction:add: [[ADD:-?[0-9]+]] {{[0-9]+}} 2
+	// CHECK: instrumentation:instruction:add: [[OTHER:-?[0-9]+]] {{[0-9]+}} 3
+	add(1);
+	add_other(1);
+
+	// CHECK: site [[ADD]]: add instrument-everything-sites.c:{{[0-9]+}}
+	// CHECK: site [[OTHER]]: add_other instrument-everything-sites.c:{{[0-9]+}}
+	sites = loom_site_table(&count);
+	for (size_t i = 0; i < count; i++) {
+		const struct loom_site *s = sites + i;
+
+		if (strcmp(s->description, "instrumentation:instruction:add") == 0) {
+			const char *file = strrchr(s->file, '/');
+			printf("site %" PRId64 ": %s %s:%u\n", (int64_t) s->id,
+			    s->function, file ? file + 1 : s->file, s->line);
+		}
+
+		if (loom_site_lookup(s->id) != s)
+			duplicates++;
+	}
+
+	// CHECK: duplicate sites: 0
+	printf("duplicate sites: %zu\n", duplicates);
+
+	return 0;
+}
+
+#else
+
+int
+add(int x)
+{
+	return x + 1;
+}
+
+#endif /* !POLICY_FILE */
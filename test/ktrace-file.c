@@ -0,0 +1,54 @@
+/**
+ * \file  ktrace-file.c
+ * \brief Tests sending serialized records to the runtime's trace writer.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE '-DTRACE_FILE="%t.trace"' %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %filecheck -input-file %t.instr.ll -check-prefix MAIN %s
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __ktrace_test
+
+ktrace: file
+
+trace_file: TRACE_FILE
+
+block_structure: true
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+#else
+
+#include <stdio.h>
+
+// MAIN: [[TRACE_FILE:@trace_file[.0-9]*]] = {{.*}} c"{{.*}}.trace\00"
+
+// CHECK: define{{.*}} [[FOO_TYPE:i[0-9]+]] @foo(i32{{.*}}, float{{.*}}, double{{.*}})
+int	foo(int x, float y, double z)
+{
+	return x;
+}
+
+// CHECK:       define{{.*}} void @__ktrace_test_call_foo
+// CHECK-NEXT:  preamble:
+// CHECK:       call i32 @loom_trace_write
+
+// MAIN:       define{{.*}} i32 @main
+int
+main(int argc, char *argv[])
+{
+	// MAIN:    call i32 @loom_trace_open({{.*}}[[TRACE_FILE]]
+	foo(1, 2, 3);
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
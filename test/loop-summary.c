@@ -0,0 +1,80 @@
+/**
+ * \file  loop-summary.c
+ * \brief Tests loop-level summarization of structure field writes.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+summarize_loops: true
+
+structures:
+  - name: foo
+    fields:
+      - name: f_int
+        operations: [ write ]
+      - name: f_flags
+        operations: [ write ]
+
+#else
+
+#include <stdio.h>
+
+struct foo {
+	int	f_int;
+	float	f_float;
+	unsigned int	f_flags;
+};
+
+int
+main(int argc, char *argv[])
+{
+	struct foo f;
+
+	// Writes outside of loops are logged as usual:
+	// CHECK: call void @[[PREFIX:__test_hook]]_store_struct_foo_field_f_int
+	// CHECK-OUTPUT: foo.f_int store: [[FOO:.*]] 42
+	f.f_int = 42;
+
+	// Writes within a loop are accumulated and summarized on loop exit:
+	// CHECK-NOT: call void @[[PREFIX]]_store_struct_foo_field_f_int
+	// CHECK: call void @[[PREFIX]]_summary_struct_foo_field_f_int
+	// CHECK-OUTPUT: foo.f_int summary: [[FOO]] 10 10 1 1 10
+	for (int i = 0; i < 10; i++) {
+		f.f_int = 10 - i;
+	}
+
+	// Loops that don't write anything don't log anything:
+	// CHECK-OUTPUT-NOT: summary
+	for (int i = 1; i < argc; i++) {
+		f.f_int = i;
+	}
+
+	// Unsigned fields are compared as unsigned (printf still shows %d):
+	// CHECK: icmp ult i32
+	// CHECK: icmp ugt i32
+	// CHECK: call void @[[PREFIX]]_summary_struct_foo_field_f_flags
+	// CHECK-OUTPUT: foo.f_flags summary: [[FOO]] 3 1 2 1 -2147483648
+	unsigned int flags[] = { 1, 0x80000000, 2 };
+	for (int i = 0; i < 3; i++) {
+		f.f_flags = flags[i];
+	}
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
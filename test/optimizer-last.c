@@ -0,0 +1,87 @@
+/**
+ * \file  optimizer-last.c
+ * \brief Tests running Loom at the end of clang's optimization pipeline.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -O2 %loadloom -mllvm -loom-ep=optimizer-last -mllvm -loom-file=%t.yaml -S -emit-llvm %t.c -o %t.ll
+ * RUN: %filecheck -input-file %t.ll %s
+ * RUN: %clang %cflags -O0 %loadloom -mllvm -loom-ep=optimizer-last -mllvm -loom-file=%t.yaml -S -emit-llvm %t.c -o %t.O0.ll
+ * RUN: %filecheck -input-file %t.O0.ll %s -check-prefix CHECK-O0
+ * RUN: %clang %cflags -O2 %loadloom -mllvm -loom-ep=optimizer-last -mllvm -loom-file=%t.yaml %t.c %ldflags -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+functions:
+  - name: sum
+    callee: [ entry ]
+
+  - name: twice
+    caller: [ entry ]
+    callee: [ entry ]
+
+#else
+
+#include <stdio.h>
+
+/*
+ * Probes are added after optimization, so this loop is vectorized as it
+ * would be in an uninstrumented build.
+ */
+// CHECK: define{{.*}} i32 @sum(
+// CHECK: call void @__test_hook_enter_sum(
+// CHECK: <4 x i32>
+__attribute__((noinline))
+int
+sum(const int *values, int n)
+{
+	int total = 0;
+
+	for (int i = 0; i < n; i++)
+		total += values[i];
+
+	return total;
+}
+
+/*
+ * Calls that have been inlined by the time that Loom runs have no call
+ * site to instrument, and the inlined body has no callee hook: only the
+ * out-of-line copy of the function does.
+ */
+// CHECK: define{{.*}} i32 @twice(
+// CHECK: call void @__test_hook_enter_twice(
+int
+twice(int x)
+{
+	return 2 * x;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int values[] = { 1, 2, 3, 4 };
+
+	// CHECK-O0: call void @__test_hook_enter_sum(
+	// CHECK-OUTPUT: enter sum: 0x{{[0-9a-f]+}} 4
+	printf("%d\n", sum(values, 4));
+
+	// CHECK: define{{.*}} i32 @main(
+	// CHECK-NOT: @__test_hook_call_twice
+	// CHECK-NOT: @__test_hook_enter_twice
+	// CHECK: ret i32
+	// CHECK-O0: call void @__test_hook_call_twice(
+	// CHECK-OUTPUT-NOT: twice
+	printf("%d\n", twice(argc));
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,70 @@
+/**
+ * \file  overhead-budget-rates.c
+ * \brief Tests sites of the same probe being sampled at different rates.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+logging: printf
+
+hook_prefix: __test_hook
+
+budget:
+  overhead: 1
+
+functions:
+  - name: work
+    caller: [ entry ]
+
+#else
+
+int
+work(int x)
+{
+	return x + 1;
+}
+
+// CHECK: @__test_hook_call_work_sample_0 = internal global i64 0
+// CHECK: @__test_hook_call_work_sample_1 = internal global i64 0
+
+// CHECK: define{{.*}} i32 @main
+int
+main(int argc, char *argv[])
+{
+	int total = 0;
+
+	// The inner call is more frequent, so it's sampled at a lower rate
+	// than the outer one. If the two sites shared a counter, the outer
+	// site (with the smaller rate) would keep resetting it before the
+	// inner site could ever fire.
+	for (int i = 0; i < argc * 100000; i++) {
+		// CHECK: load i64, i64* @__test_hook_call_work_sample_0
+		// CHECK: store i64 {{.*}}, i64* @__test_hook_call_work_sample_0
+		total += work(i);
+
+		for (int j = 0; j < 8; j++) {
+			// CHECK: load i64, i64* @__test_hook_call_work_sample_1
+			// CHECK: store i64 {{.*}}, i64* @__test_hook_call_work_sample_1
+			total += work(-1);
+		}
+	}
+
+	// Both sites log (some of) their events:
+	// CHECK-OUTPUT-DAG: call work: {{[0-9]+}}
+	// CHECK-OUTPUT-DAG: call work: -1
+
+	return total == 0;
+}
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,60 @@
+/**
+ * \file  overhead-budget.c
+ * \brief Tests fitting probes into an overhead budget.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE '-DBUDGET_REPORT="%t.report"' %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %filecheck -input-file %t.report %s -check-prefix CHECK-REPORT
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ */
+
+#if defined (POLICY_FILE)
+
+logging: printf
+
+budget:
+  overhead: 1
+  report: BUDGET_REPORT
+
+functions:
+  - name: work
+    caller: [ entry, exit ]
+
+#else
+
+#include <stdio.h>
+
+int
+work(int x)
+{
+	return x * x;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int total = 0;
+
+	// Logging every call to work() with printf would cost far more than
+	// 1% of this loop, so calls must be sampled (each site counting its own
+	// events):
+	// CHECK: @[[PREFIX:__loom]]_call_work_sample_0 = internal global i64 0
+	// CHECK: @[[PREFIX]]_return_work_sample_0 = internal global i64 0
+	for (int i = 0; i < argc * 1000; i++) {
+		total += work(i);
+	}
+
+	printf("%d\n", total);
+
+	return 0;
+}
+
+// CHECK-REPORT: # Loom overhead budget: 1.00% of {{[0-9]+}} estimated cycles
+// CHECK-REPORT: # frequency	cycles/event	cycles	decision	probe
+// CHECK-REPORT: {{[0-9]+}}	{{[0-9]+}}	{{[0-9]+}}	sample 1/{{[0-9]+}}	call work in main
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,111 @@
+/**
+ * \file  patchable-probes.c
+ * \brief Tests probes in nop sleds that are patched in (and out) at run time.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll 2> %t.warnings
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %filecheck -input-file %t.warnings %s -check-prefix CHECK-WARN
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %t.instr.o %rtflags -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ * RUN: env LOOM_PATCH=__test_hook_call_bar %t.instr > %t.env
+ * RUN: %filecheck -input-file %t.env %s -check-prefix CHECK-ENV
+ */
+
+#if defined (POLICY_FILE)
+
+strategy: patchable
+
+logging: printf
+
+hook_prefix: __test_hook
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+    - name: bar
+      caller: [ entry ]
+
+    - name: many
+      caller: [ entry ]
+
+#else
+
+#include <stdio.h>
+
+/* From loom-patch.h: */
+int	loom_patch(const char *name, int enable);
+
+// Hooks are only referred to by their sleds' descriptions, which also
+// pull in the runtime's trampoline:
+// CHECK: @__loom_patch_runtime = internal constant {{.*}} @__loom_patch_trampoline
+
+// Sites with too many arguments for a sled use a flag that starts out clear
+// and is described (by hook name) in loom_patch_flags:
+// CHECK-WARN: Warning: __test_hook_call_many can't be called from a patchable sled
+// CHECK-WARN-NOT: __test_hook_call_many
+// CHECK: @__test_hook_call_many_enabled = weak global i8 0
+// CHECK: @__test_hook_call_many_patch_flag = internal global {{.*}} @__test_hook_call_many_enabled{{.*}} section "loom_patch_flags"
+
+// CHECK: @llvm.compiler.used = {{.*}} @__test_hook_call_foo {{.*}} @__loom_patch_runtime
+
+int	foo(int x)	{ return x; }
+int	bar(int x)	{ return x; }
+int	many(int a, int b, int c, int d, int e, int f, int g)	{ return a; }
+
+// CHECK: define{{.*}} i32 @main({{.*}}) [[MAIN_ATTRS:#[0-9]+]]
+int
+main(int argc, char *argv[])
+{
+	// Arguments go in the hook's argument registers, ahead of a sled that
+	// jumps over itself (until it's patched) and is described in loom_sleds:
+	// CHECK: call void asm sideeffect ".p2align 1\0A0:\0A.byte 0xeb, 13\0A.skip 13, 0x90{{.*}}.pushsection loom_sleds{{.*}}.quad 0b, \22__test_hook_call_foo\22, 1b{{.*}}", "{rdi},~{r10},~{memory}{{.*}}"(i64 1)
+	// CHECK-NEXT: call i32 @foo(i32 1)
+	foo(1);
+	// CHECK-OUTPUT-NOT: call foo: 1
+	// CHECK-ENV-NOT: call foo: 1
+
+	printf("patched %d\n", loom_patch("__test_hook_call_foo", 1));
+	// CHECK-OUTPUT: patched 3
+	// CHECK-ENV: patched 3
+
+	foo(2);
+	bar(3);
+	// CHECK-OUTPUT: call foo: 2
+	// CHECK-OUTPUT-NOT: call bar: 3
+	// CHECK-ENV: call foo: 2
+	// CHECK-ENV: call bar: 3
+
+	many(1, 2, 3, 4, 5, 6, 7);
+	many(1, 2, 3, 4, 5, 6, 7);
+	printf("patched %d\n", loom_patch("__test_hook_call_many", 1));
+	many(8, 9, 10, 11, 12, 13, 14);
+	// CHECK-OUTPUT-NOT: call many: 1 2
+	// CHECK-OUTPUT: patched 1
+	// CHECK-OUTPUT: call many: 8 9 10 11 12 13 14
+	// CHECK-ENV: patched 1
+	// CHECK-ENV: call many: 8 9 10 11 12 13 14
+
+	printf("patched %d\n", loom_patch(NULL, 0));
+	// CHECK-OUTPUT: patched 6
+	// CHECK-ENV: patched 6
+
+	foo(4);
+	bar(5);
+	many(15, 16, 17, 18, 19, 20, 21);
+	// CHECK-OUTPUT-NOT: call
+	// CHECK-ENV-NOT: call
+
+	return 0;
+}
+
+// Patched sleds call hooks from the middle of their callers:
+// CHECK: attributes [[MAIN_ATTRS]] = { {{.*}}noredzone
+
+#endif /* !POLICY_FILE */
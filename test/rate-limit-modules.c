@@ -0,0 +1,72 @@
+/**
+ * \file  rate-limit-modules.c
+ * \brief Tests that rate limits are shared by separately-instrumented modules.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %cpp %cflags -DOTHER_MODULE %s > %t.other.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.other.c -o %t.other.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %loom -S %t.other.ll -loom-file %t.yaml -o %t.other.instr.ll
+ * RUN: %filecheck -input-file %t.other.instr.ll %s -check-prefix CHECK-OTHER
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %llc -filetype=obj %t.other.instr.ll -o %t.other.instr.o
+ * RUN: %clang %ldflags %t.instr.o %t.other.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+functions:
+  - name: retry
+    caller: [ entry ]
+    max_rate: 5/s
+
+#elif defined (OTHER_MODULE)
+
+void	retry(int attempt);
+
+// CHECK-OTHER: @__test_hook_call_retry_tokens = linkonce_odr hidden thread_local global i64 0
+void
+retry_elsewhere(void)
+{
+	for (int i = 0; i < 5; i++) {
+		retry(100 + i);
+	}
+}
+
+#else
+
+#include <unistd.h>
+
+void	retry(int attempt)	{ }
+void	retry_elsewhere(void);
+
+int
+main(int argc, char *argv[])
+{
+	// CHECK-OUTPUT: call retry: 0 0
+	// CHECK-OUTPUT: call retry: 4 0
+	for (int i = 0; i < 5; i++) {
+		retry(i);
+	}
+
+	// This module has used up the bucket, so the other one can't log:
+	// CHECK-OUTPUT-NOT: call retry: 10{{[0-4]}}
+	retry_elsewhere();
+
+	// CHECK-OUTPUT: call retry: -1 5
+	usleep(300000);
+	retry(-1);
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
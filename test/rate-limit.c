@@ -0,0 +1,65 @@
+/**
+ * \file  rate-limit.c
+ * \brief Tests per-thread rate limiting of events with `max_rate:`.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+logging: printf
+
+functions:
+  - name: retry
+    caller: [ entry ]
+    max_rate: 5/s
+
+#else
+
+#include <stdio.h>
+#include <unistd.h>
+
+// Buckets are shared by every module that probes the same event:
+// CHECK: @__test_hook_call_retry_tokens = linkonce_odr hidden thread_local global i64 0
+// CHECK: @__test_hook_call_retry_dropped = linkonce_odr hidden thread_local global i64 0
+void	retry(int attempt)	{ }
+
+int
+main(int argc, char *argv[])
+{
+	// CHECK: ratelimit.refill:
+	// CHECK: call i64 @__loom_coarse_clock_ms()
+	// CHECK: ratelimit.accept:
+	// CHECK: call void @__test_hook_call_retry(
+
+	// A full bucket holds one second's worth of events:
+	// CHECK-OUTPUT: call retry: 0 0
+	// CHECK-OUTPUT: call retry: 4 0
+	// CHECK-OUTPUT-NOT: call retry: 5
+	for (int i = 0; i < 10000; i++) {
+		retry(i);
+	}
+
+	// After 300 ms, there's room for one more event:
+	// CHECK-OUTPUT: call retry: -1 9995
+	usleep(300000);
+	retry(-1);
+
+	return 0;
+}
+
+// The dropped-event count is logged after the call's own arguments:
+// CHECK: define{{.*}} void @__test_hook_call_retry(i32{{.*}}, i64{{.*}})
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,74 @@
+/**
+ * \file  sample-profile.c
+ * \brief Tests writing function entry and call counts as a sample profile.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE '-DPROFILE_OUTPUT="%t.prof"' %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: rm -f %t.prof.*
+ * RUN: %t.instr > %t.stdout
+ * RUN: cat %t.prof.* > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ * RUN: %profdata merge -sample %t.output -o %t.profdata
+ * RUN: %profdata show -sample %t.profdata | %filecheck %s -check-prefix CHECK-PROFDATA
+ */
+
+#if defined (POLICY_FILE)
+
+profile_output: PROFILE_OUTPUT
+
+#else
+
+#include <stdio.h>
+
+// Every function gets one counter for entries and one per call site:
+// CHECK-DAG: @[[PREFIX:__loom]]_counts_square = internal global [1 x i64] zeroinitializer
+// CHECK-DAG: @[[PREFIX]]_counts_sum_squares = internal global [2 x i64] zeroinitializer
+// CHECK-DAG: @[[PREFIX]]_counts_main = internal global [4 x i64] zeroinitializer
+
+// Counts are written out by a destructor:
+// CHECK-DAG: @llvm.global_dtors = {{.*}} @[[PREFIX]]_at_exit
+
+int
+square(int x)
+{
+	return x * x;
+}
+
+int
+sum_squares(int n)
+{
+	int total = 0;
+	for (int i = 0; i < n; i++)
+		total += square(i);
+	return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n = sum_squares(4);
+	n += sum_squares(2);
+	printf("%d\n", n);
+	return 0;
+}
+
+// Calls are identified by their line offset within the calling function:
+// CHECK-OUTPUT: square:6:6
+// CHECK-OUTPUT-NEXT: sum_squares:8:2
+// CHECK-OUTPUT-NEXT:  4: 6 square:6
+// CHECK-OUTPUT-NEXT: main:4:1
+// CHECK-OUTPUT-NEXT:  2: 1 sum_squares:1
+// CHECK-OUTPUT-NEXT:  3: 1 sum_squares:1
+// CHECK-OUTPUT-NEXT:  4: 1 printf:1
+
+// CHECK-PROFDATA-DAG: Function: square: 6, 6, 0 sampled lines
+// CHECK-PROFDATA-DAG: Function: sum_squares: 8, 2, 1 sampled lines
+// CHECK-PROFDATA-DAG: Function: main: 4, 1, 3 sampled lines
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,187 @@
+/**
+ * \file  shm-collector-run.c
+ * \brief Produce records into a shared-memory ring and collect them.
+ *
+ * The collector is stopped part-way through and restarted, or runs
+ * alongside the producers: no records should be lost or duplicated.
+ *
+ * Commands for llvm-lit:
+ * RUN: %clang %cflags %s %rtflags -o %t
+ * RUN: rm -f %t.out
+ * RUN: %t produce /loom-lit-shm-test
+ * RUN: %collector -c 1000 -o %t.out /loom-lit-shm-test
+ * RUN: %collector -u -o %t.out /loom-lit-shm-test
+ * RUN: %t verify %t.out | %filecheck %s
+ *
+ * The same again, with the collector compressing records into blocks:
+ * RUN: rm -f %t.z
+ * RUN: %t produce /loom-lit-shm-test
+ * RUN: %collector -z 1 -c 1000 -o %t.z /loom-lit-shm-test
+ * RUN: %collector -z 4 -u -o %t.z /loom-lit-shm-test
+ * RUN: %unpack %t.z %t.unpacked
+ * RUN: %t verify %t.unpacked | %filecheck %s
+ *
+ * And with the collector following the ring while it's being written,
+ * having attached before the first record was committed:
+ * RUN: rm -f %t.follow
+ * RUN: %t follow /loom-lit-shm-test %collector %t.follow
+ * RUN: %t verify %t.follow | %filecheck %s
+ */
+
+#include <loom-shm.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define	THREADS		4
+#define	RECORDS		1000
+
+/* Pause now and then, so that a following collector has to keep up. */
+static int slow;
+
+static void *
+produce(void *arg)
+{
+	long id = (long) arg;
+
+	for (long i = 0; i < RECORDS; i++) {
+		if (slow && i % 8 == 0)
+			usleep(1000);
+
+		if (i % 2) {
+			// Serialized record: copied into the ring.
+			char record[32];
+			int len = snprintf(record, sizeof(record), "%ld:%ld", id, i);
+			loom_shm_write(record, len);
+		} else {
+			// Raw record: written in place.
+			char *p = loom_shm_reserve(32);
+			if (p != NULL) {
+				int len = snprintf(p, 32, "%ld:%ld", id, i);
+				memset(p + len, 0, 32 - len);
+				loom_shm_commit(p);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int
+verify(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	long next[THREADS] = { 0 };
+	unsigned long long total = 0, bad = 0;
+	uint32_t len;
+	char record[33];
+
+	while (f != NULL && fread(&len, sizeof(len), 1, f) == 1) {
+		long id, i;
+
+		if (len >= sizeof(record) || fread(record, 1, len, f) != len) {
+			bad++;
+			break;
+		}
+
+		record[len] = '\0';
+		if (sscanf(record, "%ld:%ld", &id, &i) != 2 || id < 0
+		    || id >= THREADS || i != next[id]) {
+			bad++;
+			continue;
+		}
+
+		next[id]++;
+		total++;
+	}
+
+	// CHECK: read: 4000
+	// CHECK: bad: 0
+	printf("read: %llu\n", total);
+	printf("bad: %llu\n", bad);
+
+	return (bad == 0) ? 0 : 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t threads[THREADS];
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s produce <name> |"
+		    " follow <name> <collector> <file> | verify <file>\n",
+		    argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "verify") == 0)
+		return verify(argv[2]);
+
+	// Start from an empty ring, even if a previous run failed.
+	shm_unlink(argv[2]);
+
+	pid_t collector = -1;
+	if (strcmp(argv[1], "follow") == 0) {
+		char count[32];
+
+		if (argc < 5) {
+			fprintf(stderr, "Usage: %s follow <name> <collector>"
+			    " <file>\n", argv[0]);
+			return 1;
+		}
+
+		snprintf(count, sizeof(count), "%d", THREADS * RECORDS);
+		collector = fork();
+		if (collector == 0) {
+			execl(argv[3], argv[3], "-f", "-u", "-c", count,
+			    "-o", argv[4], argv[2], (char *) NULL);
+			perror(argv[3]);
+			_exit(1);
+		}
+
+		// Let the collector wait for the ring, then attach to it while
+		// it's still empty.
+		slow = 1;
+		usleep(200000);
+	}
+
+	if (loom_shm_open(argv[2]) != 0) {
+		perror("loom_shm_open");
+		return 1;
+	}
+
+	if (collector > 0)
+		usleep(300000);
+
+	for (long i = 0; i < THREADS; i++)
+		pthread_create(threads + i, NULL, produce, (void *) i);
+
+	for (long i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (collector > 0) {
+		int status;
+
+		// A collector that has lost its place never finishes.
+		for (int i = 0; i < 100; i++) {
+			if (waitpid(collector, &status, WNOHANG) == collector)
+				return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+			usleep(100000);
+		}
+
+		fprintf(stderr, "collector didn't finish\n");
+		kill(collector, SIGTERM);
+		waitpid(collector, &status, 0);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+; \file  single-exit.ll
+; \brief Tests instrumenting multi-return functions at a single, merged exit
+;
+; Commands for llvm-lit:
+; RUN: %loom -S %s -loom-file %s.policy -o %t.instr.ll
+; RUN: %filecheck -input-file %t.instr.ll %s
+; RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-freebsd12.0"
+
+; Every return branches to one exit block, which is instrumented once:
+; CHECK-LABEL: define i32 @classify
+define i32 @classify(i32 %x) {
+entry:
+  %neg = icmp slt i32 %x, 0
+  br i1 %neg, label %negative, label %check
+
+; CHECK: negative:
+; CHECK-NEXT: br label %loom.exit
+negative:
+  ret i32 -1
+
+check:
+  %zero = icmp eq i32 %x, 0
+  br i1 %zero, label %zero.ret, label %positive
+
+; CHECK: zero.ret:
+; CHECK-NEXT: br label %loom.exit
+zero.ret:
+  ret i32 0
+
+; CHECK: positive:
+; CHECK-NEXT: br label %loom.exit
+positive:
+  ret i32 1
+
+; CHECK: loom.exit:
+; CHECK-NEXT: [[RETVAL:%.+]] = phi i32 [ -1, %negative ], [ 0, %zero.ret ], [ 1, %positive ]
+; CHECK-NEXT: call void @[[PREFIX:__loom]]_leave_classify(i32 [[RETVAL]], i32 %x)
+; CHECK-NEXT: ret i32 [[RETVAL]]
+}
+; CHECK-NOT: call void @[[PREFIX]]_leave_classify
+
+; Void functions need no PHI:
+; CHECK-LABEL: define void @check
+define void @check(i1 %a, i1 %b) {
+entry:
+  br i1 %a, label %early, label %late
+
+early:
+  ret void
+
+late:
+  ret void
+
+; CHECK: loom.exit:
+; CHECK-NEXT: call void @[[PREFIX]]_leave_check(i1 %a, i1 %b)
+; CHECK-NEXT: ret void
+}
@@ -0,0 +1,56 @@
+; \file  thinlto-names.ll
+; \brief Tests instrumenting a module as a ThinLTO backend sees it: with
+;        promoted (renamed) locals and functions imported from other modules.
+;
+; Commands for llvm-lit:
+; RUN: %loom -S %s -loom-file %s.policy -o %t.instr.ll
+; RUN: %filecheck -input-file %t.instr.ll %s
+; RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-freebsd12.0"
+
+; A static function that ThinLTO promoted (with a `.llvm.<hash>` suffix) is
+; matched and instrumented under its source name:
+; CHECK-LABEL: define hidden i32 @helper.llvm.8712345678901234(
+; CHECK: call void @__test_hook_enter_helper(i32 %x)
+define hidden i32 @helper.llvm.8712345678901234(i32 %x) {
+entry:
+  ret i32 %x
+}
+
+; Other suffixes aren't promotions:
+; CHECK-LABEL: define i32 @other.llvm.abc(
+; CHECK-NOT: call void @__test_hook
+; CHECK: ret i32
+define i32 @other.llvm.abc(i32 %x) {
+entry:
+  ret i32 %x
+}
+
+; Imported functions are only here to be inlined: they're instrumented in
+; the module that defines them.
+; CHECK-LABEL: define available_externally i32 @imported(
+; CHECK-NOT: call void @__test_hook
+; CHECK: ret i32
+define available_externally i32 @imported(i32 %x) {
+entry:
+  %y = call i32 @helper.llvm.8712345678901234(i32 %x)
+  ret i32 %y
+}
+
+; Calls to them are still instrumented, like any other calls:
+; CHECK-LABEL: define i32 @main(
+; CHECK: call void @__test_hook_call_helper(i32 1)
+; CHECK: call i32 @helper.llvm.8712345678901234(i32 1)
+; CHECK: call void @__test_hook_call_imported(i32 2)
+; CHECK: call i32 @imported(i32 2)
+define i32 @main() {
+entry:
+  %a = call i32 @helper.llvm.8712345678901234(i32 1)
+  %b = call i32 @imported(i32 2)
+  %c = call i32 @other.llvm.abc(i32 3)
+  %sum = add i32 %a, %b
+  %total = add i32 %sum, %c
+  ret i32 %total
+}
@@ -0,0 +1,132 @@
+/**
+ * \file  trace-writer-run.c
+ * \brief Write records from several threads with the runtime trace writer.
+ *
+ * Commands for llvm-lit:
+ * RUN: %clang %cflags %s %rtflags -o %t
+ * RUN: %t %t.trace | %filecheck %s
+ * RUN: env LOOM_TRACE_NO_URING=1 %t %t.pwritev | %filecheck %s
+ * RUN: env LOOM_TRACE_BUFFERS=4 LOOM_TRACE_BUFFER_SIZE=4096 %t %t.small \
+ * RUN:   | %filecheck %s -check-prefix SMALL
+ * RUN: env LOOM_TRACE_COMPRESS=1 %t %t.lz4 \
+ * RUN:   | %filecheck %s -check-prefixes CHECK,COMPRESSED
+ * RUN: env LOOM_TRACE_COMPRESS=9 %t %t.lz4hc \
+ * RUN:   | %filecheck %s -check-prefixes CHECK,COMPRESSED
+ * RUN: %unpack -j 3 %t.lz4 %t.unpacked
+ * RUN: cmp %t.lz4.raw %t.unpacked
+ */
+
+#include <loom-trace.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define	THREADS		4
+#define	RECORDS		100000
+
+static void *
+write_records(void *arg)
+{
+	long id = (long) arg;
+	char record[32];
+
+	for (long i = 0; i < RECORDS; i++) {
+		int len = snprintf(record, sizeof(record), "%ld:%ld", id, i);
+		loom_trace_write(record, len);
+	}
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t threads[THREADS];
+	struct loom_trace_stats stats;
+
+	if (argc < 2 || loom_trace_open(argv[1]) != 0) {
+		perror("loom_trace_open");
+		return 1;
+	}
+
+	for (long i = 0; i < THREADS; i++)
+		pthread_create(threads + i, NULL, write_records, (void *) i);
+
+	// The main thread writes records too (its last buffer is written on close).
+	write_records((void *) THREADS);
+
+	for (long i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	loom_trace_close();
+	loom_trace_stats(&stats);
+
+	// CHECK: written: 500000
+	// CHECK: dropped: 0
+	// SMALL: dropped: {{[1-9][0-9]*}}
+	printf("written: %llu\n", (unsigned long long) stats.records);
+	printf("dropped: %llu\n", (unsigned long long) stats.dropped);
+
+	/*
+	 * Compressed traces must be smaller than their records, and must
+	 * decompress to something we can read back.
+	 */
+	char filename[1024];
+	snprintf(filename, sizeof(filename), "%s", argv[1]);
+
+	// COMPRESSED: compressed: yes
+	if (stats.bytes < stats.raw_bytes) {
+		printf("compressed: yes\n");
+		snprintf(filename, sizeof(filename), "%s.raw", argv[1]);
+
+		int in = open(argv[1], O_RDONLY);
+		int out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (in < 0 || out < 0 || loom_trace_unpack(in, out, 4) != 0) {
+			perror("loom_trace_unpack");
+			return 1;
+		}
+
+		close(in);
+		close(out);
+	}
+
+	/*
+	 * Read the trace back: every record must be intact and each thread's
+	 * records must appear in order (with gaps only for dropped records).
+	 */
+	FILE *f = fopen(filename, "r");
+	long next[THREADS + 1] = { 0 };
+	unsigned long long total = 0, bad = 0;
+	uint32_t len;
+	char record[32];
+
+	while (fread(&len, sizeof(len), 1, f) == 1) {
+		long id, i;
+
+		if (len >= sizeof(record) || fread(record, 1, len, f) != len) {
+			bad++;
+			break;
+		}
+
+		record[len] = '\0';
+		if (sscanf(record, "%ld:%ld", &id, &i) != 2 || id < 0
+		    || id > THREADS || i < next[id]) {
+			bad++;
+			continue;
+		}
+
+		next[id] = i + 1;
+		total++;
+	}
+
+	// CHECK: read: 500000
+	// CHECK: bad: 0
+	// SMALL: bad: 0
+	printf("read: %llu\n", total);
+	printf("bad: %llu\n", bad);
+
+	return (total == stats.records) ? 0 : 1;
+}
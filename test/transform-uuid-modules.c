@@ -0,0 +1,122 @@
+/**
+ * \file  transform-uuid-modules.c
+ * \brief Tests that closing a descriptor in another module invalidates UUIDs.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %cpp %cflags -DOTHER_MODULE %s > %t.other.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.other.c -o %t.other.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %loom -S %t.other.ll -loom-file %t.yaml -o %t.other.instr.ll
+ * RUN: %filecheck -input-file %t.other.instr.ll %s -check-prefix CHECK-OTHER
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %llc -filetype=obj %t.other.instr.ll -o %t.other.instr.o
+ * RUN: %clang %ldflags %t.instr.o %t.other.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+logging: printf
+
+hook_prefix: __test_hook
+
+functions:
+  - name: use
+    caller: [ entry ]
+    transforms:
+      - arg: 0
+        fn: GetUUID
+
+#elif defined (OTHER_MODULE)
+
+#include <stdio.h>
+#include <unistd.h>
+
+// This module doesn't look any UUIDs up, but its closes still invalidate
+// the cache entries of the module that does (or of any shared object):
+// CHECK-OTHER: @__loom_fd_generation = linkonce_odr global [64 x i64] zeroinitializer
+// CHECK-OTHER-NOT: @__loom_fd_uuid_cache
+
+// CHECK-OTHER: define{{.*}} void @close_elsewhere
+void
+close_elsewhere(int fd)
+{
+	// CHECK-OTHER: call i32 @close(
+	// CHECK-OTHER: atomicrmw add i64* {{.*}}, i64 1 monotonic
+	close(fd);
+}
+
+// CHECK-OTHER: define{{.*}} void @fclose_elsewhere
+void
+fclose_elsewhere(FILE *f)
+{
+	// A stream's descriptor must be found before the stream is closed:
+	// CHECK-OTHER: [[FD:%.+]] = call i32 @fileno(
+	// CHECK-OTHER: call i32 @fclose(
+	// CHECK-OTHER: and i32 [[FD]], 63
+	// CHECK-OTHER: atomicrmw add i64* {{.*}}, i64 1 monotonic
+	fclose(f);
+}
+
+#else
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void	close_elsewhere(int fd);
+void	fclose_elsewhere(FILE *f);
+
+/*
+ * A stand-in for FreeBSD's fgetuuid(2) that counts how often it's called
+ * (i.e., how often the cache misses).
+ */
+static int lookups;
+
+int
+fgetuuid(int fd, void *uuid)
+{
+	lookups++;
+	memset(uuid, fd, 16);
+	return 0;
+}
+
+int	use(int fd)	{ return fd; }
+
+int
+main(int argc, char *argv[])
+{
+	int fd = dup(1);
+
+	use(fd);
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 1
+
+	// The descriptor's number is reused, but it refers to a new file:
+	close_elsewhere(fd);
+	fd = dup(1);
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 2
+
+	// The same goes for descriptors closed by fclose(3):
+	FILE *f = fdopen(fd, "w");
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 2
+
+	fclose_elsewhere(f);
+	fd = dup(1);
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 3
+
+	return 0;
+}
+
+#endif /* !POLICY_FILE */
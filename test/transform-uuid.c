@@ -0,0 +1,124 @@
+/**
+ * \file  transform-uuid.c
+ * \brief Tests the GetUUID transform and its per-thread cache.
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+logging: printf
+
+hook_prefix: __test_hook
+
+functions:
+  - name: use
+    caller: [ entry ]
+    transforms:
+      - arg: 0
+        fn: GetUUID
+
+  - name: pair
+    caller: [ entry ]
+    transforms:
+      - arg: 0
+        fn: GetUUID
+      - arg: 1
+        fn: GetUUID
+
+#else
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// UUIDs are cached per thread, keyed by descriptor and the generation of
+// the descriptor's cache slot:
+// CHECK-DAG: @__loom_fd_generation = linkonce_odr global [64 x i64] zeroinitializer
+// CHECK-DAG: @__loom_fd_uuid_cache = linkonce_odr hidden thread_local global [64 x {{.*}}]
+
+/*
+ * A stand-in for FreeBSD's fgetuuid(2) that counts how often it's called
+ * (i.e., how often the cache misses).
+ */
+static int lookups;
+
+int
+fgetuuid(int fd, void *uuid)
+{
+	lookups++;
+	memset(uuid, fd, 16);
+	return 0;
+}
+
+int	use(int fd)	{ return fd; }
+int	pair(int a, int b)	{ return a + b; }
+
+// CHECK: define{{.*}} i32 @main
+int
+main(int argc, char *argv[])
+{
+	int fd = dup(1);
+	int other = dup(1);
+
+	// CHECK: call i8* @__loom_fd_uuid(i32
+	// CHECK-OUTPUT: call use: 0x{{[0-9a-f]+}}[16]
+	use(fd);
+	use(fd);
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 1
+
+	use(other);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 2
+
+	// Replacing or closing a descriptor invalidates its cached UUID:
+	// CHECK: call i32 @dup2(
+	// CHECK: atomicrmw add i64* {{.*}}, i64 1 monotonic
+	dup2(other, fd);
+	use(fd);
+	use(other);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 3
+
+	// CHECK: call i32 @close(
+	// CHECK: atomicrmw add i64* {{.*}}, i64 1 monotonic
+	close(fd);
+	fd = dup(1);
+	use(fd);
+	use(fd);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: lookups: 4
+
+	// Descriptors that share a cache slot can be logged together: each
+	// UUID is copied out of the cache before the next is looked up.
+	// CHECK: call i32 @dup2(
+	// CHECK: [[FIRST:%.+]] = call i8* @__loom_fd_uuid(i32
+	// CHECK: call void @llvm.memcpy{{.*}}[[FIRST]], i64 16
+	// CHECK: [[SECOND:%.+]] = call i8* @__loom_fd_uuid(i32
+	// CHECK: call void @llvm.memcpy{{.*}}[[SECOND]], i64 16
+	// CHECK: call void @__test_hook_call_pair(
+	int high = dup2(fd, fd + 64);
+	pair(fd, high);
+	printf("lookups: %d\n", lookups);
+	// CHECK-OUTPUT: call pair: 0x{{[0-9a-f]+}}[16] 0x{{[0-9a-f]+}}[16]
+	// CHECK-OUTPUT: lookups: 6
+
+	return 0;
+}
+
+// CHECK: define linkonce_odr hidden i8* @__loom_fd_uuid(i32 %fd)
+// CHECK: load atomic i64, i64* {{.*}} monotonic
+// CHECK: call i32 {{.*}}@fgetuuid
+
+#endif /* !POLICY_FILE */
@@ -0,0 +1,80 @@
+/**
+ * \file  usdt-probes.c
+ * \brief Tests SystemTap-style USDT probe points (.note.stapsdt).
+ *
+ * Commands for llvm-lit:
+ * RUN: %cpp -DPOLICY_FILE %s > %t.yaml
+ * RUN: %cpp %cflags %s > %t.c
+ * RUN: %clang %cflags -S -emit-llvm %cflags %t.c -o %t.ll
+ * RUN: %loom -S %t.ll -loom-file %t.yaml -o %t.instr.ll
+ * RUN: %filecheck -input-file %t.instr.ll %s
+ * RUN: %llc -filetype=obj %t.instr.ll -o %t.instr.o
+ * RUN: %readelf --notes %t.instr.o > %t.notes
+ * RUN: %filecheck -input-file %t.notes %s -check-prefix CHECK-NOTES
+ * RUN: %clang %ldflags %t.instr.o -o %t.instr
+ * RUN: %t.instr > %t.output
+ * RUN: %filecheck -input-file %t.output %s -check-prefix CHECK-OUTPUT
+ */
+
+#if defined (POLICY_FILE)
+
+hook_prefix: __test_hook
+
+dtrace: usdt
+
+usdt_semaphores: true
+
+functions:
+    - name: foo
+      caller: [ entry ]
+
+    - name: bar
+      callee: [ exit ]
+
+#else
+
+#include <stdio.h>
+
+// Tracers count themselves in each probe's semaphore while attached:
+// CHECK-DAG: @loom___test_hook_call_foo_semaphore = weak hidden global i16 0, section ".probes"
+// CHECK-DAG: @loom___test_hook_return_bar_semaphore = weak hidden global i16 0, section ".probes"
+
+int	foo(int x, long y, const char *s)	{ return x; }
+double	bar(double d)	{ return d * 2; }
+
+// Hooks are created as they're needed: bar's when bar is instrumented and
+// foo's when its caller (main) is.
+// CHECK: define{{.*}} void @__test_hook_return_bar(double{{.*}}, double{{.*}})
+// CHECK: call void asm sideeffect "{{.*}}\22__test_hook_return_bar\22{{.*}}\228@${0} 8@${1}\22
+
+// CHECK: define{{.*}} void @__test_hook_call_foo(i32{{.*}}, i64{{.*}}, i8*{{.*}})
+// CHECK: [[TRACERS:%.*]] = load volatile i16, i16* @loom___test_hook_call_foo_semaphore
+// CHECK: [[ATTACHED:%.*]] = icmp ne i16 [[TRACERS]], 0
+// CHECK: br i1 [[ATTACHED]]
+// CHECK: call void asm sideeffect "990: nop{{.*}}.note.stapsdt{{.*}}loom___test_hook_call_foo_semaphore{{.*}}\22loom\22{{.*}}\22__test_hook_call_foo\22{{.*}}\22-4@${0} -8@${1} 8@${2}\22{{.*}}", "r,r,r,~{memory}"
+
+int
+main(int argc, char *argv[])
+{
+	foo(1, -2, "three");
+	bar(4);
+
+	// Probes don't do anything until a tracer attaches:
+	// CHECK-OUTPUT: done
+	// CHECK-OUTPUT-NOT: {{.}}
+	printf("done\n");
+
+	return 0;
+}
+
+// Every probe is described by an ELF note, with the locations of its
+// arguments (in this case, registers):
+// CHECK-NOTES: NT_STAPSDT
+// CHECK-NOTES: Provider: loom
+// CHECK-NOTES-NEXT: Name: __test_hook_return_bar
+// CHECK-NOTES: Arguments: 8@%{{[a-z0-9]+}} 8@%{{[a-z0-9]+}}
+// CHECK-NOTES: Provider: loom
+// CHECK-NOTES-NEXT: Name: __test_hook_call_foo
+// CHECK-NOTES: Arguments: -4@%{{[a-z0-9]+}} -8@%{{[a-z0-9]+}} 8@%{{[a-z0-9]+}}
+
+#endif /* !POLICY_FILE */
@@ -39,8 +39,10 @@ then
 	export PATH="${LLVM_HOME}/Release/bin:$PATH"
 fi
 
-clang -I"${headersDirectoryPath}" -emit-llvm -c -g -o test.bc test.c && \
-opt -load "${llvmLoomSharedLibraryPath}" -loom -loom-file test.policy test.bc -o test.opt.bc && \
-llc -relocation-model=pic test.opt.bc -o test.s && \
-gcc  -fPIC -no-pie test.s -g -o test.native && \
+# Loom runs within clang, so there's no need to write out bitcode and run
+# opt and llc separately.
+clang -I"${headersDirectoryPath}" -g -fPIC -no-pie \
+	-Xclang -load -Xclang "${llvmLoomSharedLibraryPath}" \
+	-mllvm -loom-ep=optimizer-last -mllvm -loom-file=test.policy \
+	test.c -o test.native && \
 ./test.native a b c